@@ -0,0 +1,40 @@
+#ifndef XEUS_STATA_BATCH_RUNNER_HPP
+#define XEUS_STATA_BATCH_RUNNER_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_stata
+{
+    // Settings for `xstata run`
+    struct batch_options
+    {
+        std::vector<std::string> inputs;    // .ipynb and .do files
+        size_t jobs = 1;                    // concurrent Stata sessions
+        std::string output_dir;             // empty: notebooks are updated in place
+        std::string summary_path;           // empty: summary goes to stdout
+        bool allow_errors = false;          // keep running cells after an error
+        bool fresh = false;                 // new Stata process for every document
+
+        // Set as globals before each document
+        std::vector<std::pair<std::string, std::string>> parameters;
+    };
+
+    // Execute the documents without a Jupyter frontend, up to jobs at a time,
+    // each on one of a fixed set of Stata sessions. Executed notebooks get
+    // their outputs written back; a do-file gets a .log next to its output
+    // location. Returns the JSON summary (per-document status and per-cell
+    // timings), which is also written to summary_path or stdout.
+    nl::json run_batch(const batch_options& options);
+
+    // Stop after the cells that are running now; safe in a signal handler
+    void interrupt_batch();
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_BATCH_RUNNER_HPP
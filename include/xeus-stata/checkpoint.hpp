@@ -0,0 +1,53 @@
+#ifndef XEUS_STATA_CHECKPOINT_HPP
+#define XEUS_STATA_CHECKPOINT_HPP
+
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    class stata_session;
+
+    // Saves and restores the state of a Stata session (frames, stored
+    // estimates, globals and scalars) to a checkpoint directory so that a
+    // fresh Stata process can pick up where a previous one left off.
+    class checkpoint_manager
+    {
+    public:
+        checkpoint_manager(stata_session* session);
+
+        // Save the current session state under the given name
+        // Returns a short human-readable summary
+        std::string save(const std::string& name);
+
+        // Restore a previously saved checkpoint into the session
+        std::string restore(const std::string& name);
+
+        // List available checkpoints
+        std::vector<std::string> list() const;
+
+        // Name of the last checkpoint saved or restored ("" if none)
+        const std::string& last_checkpoint() const;
+
+        // Root directory holding all checkpoints
+        const std::string& root() const;
+
+    private:
+        stata_session* m_session;
+        std::string m_root;
+        std::string m_last;
+
+        // Run Stata code, throwing if it fails
+        std::string run(const std::string& code);
+
+        std::string checkpoint_dir(const std::string& name) const;
+    };
+
+    // Default checkpoint root: $XEUS_STATA_CHECKPOINT_DIR, then a tmpfs-backed
+    // runtime directory, then /tmp. Checkpoints are only saved to and
+    // restored from a root that passes ensure_private_dir.
+    std::string default_checkpoint_root();
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_CHECKPOINT_HPP
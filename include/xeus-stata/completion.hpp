@@ -1,17 +1,19 @@
 #ifndef XEUS_STATA_COMPLETION_HPP
 #define XEUS_STATA_COMPLETION_HPP
 
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace xeus_stata
 {
     class stata_session;
+    class symbol_index;
 
     class completion_engine
     {
     public:
-        completion_engine(stata_session* session);
+        completion_engine(stata_session* session, std::shared_ptr<const symbol_index> index = nullptr);
 
         // Get completions for the given code at cursor position
         std::vector<std::string> get_completions(
@@ -22,6 +24,7 @@ namespace xeus_stata
 
     private:
         stata_session* m_session;
+        std::shared_ptr<const symbol_index> m_index;
 
         // Get command completions
         std::vector<std::string> get_command_completions(const std::string& prefix);
@@ -1,16 +1,18 @@
 #ifndef XEUS_STATA_INSPECTION_HPP
 #define XEUS_STATA_INSPECTION_HPP
 
+#include <memory>
 #include <string>
 
 namespace xeus_stata
 {
     class stata_session;
+    class symbol_index;
 
     class inspection_engine
     {
     public:
-        inspection_engine(stata_session* session);
+        inspection_engine(stata_session* session, std::shared_ptr<const symbol_index> index = nullptr);
 
         // Get inspection info for code at cursor position
         std::string get_inspection(
@@ -21,6 +23,7 @@ namespace xeus_stata
 
     private:
         stata_session* m_session;
+        std::shared_ptr<const symbol_index> m_index;
 
         // Get help for a Stata command
         std::string get_command_help(const std::string& command);
@@ -0,0 +1,37 @@
+#ifndef XEUS_STATA_LIBRARY_ABI_HPP
+#define XEUS_STATA_LIBRARY_ABI_HPP
+
+// C entry points the library backend resolves from the Stata shared
+// library. StataSO_Main and StataSO_Execute are required, everything else
+// is optional and the backend falls back to plain commands without it.
+//
+//   int  StataSO_Main(int argc, char** argv);             0 on success
+//   int  StataSO_Execute(const char* command, int echo);  Stata return code
+//   void StataSO_SetBreak(void);                          request --Break--
+//   void StataSO_Shutdown(void);
+//   void StataSO_SetOutputHandler(handler, void* user);   console output
+//   long long StataSO_Nobs(void);
+//   int  StataSO_Nvar(void);
+//   int  StataSO_VarName(int var, char* buffer, int size); 1-based, 0 on success
+//   int  StataSO_VarIndex(const char* name);              1-based, 0 if unknown
+//   int  StataSO_GetNum(int var, long long obs, double* value);  1-based
+//
+// Without an output handler, output is read from an SMCL log.
+
+extern "C"
+{
+    typedef void (*xstata_output_handler)(const char* text, void* user);
+
+    typedef int (*xstata_main_fn)(int argc, char** argv);
+    typedef int (*xstata_execute_fn)(const char* command, int echo);
+    typedef void (*xstata_break_fn)(void);
+    typedef void (*xstata_shutdown_fn)(void);
+    typedef void (*xstata_set_output_handler_fn)(xstata_output_handler handler, void* user);
+    typedef long long (*xstata_nobs_fn)(void);
+    typedef int (*xstata_nvar_fn)(void);
+    typedef int (*xstata_varname_fn)(int var, char* buffer, int size);
+    typedef int (*xstata_varindex_fn)(const char* name);
+    typedef int (*xstata_getnum_fn)(int var, long long obs, double* value);
+}
+
+#endif // XEUS_STATA_LIBRARY_ABI_HPP
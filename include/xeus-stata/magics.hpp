@@ -0,0 +1,25 @@
+#ifndef XEUS_STATA_MAGICS_HPP
+#define XEUS_STATA_MAGICS_HPP
+
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    // A kernel magic found on the first line of a cell
+    // %name args...   (line magic, operates on its arguments only)
+    // %%name args...  (cell magic, operates on the rest of the cell)
+    struct magic_command
+    {
+        std::string name;
+        std::vector<std::string> args;
+        std::string body;
+        bool is_cell_magic = false;
+    };
+
+    // Parse a leading magic; returns false if the cell is plain Stata code
+    bool parse_magic(const std::string& code, magic_command& magic);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_MAGICS_HPP
@@ -0,0 +1,105 @@
+#ifndef XEUS_STATA_METRICS_HPP
+#define XEUS_STATA_METRICS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_stata
+{
+    // Fixed-bucket histogram; observe() is a couple of relaxed atomic adds
+    class histogram
+    {
+    public:
+        // bounds are inclusive upper bucket limits in the base unit
+        // (microseconds for latencies, bytes for sizes), ascending
+        explicit histogram(std::vector<uint64_t> bounds);
+
+        void observe(uint64_t value);
+
+        // Cumulative bucket counts, one per bound plus +Inf
+        std::vector<uint64_t> cumulative_counts() const;
+        uint64_t count() const;
+        uint64_t sum() const;
+        const std::vector<uint64_t>& bounds() const;
+
+    private:
+        std::vector<uint64_t> m_bounds;
+        std::unique_ptr<std::atomic<uint64_t>[]> m_counts;
+        std::atomic<uint64_t> m_sum;
+    };
+
+    // Cumulative kernel metrics, exported as JSON (comm) and in the
+    // Prometheus text format (file in the runtime directory)
+    class kernel_metrics
+    {
+    public:
+        kernel_metrics();
+        ~kernel_metrics();
+
+        kernel_metrics(const kernel_metrics&) = delete;
+        kernel_metrics& operator=(const kernel_metrics&) = delete;
+
+        // Hot-path recording, lock-free. error_code is the r() code, 0 on
+        // success, negative for a cell that failed without one.
+        void record_execution(double total_ms, double parse_ms, size_t pty_bytes, int error_code);
+        void record_graph(size_t bytes);
+        void record_completion(double ms);
+        void record_inspection(double ms);
+
+        // Provides the Stata child pid for RSS sampling
+        void set_pid_provider(std::function<int()> provider);
+
+        nl::json snapshot() const;
+        std::string prometheus_text() const;
+
+        // Periodically rewrite a Prometheus text file; interval 0 disables
+        void start_exporter(const std::string& path, int interval_seconds);
+        void stop_exporter();
+
+    private:
+        static const int MAX_TRACKED_RC = 1024;
+
+        std::atomic<uint64_t> m_cells_executed;
+        std::atomic<uint64_t> m_cells_failed;
+        std::unique_ptr<std::atomic<uint64_t>[]> m_errors_by_rc;
+        std::atomic<uint64_t> m_errors_other_rc;
+        std::atomic<uint64_t> m_pty_bytes;
+        std::atomic<uint64_t> m_graphs_published;
+
+        histogram m_execution_us;
+        histogram m_parse_us;
+        histogram m_completion_us;
+        histogram m_inspection_us;
+        histogram m_graph_bytes;
+
+        std::function<int()> m_pid_provider;
+
+        std::thread m_exporter;
+        std::mutex m_exporter_mutex;
+        std::condition_variable m_exporter_wakeup;
+        bool m_exporter_stopping;
+
+        void write_prometheus_file(const std::string& path) const;
+    };
+
+    // Directory for the metrics file: $XEUS_STATA_METRICS_DIR, then the
+    // Jupyter runtime directory
+    std::string default_metrics_dir();
+
+    // Resident set size of a process in bytes, 0 if unavailable
+    uint64_t process_rss_bytes(int pid);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_METRICS_HPP
@@ -0,0 +1,93 @@
+#ifndef XEUS_STATA_PARALLEL_HPP
+#define XEUS_STATA_PARALLEL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    class stata_session;
+
+    // A %%parallel N [append | by(var)] cell
+    //
+    // Without by(), the cell is one forvalues/foreach loop, optionally
+    // preceded by setup statements, and each iteration is a task. With
+    // by(var), the whole cell is run once per group of var on that group's
+    // observations.
+    struct parallel_job
+    {
+        size_t workers = 0;
+        std::string by;             // empty for a loop
+        bool append = false;        // loop datasets replace the main one
+        std::string setup;          // statements before the loop
+        std::string loop_header;    // "forvalues i = 1/100", without the brace
+        std::string loop_var;
+        std::string body;           // loop body, or the whole cell with by()
+    };
+
+    // Throws std::runtime_error with a usage message if the cell does not
+    // have one of the two forms
+    parallel_job parse_parallel_cell(const std::vector<std::string>& args, const std::string& cell);
+
+    // Programs defined in the session rather than loaded from ado-files,
+    // from the output of program dir: it lists them as a size and a name,
+    // with no "ado" in front
+    std::vector<std::string> session_programs(const std::string& program_dir);
+
+    // Turn program list output, with each program preceded by an
+    // "xstata_program:name" line, back into program define blocks that
+    // replace any program of the same name. The header is "name:" or
+    // "name, rclass:", and body lines are numbered; a line too long for
+    // the line size continues unnumbered.
+    std::string rebuild_programs(const std::string& output);
+
+    struct parallel_result
+    {
+        std::string output;         // task outputs in task order
+        bool is_error = false;
+        int error_code = 0;
+        std::string error_message;
+        size_t tasks = 0;
+        size_t merged = 0;          // task datasets appended into the main session
+    };
+
+    // Runs parallel jobs on worker Stata sessions that are kept between
+    // cells. The main session's dataset, globals, scalars, matrices, set
+    // options and programs are saved once to a scratch directory and
+    // loaded by the workers; tasks are handed out from per-worker queues,
+    // and an idle worker steals from the busiest one. Groups changed under
+    // by(), and with append the datasets changed by loop tasks, are
+    // appended back into the main session in task order.
+    class parallel_runner
+    {
+    public:
+        // Called on the thread running run(), about twice a second, with a
+        // short per-worker progress report
+        using progress_callback = std::function<void(const std::string&)>;
+
+        parallel_runner();
+        ~parallel_runner();
+
+        parallel_result run(stata_session& main, const parallel_job& job, const progress_callback& progress);
+
+        // Stop handing out tasks and interrupt the running ones; safe in a
+        // signal handler
+        void interrupt();
+
+    private:
+        static const size_t MAX_WORKERS = 64;
+
+        stata_session& worker(size_t index);
+
+        std::vector<std::unique_ptr<stata_session>> m_workers;
+        std::atomic<stata_session*> m_active[MAX_WORKERS];
+        std::atomic<bool> m_cancel{false};
+    };
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_PARALLEL_HPP
@@ -0,0 +1,58 @@
+#ifndef XEUS_STATA_PNG_HPP
+#define XEUS_STATA_PNG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    // Header fields from the IHDR chunk
+    struct png_info
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint8_t bit_depth = 0;
+        uint8_t color_type = 0;
+        uint8_t interlace = 0;
+    };
+
+    // Read the IHDR chunk; false if data is not a PNG
+    bool read_png_info(const unsigned char* data, size_t size, png_info& info);
+
+    // Copy of a PNG without ancillary chunks (text, timestamps, physical
+    // size, ICC profiles), keeping those that change how it renders
+    std::vector<unsigned char> strip_png_ancillary(const std::vector<unsigned char>& data);
+
+    struct png_budget
+    {
+        // Images above either limit are recompressed and, if that is not
+        // enough, downsampled by an integer factor; 0 means no limit
+        uint64_t max_pixels = 0;
+        size_t max_bytes = 0;
+    };
+
+    struct png_optimize_result
+    {
+        std::vector<unsigned char> data;
+        png_info info;
+        bool resampled = false;
+    };
+
+    // Fit a PNG into the budget. Without zlib, or for layouts it cannot
+    // decode (16-bit, palette, interlaced), only strips ancillary chunks.
+    png_optimize_result optimize_png(const std::vector<unsigned char>& data, const png_budget& budget);
+
+    // Quickly encoded copy whose longer side is at most max_side pixels,
+    // for showing while the full image is prepared. Empty data if the
+    // image cannot be decoded (or zlib is not available).
+    png_optimize_result make_png_preview(const std::vector<unsigned char>& data, uint32_t max_side);
+
+    // Where full-resolution originals of optimized graphs are kept:
+    // $XEUS_STATA_GRAPH_DIR, then the runtime directory
+    std::string default_graph_dir();
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_PNG_HPP
@@ -0,0 +1,50 @@
+#ifndef XEUS_STATA_PREFETCH_HPP
+#define XEUS_STATA_PREFETCH_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xeus_stata
+{
+    // Data files a cell is going to read, in the order it reads them: use,
+    // merge/append/joinby/cross using, import delimited/excel and insheet.
+    // Relative paths are resolved against pwd, following any literal cd
+    // earlier in the cell; Stata's default extension is added where it
+    // would be. Paths built from macros are skipped, as are files that
+    // do not exist.
+    std::vector<std::string> referenced_data_files(const std::string& code, const std::string& pwd);
+
+    // Pulls files into the page cache on a background thread
+    // (posix_fadvise WILLNEED and readahead on Linux, F_RDADVISE on macOS),
+    // so a network file system is read while earlier commands run
+    class data_prefetcher
+    {
+    public:
+        // At most max_bytes of each file, from the start
+        explicit data_prefetcher(uint64_t max_bytes);
+        ~data_prefetcher();
+
+        data_prefetcher(const data_prefetcher&) = delete;
+        data_prefetcher& operator=(const data_prefetcher&) = delete;
+
+        void prefetch(const std::vector<std::string>& files);
+
+    private:
+        void run();
+
+        uint64_t m_max_bytes;
+        std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        std::deque<std::string> m_queue;
+        bool m_stopping = false;
+        std::thread m_thread;
+    };
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_PREFETCH_HPP
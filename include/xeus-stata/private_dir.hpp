@@ -0,0 +1,23 @@
+#ifndef XEUS_STATA_PRIVATE_DIR_HPP
+#define XEUS_STATA_PRIVATE_DIR_HPP
+
+#include <string>
+
+namespace xeus_stata
+{
+    // Fallback directories such as /tmp/xeus-stata-<uid> have predictable
+    // names, so another local user can create them first. Anything run,
+    // loaded or connected to from them is checked with these.
+
+    // path is owned by the effective user, is not a symbolic link and is
+    // not writable by group or others, and every directory above it is
+    // owned by that user or root and not writable by others (unless
+    // sticky, like /tmp). False with the reason in error otherwise.
+    bool check_private_path(const std::string& path, std::string& error);
+
+    // Create the missing parts of path with mode 0700, then check it
+    bool ensure_private_dir(const std::string& path, std::string& error);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_PRIVATE_DIR_HPP
@@ -0,0 +1,41 @@
+#ifndef XEUS_STATA_PROFILE_HPP
+#define XEUS_STATA_PROFILE_HPP
+
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_stata
+{
+    // One program in a profiler report, summed over every place it was
+    // called from
+    struct profile_row
+    {
+        std::string program;
+        long long calls = 0;
+        double total_s = 0;     // including the programs it called
+        double self_s = 0;      // excluding them
+    };
+
+    struct profile_report
+    {
+        std::vector<profile_row> rows;  // by self time, largest first
+        long long total_count = 0;
+        double total_s = 0;
+    };
+
+    // Parse the output of `profiler report`: one line per call site with
+    // count, time and the program name indented under its caller, then the
+    // overall totals
+    profile_report parse_profiler_report(const std::string& output);
+
+    std::string format_profile_text(const profile_report& report);
+    std::string format_profile_html(const profile_report& report);
+    nl::json profile_to_json(const profile_report& report);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_PROFILE_HPP
@@ -0,0 +1,113 @@
+#ifndef XEUS_STATA_RESOURCE_MONITOR_HPP
+#define XEUS_STATA_RESOURCE_MONITOR_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_stata
+{
+    // One reading of a process from /proc/<pid>/{stat,status,io}
+    struct process_usage
+    {
+        bool valid = false;
+        double cpu_seconds = 0;     // user + system, all threads
+        uint64_t rss_bytes = 0;
+        uint64_t swap_bytes = 0;
+        int threads = 0;
+        int running_threads = 0;    // threads in state R
+        int blocked_threads = 0;    // threads in state D (waiting on I/O)
+        uint64_t read_bytes = 0;    // storage I/O, 0 if /proc/<pid>/io is not readable
+        uint64_t write_bytes = 0;
+    };
+
+    // False if the process is gone or /proc is not available
+    bool read_process_usage(int pid, process_usage& usage);
+
+    // Resources one cell used, from readings at its start and end and the
+    // samples taken in between
+    struct cell_resources
+    {
+        bool valid = false;
+        uint64_t peak_rss_bytes = 0;
+        double cpu_seconds = 0;
+        uint64_t read_bytes = 0;
+        uint64_t write_bytes = 0;
+        int max_threads = 0;
+        size_t samples = 0;
+        bool rss_warning = false;
+    };
+
+    nl::json cell_resources_to_json(const cell_resources& resources);
+
+    // Samples the Stata process on its own thread. Nothing is published
+    // from that thread; the kernel picks the latest sample up on the shell
+    // thread (between reads while a cell runs, and on comm requests).
+    class resource_monitor
+    {
+    public:
+        // interval_ms 0 disables sampling; rss_limit_bytes 0 disables the
+        // warning, which fires once per cell at 90% of the limit
+        resource_monitor(std::function<int()> pid_provider, int interval_ms, uint64_t rss_limit_bytes);
+        ~resource_monitor();
+
+        resource_monitor(const resource_monitor&) = delete;
+        resource_monitor& operator=(const resource_monitor&) = delete;
+
+        void start();
+        void stop();
+
+        void begin_cell();
+        cell_resources end_cell();
+
+        // Latest sample as JSON (cpu_percent, rss_bytes, ...), and a
+        // counter that changes with every new sample
+        nl::json latest() const;
+        uint64_t sample_count() const;
+
+        // True, once per cell, when RSS has reached the warning threshold
+        bool take_rss_warning(uint64_t& rss_bytes);
+
+        uint64_t rss_limit() const { return m_rss_limit; }
+
+    private:
+        void run();
+        void record(const process_usage& usage, double cpu_percent);
+
+        std::function<int()> m_pid_provider;
+        int m_interval_ms;
+        uint64_t m_rss_limit;
+
+        std::thread m_thread;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        bool m_stopping = false;
+
+        process_usage m_latest;
+        double m_latest_cpu_percent = 0;
+        uint64_t m_samples = 0;
+
+        // Current cell
+        bool m_in_cell = false;
+        process_usage m_cell_start;
+        cell_resources m_cell;
+        bool m_warning_pending = false;
+    };
+
+    // Byte count with an optional K, M, G or T suffix (powers of 1024);
+    // 0 if empty or malformed
+    uint64_t parse_byte_size(const std::string& text);
+
+    // "1.5 GB" style, in powers of 1024
+    std::string format_byte_size(uint64_t bytes);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_RESOURCE_MONITOR_HPP
@@ -0,0 +1,85 @@
+#ifndef XEUS_STATA_RESOURCE_POLICY_HPP
+#define XEUS_STATA_RESOURCE_POLICY_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_stata
+{
+    // Limits for the Stata processes of one kernel. Read from the JSON
+    // file in XEUS_STATA_RESOURCE_CONFIG (keys as below), then from the
+    // XEUS_STATA_* variables, which win.
+    struct resource_policy_config
+    {
+        std::string cpus;           // XEUS_STATA_CPUS: "0-7,16", or "auto:N" for N free CPUs
+        int numa_node = -1;         // XEUS_STATA_NUMA_NODE: keep "auto" on this node
+        int processors = 0;         // XEUS_STATA_PROCESSORS: set processors, 0 = size of the CPU set
+        std::string cgroup;         // XEUS_STATA_CGROUP: parent cgroup, "auto" = next to the kernel's
+        std::string cpu_max;        // XEUS_STATA_CPU_MAX: cores ("2.5") or a raw cpu.max value
+        uint64_t memory_max = 0;    // XEUS_STATA_MEMORY_MAX: bytes, K/M/G/T suffixes allowed
+    };
+
+    resource_policy_config load_resource_policy_config();
+
+    // "0-3,8" <-> {0, 1, 2, 3, 8}
+    std::vector<int> parse_cpu_list(const std::string& text);
+    std::string format_cpu_list(const std::vector<int>& cpus);
+
+    // Set up once per kernel process: CPUs for "auto" are claimed with a
+    // lock file each (XEUS_STATA_CPU_LOCK_DIR, default /tmp/xeus-stata-cpus)
+    // held until the kernel exits, so kernels on one host do not share
+    // cores. The cgroup, xstata-<kernel pid>, holds every Stata process
+    // of the kernel and is removed on exit. Problems are collected as
+    // notes rather than thrown; an unmet limit does not stop the kernel.
+    class resource_policy
+    {
+    public:
+        static resource_policy& instance();
+
+        ~resource_policy();
+
+        resource_policy(const resource_policy&) = delete;
+        resource_policy& operator=(const resource_policy&) = delete;
+
+        bool active() const;
+
+        // Pin every thread of pid to the CPU set and move it into the cgroup
+        void apply(int pid);
+
+        // For `set processors`; 0 if the policy does not set it
+        int processors() const;
+
+        // The effective limits, e.g. "CPUs 0-7 (NUMA node 0), cgroup
+        // .../xstata-123 with memory.max 17179869184"
+        std::string summary() const;
+        nl::json to_json() const;
+
+        uint64_t memory_max() const { return m_config.memory_max; }
+
+    private:
+        resource_policy();
+
+        void claim_cpus(int count);
+        void create_cgroup();
+        void note(const std::string& text);
+
+        resource_policy_config m_config;
+        std::vector<int> m_cpus;
+        std::vector<int> m_nodes;           // NUMA nodes the CPU set spans
+        std::vector<int> m_lock_fds;
+        std::string m_cgroup_dir;           // empty without a cgroup
+        std::string m_cpu_max_applied;
+        std::string m_memory_max_applied;
+        std::vector<std::string> m_notes;  // guarded by m_mutex, apply() runs on several threads
+        mutable std::mutex m_mutex;
+    };
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_RESOURCE_POLICY_HPP
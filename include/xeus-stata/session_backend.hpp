@@ -0,0 +1,142 @@
+#ifndef XEUS_STATA_SESSION_BACKEND_HPP
+#define XEUS_STATA_SESSION_BACKEND_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "timing.hpp"
+#include "smcl.hpp"
+
+namespace xeus_stata
+{
+    // Data state at the end of a cell, reported by the cell trailer
+    struct cell_state
+    {
+        bool valid = false;         // false if the trailer was not seen
+        long long nobs = 0;         // c(N)
+        int nvars = 0;              // c(k)
+        bool data_changed = false;  // c(changed)
+        std::string frame;          // c(frame)
+        std::string pwd;            // c(pwd)
+        double stata_clock = 0;     // Stata's clock, %tc milliseconds
+    };
+
+    // Jupyter user_expressions as name and Stata expression, evaluated
+    // right after the cell while its r(), e() and locals are in place
+    using expression_list = std::vector<std::pair<std::string, std::string>>;
+
+    struct expression_result
+    {
+        std::string name;
+        int rc = 0;             // 0 if the expression evaluated
+        std::string value;      // as Stata stores it in a local
+    };
+
+    struct execution_result
+    {
+        std::string output;
+        bool is_error;
+        int error_code;
+        std::string error_message;
+        std::vector<std::string> graph_files;
+        execution_timing timing;
+
+        // Output split by class (result/text/error), only filled when
+        // output is captured through the SMCL log
+        std::vector<smcl_segment> segments;
+
+        cell_state state;
+
+        // One per requested expression that was reached, in request order
+        std::vector<expression_result> expressions;
+    };
+
+    // Raised when the Stata child process exits underneath the kernel
+    class stata_process_error : public std::runtime_error
+    {
+    public:
+        stata_process_error(const std::string& what, int exit_status, int signal)
+            : std::runtime_error(what)
+            , m_exit_status(exit_status)
+            , m_signal(signal)
+        {
+        }
+
+        // Exit status if the process exited normally, -1 otherwise
+        int exit_status() const { return m_exit_status; }
+
+        // Terminating signal if the process was killed, 0 otherwise
+        int signal() const { return m_signal; }
+
+    private:
+        int m_exit_status;
+        int m_signal;
+    };
+
+    // Raised when a cell runs past the execute timeout. Stata has been
+    // interrupted and read up to a sync marker, so the session is ready
+    // for the next cell.
+    class stata_timeout_error : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // How a session talks to Stata. The PTY backend drives a console Stata
+    // child process; the library backend runs Stata in-process through its
+    // shared library.
+    class session_backend
+    {
+    public:
+        virtual ~session_backend() = default;
+
+        // Short name for logs and kernel info ("pty", "library")
+        virtual std::string name() const = 0;
+
+        virtual execution_result execute(const std::string& code,
+                                         const expression_list& expressions = {}) = 0;
+        virtual bool is_ready() const = 0;
+        virtual void interrupt() = 0;
+        virtual void shutdown() = 0;
+
+        // Process running Stata, for resource sampling
+        virtual int get_pid() const = 0;
+
+        // Only meaningful for backends that can lose their Stata process
+        virtual void set_respawn_callback(std::function<void()> callback);
+
+        // Called on the executing thread every ~100 ms while waiting on
+        // Stata; backends that block inside Stata never call it
+        virtual void set_wait_callback(std::function<void()> callback);
+
+        // The defaults below go through execute(); backends with direct
+        // access to Stata's memory override them
+        virtual std::string get_macro(const std::string& name);
+
+        // Variables of the current frame, in dataset order
+        virtual std::vector<std::string> variable_names();
+
+        // Up to count values of a numeric variable starting at observation
+        // first (0-based); missing values are NaN
+        virtual std::vector<double> numeric_values(const std::string& variable,
+                                                   size_t first, size_t count);
+    };
+
+    // Console Stata on a pseudo-terminal; stata_path empty means
+    // $STATA_PATH, then the path found at build time
+    std::unique_ptr<session_backend> make_pty_backend(const std::string& stata_path);
+
+    // Stata loaded with dlopen from library_path
+    std::unique_ptr<session_backend> make_library_backend(const std::string& library_path);
+
+    // Per-session scratch directory, on tmpfs when available
+    // ($XEUS_STATA_SCRATCH_DIR overrides the location)
+    std::string make_scratch_dir();
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_SESSION_BACKEND_HPP
@@ -0,0 +1,28 @@
+#ifndef XEUS_STATA_SMCL_HPP
+#define XEUS_STATA_SMCL_HPP
+
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    // A run of rendered SMCL text in one output class
+    // style is one of "com" (command echo), "txt", "res", "err", "inp"
+    struct smcl_segment
+    {
+        std::string style;
+        std::string text;
+    };
+
+    // Render SMCL (as written by `log using ..., smcl`) into plain text
+    // segments, keeping the output class of each piece. Box-drawing
+    // directives become the same ASCII the console shows.
+    std::vector<smcl_segment> parse_smcl(const std::string& smcl, int linesize = 200);
+
+    // Concatenate the text of all segments except those in the given style
+    std::string smcl_text(const std::vector<smcl_segment>& segments,
+                          const std::string& skip_style = "com");
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_SMCL_HPP
@@ -0,0 +1,125 @@
+#ifndef XEUS_STATA_LEXER_HPP
+#define XEUS_STATA_LEXER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    enum class token_kind : uint8_t
+    {
+        word,               // command, variable or option name
+        number,
+        string,             // "..."
+        compound_string,    // `"..."', may nest
+        local_macro,        // `name', may nest
+        global_macro,       // $name or ${name}
+        open_brace,
+        close_brace,
+        open_paren,
+        close_paren,
+        op,                 // any other punctuation
+        comment,            // /* */ (nests), // and * comments
+        continuation,       // /// up to and including the line break
+        delimit,            // #delimit directive
+        end_of_statement,   // line break, or ; under #delimit ;
+        mata_line           // a line inside a mata block, lexed as one token
+    };
+
+    // Tokens point into the source; lexing never allocates
+    struct token
+    {
+        token_kind kind;
+        bool unterminated;  // string, comment or macro cut off by the line end
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // Everything the lexer carries across statements, so lexing can resume
+    // at a statement boundary
+    struct lexer_state
+    {
+        bool semicolon_delimiter = false;   // #delimit ;
+        bool in_mata = false;               // between mata and end
+        bool mata_pending = false;          // mata seen, block starts on the next line
+        int brace_depth = 0;
+        int min_brace_depth = 0;            // below zero: a stray }
+        int comment_depth = 0;              // inside /* */
+        bool at_statement_start = true;
+    };
+
+    class stata_lexer
+    {
+    public:
+        stata_lexer(const std::string& source, size_t offset = 0, const lexer_state& state = lexer_state());
+
+        // Next token; false at the end of the source
+        bool next(token& tok);
+
+        const lexer_state& state() const { return m_state; }
+        size_t offset() const { return m_pos; }
+
+    private:
+        token make(token_kind kind, size_t start, bool unterminated = false);
+        token lex_block_comment(size_t start);
+        token lex_star_comment(size_t start);
+        token lex_mata_line();
+        void skip_macro(size_t& pos, bool& unterminated) const;
+        void skip_compound_string(size_t& pos, bool& unterminated) const;
+
+        const std::string& m_source;
+        size_t m_pos;
+        lexer_state m_state;
+    };
+
+    // A cell lexed once, shared by is_complete, completion and the other
+    // analyses of the same code
+    struct lexed_cell
+    {
+        std::string code;
+        std::vector<token> tokens;
+        lexer_state end_state;
+
+        // Where the last complete statement ends, and the state there;
+        // lexing of a longer cell with the same prefix resumes here
+        size_t resume_offset = 0;
+        size_t resume_token = 0;
+        lexer_state resume_state;
+
+        std::string text(const token& tok) const { return code.substr(tok.offset, tok.length); }
+
+        // Token containing offset (or ending right at it), nullptr if none
+        const token* token_at(size_t offset) const;
+
+        // First word of each statement, skipping prefixes such as quietly
+        // and capture
+        std::vector<std::string> commands() const;
+
+        // Same, as indexes into tokens
+        std::vector<size_t> command_tokens() const;
+
+        // Whether a word starting at offset would be a statement's command
+        bool is_command_position(size_t offset) const;
+    };
+
+    // Lex code, reusing the cached tokens of this cell or of a shorter
+    // version of it (as typed in a console); keeps the last few cells
+    std::shared_ptr<const lexed_cell> lex_cell(const std::string& code);
+
+    enum class completeness
+    {
+        complete,
+        incomplete,
+        invalid
+    };
+
+    // Whether a cell can run as is, and how deep the next line should be
+    // indented (in braces) when it is incomplete
+    completeness cell_completeness(const lexed_cell& cell, int& indent_level);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_LEXER_HPP
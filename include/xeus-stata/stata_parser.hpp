@@ -10,6 +10,38 @@ namespace xeus_stata
     // Parse Stata output to extract execution results
     execution_result parse_execution_output(const std::string& output);
 
+    // Parse a chunk of the session's SMCL log; found_marker tells whether
+    // the end-of-cell marker was reached
+    execution_result parse_smcl_execution_output(const std::string& smcl,
+                                                 const std::string& marker,
+                                                 bool& found_marker);
+
+    // Stata string literal for any text, in compound quotes so that paths
+    // and values containing " survive
+    std::string compound_quote(const std::string& text);
+
+    // Stata commands printing the end-of-cell trailer: the cell's return
+    // code (rc_expression, "." if unknown), c(N), c(k), c(changed),
+    // c(frame), the cell's run time in ms (elapsed_expression), Stata's
+    // clock and c(pwd), on one '|'-separated line. One command per line,
+    // each ending in a newline.
+    std::string trailer_command(const std::string& rc_expression,
+                                const std::string& elapsed_expression);
+
+    // Take the trailer line out of result's output and segments. A known
+    // return code replaces the error status guessed from the output.
+    // False if there is no trailer.
+    bool apply_trailer(execution_result& result);
+
+    // Stata commands evaluating each expression into a local and printing
+    // its return code and value on a tagged line, one command per line
+    std::string expressions_command(const expression_list& expressions);
+
+    // Move the tagged lines, which follow the cell's output, out of
+    // result's output and segments into result.expressions. Call after
+    // apply_trailer.
+    void apply_expressions(execution_result& result, const expression_list& expressions);
+
     // Generate a unique execution marker
     std::string generate_execution_marker();
 
@@ -25,6 +57,15 @@ namespace xeus_stata
     // Check if output looks like a Stata table
     bool is_stata_table(const std::string& output);
 
+    // Escape &, < and > in one pass
+    std::string html_escape(const std::string& text);
+
+    // Stylesheets used by the two formatters below. They are short and go
+    // with every output, so an output keeps its styling however the
+    // outputs before it were cleared.
+    const std::string& html_table_styles();
+    const std::string& raw_html_styles();
+
     // Format output as HTML table
     std::string format_as_html_table(const std::string& output);
 
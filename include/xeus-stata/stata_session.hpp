@@ -6,17 +6,13 @@
 #include <functional>
 #include <vector>
 
+#include "session_backend.hpp"
+
 namespace xeus_stata
 {
-    struct execution_result
-    {
-        std::string output;
-        bool is_error;
-        int error_code;
-        std::string error_message;
-        std::vector<std::string> graph_files;
-    };
-
+    // Selects a backend from the environment and forwards to it:
+    // XEUS_STATA_BACKEND=pty (default) or library, with the library path
+    // in XEUS_STATA_LIBRARY
     class stata_session
     {
     public:
@@ -30,10 +26,15 @@ namespace xeus_stata
         // Execute Stata code and return result
         execution_result execute(const std::string& code);
 
+        // Same, then evaluate expressions in the same round trip
+        execution_result execute(const std::string& code, const expression_list& expressions);
+
         // Get Stata version
         std::string get_version();
 
         // Check if session is ready
+        // Also true while a replacement process is starting, since
+        // execute() waits for it
         bool is_ready() const;
 
         // Shutdown the Stata session
@@ -42,13 +43,40 @@ namespace xeus_stata
         // Interrupt current execution
         void interrupt();
 
+        // Process id of the Stata child, -1 if not running
+        int get_pid() const;
+
         // Get/set macros
         std::string get_macro(const std::string& name);
         void set_macro(const std::string& name, const std::string& value);
 
+        // Called on the respawn thread once a replacement Stata process is
+        // up, after the initialization do-file has run
+        void set_respawn_callback(std::function<void()> callback);
+
+        // Called on the executing thread while a cell runs, see
+        // session_backend::set_wait_callback
+        void set_wait_callback(std::function<void()> callback);
+
+        // Name of the active backend
+        std::string backend_name() const;
+
+        // Effective CPU and memory limits under the kernel's resource
+        // policy, empty without one
+        std::string resource_summary() const;
+
+        // Dataset access, see session_backend
+        std::vector<std::string> variable_names();
+        std::vector<double> numeric_values(const std::string& variable, size_t first, size_t count);
+
     private:
-        class impl;
-        std::unique_ptr<impl> m_impl;
+        // Pin the Stata process, move it into the cgroup and match
+        // `set processors` to the CPU set; again after every respawn
+        void apply_resource_policy();
+
+        std::unique_ptr<session_backend> m_backend;
+        std::function<void()> m_respawn_callback;
+        int m_processors = 0;   // c(processors) after the policy was applied
     };
 
 } // namespace xeus_stata
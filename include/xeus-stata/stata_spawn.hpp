@@ -0,0 +1,48 @@
+#ifndef XEUS_STATA_SPAWN_HPP
+#define XEUS_STATA_SPAWN_HPP
+
+#include <string>
+
+namespace xeus_stata
+{
+    // A console Stata on a pseudo-terminal
+    struct stata_process
+    {
+        int master_fd = -1;     // non-blocking PTY master
+        int pid = -1;
+        bool own_child = true;  // false for processes handed over by the pool
+    };
+
+    // Fork and exec Stata (-q) on a new PTY. A detached process gets its
+    // own session with the PTY as controlling terminal, so it is hung up
+    // once the last copy of the master is closed; otherwise it is tied to
+    // the lifetime of the calling process.
+    stata_process spawn_stata(const std::string& stata_path, bool detached);
+
+    // Wait for the first prompt, apply the session settings (set more off,
+    // set linesize 200) and read until they are done, leaving an idle
+    // Stata and a drained PTY. False on timeout or if Stata exits.
+    bool initialize_stata(const stata_process& process, int timeout_ms);
+
+    // $XEUS_STATA_POOL_SOCKET, then the runtime directory, then
+    // /tmp/xeus-stata-<uid>
+    std::string default_pool_socket();
+
+    // Take an idle, initialized Stata for stata_path from the xstata-pool
+    // daemon. False, quickly, when no daemon listens on socket_path or
+    // it has nothing to hand out. The socket must be ours, in a directory
+    // that passes check_private_path, and the daemon must run as the same
+    // user: whoever binds the path hands the kernel its terminal.
+    bool acquire_pooled_stata(const std::string& socket_path, const std::string& stata_path,
+                              stata_process& process);
+
+    // Whether the peer of a connected Unix socket runs as the effective user
+    bool peer_is_same_user(int socket_fd);
+
+    // Pass a descriptor and a short text message over a Unix socket
+    bool send_fd(int socket_fd, int fd, const std::string& message);
+    bool receive_fd(int socket_fd, int& fd, std::string& message);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_SPAWN_HPP
@@ -0,0 +1,76 @@
+#ifndef XEUS_STATA_SYMBOL_INDEX_HPP
+#define XEUS_STATA_SYMBOL_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    enum class symbol_kind : uint8_t
+    {
+        command = 1,    // built-in or ado command
+        function = 2
+    };
+
+    // Commands and functions known without asking Stata: the built-in
+    // tables plus every .ado on the adopath, with the one-line summary
+    // from the matching .sthlp. The index lives in a versioned file that
+    // all kernels on a host map read-only, so it costs each of them only
+    // shared page cache.
+    class symbol_index
+    {
+    public:
+        ~symbol_index();
+
+        symbol_index(const symbol_index&) = delete;
+        symbol_index& operator=(const symbol_index&) = delete;
+
+        // Map the index for this Stata installation (stata_path empty
+        // means $STATA_PATH, then the build-time default), building it
+        // first if it is missing or out of date. Falls back to an index
+        // in memory if the cache directory is not writable.
+        static std::shared_ptr<const symbol_index> open(const std::string& stata_path = "");
+
+        // Names of the given kind starting with prefix, in order
+        std::vector<std::string> complete(const std::string& prefix, symbol_kind kind,
+                                          size_t limit = 200) const;
+
+        // One-line summary of a command ("Linear regression"), empty if
+        // unknown
+        std::string summary(const std::string& name) const;
+
+        size_t size() const;
+
+        // File the index is mapped from, empty when it is in memory
+        const std::string& path() const { return m_path; }
+
+    private:
+        symbol_index() = default;
+
+        struct entry;
+        const entry* entries() const;
+        const char* strings() const;
+        const entry* lower_bound(const std::string& name) const;
+
+        const unsigned char* m_data = nullptr;
+        size_t m_size = 0;
+        void* m_map = nullptr;
+        std::vector<unsigned char> m_owned;
+        std::string m_path;
+    };
+
+    // Whether size bytes at data are a complete index built from stamp,
+    // with every entry inside the string table. A cache file that fails
+    // this is rebuilt rather than mapped.
+    bool valid_symbol_index(const unsigned char* data, size_t size, uint64_t stamp);
+
+    // $XEUS_STATA_INDEX_DIR, then $XDG_CACHE_HOME/xeus-stata, then
+    // ~/.cache/xeus-stata
+    std::string default_index_dir();
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_SYMBOL_INDEX_HPP
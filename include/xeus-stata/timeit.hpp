@@ -0,0 +1,57 @@
+#ifndef XEUS_STATA_TIMEIT_HPP
+#define XEUS_STATA_TIMEIT_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xeus_stata
+{
+    class stata_session;
+
+    // %%timeit [-n RUNS] [-w WARMUP] [-p]
+    struct timeit_options
+    {
+        size_t runs = 7;
+        size_t warmup = 1;
+        bool restore_data = false;  // -p: every run starts from the same data
+    };
+
+    // Throws std::runtime_error with a usage message
+    timeit_options parse_timeit_args(const std::vector<std::string>& args);
+
+    struct timing_summary
+    {
+        std::vector<double> samples;    // milliseconds, in run order
+        double min = 0;
+        double median = 0;
+        double p95 = 0;
+        double mean = 0;
+    };
+
+    timing_summary summarize_samples(std::vector<double> samples);
+
+    struct timeit_result
+    {
+        timeit_options options;
+        timing_summary stata;       // Stata's own timer around the cell
+        timing_summary kernel;      // kernel clock, less the per-cell overhead
+        double overhead_ms = 0;     // kernel clock of an empty cell
+        bool has_stata_timer = false;
+    };
+
+    // Run code warmup + runs times. A failing run stops the benchmark with
+    // a std::runtime_error carrying Stata's error.
+    timeit_result run_timeit(stata_session& session, const std::string& code, const timeit_options& options);
+
+    std::string format_timeit_text(const timeit_result& result);
+    std::string format_timeit_html(const timeit_result& result);
+    nl::json timeit_to_json(const timeit_result& result);
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_TIMEIT_HPP
@@ -0,0 +1,64 @@
+#ifndef XEUS_STATA_TIMING_HPP
+#define XEUS_STATA_TIMING_HPP
+
+#include <chrono>
+#include <cstddef>
+
+namespace xeus_stata
+{
+    // Monotonic stopwatch for measuring execution stages
+    class stopwatch
+    {
+    public:
+        stopwatch()
+            : m_start(std::chrono::steady_clock::now())
+        {
+        }
+
+        void restart()
+        {
+            m_start = std::chrono::steady_clock::now();
+        }
+
+        double elapsed_ms() const
+        {
+            return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - m_start).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    // Where the time of one cell went, in milliseconds
+    // The session fills in the first block, the interpreter the rest
+    struct execution_timing
+    {
+        double write_ms = 0;        // writing the cell to the PTY
+        double stata_ms = 0;        // waiting on Stata for the end marker
+        double stata_timer_ms = 0;  // the cell alone, timed by Stata
+        double pty_read_ms = 0;     // read() calls on the PTY
+        double parse_ms = 0;        // parse_execution_output
+        double interrupt_ms = 0;    // interrupt request to a settled session
+        double total_session_ms = 0;
+
+        double format_ms = 0;       // table/HTML detection and formatting
+        double graph_read_ms = 0;   // reading exported graph files
+        double optimize_ms = 0;     // PNG recompression/downsampling
+        double encode_ms = 0;       // base64 encoding
+        double publish_ms = 0;      // IOPub publishing
+        double total_ms = 0;
+        double idle_ms = 0;         // Stata idle since the previous cell's result, 0 for the first
+
+        size_t bytes_written = 0;   // to the PTY
+        size_t bytes_read = 0;      // from the PTY
+        size_t read_batches = 0;
+        size_t output_bytes = 0;    // after parsing
+        size_t graph_bytes = 0;     // raw image bytes
+        size_t optimized_bytes = 0; // image bytes after optimization
+        size_t encoded_bytes = 0;   // base64 image bytes
+    };
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_TIMING_HPP
@@ -0,0 +1,92 @@
+#ifndef XEUS_STATA_TRACE_HPP
+#define XEUS_STATA_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace xeus_stata
+{
+    // Chrome/Perfetto trace-event recording
+    //
+    // Enabled by setting XEUS_STATA_TRACE to an output path. Events are
+    // recorded into a lock-free ring buffer owned by the emitting thread and
+    // written out by a background thread, so the hot path never blocks.
+    // When tracing is off every probe is a single relaxed atomic load.
+
+    namespace detail
+    {
+        extern std::atomic<bool> g_tracing_enabled;
+    }
+
+    inline bool tracing_enabled()
+    {
+        return detail::g_tracing_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Start tracing to the path in XEUS_STATA_TRACE, if set
+    void start_tracing_from_env();
+
+    // Start writing trace events to the given file
+    void start_tracing(const std::string& path);
+
+    // Flush remaining events and close the trace file
+    void stop_tracing();
+
+    // Tag subsequent events from all threads with this cell (execution count)
+    void trace_set_cell(int64_t cell_id);
+
+    // Name the calling thread in the trace viewer
+    void trace_set_thread_name(const char* name);
+
+    // Records a complete ("X") event covering its lifetime
+    // name and category must be string literals, they are stored by pointer
+    class trace_scope
+    {
+    public:
+        trace_scope(const char* name, const char* category)
+            : m_name(name)
+            , m_category(category)
+            , m_start(tracing_enabled() ? now_us() : 0)
+            , m_value(-1)
+        {
+        }
+
+        ~trace_scope()
+        {
+            finish();
+        }
+
+        trace_scope(const trace_scope&) = delete;
+        trace_scope& operator=(const trace_scope&) = delete;
+
+        // Attach a numeric argument (bytes, counts) to the event
+        void set_value(int64_t value)
+        {
+            m_value = value;
+        }
+
+        // End the event before the scope does
+        void finish()
+        {
+            if (m_start != 0)
+            {
+                record(m_name, m_category, m_start, now_us() - m_start, m_value);
+                m_start = 0;
+            }
+        }
+
+        static uint64_t now_us();
+        static void record(const char* name, const char* category,
+                           uint64_t start_us, uint64_t duration_us, int64_t value);
+
+    private:
+        const char* m_name;
+        const char* m_category;
+        uint64_t m_start;
+        int64_t m_value;
+    };
+
+} // namespace xeus_stata
+
+#endif // XEUS_STATA_TRACE_HPP
@@ -1,12 +1,17 @@
 #ifndef XEUS_STATA_INTERPRETER_HPP
 #define XEUS_STATA_INTERPRETER_HPP
 
+#include <list>
 #include <memory>
 #include <string>
 
 #include "xeus/xinterpreter.hpp"
+#include "xeus/xcomm.hpp"
 #include "nlohmann/json.hpp"
 
+#include "png.hpp"
+#include "timing.hpp"
+
 namespace nl = nlohmann;
 
 namespace xeus_stata
@@ -14,6 +19,12 @@ namespace xeus_stata
     class stata_session;
     class completion_engine;
     class inspection_engine;
+    class checkpoint_manager;
+    class kernel_metrics;
+    class parallel_runner;
+    class resource_monitor;
+    class data_prefetcher;
+    struct magic_command;
 
     class interpreter : public xeus::xinterpreter
     {
@@ -54,10 +65,67 @@ namespace xeus_stata
 
         void shutdown_request_impl() override;
 
+        // Handle a %magic cell, returns the execute reply
+        nl::json execute_magic(
+            const magic_command& magic,
+            int execution_counter,
+            const xeus::execute_request_config& config
+        );
+
+        // %%profile: the cell under Stata's profiler
+        nl::json execute_profile(
+            const std::string& code,
+            int execution_counter,
+            const xeus::execute_request_config& config
+        );
+
+        // %%parallel: the cell spread over worker Stata processes
+        nl::json execute_parallel(
+            const magic_command& magic,
+            int execution_counter,
+            const xeus::execute_request_config& config
+        );
+
+        // Push a new resource sample to the open comms and warn once a
+        // cell nears the RSS limit; runs on the shell thread only
+        void publish_resources();
+
     private:
         std::unique_ptr<stata_session> m_session;
         std::unique_ptr<completion_engine> m_completer;
         std::unique_ptr<inspection_engine> m_inspector;
+        std::unique_ptr<checkpoint_manager> m_checkpoints;
+        std::unique_ptr<parallel_runner> m_parallel;
+        bool m_show_timing;
+
+        std::unique_ptr<kernel_metrics> m_metrics;
+        std::list<xeus::xcomm> m_metrics_comms;
+
+        // Live CPU/RSS/I/O of the Stata process (XEUS_STATA_RESOURCE_INTERVAL_MS)
+        std::unique_ptr<resource_monitor> m_resources;
+        std::list<xeus::xcomm> m_resource_comms;
+        uint64_t m_resources_sent;
+        bool m_resource_warnings;
+
+        // Time from one cell's result to the next cell reaching Stata;
+        // during Run All this is the gap Stata spends waiting on the kernel
+        stopwatch m_idle_timer;
+        bool m_idle_cells;
+
+        // Page-cache prefetch of the data files a cell reads, resolved
+        // against Stata's working directory after the last cell
+        // (XEUS_STATA_PREFETCH=0 turns it off)
+        std::unique_ptr<data_prefetcher> m_prefetcher;
+        std::string m_stata_pwd;
+
+        // PNG optimization before publishing (XEUS_STATA_GRAPH_OPTIMIZE)
+        bool m_optimize_graphs;
+        png_budget m_graph_budget;
+
+        // PNGs of at least this many bytes are first shown as a preview
+        // whose longer side is m_preview_max_side; 0 disables previews
+        size_t m_preview_min_bytes;
+        uint32_t m_preview_max_side;
     };
 
 } // namespace xeus_stata
@@ -0,0 +1,589 @@
+#include "xeus-stata/batch_runner.hpp"
+#include "xeus-stata/stata_session.hpp"
+#include "xeus-stata/stata_parser.hpp"
+#include "xeus-stata/magics.hpp"
+#include "xeus-stata/base64.hpp"
+#include "xeus-stata/png.hpp"
+#include "xeus-stata/timing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // Sessions are registered here so the signal handler can reach
+        // them without taking a lock
+        const size_t MAX_JOBS = 64;
+        std::atomic<stata_session*> g_sessions[MAX_JOBS];
+        std::atomic<bool> g_interrupted{false};
+
+        std::mutex g_log_mutex;
+
+        void log_progress(const std::string& line)
+        {
+            std::lock_guard<std::mutex> lock(g_log_mutex);
+            std::cerr << line << std::endl;
+        }
+
+        std::string read_file(const std::string& path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                throw std::runtime_error("cannot read " + path);
+            }
+            std::stringstream buffer;
+            buffer << file.rdbuf();
+            return buffer.str();
+        }
+
+        // Write next to the destination and rename, so a failed run never
+        // leaves a truncated notebook behind
+        void write_file(const std::string& path, const std::string& content)
+        {
+            std::string temp = path + ".xstata-" + std::to_string(getpid()) + ".tmp";
+            {
+                std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+                if (!file || !(file << content) || !file.flush())
+                {
+                    std::remove(temp.c_str());
+                    throw std::runtime_error("cannot write " + path);
+                }
+            }
+            std::error_code ec;
+            fs::rename(temp, path, ec);
+            if (ec)
+            {
+                std::remove(temp.c_str());
+                throw std::runtime_error("cannot write " + path + ": " + ec.message());
+            }
+        }
+
+        // nbformat stores multi-line strings as a list of lines
+        nl::json split_lines(const std::string& text)
+        {
+            nl::json lines = nl::json::array();
+            size_t start = 0;
+            while (start < text.size())
+            {
+                size_t end = text.find('\n', start);
+                end = end == std::string::npos ? text.size() : end + 1;
+                lines.push_back(text.substr(start, end - start));
+                start = end;
+            }
+            return lines;
+        }
+
+        std::string join_lines(const nl::json& source)
+        {
+            if (source.is_string())
+            {
+                return source.get<std::string>();
+            }
+            std::string text;
+            if (source.is_array())
+            {
+                for (const auto& line : source)
+                {
+                    text += line.get<std::string>();
+                }
+            }
+            return text;
+        }
+
+        // Image output for an exported graph; null if the file is missing
+        nl::json graph_output(const std::string& graph_file, int execution_count)
+        {
+            std::ifstream file(graph_file, std::ios::binary);
+            std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)),
+                                            std::istreambuf_iterator<char>());
+            file.close();
+            unlink(graph_file.c_str());
+            if (data.empty())
+            {
+                return nullptr;
+            }
+
+            std::string mime_type = "image/png";
+            if (graph_file.find(".svg") != std::string::npos)
+            {
+                mime_type = "image/svg+xml";
+            }
+            else if (graph_file.find(".pdf") != std::string::npos)
+            {
+                mime_type = "application/pdf";
+            }
+
+            nl::json metadata = nl::json::object();
+            png_info info;
+            if (mime_type == "image/png" && read_png_info(data.data(), data.size(), info))
+            {
+                metadata["image/png"] = {{"width", info.width}, {"height", info.height}};
+            }
+
+            return {
+                {"output_type", "execute_result"},
+                {"execution_count", execution_count},
+                {"data", {{mime_type, base64_encode(data.data(), data.size())}}},
+                {"metadata", metadata}
+            };
+        }
+
+        // Notebook outputs of one cell, matching what the kernel publishes
+        // for it: stderr and an error, or text/tables followed by graphs
+        struct output_builder
+        {
+            nl::json outputs(const execution_result& result, int execution_count)
+            {
+                nl::json outputs = nl::json::array();
+                if (result.is_error)
+                {
+                    nl::json traceback = nl::json::array();
+                    if (!result.error_message.empty())
+                    {
+                        outputs.push_back(stream("stderr", result.error_message));
+                        traceback.push_back(result.error_message);
+                    }
+                    traceback.push_back("Stata error code: r(" + std::to_string(result.error_code) + ")");
+                    outputs.push_back({
+                        {"output_type", "error"},
+                        {"ename", "StataError"},
+                        {"evalue", "r(" + std::to_string(result.error_code) + ")"},
+                        {"traceback", traceback}
+                    });
+                    return outputs;
+                }
+
+                if (!result.output.empty())
+                {
+                    nl::json data;
+                    if (is_raw_html_output(result.output))
+                    {
+                        data["text/html"] = split_lines(format_as_raw_html(result.output));
+                        data["text/plain"] = split_lines(result.output);
+                    }
+                    else if (is_stata_table(result.output))
+                    {
+                        data["text/plain"] = split_lines(result.output);
+                        data["text/html"] = split_lines(format_as_html_table(result.output));
+                    }
+
+                    if (data.empty())
+                    {
+                        outputs.push_back(stream("stdout", result.output));
+                    }
+                    else
+                    {
+                        outputs.push_back({
+                            {"output_type", "execute_result"},
+                            {"execution_count", execution_count},
+                            {"data", data},
+                            {"metadata", nl::json::object()}
+                        });
+                    }
+                }
+
+                for (const auto& graph_file : result.graph_files)
+                {
+                    nl::json graph = graph_output(graph_file, execution_count);
+                    if (!graph.is_null())
+                    {
+                        outputs.push_back(std::move(graph));
+                    }
+                }
+                return outputs;
+            }
+
+            static nl::json stream(const std::string& name, const std::string& text)
+            {
+                return {{"output_type", "stream"}, {"name", name}, {"text", split_lines(text)}};
+            }
+        };
+
+        nl::json timeout_output(const stata_timeout_error& e)
+        {
+            return {
+                {"output_type", "error"},
+                {"ename", "TimeoutError"},
+                {"evalue", e.what()},
+                {"traceback", nl::json::array({e.what()})}
+            };
+        }
+
+        nl::json cell_summary(size_t index, int execution_count, const execution_result& result, double ms)
+        {
+            return {
+                {"index", index},
+                {"execution_count", execution_count},
+                {"status", result.is_error ? "error" : "ok"},
+                {"error_code", result.is_error ? result.error_code : 0},
+                {"ms", ms},
+                {"stata_ms", result.timing.stata_timer_ms}
+            };
+        }
+
+        // Runs documents on one Stata session, registered in slot
+        class batch_worker
+        {
+        public:
+            batch_worker(const batch_options& options, size_t slot)
+                : m_options(options)
+                , m_slot(slot)
+            {
+            }
+
+            ~batch_worker()
+            {
+                close_session();
+            }
+
+            nl::json run(const std::string& path)
+            {
+                stopwatch timer;
+                nl::json summary = {
+                    {"path", path},
+                    {"worker", m_slot},
+                    {"status", "ok"},
+                    {"cells", nl::json::array()}
+                };
+
+                try
+                {
+                    prepare_session(path);
+                    std::string extension = fs::path(path).extension().string();
+                    if (extension == ".ipynb")
+                    {
+                        run_notebook(path, summary);
+                    }
+                    else
+                    {
+                        run_do_file(path, summary);
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    summary["status"] = "failed";
+                    summary["error"] = e.what();
+                }
+
+                if (g_interrupted && summary["status"] == "ok")
+                {
+                    summary["status"] = "interrupted";
+                }
+                summary["ms"] = timer.elapsed_ms();
+                return summary;
+            }
+
+        private:
+            stata_session& session()
+            {
+                if (!m_session)
+                {
+                    m_session = std::make_unique<stata_session>();
+                    g_sessions[m_slot] = m_session.get();
+                }
+                return *m_session;
+            }
+
+            void close_session()
+            {
+                if (m_session)
+                {
+                    g_sessions[m_slot] = nullptr;
+                    m_session->shutdown();
+                    m_session.reset();
+                }
+            }
+
+            // A clean session in the document's directory with the
+            // parameters set, as a kernel started for the notebook would be
+            void prepare_session(const std::string& path)
+            {
+                if (m_options.fresh || m_documents == 0)
+                {
+                    close_session();
+                }
+                else
+                {
+                    session().execute("clear all");
+                }
+                ++m_documents;
+
+                std::string directory = fs::absolute(path).parent_path().string();
+                std::string setup = "quietly cd " + compound_quote(directory);
+                for (const auto& parameter : m_options.parameters)
+                {
+                    setup += "\nglobal " + parameter.first + " " + compound_quote(parameter.second);
+                }
+                execution_result result = session().execute(setup);
+                if (result.is_error)
+                {
+                    throw std::runtime_error("setup failed, r(" + std::to_string(result.error_code) + "): " +
+                                             result.error_message);
+                }
+            }
+
+            std::string output_path(const std::string& path, const std::string& extension) const
+            {
+                fs::path target = fs::path(path).replace_extension(extension);
+                if (!m_options.output_dir.empty())
+                {
+                    target = fs::path(m_options.output_dir) / target.filename();
+                }
+                return target.string();
+            }
+
+            void run_notebook(const std::string& path, nl::json& summary)
+            {
+                nl::json notebook = nl::json::parse(read_file(path));
+                if (!notebook.contains("cells") || !notebook["cells"].is_array())
+                {
+                    throw std::runtime_error("not a notebook: " + path);
+                }
+
+                output_builder builder;
+                int execution_count = 0;
+                bool stopped = false;
+                size_t not_run = 0;
+
+                nl::json& cells = notebook["cells"];
+                for (size_t i = 0; i < cells.size(); ++i)
+                {
+                    nl::json& cell = cells[i];
+                    if (cell.value("cell_type", "") != "code")
+                    {
+                        continue;
+                    }
+                    cell["outputs"] = nl::json::array();
+                    cell["execution_count"] = nullptr;
+
+                    std::string code = join_lines(cell.value("source", nl::json("")));
+                    if (code.find_first_not_of(" \t\r\n") == std::string::npos)
+                    {
+                        continue;
+                    }
+                    if (stopped || g_interrupted)
+                    {
+                        ++not_run;
+                        continue;
+                    }
+
+                    // Kernel magics act on the frontend session; batch runs
+                    // plain Stata only
+                    magic_command magic;
+                    if (parse_magic(code, magic))
+                    {
+                        summary["cells"].push_back({{"index", i}, {"status", "skipped"}, {"magic", magic.name}});
+                        continue;
+                    }
+
+                    ++execution_count;
+                    cell["execution_count"] = execution_count;
+                    stopwatch timer;
+                    try
+                    {
+                        execution_result result = session().execute(code);
+                        double ms = timer.elapsed_ms();
+                        cell["outputs"] = builder.outputs(result, execution_count);
+                        summary["cells"].push_back(cell_summary(i, execution_count, result, ms));
+                        if (result.is_error)
+                        {
+                            summary["status"] = "error";
+                            stopped = !m_options.allow_errors;
+                        }
+                    }
+                    catch (const stata_timeout_error& e)
+                    {
+                        // Stata was interrupted and is in sync again
+                        cell["outputs"].push_back(timeout_output(e));
+                        summary["cells"].push_back({
+                            {"index", i},
+                            {"execution_count", execution_count},
+                            {"status", "timeout"},
+                            {"ms", timer.elapsed_ms()}
+                        });
+                        summary["status"] = "error";
+                        stopped = !m_options.allow_errors;
+                    }
+                    catch (const stata_process_error& e)
+                    {
+                        // The session respawns; the rest of this notebook
+                        // would run against a blank Stata
+                        cell["outputs"].push_back({
+                            {"output_type", "error"},
+                            {"ename", "StataProcessExited"},
+                            {"evalue", e.what()},
+                            {"traceback", nl::json::array({e.what()})}
+                        });
+                        summary["cells"].push_back({
+                            {"index", i},
+                            {"execution_count", execution_count},
+                            {"status", "failed"},
+                            {"ms", timer.elapsed_ms()}
+                        });
+                        summary["status"] = "failed";
+                        summary["error"] = e.what();
+                        stopped = true;
+                    }
+                }
+
+                if (not_run > 0)
+                {
+                    summary["not_run"] = not_run;
+                }
+                std::string target = output_path(path, ".ipynb");
+                write_file(target, notebook.dump(1) + "\n");
+                summary["output"] = target;
+            }
+
+            // A do-file runs as one cell; its output goes to a .log
+            void run_do_file(const std::string& path, nl::json& summary)
+            {
+                std::string code = read_file(path);
+                stopwatch timer;
+                execution_result result;
+                try
+                {
+                    result = session().execute(code);
+                }
+                catch (const stata_timeout_error& e)
+                {
+                    summary["cells"].push_back({{"index", 0}, {"execution_count", 1}, {"status", "timeout"},
+                                                {"ms", timer.elapsed_ms()}});
+                    summary["status"] = "error";
+                    summary["error"] = e.what();
+                    std::string target = output_path(path, ".log");
+                    write_file(target, std::string(e.what()) + "\n");
+                    summary["output"] = target;
+                    return;
+                }
+                double ms = timer.elapsed_ms();
+                summary["cells"].push_back(cell_summary(0, 1, result, ms));
+
+                std::string log = result.output;
+                if (result.is_error)
+                {
+                    summary["status"] = "error";
+                    log += result.error_message + "\nr(" + std::to_string(result.error_code) + ");\n";
+                }
+                for (const auto& graph_file : result.graph_files)
+                {
+                    unlink(graph_file.c_str());
+                }
+
+                std::string target = output_path(path, ".log");
+                write_file(target, log);
+                summary["output"] = target;
+            }
+
+            const batch_options& m_options;
+            size_t m_slot;
+            size_t m_documents = 0;
+            std::unique_ptr<stata_session> m_session;
+        };
+    }
+
+    void interrupt_batch()
+    {
+        g_interrupted = true;
+        for (auto& slot : g_sessions)
+        {
+            stata_session* session = slot.load();
+            if (session != nullptr)
+            {
+                session->interrupt();
+            }
+        }
+    }
+
+    nl::json run_batch(const batch_options& options)
+    {
+        stopwatch timer;
+        size_t jobs = std::max<size_t>(1, std::min(options.jobs, MAX_JOBS));
+
+        // There is only one in-process Stata
+        const char* backend = std::getenv("XEUS_STATA_BACKEND");
+        if (jobs > 1 && backend && std::string(backend) == "library")
+        {
+            log_progress("xstata run: the library backend runs one document at a time");
+            jobs = 1;
+        }
+        jobs = std::min(jobs, std::max<size_t>(1, options.inputs.size()));
+
+        if (!options.output_dir.empty())
+        {
+            fs::create_directories(options.output_dir);
+        }
+
+        std::vector<nl::json> documents(options.inputs.size());
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+        for (size_t slot = 0; slot < jobs; ++slot)
+        {
+            workers.emplace_back([&, slot]() {
+                batch_worker worker(options, slot);
+                for (size_t i = next++; i < options.inputs.size() && !g_interrupted; i = next++)
+                {
+                    documents[i] = worker.run(options.inputs[i]);
+                    log_progress("[" + documents[i]["status"].get<std::string>() + "] " + options.inputs[i] +
+                                 " (" + std::to_string(static_cast<long long>(documents[i]["ms"].get<double>())) +
+                                 " ms)");
+                }
+            });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+
+        size_t ok = 0;
+        size_t failed = 0;
+        nl::json summary = {{"jobs", jobs}, {"documents", nl::json::array()}};
+        for (size_t i = 0; i < documents.size(); ++i)
+        {
+            if (documents[i].is_null())
+            {
+                documents[i] = {{"path", options.inputs[i]}, {"status", "not_run"}};
+            }
+            if (documents[i]["status"] == "ok")
+            {
+                ++ok;
+            }
+            else
+            {
+                ++failed;
+            }
+            summary["documents"].push_back(std::move(documents[i]));
+        }
+        summary["ok"] = ok;
+        summary["failed"] = failed;
+        summary["total_ms"] = timer.elapsed_ms();
+
+        std::string text = summary.dump(2) + "\n";
+        if (options.summary_path.empty())
+        {
+            std::cout << text << std::flush;
+        }
+        else
+        {
+            write_file(options.summary_path, text);
+        }
+        return summary;
+    }
+
+} // namespace xeus_stata
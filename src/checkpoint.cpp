@@ -0,0 +1,489 @@
+#include "xeus-stata/checkpoint.hpp"
+#include "xeus-stata/private_dir.hpp"
+#include "xeus-stata/stata_session.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace nl = nlohmann;
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    namespace
+    {
+        const int CHECKPOINT_FORMAT_VERSION = 1;
+
+        // Checkpoint, frame and estimate names all end up in file names
+        // and Stata commands, so restrict them to Stata name characters
+        bool is_valid_name(const std::string& name)
+        {
+            if (name.empty() || name.size() > 64)
+            {
+                return false;
+            }
+            for (char c : name)
+            {
+                if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-')
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::vector<std::string> split_words(const std::string& text)
+        {
+            std::vector<std::string> words;
+            std::stringstream ss(text);
+            std::string word;
+            while (ss >> word)
+            {
+                words.push_back(word);
+            }
+            return words;
+        }
+
+        // Find a "tag:value" line in Stata output and return the value
+        std::string find_tagged_value(const std::string& output, const std::string& tag)
+        {
+            std::stringstream ss(output);
+            std::string line;
+            while (std::getline(ss, line))
+            {
+                size_t start = line.find_first_not_of(" \t");
+                if (start != std::string::npos && line.compare(start, tag.size(), tag) == 0)
+                {
+                    std::string value = line.substr(start + tag.size());
+                    value.erase(value.find_last_not_of(" \t\r") + 1);
+                    return value;
+                }
+            }
+            return "";
+        }
+
+        // Run fn on every file concurrently and wait for all of them
+        template <class F>
+        void for_each_file_parallel(const std::vector<std::string>& files, F fn)
+        {
+            std::vector<std::future<void>> tasks;
+            tasks.reserve(files.size());
+            for (const auto& file : files)
+            {
+                tasks.push_back(std::async(std::launch::async, fn, file));
+            }
+            for (auto& task : tasks)
+            {
+                task.get();
+            }
+        }
+
+        void sync_file(const std::string& path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd >= 0)
+            {
+                fsync(fd);
+                close(fd);
+            }
+        }
+
+        // Pull a file into the page cache ahead of Stata reading it
+        void prefetch_file(const std::string& path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return;
+            }
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+            // No fadvise, read the file through once instead
+            char buffer[1 << 16];
+            while (read(fd, buffer, sizeof(buffer)) > 0)
+            {
+            }
+#endif
+            close(fd);
+        }
+
+        double seconds_since(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    std::string default_checkpoint_root()
+    {
+        const char* env_dir = std::getenv("XEUS_STATA_CHECKPOINT_DIR");
+        if (env_dir && env_dir[0] != '\0')
+        {
+            return env_dir;
+        }
+
+        // XDG_RUNTIME_DIR is tmpfs on most systemd hosts
+        const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+        if (runtime_dir && runtime_dir[0] != '\0')
+        {
+            return std::string(runtime_dir) + "/xeus-stata/checkpoints";
+        }
+
+        return "/tmp/xeus-stata-" + std::to_string(getuid()) + "/checkpoints";
+    }
+
+    checkpoint_manager::checkpoint_manager(stata_session* session)
+        : m_session(session)
+        , m_root(default_checkpoint_root())
+    {
+    }
+
+    const std::string& checkpoint_manager::last_checkpoint() const
+    {
+        return m_last;
+    }
+
+    const std::string& checkpoint_manager::root() const
+    {
+        return m_root;
+    }
+
+    std::string checkpoint_manager::checkpoint_dir(const std::string& name) const
+    {
+        return m_root + "/" + name;
+    }
+
+    std::string checkpoint_manager::run(const std::string& code)
+    {
+        auto result = m_session->execute(code);
+        if (result.is_error)
+        {
+            std::string message = result.error_message.empty() ? result.output : result.error_message;
+            throw std::runtime_error("Stata error r(" + std::to_string(result.error_code) + ") " +
+                                     "while running '" + code.substr(0, code.find('\n')) + "': " +
+                                     message);
+        }
+        return result.output;
+    }
+
+    std::vector<std::string> checkpoint_manager::list() const
+    {
+        std::vector<std::string> names;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(m_root, ec))
+        {
+            if (entry.is_directory() && fs::exists(entry.path() / "manifest.json"))
+            {
+                names.push_back(entry.path().filename().string());
+            }
+        }
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    std::string checkpoint_manager::save(const std::string& name)
+    {
+        if (!is_valid_name(name))
+        {
+            throw std::runtime_error("Invalid checkpoint name '" + name + "'");
+        }
+        if (!m_session || !m_session->is_ready())
+        {
+            throw std::runtime_error("Stata session not available");
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Write into a staging directory and rename it into place at the end
+        // so that an interrupted save never leaves a half-written checkpoint
+        std::string final_dir = checkpoint_dir(name);
+        std::string staging_dir = m_root + "/." + name + ".partial-" + std::to_string(getpid());
+        std::string error;
+        if (!ensure_private_dir(m_root, error))
+        {
+            throw std::runtime_error("Refusing to save a checkpoint: " + error);
+        }
+        fs::remove_all(staging_dir);
+        if (!ensure_private_dir(staging_dir, error))
+        {
+            throw std::runtime_error("Refusing to save a checkpoint: " + error);
+        }
+
+        // Discover frames (Stata 16+) and stored estimates
+        std::string query = run(
+            "capture quietly frames dir\n"
+            "display \"xstata_frames:`r(frames)'\"\n"
+            "display \"xstata_frame:`c(frame)'\"\n"
+            "quietly estimates dir\n"
+            "display \"xstata_estimates:`r(names)'\"\n"
+            "display \"xstata_ecmd:`e(cmd)'\""
+        );
+
+        std::vector<std::string> frames = split_words(find_tagged_value(query, "xstata_frames:"));
+        std::string current_frame = find_tagged_value(query, "xstata_frame:");
+        std::vector<std::string> estimates = split_words(find_tagged_value(query, "xstata_estimates:"));
+        bool has_active_estimates = !find_tagged_value(query, "xstata_ecmd:").empty();
+        bool has_frames = !frames.empty();
+
+        if (!has_frames)
+        {
+            frames.push_back("default");
+        }
+
+        nl::json manifest;
+        manifest["version"] = CHECKPOINT_FORMAT_VERSION;
+        manifest["name"] = name;
+        manifest["created"] = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        manifest["has_frames"] = has_frames;
+        manifest["current_frame"] = current_frame.empty() ? "default" : current_frame;
+        manifest["frames"] = nl::json::array();
+        manifest["estimates"] = nl::json::array();
+        manifest["active_estimates"] = has_active_estimates;
+
+        std::vector<std::string> written;
+
+        // Datasets, one file per frame
+        for (const auto& frame : frames)
+        {
+            if (!is_valid_name(frame))
+            {
+                continue;
+            }
+            std::string file = staging_dir + "/frame_" + frame + ".dta";
+            std::string save_cmd = "quietly save \"" + file + "\", replace emptyok";
+            run(has_frames ? "frame " + frame + ": " + save_cmd : save_cmd);
+            manifest["frames"].push_back({{"name", frame}, {"file", "frame_" + frame + ".dta"}});
+            written.push_back(file);
+        }
+
+        // Stored estimates; restoring each one clobbers e(), so hold the
+        // active results aside and put them back (or clear e() again)
+        // afterwards
+        if (has_active_estimates)
+        {
+            std::string file = staging_dir + "/est__active.ster";
+            run("quietly estimates save \"" + file + "\", replace");
+            written.push_back(file);
+            if (!estimates.empty())
+            {
+                run("quietly _estimates hold __xstata_ckpt, copy");
+            }
+        }
+        for (const auto& est : estimates)
+        {
+            if (!is_valid_name(est))
+            {
+                continue;
+            }
+            std::string file = staging_dir + "/est_" + est + ".ster";
+            run("quietly estimates restore " + est + "\n"
+                "quietly estimates save \"" + file + "\", replace");
+            manifest["estimates"].push_back({{"name", est}, {"file", "est_" + est + ".ster"}});
+            written.push_back(file);
+        }
+        if (has_active_estimates && !estimates.empty())
+        {
+            run("quietly _estimates unhold __xstata_ckpt");
+        }
+        else if (!estimates.empty())
+        {
+            // There were no active results; leave none behind
+            run("ereturn clear");
+        }
+
+        // Globals and scalars go into a do-file that replays them
+        // Numeric scalars are written in %21x so they round-trip exactly
+        std::string state_file = staging_dir + "/state.do";
+        run(
+            "tempname xstata_fh\n"
+            "file open `xstata_fh' using \"" + state_file + "\", write text replace\n"
+            "foreach xstata_g in `: all globals' {\n"
+            "file write `xstata_fh' `\"global `xstata_g' `\"${`xstata_g'}\"'\"' _n\n"
+            "}\n"
+            "foreach xstata_s in `: all numeric scalars' {\n"
+            "file write `xstata_fh' \"scalar `xstata_s' = \" %21x (scalar(`xstata_s')) _n\n"
+            "}\n"
+            "foreach xstata_s in `: all string scalars' {\n"
+            "file write `xstata_fh' `\"scalar `xstata_s' = `\"`=scalar(`xstata_s')'\"'\"' _n\n"
+            "}\n"
+            "file close `xstata_fh'"
+        );
+        written.push_back(state_file);
+
+        std::uintmax_t total_bytes = 0;
+        for (const auto& file : written)
+        {
+            std::error_code ec;
+            auto size = fs::file_size(file, ec);
+            if (!ec)
+            {
+                total_bytes += size;
+            }
+        }
+        manifest["bytes"] = total_bytes;
+
+        {
+            std::ofstream out(staging_dir + "/manifest.json");
+            out << manifest.dump(2);
+        }
+        written.push_back(staging_dir + "/manifest.json");
+
+        // Stata writes the files one after another; flushing them to stable
+        // storage is independent per file so do it concurrently
+        for_each_file_parallel(written, sync_file);
+
+        // Swap the staging directory into place
+        if (fs::exists(final_dir))
+        {
+            std::string old_dir = m_root + "/." + name + ".old-" + std::to_string(getpid());
+            fs::rename(final_dir, old_dir);
+            fs::rename(staging_dir, final_dir);
+            fs::remove_all(old_dir);
+        }
+        else
+        {
+            fs::rename(staging_dir, final_dir);
+        }
+
+        m_last = name;
+
+        std::ostringstream summary;
+        summary << "Checkpoint '" << name << "' saved: "
+                << manifest["frames"].size() << " frame(s), "
+                << manifest["estimates"].size() << " stored estimate(s), "
+                << std::fixed << std::setprecision(1) << (total_bytes / 1048576.0) << " MB in "
+                << std::setprecision(2) << seconds_since(start) << " s\n"
+                << "Location: " << final_dir;
+        return summary.str();
+    }
+
+    std::string checkpoint_manager::restore(const std::string& name)
+    {
+        if (!is_valid_name(name))
+        {
+            throw std::runtime_error("Invalid checkpoint name '" + name + "'");
+        }
+        if (!m_session || !m_session->is_ready())
+        {
+            throw std::runtime_error("Stata session not available");
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::string dir = checkpoint_dir(name);
+        std::ifstream manifest_file(dir + "/manifest.json");
+        if (!manifest_file)
+        {
+            throw std::runtime_error("No checkpoint named '" + name + "' in " + m_root);
+        }
+
+        // state.do is run as Stata code, so the directory must be ours alone
+        std::string error;
+        if (!check_private_path(dir, error))
+        {
+            throw std::runtime_error("Refusing to restore checkpoint '" + name + "': " + error);
+        }
+
+        nl::json manifest = nl::json::parse(manifest_file);
+        if (manifest.value("version", 0) != CHECKPOINT_FORMAT_VERSION)
+        {
+            throw std::runtime_error("Checkpoint '" + name + "' has an unsupported format version");
+        }
+
+        bool has_frames = manifest.value("has_frames", false);
+
+        // Warm the page cache for every file while Stata clears its state
+        std::vector<std::string> files;
+        for (const auto& frame : manifest["frames"])
+        {
+            files.push_back(dir + "/" + frame["file"].get<std::string>());
+        }
+        for (const auto& est : manifest["estimates"])
+        {
+            files.push_back(dir + "/" + est["file"].get<std::string>());
+        }
+        auto prefetch = std::async(std::launch::async, [files]() {
+            for_each_file_parallel(files, prefetch_file);
+        });
+
+        run(std::string(has_frames ? "quietly frames reset\n" : "quietly clear\n") +
+            "quietly estimates clear\n"
+            "quietly scalar drop _all");
+
+        prefetch.get();
+
+        for (const auto& frame : manifest["frames"])
+        {
+            std::string frame_name = frame["name"].get<std::string>();
+            std::string file = dir + "/" + frame["file"].get<std::string>();
+            if (!is_valid_name(frame_name))
+            {
+                continue;
+            }
+            std::string use_cmd = "quietly use \"" + file + "\", clear";
+            if (!has_frames)
+            {
+                run(use_cmd);
+            }
+            else if (frame_name == "default")
+            {
+                run("frame default: " + use_cmd);
+            }
+            else
+            {
+                run("frame create " + frame_name + "\n"
+                    "frame " + frame_name + ": " + use_cmd);
+            }
+        }
+
+        for (const auto& est : manifest["estimates"])
+        {
+            std::string est_name = est["name"].get<std::string>();
+            if (!is_valid_name(est_name))
+            {
+                continue;
+            }
+            run("quietly estimates use \"" + dir + "/" + est["file"].get<std::string>() + "\"\n"
+                "quietly estimates store " + est_name);
+        }
+
+        if (manifest.value("active_estimates", false))
+        {
+            run("quietly estimates use \"" + dir + "/est__active.ster\"");
+        }
+
+        run("quietly run \"" + dir + "/state.do\"");
+
+        std::string current_frame = manifest.value("current_frame", "default");
+        if (has_frames && is_valid_name(current_frame))
+        {
+            run("frame change " + current_frame);
+        }
+
+        m_last = name;
+
+        std::ostringstream summary;
+        summary << "Checkpoint '" << name << "' restored: "
+                << manifest["frames"].size() << " frame(s), "
+                << manifest["estimates"].size() << " stored estimate(s) in "
+                << std::fixed << std::setprecision(2) << seconds_since(start) << " s";
+        return summary.str();
+    }
+
+} // namespace xeus_stata
@@ -1,26 +1,17 @@
 #include "xeus-stata/completion.hpp"
 #include "xeus-stata/stata_session.hpp"
+#include "xeus-stata/stata_lexer.hpp"
+#include "xeus-stata/symbol_index.hpp"
 
 #include <algorithm>
 #include <cctype>
+#include <utility>
 
 namespace xeus_stata
 {
-    // Basic Stata commands for completion
-    static const std::vector<std::string> STATA_COMMANDS = {
-        "append", "assert", "bysort", "capture", "cd", "clear", "collapse",
-        "compress", "count", "describe", "display", "drop", "duplicates",
-        "edit", "egen", "encode", "exit", "export", "file", "foreach",
-        "format", "forvalues", "generate", "graph", "help", "histogram",
-        "if", "import", "infile", "insheet", "keep", "label", "list",
-        "log", "logit", "merge", "mkdir", "preserve", "quietly", "regress",
-        "rename", "replace", "reshape", "restore", "return", "save",
-        "scatter", "sort", "summarize", "sysuse", "tabulate", "twoway",
-        "use", "while", "xi"
-    };
-
-    completion_engine::completion_engine(stata_session* session)
+    completion_engine::completion_engine(stata_session* session, std::shared_ptr<const symbol_index> index)
         : m_session(session)
+        , m_index(std::move(index))
     {
     }
 
@@ -40,17 +31,40 @@ namespace xeus_stata
         std::string prefix = code.substr(word_start, cursor_pos - word_start);
         start_pos = word_start;
 
-        // Determine context
-        // For now, we'll do simple command completion
-        // Future: detect if we're in a variable context, macro context, etc.
+        // Nothing to complete inside strings and comments; inside `...'
+        // only macro names make sense
+        auto cell = lex_cell(code);
+        const token* tok = cursor_pos > 0 ? cell->token_at(static_cast<size_t>(cursor_pos)) : nullptr;
+        if (tok && static_cast<size_t>(cursor_pos) > tok->offset)
+        {
+            size_t end = static_cast<size_t>(tok->offset) + tok->length;
+            bool line_comment = tok->kind == token_kind::comment && code.compare(tok->offset, 2, "/*") != 0;
+            bool inside = static_cast<size_t>(cursor_pos) < end || tok->unterminated || line_comment;
+            if (inside)
+            {
+                switch (tok->kind)
+                {
+                    case token_kind::string:
+                    case token_kind::compound_string:
+                    case token_kind::comment:
+                    case token_kind::continuation:
+                        return {};
+                    case token_kind::local_macro:
+                    case token_kind::global_macro:
+                        return get_macro_completions(prefix);
+                    default:
+                        break;
+                }
+            }
+        }
 
-        std::vector<std::string> completions;
+        // Commands where a statement's command goes, functions elsewhere
+        if (cell->is_command_position(static_cast<size_t>(word_start)))
+        {
+            return get_command_completions(prefix);
+        }
 
-        // Try command completions first
-        auto cmd_completions = get_command_completions(prefix);
-        completions.insert(completions.end(),
-                          cmd_completions.begin(),
-                          cmd_completions.end());
+        std::vector<std::string> completions = get_function_completions(prefix);
 
         // Could add variable completions here if session is active
         // auto var_completions = get_variable_completions(prefix);
@@ -61,17 +75,11 @@ namespace xeus_stata
     std::vector<std::string> completion_engine::get_command_completions(
         const std::string& prefix)
     {
-        std::vector<std::string> completions;
-
-        for (const auto& cmd : STATA_COMMANDS)
+        if (!m_index)
         {
-            if (cmd.find(prefix) == 0) // starts with prefix
-            {
-                completions.push_back(cmd);
-            }
+            return {};
         }
-
-        return completions;
+        return m_index->complete(prefix, symbol_kind::command);
     }
 
     std::vector<std::string> completion_engine::get_variable_completions(
@@ -105,8 +113,11 @@ namespace xeus_stata
     std::vector<std::string> completion_engine::get_function_completions(
         const std::string& prefix)
     {
-        // TODO: Add Stata function completions
-        return {};
+        if (!m_index || prefix.empty())
+        {
+            return {};
+        }
+        return m_index->complete(prefix, symbol_kind::function);
     }
 
     std::vector<std::string> completion_engine::get_macro_completions(
@@ -1,12 +1,15 @@
 #include "xeus-stata/inspection.hpp"
 #include "xeus-stata/stata_session.hpp"
+#include "xeus-stata/symbol_index.hpp"
 
 #include <sstream>
+#include <utility>
 
 namespace xeus_stata
 {
-    inspection_engine::inspection_engine(stata_session* session)
+    inspection_engine::inspection_engine(stata_session* session, std::shared_ptr<const symbol_index> index)
         : m_session(session)
+        , m_index(std::move(index))
     {
     }
 
@@ -40,6 +43,17 @@ namespace xeus_stata
             return "";
         }
 
+        // The indexed one-line summary answers a quick inspection without
+        // a round trip to Stata
+        if (detail_level == 0 && m_index)
+        {
+            std::string summary = m_index->summary(word);
+            if (!summary.empty())
+            {
+                return word + " -- " + summary;
+            }
+        }
+
         // Try to get help for the word (assuming it's a command)
         return get_command_help(word);
     }
@@ -0,0 +1,377 @@
+#include "xeus-stata/session_backend.hpp"
+#include "xeus-stata/library_abi.hpp"
+#include "xeus-stata/stata_parser.hpp"
+#include "xeus-stata/trace.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // Stata stores missing values as doubles above this
+        const double STATA_MISSING = 8.988465674311579e+307;
+
+        template <class F>
+        F resolve(void* handle, const char* symbol)
+        {
+            return reinterpret_cast<F>(dlsym(handle, symbol));
+        }
+    }
+
+    class library_backend final : public session_backend
+    {
+    public:
+        explicit library_backend(const std::string& library_path)
+            : m_library_path(library_path)
+            , m_handle(nullptr)
+            , m_ready(false)
+            , m_scratch_dir(make_scratch_dir())
+            , m_log_path(m_scratch_dir + "/output.smcl")
+            , m_graph_path(m_scratch_dir + "/graph.png")
+        {
+            try
+            {
+                load();
+                start();
+            }
+            catch (...)
+            {
+                std::error_code ec;
+                std::filesystem::remove_all(m_scratch_dir, ec);
+                throw;
+            }
+        }
+
+        ~library_backend() override
+        {
+            shutdown();
+
+            std::error_code ec;
+            std::filesystem::remove_all(m_scratch_dir, ec);
+        }
+
+        std::string name() const override
+        {
+            return "library";
+        }
+
+        execution_result execute(const std::string& code, const expression_list& expressions = {}) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_ready)
+            {
+                throw std::runtime_error("Stata session not ready");
+            }
+
+            trace_scope trace("session.execute", "session");
+            stopwatch total_timer;
+
+            // The cell goes through a do-file so multi-line code, #delimit
+            // and comments behave as in the console; include keeps locals
+            std::string dofile = m_scratch_dir + "/cell.do";
+            {
+                std::ofstream out(dofile, std::ios::binary | std::ios::trunc);
+                out << code << "\n";
+                if (!out)
+                {
+                    throw std::runtime_error("Failed to write " + dofile);
+                }
+            }
+            unlink(m_graph_path.c_str());
+
+            std::streamoff log_offset = m_set_output_handler ? 0 : log_size();
+            m_output.clear();
+
+            stopwatch stage_timer;
+            int rc = m_execute(("include \"" + dofile + "\"").c_str(), 0);
+            double stata_ms = stage_timer.elapsed_ms();
+            std::string console = std::move(m_output);
+            m_output.clear();
+
+            // user_expressions first, while r() and e() are the cell's
+            std::stringstream expression_commands(expressions_command(expressions));
+            std::string command;
+            while (std::getline(expression_commands, command))
+            {
+                m_execute(command.c_str(), 0);
+            }
+
+            // Graph export runs separately so it also happens after an error,
+            // followed by the trailer with the data state; the cell's r()
+            // results are held around both
+            m_execute("_return hold xstata_r", 0);
+            m_execute("quietly capture graph describe Graph", 0);
+            m_execute(("if (_rc == 0) quietly graph export \"" + m_graph_path + "\", replace").c_str(), 0);
+            m_execute("quietly graph drop _all", 0);
+            std::stringstream trailer_commands(trailer_command(std::to_string(rc), std::to_string(stata_ms)));
+            while (std::getline(trailer_commands, command))
+            {
+                m_execute(command.c_str(), 0);
+            }
+            m_execute("_return restore xstata_r", 0);
+            console += m_output;
+            m_output.clear();
+
+            stage_timer.restart();
+            execution_result result;
+            if (m_set_output_handler)
+            {
+                trace_scope parse_trace("parser.parse_execution_output", "parser");
+                parse_trace.set_value(static_cast<int64_t>(console.size()));
+                result = parse_execution_output(console);
+                result.timing.bytes_read = console.size();
+            }
+            else
+            {
+                trace_scope parse_trace("parser.parse_smcl_log", "parser");
+                std::string marker = "__MARKER__" + generate_execution_marker() + "__";
+                m_execute(("display \"" + marker + "\"").c_str(), 0);
+                std::string chunk = read_log(log_offset);
+                bool found_marker = false;
+                result = parse_smcl_execution_output(chunk, marker, found_marker);
+                result.timing.bytes_read = chunk.size();
+            }
+            m_output.clear();
+            apply_trailer(result);
+            apply_expressions(result, expressions);
+
+            // The return code is authoritative, output parsing can only
+            // add the message
+            if (rc != 0)
+            {
+                result.is_error = true;
+                result.error_code = rc;
+            }
+
+            result.timing.parse_ms = stage_timer.elapsed_ms();
+            result.timing.stata_ms = stata_ms;
+            result.timing.bytes_written = code.size() + 1;
+            result.timing.output_bytes = result.output.size();
+
+            struct stat st;
+            if (stat(m_graph_path.c_str(), &st) == 0 && st.st_size > 0)
+            {
+                result.graph_files.push_back(m_graph_path);
+            }
+
+            result.timing.total_session_ms = total_timer.elapsed_ms();
+            return result;
+        }
+
+        bool is_ready() const override
+        {
+            return m_ready;
+        }
+
+        void interrupt() override
+        {
+            // Called from another thread while execute() is blocked in Stata
+            if (m_set_break)
+            {
+                m_set_break();
+            }
+        }
+
+        void shutdown() override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_ready)
+            {
+                return;
+            }
+            m_ready = false;
+            if (m_shutdown)
+            {
+                m_shutdown();
+            }
+            // The library is deliberately not unloaded: Stata cannot be
+            // initialized twice in one process, and a dlclose would only
+            // invite a second StataSO_Main
+        }
+
+        int get_pid() const override
+        {
+            return static_cast<int>(getpid());
+        }
+
+        std::vector<std::string> variable_names() override
+        {
+            if (!m_nvar || !m_varname)
+            {
+                return session_backend::variable_names();
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::vector<std::string> names;
+            int nvar = m_nvar();
+            names.reserve(static_cast<size_t>(nvar > 0 ? nvar : 0));
+            char buffer[64];
+            for (int i = 1; i <= nvar; ++i)
+            {
+                if (m_varname(i, buffer, sizeof(buffer)) == 0)
+                {
+                    names.emplace_back(buffer);
+                }
+            }
+            return names;
+        }
+
+        std::vector<double> numeric_values(const std::string& variable,
+                                           size_t first, size_t count) override
+        {
+            if (!m_nobs || !m_varindex || !m_getnum)
+            {
+                return session_backend::numeric_values(variable, first, count);
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            int var = m_varindex(variable.c_str());
+            if (var <= 0)
+            {
+                throw std::runtime_error("Cannot read variable " + variable + ": r(111)");
+            }
+
+            long long nobs = m_nobs();
+            long long last = std::min<long long>(nobs, static_cast<long long>(first + count));
+            std::vector<double> values;
+            for (long long obs = static_cast<long long>(first) + 1; obs <= last; ++obs)
+            {
+                double value = 0;
+                if (m_getnum(var, obs, &value) != 0 || value >= STATA_MISSING)
+                {
+                    value = std::numeric_limits<double>::quiet_NaN();
+                }
+                values.push_back(value);
+            }
+            return values;
+        }
+
+    private:
+        void load()
+        {
+            // RTLD_GLOBAL so plugins Stata loads later can see its symbols
+            m_handle = dlopen(m_library_path.c_str(), RTLD_NOW | RTLD_GLOBAL);
+            if (!m_handle)
+            {
+                const char* error = dlerror();
+                throw std::runtime_error("Failed to load Stata library " + m_library_path + ": " +
+                                         (error ? error : "unknown error"));
+            }
+
+            m_main = resolve<xstata_main_fn>(m_handle, "StataSO_Main");
+            m_execute = resolve<xstata_execute_fn>(m_handle, "StataSO_Execute");
+            if (!m_main || !m_execute)
+            {
+                throw std::runtime_error(m_library_path + " does not export StataSO_Main and StataSO_Execute");
+            }
+
+            m_set_break = resolve<xstata_break_fn>(m_handle, "StataSO_SetBreak");
+            m_shutdown = resolve<xstata_shutdown_fn>(m_handle, "StataSO_Shutdown");
+            m_set_output_handler = resolve<xstata_set_output_handler_fn>(m_handle, "StataSO_SetOutputHandler");
+            m_nobs = resolve<xstata_nobs_fn>(m_handle, "StataSO_Nobs");
+            m_nvar = resolve<xstata_nvar_fn>(m_handle, "StataSO_Nvar");
+            m_varname = resolve<xstata_varname_fn>(m_handle, "StataSO_VarName");
+            m_varindex = resolve<xstata_varindex_fn>(m_handle, "StataSO_VarIndex");
+            m_getnum = resolve<xstata_getnum_fn>(m_handle, "StataSO_GetNum");
+        }
+
+        void start()
+        {
+            char arg0[] = "xstata";
+            char arg1[] = "-q";
+            char* argv[] = {arg0, arg1, nullptr};
+            int rc = m_main(2, argv);
+            if (rc != 0)
+            {
+                throw std::runtime_error("Stata library failed to initialize: " + std::to_string(rc));
+            }
+
+            if (m_set_output_handler)
+            {
+                m_set_output_handler(&library_backend::on_output, this);
+            }
+
+            m_execute("set more off", 0);
+            m_execute("set linesize 200", 0);
+
+            if (!m_set_output_handler)
+            {
+                int log_rc = m_execute(("quietly log using \"" + m_log_path +
+                                        "\", smcl replace name(_xstata) nomsg").c_str(), 0);
+                if (log_rc != 0)
+                {
+                    throw std::runtime_error("Failed to open the output log: r(" + std::to_string(log_rc) + ")");
+                }
+            }
+
+            m_ready = true;
+        }
+
+        static void on_output(const char* text, void* user)
+        {
+            static_cast<library_backend*>(user)->m_output += text;
+        }
+
+        std::streamoff log_size() const
+        {
+            struct stat st;
+            return stat(m_log_path.c_str(), &st) == 0 ? static_cast<std::streamoff>(st.st_size) : 0;
+        }
+
+        std::string read_log(std::streamoff offset) const
+        {
+            std::ifstream log(m_log_path, std::ios::binary);
+            if (!log)
+            {
+                return "";
+            }
+            log.seekg(offset);
+            return std::string((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+        }
+
+        std::string m_library_path;
+        void* m_handle;
+        bool m_ready;
+
+        // Stata is single-threaded; completion and inspection share it with
+        // the shell thread
+        std::mutex m_mutex;
+
+        std::string m_scratch_dir;
+        std::string m_log_path;
+        std::string m_graph_path;
+
+        // Console output collected by the output handler
+        std::string m_output;
+
+        xstata_main_fn m_main = nullptr;
+        xstata_execute_fn m_execute = nullptr;
+        xstata_break_fn m_set_break = nullptr;
+        xstata_shutdown_fn m_shutdown = nullptr;
+        xstata_set_output_handler_fn m_set_output_handler = nullptr;
+        xstata_nobs_fn m_nobs = nullptr;
+        xstata_nvar_fn m_nvar = nullptr;
+        xstata_varname_fn m_varname = nullptr;
+        xstata_varindex_fn m_varindex = nullptr;
+        xstata_getnum_fn m_getnum = nullptr;
+    };
+
+    std::unique_ptr<session_backend> make_library_backend(const std::string& library_path)
+    {
+        return std::make_unique<library_backend>(library_path);
+    }
+
+} // namespace xeus_stata
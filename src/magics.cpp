@@ -0,0 +1,49 @@
+#include "xeus-stata/magics.hpp"
+
+#include <sstream>
+
+namespace xeus_stata
+{
+    bool parse_magic(const std::string& code, magic_command& magic)
+    {
+        // Skip leading blank lines, magics must be the first statement
+        size_t start = code.find_first_not_of(" \t\r\n");
+        if (start == std::string::npos || code[start] != '%')
+        {
+            return false;
+        }
+
+        size_t line_end = code.find('\n', start);
+        std::string first_line = code.substr(start, line_end == std::string::npos
+                                                        ? std::string::npos
+                                                        : line_end - start);
+
+        magic = magic_command();
+        size_t name_start = 1;
+        if (first_line.size() > 1 && first_line[1] == '%')
+        {
+            magic.is_cell_magic = true;
+            name_start = 2;
+        }
+
+        std::stringstream ss(first_line.substr(name_start));
+        if (!(ss >> magic.name))
+        {
+            return false;
+        }
+
+        std::string arg;
+        while (ss >> arg)
+        {
+            magic.args.push_back(arg);
+        }
+
+        if (magic.is_cell_magic && line_end != std::string::npos)
+        {
+            magic.body = code.substr(line_end + 1);
+        }
+
+        return true;
+    }
+
+} // namespace xeus_stata
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <memory>
+#include <cstdlib>
+#include <string>
 #include <signal.h>
 
 #include "xeus/xkernel.hpp"
@@ -9,6 +11,8 @@
 
 #include "xeus-stata/xinterpreter.hpp"
 #include "xeus-stata/xeus_stata_config.hpp"
+#include "xeus-stata/trace.hpp"
+#include "xeus-stata/batch_runner.hpp"
 
 namespace {
     // Global pointer to interpreter for signal handler access
@@ -25,10 +29,125 @@ namespace {
         }
         // Note: Don't restore default handler - we want to keep catching signals
     }
+
+    void batch_signal_handler(int)
+    {
+        xeus_stata::interrupt_batch();
+    }
+
+    void print_run_usage()
+    {
+        std::cout << "Usage:" << std::endl;
+        std::cout << "  xstata run [options] <file.ipynb|file.do>..." << std::endl;
+        std::cout << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "  -j, --jobs N        Documents run at once, one Stata each (default 1)" << std::endl;
+        std::cout << "  -o, --output-dir D  Write executed notebooks and logs to D (default: in place)" << std::endl;
+        std::cout << "  -p, --param K=V     Set global K to V before each document" << std::endl;
+        std::cout << "  --summary FILE      Write the JSON summary to FILE (default stdout)" << std::endl;
+        std::cout << "  --allow-errors      Keep running cells after an error" << std::endl;
+        std::cout << "  --fresh             Start a new Stata for every document" << std::endl;
+    }
+
+    // xstata run: execute notebooks and do-files without a frontend
+    int run_main(int argc, char* argv[])
+    {
+        xeus_stata::batch_options options;
+        const char* jobs_env = std::getenv("XEUS_STATA_RUN_JOBS");
+        if (jobs_env && jobs_env[0] != '\0')
+        {
+            options.jobs = std::strtoul(jobs_env, nullptr, 10);
+        }
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if ((arg == "-j" || arg == "--jobs") && has_value)
+            {
+                options.jobs = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if ((arg == "-o" || arg == "--output-dir") && has_value)
+            {
+                options.output_dir = argv[++i];
+            }
+            else if ((arg == "-p" || arg == "--param") && has_value)
+            {
+                std::string parameter = argv[++i];
+                size_t equals = parameter.find('=');
+                if (equals == std::string::npos || equals == 0)
+                {
+                    std::cerr << "Error: --param expects NAME=VALUE, got " << parameter << std::endl;
+                    return 2;
+                }
+                options.parameters.emplace_back(parameter.substr(0, equals), parameter.substr(equals + 1));
+            }
+            else if (arg == "--summary" && has_value)
+            {
+                options.summary_path = argv[++i];
+            }
+            else if (arg == "--allow-errors")
+            {
+                options.allow_errors = true;
+            }
+            else if (arg == "--fresh")
+            {
+                options.fresh = true;
+            }
+            else if (arg == "--help" || arg == "-h")
+            {
+                print_run_usage();
+                return 0;
+            }
+            else if (!arg.empty() && arg[0] == '-')
+            {
+                std::cerr << "Error: unknown option " << arg << std::endl;
+                print_run_usage();
+                return 2;
+            }
+            else
+            {
+                options.inputs.push_back(arg);
+            }
+        }
+
+        if (options.inputs.empty())
+        {
+            print_run_usage();
+            return 2;
+        }
+
+        struct sigaction sa;
+        sa.sa_handler = batch_signal_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+
+        xeus_stata::start_tracing_from_env();
+        int status = 0;
+        try
+        {
+            nl::json summary = xeus_stata::run_batch(options);
+            status = summary["failed"].get<size_t>() == 0 ? 0 : 1;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            status = 2;
+        }
+        xeus_stata::stop_tracing();
+        return status;
+    }
 }
 
 int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "run")
+    {
+        return run_main(argc - 1, argv + 1);
+    }
+
     // Parse command line arguments
     std::string connection_file;
 
@@ -51,6 +170,7 @@ int main(int argc, char* argv[])
             std::cout << std::endl;
             std::cout << "Usage:" << std::endl;
             std::cout << "  xstata -f <connection_file>" << std::endl;
+            std::cout << "  xstata run [options] <file.ipynb|file.do>...  (see xstata run --help)" << std::endl;
             std::cout << "  xstata --version" << std::endl;
             std::cout << "  xstata --help" << std::endl;
             std::cout << std::endl;
@@ -61,6 +181,11 @@ int main(int argc, char* argv[])
             std::cout << std::endl;
             std::cout << "Environment Variables:" << std::endl;
             std::cout << "  STATA_PATH    Path to Stata executable" << std::endl;
+            std::cout << "  XEUS_STATA_TRACE  Write a Chrome trace-event file to this path" << std::endl;
+            std::cout << "  XEUS_STATA_POOL  Set to 1 to take Stata from the xstata-pool daemon (XEUS_STATA_POOL_SOCKET)" << std::endl;
+            std::cout << "  XEUS_STATA_RSS_LIMIT  Warn when Stata's memory nears this size (e.g. 16G)" << std::endl;
+            std::cout << "  XEUS_STATA_CPUS  Pin Stata to a CPU list, or auto:N free CPUs (see README for cgroup limits)" << std::endl;
+            std::cout << "  XEUS_STATA_PREFETCH  Set to 0 to stop reading a cell's datasets ahead of Stata" << std::endl;
             return 0;
         }
     }
@@ -72,6 +197,9 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    // Opt-in Chrome/Perfetto tracing
+    xeus_stata::start_tracing_from_env();
+
     try
     {
         // Load connection configuration
@@ -121,8 +249,11 @@ int main(int argc, char* argv[])
     {
         g_interpreter = nullptr;  // Clean up on error
         std::cerr << "Error: " << e.what() << std::endl;
+        xeus_stata::stop_tracing();
         return 1;
     }
 
+    xeus_stata::stop_tracing();
+
     return 0;
 }
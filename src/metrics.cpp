@@ -0,0 +1,374 @@
+#include "xeus-stata/metrics.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // 100us .. ~10min, roughly x2.5 per bucket
+        std::vector<uint64_t> latency_bounds_us()
+        {
+            return {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+                    250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000,
+                    60000000, 300000000, 600000000};
+        }
+
+        // 1 KB .. 64 MB
+        std::vector<uint64_t> size_bounds_bytes()
+        {
+            return {1024, 4096, 16384, 65536, 262144, 1048576, 4194304,
+                    16777216, 67108864};
+        }
+
+        uint64_t ms_to_us(double ms)
+        {
+            return ms > 0 ? static_cast<uint64_t>(ms * 1000.0) : 0;
+        }
+
+        void append_counter(std::ostringstream& out, const std::string& name,
+                            const std::string& help, const std::string& labels, uint64_t value)
+        {
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " counter\n"
+                << name << "{" << labels << "} " << value << "\n";
+        }
+
+        // scale converts the histogram base unit to the exported unit
+        void append_histogram(std::ostringstream& out, const std::string& name,
+                              const std::string& help, const std::string& labels,
+                              const histogram& h, double scale)
+        {
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " histogram\n";
+            auto counts = h.cumulative_counts();
+            const auto& bounds = h.bounds();
+            for (size_t i = 0; i < bounds.size(); ++i)
+            {
+                out << name << "_bucket{" << labels << ",le=\"" << bounds[i] * scale << "\"} "
+                    << counts[i] << "\n";
+            }
+            out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << counts.back() << "\n"
+                << name << "_sum{" << labels << "} " << h.sum() * scale << "\n"
+                << name << "_count{" << labels << "} " << h.count() << "\n";
+        }
+
+        nl::json histogram_json(const histogram& h)
+        {
+            nl::json buckets = nl::json::array();
+            auto counts = h.cumulative_counts();
+            for (size_t i = 0; i < h.bounds().size(); ++i)
+            {
+                buckets.push_back({{"le", h.bounds()[i]}, {"count", counts[i]}});
+            }
+            return {{"count", h.count()}, {"sum", h.sum()}, {"buckets", buckets}};
+        }
+    }
+
+    histogram::histogram(std::vector<uint64_t> bounds)
+        : m_bounds(std::move(bounds))
+        , m_counts(new std::atomic<uint64_t>[m_bounds.size() + 1])
+        , m_sum(0)
+    {
+        for (size_t i = 0; i <= m_bounds.size(); ++i)
+        {
+            m_counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void histogram::observe(uint64_t value)
+    {
+        size_t i = 0;
+        while (i < m_bounds.size() && value > m_bounds[i])
+        {
+            ++i;
+        }
+        m_counts[i].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    std::vector<uint64_t> histogram::cumulative_counts() const
+    {
+        std::vector<uint64_t> counts(m_bounds.size() + 1);
+        uint64_t running = 0;
+        for (size_t i = 0; i <= m_bounds.size(); ++i)
+        {
+            running += m_counts[i].load(std::memory_order_relaxed);
+            counts[i] = running;
+        }
+        return counts;
+    }
+
+    uint64_t histogram::count() const
+    {
+        return cumulative_counts().back();
+    }
+
+    uint64_t histogram::sum() const
+    {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+
+    const std::vector<uint64_t>& histogram::bounds() const
+    {
+        return m_bounds;
+    }
+
+    std::string default_metrics_dir()
+    {
+        const char* env_dir = std::getenv("XEUS_STATA_METRICS_DIR");
+        if (env_dir && env_dir[0] != '\0')
+        {
+            return env_dir;
+        }
+
+        // Same lookup as jupyter_core's jupyter_runtime_dir()
+        const char* runtime_dir = std::getenv("JUPYTER_RUNTIME_DIR");
+        if (runtime_dir && runtime_dir[0] != '\0')
+        {
+            return runtime_dir;
+        }
+        const char* data_dir = std::getenv("JUPYTER_DATA_DIR");
+        if (data_dir && data_dir[0] != '\0')
+        {
+            return std::string(data_dir) + "/runtime";
+        }
+        const char* home = std::getenv("HOME");
+#if defined(XEUS_STATA_PLATFORM_MACOS)
+        return std::string(home ? home : "/tmp") + "/Library/Jupyter/runtime";
+#else
+        const char* xdg_data = std::getenv("XDG_DATA_HOME");
+        if (xdg_data && xdg_data[0] != '\0')
+        {
+            return std::string(xdg_data) + "/jupyter/runtime";
+        }
+        return std::string(home ? home : "/tmp") + "/.local/share/jupyter/runtime";
+#endif
+    }
+
+    uint64_t process_rss_bytes(int pid)
+    {
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        if (pid <= 0)
+        {
+            return 0;
+        }
+        std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, 6, "VmRSS:") == 0)
+            {
+                return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+            }
+        }
+#else
+        (void)pid;
+#endif
+        return 0;
+    }
+
+    kernel_metrics::kernel_metrics()
+        : m_cells_executed(0)
+        , m_cells_failed(0)
+        , m_errors_by_rc(new std::atomic<uint64_t>[MAX_TRACKED_RC])
+        , m_errors_other_rc(0)
+        , m_pty_bytes(0)
+        , m_graphs_published(0)
+        , m_execution_us(latency_bounds_us())
+        , m_parse_us(latency_bounds_us())
+        , m_completion_us(latency_bounds_us())
+        , m_inspection_us(latency_bounds_us())
+        , m_graph_bytes(size_bounds_bytes())
+        , m_exporter_stopping(false)
+    {
+        for (int i = 0; i < MAX_TRACKED_RC; ++i)
+        {
+            m_errors_by_rc[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    kernel_metrics::~kernel_metrics()
+    {
+        stop_exporter();
+    }
+
+    void kernel_metrics::record_execution(double total_ms, double parse_ms, size_t pty_bytes, int error_code)
+    {
+        m_cells_executed.fetch_add(1, std::memory_order_relaxed);
+        m_pty_bytes.fetch_add(pty_bytes, std::memory_order_relaxed);
+        m_execution_us.observe(ms_to_us(total_ms));
+        m_parse_us.observe(ms_to_us(parse_ms));
+
+        if (error_code != 0)
+        {
+            m_cells_failed.fetch_add(1, std::memory_order_relaxed);
+            if (error_code > 0 && error_code < MAX_TRACKED_RC)
+            {
+                m_errors_by_rc[error_code].fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                m_errors_other_rc.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void kernel_metrics::record_graph(size_t bytes)
+    {
+        m_graphs_published.fetch_add(1, std::memory_order_relaxed);
+        m_graph_bytes.observe(bytes);
+    }
+
+    void kernel_metrics::record_completion(double ms)
+    {
+        m_completion_us.observe(ms_to_us(ms));
+    }
+
+    void kernel_metrics::record_inspection(double ms)
+    {
+        m_inspection_us.observe(ms_to_us(ms));
+    }
+
+    void kernel_metrics::set_pid_provider(std::function<int()> provider)
+    {
+        m_pid_provider = std::move(provider);
+    }
+
+    nl::json kernel_metrics::snapshot() const
+    {
+        nl::json errors = nl::json::object();
+        for (int rc = 1; rc < MAX_TRACKED_RC; ++rc)
+        {
+            uint64_t n = m_errors_by_rc[rc].load(std::memory_order_relaxed);
+            if (n > 0)
+            {
+                errors[std::to_string(rc)] = n;
+            }
+        }
+        uint64_t other = m_errors_other_rc.load(std::memory_order_relaxed);
+        if (other > 0)
+        {
+            errors["other"] = other;
+        }
+
+        nl::json snap;
+        snap["cells_executed"] = m_cells_executed.load(std::memory_order_relaxed);
+        snap["cells_failed"] = m_cells_failed.load(std::memory_order_relaxed);
+        snap["errors_by_rc"] = errors;
+        snap["pty_bytes_read"] = m_pty_bytes.load(std::memory_order_relaxed);
+        snap["graphs_published"] = m_graphs_published.load(std::memory_order_relaxed);
+        snap["execution_us"] = histogram_json(m_execution_us);
+        snap["parse_us"] = histogram_json(m_parse_us);
+        snap["completion_us"] = histogram_json(m_completion_us);
+        snap["inspection_us"] = histogram_json(m_inspection_us);
+        snap["graph_bytes"] = histogram_json(m_graph_bytes);
+        snap["stata_rss_bytes"] = m_pid_provider ? process_rss_bytes(m_pid_provider()) : 0;
+        return snap;
+    }
+
+    std::string kernel_metrics::prometheus_text() const
+    {
+        std::ostringstream out;
+        const std::string labels = "kernel_pid=\"" + std::to_string(getpid()) + "\"";
+
+        append_counter(out, "xstata_cells_executed_total", "Cells executed.", labels,
+                       m_cells_executed.load(std::memory_order_relaxed));
+        append_counter(out, "xstata_cells_failed_total", "Cells that ended in a Stata error.", labels,
+                       m_cells_failed.load(std::memory_order_relaxed));
+
+        out << "# HELP xstata_errors_total Stata errors by return code.\n"
+            << "# TYPE xstata_errors_total counter\n";
+        for (int rc = 1; rc < MAX_TRACKED_RC; ++rc)
+        {
+            uint64_t n = m_errors_by_rc[rc].load(std::memory_order_relaxed);
+            if (n > 0)
+            {
+                out << "xstata_errors_total{" << labels << ",rc=\"" << rc << "\"} " << n << "\n";
+            }
+        }
+        uint64_t other = m_errors_other_rc.load(std::memory_order_relaxed);
+        if (other > 0)
+        {
+            out << "xstata_errors_total{" << labels << ",rc=\"other\"} " << other << "\n";
+        }
+
+        append_counter(out, "xstata_pty_read_bytes_total", "Bytes read from the Stata PTY.", labels,
+                       m_pty_bytes.load(std::memory_order_relaxed));
+        append_counter(out, "xstata_graphs_published_total", "Graphs published.", labels,
+                       m_graphs_published.load(std::memory_order_relaxed));
+
+        append_histogram(out, "xstata_execution_seconds", "Cell execution time.", labels,
+                         m_execution_us, 1e-6);
+        append_histogram(out, "xstata_parse_seconds", "Output parsing time.", labels,
+                         m_parse_us, 1e-6);
+        append_histogram(out, "xstata_completion_seconds", "Completion request latency.", labels,
+                         m_completion_us, 1e-6);
+        append_histogram(out, "xstata_inspection_seconds", "Inspection request latency.", labels,
+                         m_inspection_us, 1e-6);
+        append_histogram(out, "xstata_graph_bytes", "Size of published graphs.", labels,
+                         m_graph_bytes, 1.0);
+
+        out << "# HELP xstata_stata_rss_bytes Resident memory of the Stata process.\n"
+            << "# TYPE xstata_stata_rss_bytes gauge\n"
+            << "xstata_stata_rss_bytes{" << labels << "} "
+            << (m_pid_provider ? process_rss_bytes(m_pid_provider()) : 0) << "\n";
+
+        return out.str();
+    }
+
+    void kernel_metrics::write_prometheus_file(const std::string& path) const
+    {
+        // Write then rename so a scraper never sees a partial file
+        std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream out(tmp_path);
+            if (!out)
+            {
+                return;
+            }
+            out << prometheus_text();
+        }
+        std::rename(tmp_path.c_str(), path.c_str());
+    }
+
+    void kernel_metrics::start_exporter(const std::string& path, int interval_seconds)
+    {
+        if (interval_seconds <= 0 || m_exporter.joinable())
+        {
+            return;
+        }
+
+        m_exporter_stopping = false;
+        m_exporter = std::thread([this, path, interval_seconds]() {
+            std::unique_lock<std::mutex> lock(m_exporter_mutex);
+            while (!m_exporter_stopping)
+            {
+                write_prometheus_file(path);
+                m_exporter_wakeup.wait_for(lock, std::chrono::seconds(interval_seconds));
+            }
+            std::remove(path.c_str());
+        });
+    }
+
+    void kernel_metrics::stop_exporter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_exporter_mutex);
+            m_exporter_stopping = true;
+        }
+        m_exporter_wakeup.notify_all();
+        if (m_exporter.joinable())
+        {
+            m_exporter.join();
+        }
+    }
+
+} // namespace xeus_stata
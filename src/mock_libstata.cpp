@@ -0,0 +1,520 @@
+// Minimal stand-in for the Stata shared library, exporting the entry points
+// of library_abi.hpp. It understands just enough Stata to drive the library
+// backend without a Stata installation:
+//
+//   display "text" | `"text"' | number | _N | c(N/k/changed/frame/pwd/linesize/version) ...
+//   set obs N | linesize N, generate/replace var = number | _n, clear, sleep ms
+//   local name [text] | local name = <display item>, `name' expansion
+//   include/do file, quietly/capture/noisily prefixes
+//
+// Anything else fails with r(199) like an unknown command.
+
+#include "xeus-stata/library_abi.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace
+{
+    struct mock_state
+    {
+        xstata_output_handler handler = nullptr;
+        void* user = nullptr;
+        long long nobs = 0;
+        int linesize = 80;
+        std::vector<std::pair<std::string, std::vector<double>>> variables;
+        std::map<std::string, std::string> locals;
+        std::atomic<bool> break_requested{false};
+        int last_rc = 0;
+    };
+
+    mock_state& state()
+    {
+        static mock_state s;
+        return s;
+    }
+
+    // Output levels: quietly hides results but not errors, capture hides both
+    const int NOISY = 0;
+    const int QUIET = 1;
+    const int SILENT = 2;
+
+    void emit(const std::string& text, int level, int shown_below = QUIET)
+    {
+        if (level < shown_below && state().handler)
+        {
+            state().handler(text.c_str(), state().user);
+        }
+    }
+
+    std::string trim(const std::string& text)
+    {
+        size_t start = text.find_first_not_of(" \t\r");
+        if (start == std::string::npos)
+        {
+            return "";
+        }
+        size_t end = text.find_last_not_of(" \t\r");
+        return text.substr(start, end - start + 1);
+    }
+
+    std::string first_word(const std::string& text, std::string& rest)
+    {
+        size_t end = text.find_first_of(" \t");
+        rest = end == std::string::npos ? "" : trim(text.substr(end));
+        return text.substr(0, end);
+    }
+
+    int fail(int rc, const std::string& message, int level)
+    {
+        emit(message + "\n", level, SILENT);
+        emit("r(" + std::to_string(rc) + ");\n", level, SILENT);
+        return rc;
+    }
+
+    std::vector<double>* find_variable(const std::string& name)
+    {
+        for (auto& variable : state().variables)
+        {
+            if (variable.first == name)
+            {
+                return &variable.second;
+            }
+        }
+        return nullptr;
+    }
+
+    // Split the arguments of display into strings, formats and
+    // expressions; an expression ends at a space outside quotes/parens
+    std::vector<std::string> display_items(const std::string& text)
+    {
+        std::vector<std::string> items;
+        size_t pos = 0;
+        while (pos < text.size())
+        {
+            if (text[pos] == ' ')
+            {
+                ++pos;
+                continue;
+            }
+            size_t start = pos;
+            if (text.compare(pos, 2, "`\"") == 0)
+            {
+                size_t close = text.find("\"'", pos + 2);
+                pos = close == std::string::npos ? text.size() : close + 2;
+            }
+            else if (text[pos] == '"')
+            {
+                size_t close = text.find('"', pos + 1);
+                pos = close == std::string::npos ? text.size() : close + 1;
+            }
+            else
+            {
+                int depth = 0;
+                bool quoted = false;
+                for (; pos < text.size(); ++pos)
+                {
+                    char c = text[pos];
+                    if (c == '"')
+                    {
+                        quoted = !quoted;
+                    }
+                    else if (!quoted && c == '(')
+                    {
+                        ++depth;
+                    }
+                    else if (!quoted && c == ')')
+                    {
+                        --depth;
+                    }
+                    else if (!quoted && depth == 0 && c == ' ')
+                    {
+                        break;
+                    }
+                }
+            }
+            std::string item = text.substr(start, pos - start);
+            // Formats only change the layout, which the mock ignores
+            if (item[0] != '%')
+            {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    std::string format_number(double value)
+    {
+        std::ostringstream ss;
+        ss << std::setprecision(15) << value;
+        return ss.str();
+    }
+
+    bool evaluate(const std::string& item, std::string& value)
+    {
+        if (item.size() >= 4 && item.compare(0, 2, "`\"") == 0 && item.compare(item.size() - 2, 2, "\"'") == 0)
+        {
+            value = item.substr(2, item.size() - 4);
+        }
+        else if (item.size() >= 2 && item.front() == '"' && item.back() == '"')
+        {
+            value = item.substr(1, item.size() - 2);
+        }
+        else if (item == "_N" || item == "c(N)")
+        {
+            value = std::to_string(state().nobs);
+        }
+        else if (item == "c(k)")
+        {
+            value = std::to_string(state().variables.size());
+        }
+        else if (item == "c(changed)")
+        {
+            value = state().variables.empty() ? "0" : "1";
+        }
+        else if (item == "c(frame)")
+        {
+            value = "default";
+        }
+        else if (item == "c(pwd)")
+        {
+            char buffer[4096];
+            value = getcwd(buffer, sizeof(buffer)) ? buffer : "";
+        }
+        else if (item == "c(linesize)")
+        {
+            value = std::to_string(state().linesize);
+        }
+        else if (item == "c(version)")
+        {
+            value = "17";
+        }
+        else if (item == "_rc")
+        {
+            value = std::to_string(state().last_rc);
+        }
+        else if (item.compare(0, 6, "clock(") == 0)
+        {
+            // Milliseconds since 01jan1960, Stata's %tc origin
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            double ms = std::chrono::duration<double, std::milli>(now).count() + 315619200000.0;
+            value = format_number(std::floor(ms));
+        }
+        else
+        {
+            char* end = nullptr;
+            double number = std::strtod(item.c_str(), &end);
+            if (item.empty() || *end != '\0')
+            {
+                return false;
+            }
+            value = format_number(number);
+        }
+        return true;
+    }
+
+    // Replace `name' with the local's value; `" starts a compound string
+    std::string expand_locals(const std::string& line)
+    {
+        std::string expanded;
+        size_t pos = 0;
+        while (pos < line.size())
+        {
+            size_t open = line.find('`', pos);
+            while (open != std::string::npos && open + 1 < line.size() && line[open + 1] == '"')
+            {
+                open = line.find('`', open + 2);
+            }
+            size_t close = open == std::string::npos ? std::string::npos : line.find('\'', open + 1);
+            if (close == std::string::npos)
+            {
+                expanded += line.substr(pos);
+                break;
+            }
+            expanded += line.substr(pos, open - pos);
+            auto it = state().locals.find(line.substr(open + 1, close - open - 1));
+            if (it != state().locals.end())
+            {
+                expanded += it->second;
+            }
+            pos = close + 1;
+        }
+        return expanded;
+    }
+
+    int run_line(const std::string& line, int level);
+
+    int run_file(const std::string& path, int level)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            return fail(601, "file " + path + " not found", level);
+        }
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line = trim(line);
+            if (line.empty() || line[0] == '*' || line.compare(0, 2, "//") == 0)
+            {
+                continue;
+            }
+            emit(". " + line + "\n", level);
+            int rc = run_line(expand_locals(line), level);
+            if (rc != 0)
+            {
+                return rc;
+            }
+        }
+        return 0;
+    }
+
+    int run_line(const std::string& line, int level)
+    {
+        std::string rest;
+        std::string command = first_word(line, rest);
+
+        if (command == "quietly" || command == "qui")
+        {
+            return run_line(rest, std::max(level, QUIET));
+        }
+        if (command == "noisily")
+        {
+            return run_line(rest, level == SILENT ? SILENT : NOISY);
+        }
+        if (command == "capture" || command == "cap")
+        {
+            state().last_rc = run_line(rest, SILENT);
+            return 0;
+        }
+
+        if (command == "display" || command == "di")
+        {
+            std::string text;
+            for (const auto& item : display_items(rest))
+            {
+                std::string value;
+                if (!evaluate(item, value))
+                {
+                    return fail(198, "invalid syntax", level);
+                }
+                text += value;
+            }
+            emit(text + "\n", level);
+            return 0;
+        }
+
+        if (command == "include" || command == "do")
+        {
+            std::string path = rest;
+            if (path.size() >= 2 && path.front() == '"' && path.back() == '"')
+            {
+                path = path.substr(1, path.size() - 2);
+            }
+            return run_file(path, level);
+        }
+
+        if (command == "set")
+        {
+            std::string value;
+            std::string setting = first_word(rest, value);
+            if (setting == "obs")
+            {
+                long long nobs = std::atoll(value.c_str());
+                state().nobs = nobs;
+                for (auto& variable : state().variables)
+                {
+                    variable.second.resize(static_cast<size_t>(nobs), 9e307);
+                }
+                emit("Number of observations (_N) was 0, now " + value + ".\n", level);
+            }
+            else if (setting == "linesize")
+            {
+                state().linesize = std::atoi(value.c_str());
+            }
+            return 0;
+        }
+
+        if (command == "generate" || command == "gen" || command == "replace")
+        {
+            size_t equals = rest.find('=');
+            if (equals == std::string::npos)
+            {
+                return fail(198, "invalid syntax", level);
+            }
+            std::string name = trim(rest.substr(0, equals));
+            std::string expression = trim(rest.substr(equals + 1));
+            std::vector<double>* values = find_variable(name);
+            if (command == "replace" && !values)
+            {
+                return fail(111, "variable " + name + " not found", level);
+            }
+            if (command != "replace" && values)
+            {
+                return fail(110, "variable " + name + " already defined", level);
+            }
+            if (!values)
+            {
+                state().variables.emplace_back(name, std::vector<double>());
+                values = &state().variables.back().second;
+            }
+            values->assign(static_cast<size_t>(state().nobs), 0.0);
+            for (size_t i = 0; i < values->size(); ++i)
+            {
+                (*values)[i] = expression == "_n" ? static_cast<double>(i + 1) : std::strtod(expression.c_str(), nullptr);
+            }
+            return 0;
+        }
+
+        if (command == "clear")
+        {
+            state().nobs = 0;
+            state().variables.clear();
+            return 0;
+        }
+
+        if (command == "sleep")
+        {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::atoi(rest.c_str()));
+            while (std::chrono::steady_clock::now() < deadline)
+            {
+                if (state().break_requested.exchange(false))
+                {
+                    emit("--Break--\n", level, SILENT);
+                    emit("r(1);\n", level, SILENT);
+                    return 1;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            return 0;
+        }
+
+        if (command == "local")
+        {
+            std::string text;
+            std::string name = first_word(rest, text);
+            if (text.empty())
+            {
+                state().locals.erase(name);
+                return 0;
+            }
+            if (text[0] == '=')
+            {
+                std::string item = trim(text.substr(1));
+                if (!evaluate(item, text))
+                {
+                    return fail(111, item + " not found", level);
+                }
+            }
+            state().locals[name] = text;
+            return 0;
+        }
+
+        if (command == "global" || command == "log" || command == "if" ||
+            command == "_return" || command == "timer")
+        {
+            // Accepted and ignored
+            return 0;
+        }
+
+        if (command == "graph")
+        {
+            // No graphs are ever drawn
+            return rest.compare(0, 8, "describe") == 0 ? fail(111, "graph Graph not found", level) : 0;
+        }
+
+        return fail(199, "command " + command + " is unrecognized", level);
+    }
+}
+
+extern "C"
+{
+    int StataSO_Main(int, char**)
+    {
+        return 0;
+    }
+
+    int StataSO_Execute(const char* command, int echo)
+    {
+        if (echo)
+        {
+            emit(std::string(". ") + command + "\n", NOISY);
+        }
+        state().break_requested = false;
+        return run_line(expand_locals(trim(command)), NOISY);
+    }
+
+    void StataSO_SetBreak(void)
+    {
+        state().break_requested = true;
+    }
+
+    void StataSO_Shutdown(void)
+    {
+        state().handler = nullptr;
+    }
+
+    void StataSO_SetOutputHandler(xstata_output_handler handler, void* user)
+    {
+        state().handler = handler;
+        state().user = user;
+    }
+
+    long long StataSO_Nobs(void)
+    {
+        return state().nobs;
+    }
+
+    int StataSO_Nvar(void)
+    {
+        return static_cast<int>(state().variables.size());
+    }
+
+    int StataSO_VarName(int var, char* buffer, int size)
+    {
+        if (var < 1 || var > StataSO_Nvar() || size <= 0)
+        {
+            return 111;
+        }
+        const std::string& name = state().variables[static_cast<size_t>(var - 1)].first;
+        std::strncpy(buffer, name.c_str(), static_cast<size_t>(size) - 1);
+        buffer[size - 1] = '\0';
+        return 0;
+    }
+
+    int StataSO_VarIndex(const char* name)
+    {
+        for (size_t i = 0; i < state().variables.size(); ++i)
+        {
+            if (state().variables[i].first == name)
+            {
+                return static_cast<int>(i + 1);
+            }
+        }
+        return 0;
+    }
+
+    int StataSO_GetNum(int var, long long obs, double* value)
+    {
+        if (var < 1 || var > StataSO_Nvar() || obs < 1 || obs > state().nobs)
+        {
+            return 198;
+        }
+        *value = state().variables[static_cast<size_t>(var - 1)].second[static_cast<size_t>(obs - 1)];
+        return 0;
+    }
+}
@@ -0,0 +1,859 @@
+#include "xeus-stata/parallel.hpp"
+#include "xeus-stata/stata_session.hpp"
+#include "xeus-stata/stata_lexer.hpp"
+#include "xeus-stata/stata_parser.hpp"
+#include "xeus-stata/timing.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    namespace
+    {
+        const char* USAGE =
+            "Usage: %%parallel N [append | by(varname)]\n"
+            "  Without by(), the cell is a forvalues or foreach loop, optionally after\n"
+            "  setup lines that every worker runs first; iterations are spread over N\n"
+            "  worker Stata processes. With append, the datasets the iterations leave\n"
+            "  replace the kernel's data. With by(varname), the cell runs once per group.";
+
+        std::string trim(const std::string& text)
+        {
+            size_t start = text.find_first_not_of(" \t\r\n");
+            if (start == std::string::npos)
+            {
+                return "";
+            }
+            size_t end = text.find_last_not_of(" \t\r\n");
+            return text.substr(start, end - start + 1);
+        }
+
+        bool is_stata_name(const std::string& name)
+        {
+            if (name.empty() || name.size() > 32 ||
+                !(std::isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_'))
+            {
+                return false;
+            }
+            return std::all_of(name.begin(), name.end(), [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+            });
+        }
+
+        // forvalues abbreviates to forv; foreach does not abbreviate
+        bool is_loop_command(const std::string& word)
+        {
+            return word == "foreach" ||
+                   (word.size() >= 4 && std::string("forvalues").compare(0, word.size(), word) == 0);
+        }
+
+        // Echoed command: ". cmd", or "  2. cmd" inside a typed loop
+        bool is_echo_line(const std::string& line)
+        {
+            size_t digits = line.find_first_not_of(' ');
+            size_t dot = line.find_first_not_of("0123456789", digits);
+            return line.compare(0, 2, ". ") == 0 ||
+                   (dot != digits && dot != std::string::npos && line[dot] == '.');
+        }
+
+        // Lines starting with tag, with the tag removed. Echoed commands
+        // never match. A value wider than the line size wraps, so the lines
+        // after it up to the next tag or echo are joined back on.
+        std::vector<std::string> tagged_lines(const std::string& output, const std::string& tag)
+        {
+            std::vector<std::string> values;
+            bool continuing = false;
+            std::stringstream ss(output);
+            std::string line;
+            while (std::getline(ss, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                if (line.compare(0, tag.size(), tag) == 0)
+                {
+                    values.push_back(line.substr(tag.size()));
+                    continuing = true;
+                }
+                else if (continuing && !line.empty() && line.compare(0, 7, "xstata_") != 0 && !is_echo_line(line))
+                {
+                    values.back() += line;
+                }
+                else
+                {
+                    continuing = false;
+                }
+            }
+            for (auto& value : values)
+            {
+                value.erase(value.find_last_not_of(" \t") + 1);
+            }
+            return values;
+        }
+
+        std::string tagged_value(const std::string& output, const std::string& tag)
+        {
+            auto values = tagged_lines(output, tag);
+            return values.empty() ? "" : values.front();
+        }
+
+        // Run code that is part of the machinery, not of the user's cell
+        execution_result run_checked(stata_session& session, const std::string& code, const std::string& what)
+        {
+            execution_result result = session.execute(code);
+            if (result.is_error)
+            {
+                throw std::runtime_error(what + " failed with r(" + std::to_string(result.error_code) + ")" +
+                                         (result.error_message.empty() ? "" : ": " + trim(result.error_message)));
+            }
+            return result;
+        }
+
+        // Write a do-file that recreates the main session's globals,
+        // scalars, matrices and the set options that change results or
+        // output, in the way checkpoints save globals and scalars. Numbers
+        // are written in %21x so they round-trip exactly.
+        void save_session_state(stata_session& main, const std::string& state_file)
+        {
+            run_checked(main,
+                "tempname __xstata_fh\n"
+                "file open `__xstata_fh' using " + compound_quote(state_file) + ", write text replace\n"
+                "foreach __xstata_g in `: all globals' {\n"
+                "file write `__xstata_fh' `\"global `__xstata_g' `\"${`__xstata_g'}\"'\"' _n\n"
+                "}\n"
+                "foreach __xstata_s in `: all numeric scalars' {\n"
+                "file write `__xstata_fh' \"scalar `__xstata_s' = \" %21x (scalar(`__xstata_s')) _n\n"
+                "}\n"
+                "foreach __xstata_s in `: all string scalars' {\n"
+                "file write `__xstata_fh' `\"scalar `__xstata_s' = `\"`=scalar(`__xstata_s')'\"'\"' _n\n"
+                "}\n"
+                "foreach __xstata_m in `: all matrices' {\n"
+                "file write `__xstata_fh' \"matrix `__xstata_m' = J(\" (rowsof(`__xstata_m')) \",\" "
+                "(colsof(`__xstata_m')) \",.)\" _n\n"
+                "forvalues __xstata_i = 1/`=rowsof(`__xstata_m')' {\n"
+                "forvalues __xstata_j = 1/`=colsof(`__xstata_m')' {\n"
+                "file write `__xstata_fh' \"matrix `__xstata_m'[`__xstata_i',`__xstata_j'] = \" "
+                "%21x (`__xstata_m'[`__xstata_i',`__xstata_j']) _n\n"
+                "}\n"
+                "}\n"
+                "file write `__xstata_fh' `\"matrix rownames `__xstata_m' = `: rowfullnames `__xstata_m''\"' _n\n"
+                "file write `__xstata_fh' `\"matrix colnames `__xstata_m' = `: colfullnames `__xstata_m''\"' _n\n"
+                "}\n"
+                "file write `__xstata_fh' \"set type `c(type)'\" _n \"set level `c(level)'\" _n "
+                "\"set maxiter `c(maxiter)'\" _n \"set varabbrev `c(varabbrev)'\" _n "
+                "\"set linesize `c(linesize)'\" _n\n"
+                "file close `__xstata_fh'\n"
+                "foreach __xstata_l in fh g s m i j {\n"
+                "local __xstata_`__xstata_l'\n"
+                "}\n"
+                "local __xstata_l",
+                "Saving the session state for the workers");
+        }
+
+        // Task queues, one per worker, seeded with contiguous blocks. A
+        // worker whose queue runs dry takes the last task of the longest
+        // other queue.
+        class task_queues
+        {
+        public:
+            task_queues(size_t tasks, size_t workers)
+                : m_queues(workers)
+            {
+                for (size_t w = 0; w < workers; ++w)
+                {
+                    size_t first = tasks * w / workers;
+                    size_t last = tasks * (w + 1) / workers;
+                    for (size_t t = first; t < last; ++t)
+                    {
+                        m_queues[w].push_back(t);
+                    }
+                }
+            }
+
+            bool next(size_t worker, size_t& task, bool& stolen)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                stolen = false;
+                if (!m_queues[worker].empty())
+                {
+                    task = m_queues[worker].front();
+                    m_queues[worker].pop_front();
+                    return true;
+                }
+
+                auto victim = std::max_element(m_queues.begin(), m_queues.end(),
+                    [](const std::deque<size_t>& a, const std::deque<size_t>& b) { return a.size() < b.size(); });
+                if (victim == m_queues.end() || victim->empty())
+                {
+                    return false;
+                }
+                task = victim->back();
+                victim->pop_back();
+                stolen = true;
+                return true;
+            }
+
+        private:
+            std::mutex m_mutex;
+            std::vector<std::deque<size_t>> m_queues;
+        };
+
+        struct worker_progress
+        {
+            size_t done = 0;
+            size_t stolen = 0;
+            std::string running;    // label of the current task
+            bool finished = false;
+        };
+
+        struct task_outcome
+        {
+            bool ran = false;
+            bool saved = false;     // result dataset written
+            bool changed = false;
+            execution_result result;
+            std::string failure;    // the session failed, not the code
+        };
+    }
+
+    std::vector<std::string> session_programs(const std::string& program_dir)
+    {
+        std::vector<std::string> names;
+        std::stringstream ss(program_dir);
+        std::string line;
+        while (std::getline(ss, line))
+        {
+            std::istringstream words(line);
+            std::string size, name, extra;
+            if (!(words >> size >> name) || (words >> extra) ||
+                size.find_first_not_of("0123456789") != std::string::npos || !is_stata_name(name))
+            {
+                continue;
+            }
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    std::string rebuild_programs(const std::string& output)
+    {
+        std::string programs;
+        std::string name;
+        bool in_body = false;
+        auto close = [&]() {
+            if (in_body)
+            {
+                programs += "end\n";
+            }
+            in_body = false;
+        };
+
+        std::stringstream ss(output);
+        std::string line;
+        const std::string tag = "xstata_program:";
+        while (std::getline(ss, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (line.compare(0, tag.size(), tag) == 0)
+            {
+                close();
+                name = line.substr(tag.size());
+                continue;
+            }
+            std::string text = trim(line);
+            if (name.empty() || text.empty() || line[0] == '.')
+            {
+                continue;
+            }
+            if (!in_body)
+            {
+                if (text.compare(0, name.size(), name) == 0 && text.back() == ':' &&
+                    (text.size() == name.size() + 1 || text[name.size()] == ','))
+                {
+                    programs += "capture program drop " + name + "\n"
+                                "program define " + text.substr(0, text.size() - 1) + "\n";
+                    in_body = true;
+                }
+                continue;
+            }
+            // Stata wraps at the line size, so a continuation is joined
+            // on as it is
+            size_t start = line.find_first_not_of(' ');
+            size_t digits = line.find_first_not_of("0123456789", start);
+            if (digits != std::string::npos && digits > start && line[digits] == '.')
+            {
+                size_t body = line.find_first_not_of(' ', digits + 1);
+                programs += (body == std::string::npos ? "" : line.substr(body)) + "\n";
+            }
+            else
+            {
+                programs.pop_back();
+                programs += text + "\n";
+            }
+        }
+        close();
+        return programs;
+    }
+
+    parallel_job parse_parallel_cell(const std::vector<std::string>& args, const std::string& cell)
+    {
+        parallel_job job;
+        if (args.empty())
+        {
+            throw std::runtime_error(USAGE);
+        }
+        char* end = nullptr;
+        long workers = std::strtol(args[0].c_str(), &end, 10);
+        if (*end != '\0' || workers < 1 || workers > 64)
+        {
+            throw std::runtime_error(std::string("%%parallel: N must be between 1 and 64\n") + USAGE);
+        }
+        job.workers = static_cast<size_t>(workers);
+
+        std::string options;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "append")
+            {
+                job.append = true;
+            }
+            else
+            {
+                options += args[i];
+            }
+        }
+        if (!options.empty())
+        {
+            if (options.compare(0, 3, "by(") != 0 || options.back() != ')' ||
+                !is_stata_name(options.substr(3, options.size() - 4)))
+            {
+                throw std::runtime_error(USAGE);
+            }
+            job.by = options.substr(3, options.size() - 4);
+        }
+        if (job.append && !job.by.empty())
+        {
+            throw std::runtime_error("%%parallel: append is for loops; with by() the groups always come back\n" +
+                                     std::string(USAGE));
+        }
+
+        if (trim(cell).empty())
+        {
+            throw std::runtime_error(USAGE);
+        }
+        if (!job.by.empty())
+        {
+            job.body = cell;
+            return job;
+        }
+
+        // Find the first top-level statement that is a loop
+        auto lexed = lex_cell(cell);
+        const auto& tokens = lexed->tokens;
+        int depth = 0;
+        bool statement_start = true;
+        size_t loop_token = tokens.size();
+        for (size_t i = 0; i < tokens.size() && loop_token == tokens.size(); ++i)
+        {
+            const token& tok = tokens[i];
+            switch (tok.kind)
+            {
+                case token_kind::end_of_statement:
+                    statement_start = true;
+                    continue;
+                case token_kind::comment:
+                case token_kind::continuation:
+                    continue;
+                case token_kind::open_brace:
+                    ++depth;
+                    break;
+                case token_kind::close_brace:
+                    --depth;
+                    break;
+                case token_kind::word:
+                    if (statement_start && depth == 0 && is_loop_command(lexed->text(tok)))
+                    {
+                        loop_token = i;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            statement_start = false;
+        }
+        if (loop_token == tokens.size())
+        {
+            throw std::runtime_error("%%parallel: no forvalues or foreach loop in the cell (use by() to split "
+                                     "the data instead)\n" + std::string(USAGE));
+        }
+
+        // The loop variable follows the command; the body is between the
+        // first brace and its match
+        size_t open = loop_token + 1;
+        while (open < tokens.size() && tokens[open].kind != token_kind::open_brace &&
+               tokens[open].kind != token_kind::end_of_statement)
+        {
+            ++open;
+        }
+        if (open >= tokens.size() || tokens[open].kind != token_kind::open_brace ||
+            tokens[loop_token + 1].kind != token_kind::word)
+        {
+            throw std::runtime_error("%%parallel: cannot read the loop header\n" + std::string(USAGE));
+        }
+        size_t close = open + 1;
+        for (depth = 1; close < tokens.size(); ++close)
+        {
+            if (tokens[close].kind == token_kind::open_brace)
+            {
+                ++depth;
+            }
+            else if (tokens[close].kind == token_kind::close_brace && --depth == 0)
+            {
+                break;
+            }
+        }
+        if (close >= tokens.size())
+        {
+            throw std::runtime_error("%%parallel: the loop is not closed");
+        }
+        for (size_t i = close + 1; i < tokens.size(); ++i)
+        {
+            if (tokens[i].kind != token_kind::end_of_statement && tokens[i].kind != token_kind::comment)
+            {
+                throw std::runtime_error("%%parallel: nothing may follow the loop; put it in another cell");
+            }
+        }
+
+        const token& first = tokens[loop_token];
+        job.setup = cell.substr(0, first.offset);
+        job.loop_header = trim(cell.substr(first.offset, tokens[open].offset - first.offset));
+        job.loop_var = lexed->text(tokens[loop_token + 1]);
+        job.body = cell.substr(tokens[open].offset + 1, tokens[close].offset - tokens[open].offset - 1);
+        if (trim(job.setup).empty())
+        {
+            job.setup.clear();
+        }
+        return job;
+    }
+
+    parallel_runner::parallel_runner()
+    {
+        for (auto& slot : m_active)
+        {
+            slot = nullptr;
+        }
+    }
+
+    parallel_runner::~parallel_runner() = default;
+
+    void parallel_runner::interrupt()
+    {
+        m_cancel = true;
+        for (auto& slot : m_active)
+        {
+            stata_session* session = slot.load();
+            if (session != nullptr)
+            {
+                session->interrupt();
+            }
+        }
+    }
+
+    stata_session& parallel_runner::worker(size_t index)
+    {
+        if (!m_workers[index])
+        {
+            m_workers[index] = std::make_unique<stata_session>();
+        }
+        return *m_workers[index];
+    }
+
+    parallel_result parallel_runner::run(stata_session& main, const parallel_job& job,
+                                         const progress_callback& progress)
+    {
+        // Each worker is a Stata process of its own
+        if (main.backend_name() != "pty")
+        {
+            throw std::runtime_error("%%parallel needs the pty backend (XEUS_STATA_BACKEND=pty)");
+        }
+
+        m_cancel = false;
+        if (m_workers.size() < job.workers)
+        {
+            m_workers.resize(job.workers);
+        }
+
+        std::string scratch = make_scratch_dir();
+        struct scratch_cleanup
+        {
+            std::string path;
+            ~scratch_cleanup()
+            {
+                std::error_code ec;
+                fs::remove_all(path, ec);
+            }
+        } cleanup{scratch};
+        std::string data_file = scratch + "/data.dta";
+        auto task_file = [&scratch](size_t task) {
+            return scratch + "/task-" + std::to_string(task) + ".dta";
+        };
+
+        // Save the dataset once. With by(), it is saved sorted by group and
+        // the last observation of each group is reported. The working
+        // directory is printed at the widest line size so it rarely wraps.
+        std::string save = "display \"xstata_linesize:\" c(linesize)\n"
+                           "local __xstata_ls = c(linesize)\n"
+                           "quietly set linesize 255\n"
+                           "display \"xstata_pwd:\" c(pwd)\n"
+                           "quietly set linesize `__xstata_ls'\n"
+                           "local __xstata_ls\n"
+                           "display \"xstata_k:\" c(k)\n"
+                           "display \"xstata_n:\" c(N)\n";
+        if (job.by.empty())
+        {
+            save += "if c(k) > 0 {\n"
+                    "    preserve\n"
+                    "    quietly save " + compound_quote(data_file) + "\n"
+                    "    restore\n"
+                    "}\n";
+        }
+        else
+        {
+            save += "confirm variable " + job.by + "\n"
+                    "preserve\n"
+                    "quietly egen long xstata_group = group(" + job.by + "), missing\n"
+                    "sort xstata_group, stable\n"
+                    "quietly gen long xstata_end = _n if xstata_group != xstata_group[_n + 1]\n"
+                    "quietly levelsof xstata_end, local(xstata_ends)\n"
+                    "display \"xstata_ends:\" \"`xstata_ends'\"\n"
+                    "drop xstata_group xstata_end\n"
+                    "quietly save " + compound_quote(data_file) + "\n"
+                    "restore\n";
+        }
+        execution_result saved = run_checked(main, save, "Saving the dataset for the workers");
+        std::string pwd = tagged_value(saved.output, "xstata_pwd:");
+        bool has_data = std::atol(tagged_value(saved.output, "xstata_k:").c_str()) > 0;
+        long long nobs = std::atoll(tagged_value(saved.output, "xstata_n:").c_str());
+        int nvars = std::atoi(tagged_value(saved.output, "xstata_k:").c_str());
+
+        // The workers start from clear all, so the rest of the session
+        // state goes across in a do-file: globals, scalars, matrices, set
+        // options and the programs defined in the session
+        std::string state_file = scratch + "/state.do";
+        save_session_state(main, state_file);
+        std::vector<std::string> names = session_programs(
+            run_checked(main, "program dir", "Listing the session's programs").output);
+        if (!names.empty())
+        {
+            std::string list = "quietly set linesize 255\n";
+            for (const auto& name : names)
+            {
+                list += "display \"xstata_program:" + name + "\"\nprogram list " + name + "\n";
+            }
+            list += "quietly set linesize " + tagged_value(saved.output, "xstata_linesize:");
+            std::ofstream state(state_file, std::ios::app);
+            state << rebuild_programs(run_checked(main, list, "Listing the session's programs").output);
+            if (!state)
+            {
+                throw std::runtime_error("Cannot write the session state to " + state_file);
+            }
+        }
+
+        std::vector<std::pair<long long, long long>> groups;
+        if (!job.by.empty())
+        {
+            std::stringstream ss(tagged_value(saved.output, "xstata_ends:"));
+            long long first = 1;
+            long long last;
+            while (ss >> last)
+            {
+                groups.emplace_back(first, last);
+                first = last + 1;
+            }
+        }
+
+        // Bring every worker to a clean state with the main session's state
+        // and data loaded and the setup statements run
+        std::vector<std::string> init_errors(job.workers);
+        {
+            std::vector<std::thread> threads;
+            for (size_t w = 0; w < job.workers; ++w)
+            {
+                threads.emplace_back([&, w]() {
+                    try
+                    {
+                        stata_session& session = worker(w);
+                        m_active[w] = &session;
+                        std::string init = "clear all\nmacro drop _all\nquietly cd " + compound_quote(pwd) +
+                                           "\nquietly run " + compound_quote(state_file);
+                        if (job.by.empty() && has_data)
+                        {
+                            init += "\nquietly use " + compound_quote(data_file) + ", clear";
+                        }
+                        run_checked(session, init, "Starting worker " + std::to_string(w + 1));
+                        if (!job.setup.empty())
+                        {
+                            run_checked(session, job.setup, "Setup on worker " + std::to_string(w + 1));
+                        }
+                    }
+                    catch (const std::exception& e)
+                    {
+                        init_errors[w] = e.what();
+                    }
+                });
+            }
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+        for (const auto& error : init_errors)
+        {
+            if (!error.empty())
+            {
+                throw std::runtime_error(error);
+            }
+        }
+        if (m_cancel)
+        {
+            throw std::runtime_error("%%parallel interrupted");
+        }
+
+        // Let Stata expand the loop header, so every forvalues range and
+        // foreach list form works as in a plain loop
+        std::vector<std::string> labels;
+        if (job.by.empty())
+        {
+            execution_result expanded = run_checked(worker(0),
+                job.loop_header + " {\n"
+                "    display \"xstata_task:\" `\"`" + job.loop_var + "'\"'\n"
+                "}",
+                "Expanding the loop");
+            labels = tagged_lines(expanded.output, "xstata_task:");
+        }
+        else
+        {
+            for (size_t g = 0; g < groups.size(); ++g)
+            {
+                labels.push_back(std::to_string(g + 1));
+            }
+        }
+
+        parallel_result outcome;
+        outcome.tasks = labels.size();
+        std::vector<task_outcome> tasks(labels.size());
+        std::vector<worker_progress> workers(job.workers);
+        std::mutex progress_mutex;
+        std::condition_variable finished;
+        size_t running = job.workers;
+        task_queues queues(labels.size(), job.workers);
+        stopwatch timer;
+
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < job.workers; ++w)
+        {
+            threads.emplace_back([&, w]() {
+                stata_session& session = worker(w);
+                bool pristine = true;   // the worker still holds the saved dataset as loaded
+                size_t task;
+                bool stolen;
+                while (!m_cancel && queues.next(w, task, stolen))
+                {
+                    std::string label = job.by.empty() ? job.loop_var + " = " + labels[task]
+                                                       : job.by + " group " + labels[task];
+                    {
+                        std::lock_guard<std::mutex> lock(progress_mutex);
+                        workers[w].running = label;
+                        workers[w].stolen += stolen ? 1 : 0;
+                    }
+
+                    std::string code;
+                    if (!job.by.empty())
+                    {
+                        code = "quietly use in " + std::to_string(groups[task].first) + "/" +
+                               std::to_string(groups[task].second) + " using " + compound_quote(data_file) +
+                               ", clear\n";
+                    }
+                    else if (!pristine)
+                    {
+                        code = has_data ? "quietly use " + compound_quote(data_file) + ", clear\n" : "clear\n";
+                    }
+                    if (job.by.empty())
+                    {
+                        code += "local " + job.loop_var + " " + compound_quote(labels[task]) + "\n";
+                    }
+                    code += job.body;
+
+                    task_outcome& result = tasks[task];
+                    try
+                    {
+                        result.result = session.execute(code);
+                        result.ran = true;
+                        const cell_state& state = result.result.state;
+                        result.changed = state.valid && state.data_changed;
+                        pristine = state.valid && !state.data_changed &&
+                                   state.nobs == nobs && state.nvars == nvars;
+
+                        // Keep what the task produced: every group with by(),
+                        // changed data for a loop with append
+                        if (!result.result.is_error && (!job.by.empty() || (job.append && result.changed)))
+                        {
+                            run_checked(session, "quietly save " + compound_quote(task_file(task)) +
+                                        ", emptyok", "Saving the result of " + label);
+                            result.saved = true;
+                        }
+                        for (const auto& graph_file : result.result.graph_files)
+                        {
+                            unlink(graph_file.c_str());
+                        }
+                        if (result.result.is_error)
+                        {
+                            m_cancel = true;
+                        }
+                    }
+                    catch (const std::exception& e)
+                    {
+                        result.failure = e.what();
+                        m_cancel = true;
+                    }
+
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    workers[w].done++;
+                    workers[w].running.clear();
+                }
+
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                workers[w].finished = true;
+                --running;
+                finished.notify_all();
+            });
+        }
+
+        // Report progress from this thread while the workers run
+        auto report = [&]() {
+            std::ostringstream out;
+            size_t done = 0;
+            for (const auto& w : workers)
+            {
+                done += w.done;
+            }
+            out << "%%parallel: " << done << "/" << labels.size() << " tasks on " << job.workers
+                << " workers, " << std::fixed << std::setprecision(1) << timer.elapsed_ms() / 1000 << " s";
+            for (size_t w = 0; w < workers.size(); ++w)
+            {
+                out << "\n  worker " << (w + 1) << ": " << workers[w].done << " done";
+                if (workers[w].stolen > 0)
+                {
+                    out << " (" << workers[w].stolen << " stolen)";
+                }
+                if (!workers[w].running.empty())
+                {
+                    out << ", running " << workers[w].running;
+                }
+                else if (workers[w].finished)
+                {
+                    out << ", finished";
+                }
+            }
+            return out.str();
+        };
+        {
+            std::unique_lock<std::mutex> lock(progress_mutex);
+            while (running > 0)
+            {
+                finished.wait_for(lock, std::chrono::milliseconds(500));
+                std::string text = report();
+                lock.unlock();
+                if (progress)
+                {
+                    progress(text);
+                }
+                lock.lock();
+            }
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        // Outputs in task order, up to the first failure
+        for (size_t t = 0; t < tasks.size(); ++t)
+        {
+            const task_outcome& task = tasks[t];
+            if (!task.failure.empty())
+            {
+                outcome.is_error = true;
+                outcome.error_code = -1;
+                outcome.error_message = "Worker failed on task " + labels[t] + ": " + task.failure;
+                break;
+            }
+            if (!task.ran)
+            {
+                continue;
+            }
+            outcome.output += task.result.output;
+            if (!outcome.output.empty() && outcome.output.back() != '\n')
+            {
+                outcome.output += '\n';
+            }
+            if (task.result.is_error)
+            {
+                outcome.is_error = true;
+                outcome.error_code = task.result.error_code;
+                std::string label = job.by.empty() ? job.loop_var + " = " + labels[t]
+                                                   : job.by + " group " + labels[t];
+                outcome.error_message = trim(task.result.error_message) + "\n(in task " + label + ")";
+                break;
+            }
+        }
+        if (!outcome.is_error && m_cancel)
+        {
+            outcome.is_error = true;
+            outcome.error_code = 1;
+            outcome.error_message = "%%parallel interrupted; the dataset was not changed";
+        }
+        if (outcome.is_error)
+        {
+            return outcome;
+        }
+
+        // Append the result datasets into the main session: for a loop only
+        // with append, with by() only if some group changed its data
+        bool any_changed = std::any_of(tasks.begin(), tasks.end(),
+                                       [](const task_outcome& t) { return t.changed; });
+        std::string merge;
+        for (size_t t = 0; t < tasks.size(); ++t)
+        {
+            if (tasks[t].saved && (job.by.empty() || any_changed))
+            {
+                merge += (merge.empty() ? "quietly use " : "quietly append using ") +
+                         compound_quote(task_file(t)) + (merge.empty() ? ", clear\n" : "\n");
+                ++outcome.merged;
+            }
+        }
+        if (!merge.empty())
+        {
+            run_checked(main, merge, "Appending the worker results");
+        }
+        return outcome;
+    }
+
+} // namespace xeus_stata
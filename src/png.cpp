@@ -0,0 +1,477 @@
+#include "xeus-stata/png.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#if defined(XEUS_STATA_HAS_ZLIB)
+    #include <zlib.h>
+#endif
+
+namespace xeus_stata
+{
+    namespace
+    {
+        const unsigned char PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+        uint32_t read_be32(const unsigned char* p)
+        {
+            return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                   (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+        }
+
+        struct png_chunk
+        {
+            const unsigned char* start;  // length field
+            uint32_t length;
+            std::string type;
+
+            const unsigned char* data() const { return start + 8; }
+            size_t total_size() const { return static_cast<size_t>(length) + 12; }
+        };
+
+        // Split a PNG into chunks; empty if it is not a well-formed PNG
+        std::vector<png_chunk> read_chunks(const unsigned char* data, size_t size)
+        {
+            std::vector<png_chunk> chunks;
+            if (size < 8 || std::memcmp(data, PNG_SIGNATURE, 8) != 0)
+            {
+                return chunks;
+            }
+
+            size_t pos = 8;
+            while (pos + 12 <= size)
+            {
+                uint32_t length = read_be32(data + pos);
+                if (length > size - pos - 12)
+                {
+                    chunks.clear();
+                    return chunks;
+                }
+                chunks.push_back({data + pos, length, std::string(reinterpret_cast<const char*>(data + pos + 4), 4)});
+                pos += static_cast<size_t>(length) + 12;
+                if (chunks.back().type == "IEND")
+                {
+                    return chunks;
+                }
+            }
+
+            // No IEND
+            chunks.clear();
+            return chunks;
+        }
+
+        // Ancillary chunks that affect how the image looks
+        bool keep_ancillary(const std::string& type)
+        {
+            return type == "tRNS" || type == "sRGB" || type == "gAMA";
+        }
+
+        bool is_critical(const std::string& type)
+        {
+            // Bit 5 of the first byte clear means critical
+            return (static_cast<unsigned char>(type[0]) & 0x20) == 0;
+        }
+
+#if defined(XEUS_STATA_HAS_ZLIB)
+        const uint64_t MAX_DECODE_PIXELS = 64ull * 1024 * 1024;
+
+        void write_be32(std::vector<unsigned char>& out, uint32_t value)
+        {
+            out.push_back(static_cast<unsigned char>(value >> 24));
+            out.push_back(static_cast<unsigned char>(value >> 16));
+            out.push_back(static_cast<unsigned char>(value >> 8));
+            out.push_back(static_cast<unsigned char>(value));
+        }
+
+        void write_chunk(std::vector<unsigned char>& out, const char* type,
+                         const unsigned char* data, size_t length)
+        {
+            write_be32(out, static_cast<uint32_t>(length));
+            size_t type_pos = out.size();
+            out.insert(out.end(), type, type + 4);
+            out.insert(out.end(), data, data + length);
+            uLong crc = crc32(0L, out.data() + type_pos, static_cast<uInt>(length + 4));
+            write_be32(out, static_cast<uint32_t>(crc));
+        }
+
+        // Decoded 8-bit pixels, channels interleaved
+        struct raster
+        {
+            uint32_t width = 0;
+            uint32_t height = 0;
+            unsigned int channels = 0;
+            std::vector<unsigned char> pixels;
+        };
+
+        unsigned int channels_for(uint8_t color_type)
+        {
+            switch (color_type)
+            {
+                case 0: return 1;  // gray
+                case 2: return 3;  // RGB
+                case 4: return 2;  // gray + alpha
+                case 6: return 4;  // RGBA
+                default: return 0;
+            }
+        }
+
+        unsigned char paeth(int a, int b, int c)
+        {
+            int p = a + b - c;
+            int pa = std::abs(p - a);
+            int pb = std::abs(p - b);
+            int pc = std::abs(p - c);
+            if (pa <= pb && pa <= pc)
+            {
+                return static_cast<unsigned char>(a);
+            }
+            return static_cast<unsigned char>(pb <= pc ? b : c);
+        }
+
+        bool decode(const std::vector<png_chunk>& chunks, const png_info& info, raster& out)
+        {
+            unsigned int channels = channels_for(info.color_type);
+            if (info.bit_depth != 8 || info.interlace != 0 || channels == 0)
+            {
+                return false;
+            }
+
+            // Refuse to inflate absurd sizes into memory
+            if (static_cast<uint64_t>(info.width) * info.height > MAX_DECODE_PIXELS)
+            {
+                return false;
+            }
+
+            std::vector<unsigned char> compressed;
+            for (const auto& chunk : chunks)
+            {
+                if (chunk.type == "IDAT")
+                {
+                    compressed.insert(compressed.end(), chunk.data(), chunk.data() + chunk.length);
+                }
+            }
+
+            size_t stride = static_cast<size_t>(info.width) * channels;
+            std::vector<unsigned char> filtered((stride + 1) * info.height);
+            uLongf filtered_size = static_cast<uLongf>(filtered.size());
+            if (uncompress(filtered.data(), &filtered_size, compressed.data(),
+                           static_cast<uLong>(compressed.size())) != Z_OK ||
+                filtered_size != filtered.size())
+            {
+                return false;
+            }
+
+            out.width = info.width;
+            out.height = info.height;
+            out.channels = channels;
+            out.pixels.assign(stride * info.height, 0);
+
+            for (uint32_t y = 0; y < info.height; ++y)
+            {
+                unsigned char filter = filtered[y * (stride + 1)];
+                const unsigned char* in = &filtered[y * (stride + 1) + 1];
+                unsigned char* row = &out.pixels[y * stride];
+                const unsigned char* prev = y > 0 ? &out.pixels[(y - 1) * stride] : nullptr;
+
+                for (size_t x = 0; x < stride; ++x)
+                {
+                    int a = x >= channels ? row[x - channels] : 0;
+                    int b = prev ? prev[x] : 0;
+                    int c = (prev && x >= channels) ? prev[x - channels] : 0;
+                    int predictor;
+                    switch (filter)
+                    {
+                        case 0: predictor = 0; break;
+                        case 1: predictor = a; break;
+                        case 2: predictor = b; break;
+                        case 3: predictor = (a + b) / 2; break;
+                        case 4: predictor = paeth(a, b, c); break;
+                        default: return false;
+                    }
+                    row[x] = static_cast<unsigned char>(in[x] + predictor);
+                }
+            }
+            return true;
+        }
+
+        // Box-filter downsampling by an integer factor
+        raster downsample(const raster& in, uint32_t factor)
+        {
+            raster out;
+            out.width = (in.width + factor - 1) / factor;
+            out.height = (in.height + factor - 1) / factor;
+            out.channels = in.channels;
+            out.pixels.resize(static_cast<size_t>(out.width) * out.height * out.channels);
+
+            std::vector<uint32_t> sums(out.channels);
+            for (uint32_t oy = 0; oy < out.height; ++oy)
+            {
+                uint32_t y_end = std::min(in.height, (oy + 1) * factor);
+                for (uint32_t ox = 0; ox < out.width; ++ox)
+                {
+                    uint32_t x_end = std::min(in.width, (ox + 1) * factor);
+                    std::fill(sums.begin(), sums.end(), 0);
+                    uint32_t count = 0;
+                    for (uint32_t y = oy * factor; y < y_end; ++y)
+                    {
+                        const unsigned char* p = &in.pixels[(static_cast<size_t>(y) * in.width + ox * factor) * in.channels];
+                        for (uint32_t x = ox * factor; x < x_end; ++x, p += in.channels)
+                        {
+                            for (unsigned int ch = 0; ch < in.channels; ++ch)
+                            {
+                                sums[ch] += p[ch];
+                            }
+                            ++count;
+                        }
+                    }
+                    unsigned char* dst = &out.pixels[(static_cast<size_t>(oy) * out.width + ox) * out.channels];
+                    for (unsigned int ch = 0; ch < out.channels; ++ch)
+                    {
+                        dst[ch] = static_cast<unsigned char>((sums[ch] + count / 2) / count);
+                    }
+                }
+            }
+            return out;
+        }
+
+        std::vector<png_chunk> rendering_chunks(const std::vector<png_chunk>& chunks)
+        {
+            std::vector<png_chunk> kept;
+            for (const auto& chunk : chunks)
+            {
+                // tRNS for gray/RGB is a color key and survives resampling
+                if (keep_ancillary(chunk.type))
+                {
+                    kept.push_back(chunk);
+                }
+            }
+            return kept;
+        }
+
+        // Encode with a per-row filter choice (minimum sum of absolute
+        // differences, the usual heuristic) and maximum compression
+        std::vector<unsigned char> encode(const raster& image, uint8_t color_type,
+                                          const std::vector<png_chunk>& kept, int level)
+        {
+            size_t stride = static_cast<size_t>(image.width) * image.channels;
+            std::vector<unsigned char> filtered;
+            filtered.reserve((stride + 1) * image.height);
+            std::vector<unsigned char> candidate(stride);
+            std::vector<unsigned char> best(stride);
+
+            for (uint32_t y = 0; y < image.height; ++y)
+            {
+                const unsigned char* row = &image.pixels[y * stride];
+                const unsigned char* prev = y > 0 ? &image.pixels[(y - 1) * stride] : nullptr;
+                uint64_t best_cost = UINT64_MAX;
+                unsigned char best_filter = 0;
+
+                for (unsigned char filter = 0; filter <= 4; ++filter)
+                {
+                    uint64_t cost = 0;
+                    for (size_t x = 0; x < stride; ++x)
+                    {
+                        int a = x >= image.channels ? row[x - image.channels] : 0;
+                        int b = prev ? prev[x] : 0;
+                        int c = (prev && x >= image.channels) ? prev[x - image.channels] : 0;
+                        int predictor = filter == 0 ? 0 : filter == 1 ? a : filter == 2 ? b
+                                      : filter == 3 ? (a + b) / 2 : paeth(a, b, c);
+                        candidate[x] = static_cast<unsigned char>(row[x] - predictor);
+                        cost += static_cast<uint64_t>(std::abs(static_cast<signed char>(candidate[x])));
+                    }
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_filter = filter;
+                        best.swap(candidate);
+                    }
+                }
+
+                filtered.push_back(best_filter);
+                filtered.insert(filtered.end(), best.begin(), best.end());
+            }
+
+            uLongf compressed_size = compressBound(static_cast<uLong>(filtered.size()));
+            std::vector<unsigned char> compressed(compressed_size);
+            if (compress2(compressed.data(), &compressed_size, filtered.data(),
+                          static_cast<uLong>(filtered.size()), level) != Z_OK)
+            {
+                return {};
+            }
+
+            std::vector<unsigned char> out(PNG_SIGNATURE, PNG_SIGNATURE + 8);
+            unsigned char ihdr[13];
+            for (int i = 0; i < 4; ++i)
+            {
+                ihdr[i] = static_cast<unsigned char>(image.width >> (24 - 8 * i));
+                ihdr[4 + i] = static_cast<unsigned char>(image.height >> (24 - 8 * i));
+            }
+            ihdr[8] = 8;
+            ihdr[9] = color_type;
+            ihdr[10] = 0;
+            ihdr[11] = 0;
+            ihdr[12] = 0;
+            write_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+            for (const auto& chunk : kept)
+            {
+                out.insert(out.end(), chunk.start, chunk.start + chunk.total_size());
+            }
+            write_chunk(out, "IDAT", compressed.data(), compressed_size);
+            write_chunk(out, "IEND", nullptr, 0);
+            return out;
+        }
+#endif
+    }
+
+    bool read_png_info(const unsigned char* data, size_t size, png_info& info)
+    {
+        // Signature, then IHDR is always the first chunk
+        if (size < 33 || std::memcmp(data, PNG_SIGNATURE, 8) != 0 ||
+            read_be32(data + 8) != 13 || std::memcmp(data + 12, "IHDR", 4) != 0)
+        {
+            return false;
+        }
+        info.width = read_be32(data + 16);
+        info.height = read_be32(data + 20);
+        info.bit_depth = data[24];
+        info.color_type = data[25];
+        info.interlace = data[28];
+        return info.width > 0 && info.height > 0;
+    }
+
+    std::vector<unsigned char> strip_png_ancillary(const std::vector<unsigned char>& data)
+    {
+        std::vector<png_chunk> chunks = read_chunks(data.data(), data.size());
+        if (chunks.empty())
+        {
+            return data;
+        }
+
+        std::vector<unsigned char> out(PNG_SIGNATURE, PNG_SIGNATURE + 8);
+        out.reserve(data.size());
+        for (const auto& chunk : chunks)
+        {
+            if (is_critical(chunk.type) || keep_ancillary(chunk.type))
+            {
+                out.insert(out.end(), chunk.start, chunk.start + chunk.total_size());
+            }
+        }
+        return out;
+    }
+
+    png_optimize_result optimize_png(const std::vector<unsigned char>& data, const png_budget& budget)
+    {
+        png_optimize_result result;
+        if (!read_png_info(data.data(), data.size(), result.info))
+        {
+            result.data = data;
+            return result;
+        }
+
+        result.data = strip_png_ancillary(data);
+        uint64_t pixels = static_cast<uint64_t>(result.info.width) * result.info.height;
+        bool over_pixels = budget.max_pixels > 0 && pixels > budget.max_pixels;
+        bool over_bytes = budget.max_bytes > 0 && result.data.size() > budget.max_bytes;
+        if (!over_pixels && !over_bytes)
+        {
+            return result;
+        }
+
+#if defined(XEUS_STATA_HAS_ZLIB)
+        std::vector<png_chunk> chunks = read_chunks(data.data(), data.size());
+        raster original;
+        if (!decode(chunks, result.info, original))
+        {
+            return result;
+        }
+
+        std::vector<png_chunk> kept = rendering_chunks(chunks);
+
+        uint32_t factor = 1;
+        while (budget.max_pixels > 0 &&
+               static_cast<uint64_t>((original.width + factor - 1) / factor) *
+               ((original.height + factor - 1) / factor) > budget.max_pixels)
+        {
+            ++factor;
+        }
+
+        // Recompress at the pixel budget, then step the factor up until the
+        // byte budget is met or the image would become too small to read
+        const uint32_t min_side = 200;
+        while (true)
+        {
+            raster scaled = factor == 1 ? original : downsample(original, factor);
+            std::vector<unsigned char> encoded = encode(scaled, result.info.color_type, kept, Z_BEST_COMPRESSION);
+            if (!encoded.empty() && (factor > 1 || encoded.size() < result.data.size()))
+            {
+                result.data.swap(encoded);
+                result.info.width = scaled.width;
+                result.info.height = scaled.height;
+                result.resampled = factor > 1;
+            }
+
+            bool fits = budget.max_bytes == 0 || result.data.size() <= budget.max_bytes;
+            uint32_t next_side = std::min(original.width, original.height) / (factor + 1);
+            if (fits || next_side < min_side)
+            {
+                break;
+            }
+            ++factor;
+        }
+#endif
+        return result;
+    }
+
+    png_optimize_result make_png_preview(const std::vector<unsigned char>& data, uint32_t max_side)
+    {
+        png_optimize_result result;
+#if defined(XEUS_STATA_HAS_ZLIB)
+        png_info info;
+        if (max_side == 0 || !read_png_info(data.data(), data.size(), info))
+        {
+            return result;
+        }
+
+        std::vector<png_chunk> chunks = read_chunks(data.data(), data.size());
+        raster original;
+        if (!decode(chunks, info, original))
+        {
+            return result;
+        }
+
+        uint32_t longest = std::max(original.width, original.height);
+        uint32_t factor = (longest + max_side - 1) / max_side;
+        raster scaled = factor > 1 ? downsample(original, factor) : std::move(original);
+        result.data = encode(scaled, info.color_type, rendering_chunks(chunks), Z_BEST_SPEED);
+        result.info = info;
+        result.info.width = scaled.width;
+        result.info.height = scaled.height;
+        result.resampled = factor > 1;
+#else
+        (void)data;
+        (void)max_side;
+#endif
+        return result;
+    }
+
+    std::string default_graph_dir()
+    {
+        const char* env_dir = std::getenv("XEUS_STATA_GRAPH_DIR");
+        if (env_dir && env_dir[0] != '\0')
+        {
+            return env_dir;
+        }
+
+        const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+        if (runtime_dir && runtime_dir[0] != '\0')
+        {
+            return std::string(runtime_dir) + "/xeus-stata/graphs";
+        }
+
+        return "/tmp/xeus-stata-" + std::to_string(getuid()) + "/graphs";
+    }
+
+} // namespace xeus_stata
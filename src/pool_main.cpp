@@ -0,0 +1,358 @@
+// xstata-pool: keeps idle, initialized Stata processes for the kernels of
+// one user. A kernel connects to the Unix socket, sends
+//
+//   acquire <stata path>
+//
+// and gets back "ok <pid>" with the PTY master attached (SCM_RIGHTS), or
+// an error message without one. The pool is then refilled in the
+// background.
+
+#include "xeus-stata/stata_spawn.hpp"
+#include "xeus-stata/private_dir.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    using xeus_stata::stata_process;
+
+    std::atomic<bool> g_running{true};
+
+    void stop_handler(int)
+    {
+        g_running = false;
+    }
+
+    class stata_pool
+    {
+    public:
+        stata_pool(const std::string& stata_path, size_t size)
+            : m_stata_path(stata_path)
+            , m_size(size)
+        {
+        }
+
+        ~stata_pool()
+        {
+            stop();
+        }
+
+        const std::string& stata_path() const
+        {
+            return m_stata_path;
+        }
+
+        void start()
+        {
+            m_refill = std::thread([this]() { refill(); });
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_changed.notify_all();
+            if (m_refill.joinable())
+            {
+                m_refill.join();
+            }
+            for (const auto& process : m_idle)
+            {
+                discard(process);
+            }
+            m_idle.clear();
+        }
+
+        // An idle process that is still alive, or false if there is none
+        bool take(stata_process& process)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while (!m_idle.empty())
+            {
+                process = m_idle.front();
+                m_idle.pop_front();
+                m_changed.notify_all();
+                if (kill(process.pid, 0) == 0)
+                {
+                    return true;
+                }
+                discard(process);
+            }
+            return false;
+        }
+
+        size_t idle() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_idle.size();
+        }
+
+    private:
+        static void discard(const stata_process& process)
+        {
+            kill(process.pid, SIGKILL);
+            close(process.master_fd);
+        }
+
+        void refill()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_stopping)
+            {
+                if (m_idle.size() >= m_size)
+                {
+                    m_changed.wait(lock);
+                    continue;
+                }
+
+                lock.unlock();
+                stata_process process;
+                bool ready = false;
+                try
+                {
+                    // Detached: the process must outlive a pool restart and
+                    // end with the kernel that takes it
+                    process = xeus_stata::spawn_stata(m_stata_path, true);
+                    ready = xeus_stata::initialize_stata(process, 30000);
+                    if (!ready)
+                    {
+                        discard(process);
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "xstata-pool: " << e.what() << std::endl;
+                }
+                lock.lock();
+
+                if (ready)
+                {
+                    m_idle.push_back(process);
+                }
+                else
+                {
+                    // No license or a bad path: retry slowly instead of
+                    // spinning on failed starts
+                    std::cerr << "xstata-pool: Stata did not start, retrying in 5 s" << std::endl;
+                    m_changed.wait_for(lock, std::chrono::seconds(5), [this]() { return m_stopping; });
+                }
+            }
+        }
+
+        std::string m_stata_path;
+        size_t m_size;
+        std::thread m_refill;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::deque<stata_process> m_idle;
+        bool m_stopping = false;
+    };
+
+    // Answer one kernel
+    void serve(int conn, stata_pool& pool)
+    {
+        struct timeval timeout = {1, 0};
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        int ignored = -1;
+        std::string request;
+        if (!xeus_stata::receive_fd(conn, ignored, request))
+        {
+            return;
+        }
+        if (ignored >= 0)
+        {
+            close(ignored);
+        }
+        request.erase(request.find_last_not_of("\r\n") + 1);
+
+        const std::string verb = "acquire ";
+        if (request.compare(0, verb.size(), verb) != 0)
+        {
+            xeus_stata::send_fd(conn, -1, "error unknown request");
+            return;
+        }
+        if (request.substr(verb.size()) != pool.stata_path())
+        {
+            xeus_stata::send_fd(conn, -1, "error pool runs " + pool.stata_path());
+            return;
+        }
+
+        stata_process process;
+        if (!pool.take(process))
+        {
+            xeus_stata::send_fd(conn, -1, "error no idle Stata");
+            return;
+        }
+
+        // The kernel now holds the only other copy of the master; once
+        // ours is closed, the kernel going away hangs Stata up
+        xeus_stata::send_fd(conn, process.master_fd, "ok " + std::to_string(process.pid));
+        close(process.master_fd);
+    }
+
+    int listen_on(const std::string& path)
+    {
+        // Kernels refuse a socket in a directory others can get at, so
+        // create it 0700 and refuse to serve from one that is not ours
+        std::string error;
+        std::filesystem::path dir = std::filesystem::path(path).parent_path();
+        if (!xeus_stata::ensure_private_dir(dir.string(), error))
+        {
+            std::cerr << "xstata-pool: cannot use " << dir.string() << ": " << error << std::endl;
+            return -1;
+        }
+
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "xstata-pool: socket path too long: " << path << std::endl;
+            return -1;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0)
+        {
+            std::cerr << "xstata-pool: socket: " << strerror(errno) << std::endl;
+            return -1;
+        }
+
+        // A socket file nobody answers on is left over from a dead pool
+        if (connect(sock, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0)
+        {
+            std::cerr << "xstata-pool: already running on " << path << std::endl;
+            close(sock);
+            return -1;
+        }
+        close(sock);
+        unlink(path.c_str());
+
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        mode_t old_mask = umask(0077);
+        int rc = bind(sock, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+        umask(old_mask);
+        if (rc != 0 || listen(sock, 16) != 0)
+        {
+            std::cerr << "xstata-pool: cannot listen on " << path << ": " << strerror(errno) << std::endl;
+            close(sock);
+            return -1;
+        }
+        return sock;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string socket_path = xeus_stata::default_pool_socket();
+    std::string stata_path;
+    size_t size = 2;
+
+    const char* size_env = std::getenv("XEUS_STATA_POOL_SIZE");
+    if (size_env && size_env[0] != '\0')
+    {
+        size = std::strtoul(size_env, nullptr, 10);
+    }
+    const char* env_path = std::getenv("STATA_PATH");
+    stata_path = env_path && env_path[0] != '\0' ? env_path : DEFAULT_STATA_PATH;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc)
+        {
+            size = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--socket" && i + 1 < argc)
+        {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--stata" && i + 1 < argc)
+        {
+            stata_path = argv[++i];
+        }
+        else
+        {
+            std::cout << "xstata-pool - keeps idle Stata processes for xeus-stata kernels" << std::endl;
+            std::cout << std::endl;
+            std::cout << "Usage:" << std::endl;
+            std::cout << "  xstata-pool [--size N] [--socket PATH] [--stata PATH]" << std::endl;
+            std::cout << std::endl;
+            std::cout << "Options:" << std::endl;
+            std::cout << "  --size N       Idle processes to keep (default 2, $XEUS_STATA_POOL_SIZE)" << std::endl;
+            std::cout << "  --socket PATH  Socket to listen on (default " << socket_path << ")" << std::endl;
+            std::cout << "  --stata PATH   Stata executable (default $STATA_PATH)" << std::endl;
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    int listener = listen_on(socket_path);
+    if (listener < 0)
+    {
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, stop_handler);
+    signal(SIGINT, stop_handler);
+
+    stata_pool pool(stata_path, size);
+    pool.start();
+    std::cerr << "xstata-pool: keeping " << size << " idle " << stata_path
+              << " on " << socket_path << std::endl;
+
+    while (g_running)
+    {
+        // Handed-over processes are still our children; reap them as the
+        // kernels that took them finish
+        while (waitpid(-1, nullptr, WNOHANG) > 0)
+        {
+        }
+
+        struct pollfd pfd = {listener, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0)
+        {
+            continue;
+        }
+        int conn = accept(listener, nullptr, nullptr);
+        if (conn < 0)
+        {
+            continue;
+        }
+        if (!xeus_stata::peer_is_same_user(conn))
+        {
+            close(conn);
+            continue;
+        }
+        serve(conn, pool);
+        close(conn);
+    }
+
+    close(listener);
+    unlink(socket_path.c_str());
+    pool.stop();
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include "xeus-stata/prefetch.hpp"
+#include "xeus-stata/stata_lexer.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+#include "xeus-stata/trace.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    namespace
+    {
+        enum class file_kind
+        {
+            dta,        // .dta added when there is no extension
+            delimited,  // .csv added
+            excel       // .xlsx or .xls
+        };
+
+        bool is_statement_end(const lexed_cell& cell, const token& tok)
+        {
+            return tok.kind == token_kind::end_of_statement || tok.kind == token_kind::open_brace ||
+                   tok.kind == token_kind::close_brace ||
+                   (tok.kind == token_kind::op && cell.code[tok.offset] == ',');
+        }
+
+        // A path starting at tokens[i]: a quoted string, or adjacent
+        // tokens such as data / big . dta. Empty if it uses macros; i ends
+        // up past the path.
+        std::string read_path(const lexed_cell& cell, size_t& i, size_t end)
+        {
+            while (i < end && (cell.tokens[i].kind == token_kind::comment ||
+                               cell.tokens[i].kind == token_kind::continuation))
+            {
+                ++i;
+            }
+            if (i >= end || is_statement_end(cell, cell.tokens[i]))
+            {
+                return "";
+            }
+
+            const token& first = cell.tokens[i];
+            if (first.kind == token_kind::string || first.kind == token_kind::compound_string)
+            {
+                ++i;
+                size_t quote = first.kind == token_kind::string ? 1 : 2;
+                std::string text = cell.text(first);
+                if (first.unterminated || text.size() < 2 * quote)
+                {
+                    return "";
+                }
+                // Compound quotes start with a backtick of their own
+                text = text.substr(quote, text.size() - 2 * quote);
+                return text.find('`') != std::string::npos || text.find('$') != std::string::npos ? "" : text;
+            }
+
+            std::string path;
+            bool usable = true;
+            size_t next_offset = first.offset;
+            while (i < end && cell.tokens[i].offset == next_offset && !is_statement_end(cell, cell.tokens[i]) &&
+                   cell.tokens[i].kind != token_kind::comment)
+            {
+                const token& tok = cell.tokens[i];
+                usable = usable && tok.kind != token_kind::local_macro && tok.kind != token_kind::global_macro &&
+                         tok.kind != token_kind::string && tok.kind != token_kind::compound_string;
+                path += cell.text(tok);
+                next_offset = tok.offset + tok.length;
+                ++i;
+            }
+            return usable ? path : "";
+        }
+
+        std::string resolve(const std::string& path, const std::string& pwd)
+        {
+            if (path.empty() || path.find("://") != std::string::npos)
+            {
+                return "";
+            }
+            fs::path resolved(path);
+            if (path[0] == '~')
+            {
+                const char* home = std::getenv("HOME");
+                resolved = fs::path(home ? home : "") / path.substr(path.size() > 1 && path[1] == '/' ? 2 : 1);
+            }
+            else if (resolved.is_relative())
+            {
+                resolved = fs::path(pwd) / resolved;
+            }
+            return resolved.lexically_normal().string();
+        }
+
+        // The file Stata would open, or empty if there is none
+        std::string existing_file(const std::string& path, file_kind kind)
+        {
+            std::vector<std::string> candidates = {path};
+            if (!fs::path(path).has_extension())
+            {
+                switch (kind)
+                {
+                    case file_kind::dta: candidates = {path + ".dta"}; break;
+                    case file_kind::delimited: candidates = {path + ".csv", path}; break;
+                    case file_kind::excel: candidates = {path + ".xlsx", path + ".xls"}; break;
+                }
+            }
+            for (const auto& candidate : candidates)
+            {
+                std::error_code ec;
+                if (fs::is_regular_file(candidate, ec))
+                {
+                    return candidate;
+                }
+            }
+            return "";
+        }
+
+        bool is_word(const lexed_cell& cell, const token& tok, const char* word)
+        {
+            return tok.kind == token_kind::word && cell.text(tok) == word;
+        }
+
+        void prefetch_file(const std::string& path, uint64_t max_bytes)
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            trace_scope trace("prefetch.file", "prefetch");
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0)
+            {
+                uint64_t length = std::min<uint64_t>(static_cast<uint64_t>(st.st_size), max_bytes);
+                trace.set_value(static_cast<int64_t>(length));
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+                // fadvise starts asynchronous reads; readahead makes sure
+                // they cover the whole range, blocking only this thread
+                posix_fadvise(fd, 0, static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+                readahead(fd, 0, static_cast<size_t>(length));
+#else
+                struct radvisory advice;
+                advice.ra_offset = 0;
+                advice.ra_count = static_cast<int>(std::min<uint64_t>(length, INT32_MAX));
+                fcntl(fd, F_RDADVISE, &advice);
+#endif
+            }
+            close(fd);
+#else
+            (void)path;
+            (void)max_bytes;
+#endif
+        }
+    }
+
+    std::vector<std::string> referenced_data_files(const std::string& code, const std::string& pwd)
+    {
+        auto cell = lex_cell(code);
+        const auto& tokens = cell->tokens;
+        std::string dir = pwd;
+        std::vector<std::string> files;
+
+        auto add = [&files, &dir](const std::string& path, file_kind kind) {
+            std::string file = existing_file(resolve(path, dir), kind);
+            if (!file.empty() && std::find(files.begin(), files.end(), file) == files.end())
+            {
+                files.push_back(file);
+            }
+        };
+
+        for (size_t start : cell->command_tokens())
+        {
+            size_t end = start + 1;
+            while (end < tokens.size() && tokens[end].kind != token_kind::end_of_statement &&
+                   tokens[end].kind != token_kind::open_brace && tokens[end].kind != token_kind::close_brace)
+            {
+                ++end;
+            }
+
+            std::string command = cell->text(tokens[start]);
+            size_t i = start + 1;
+            if (command == "cd" || command == "chdir")
+            {
+                std::string target = resolve(read_path(*cell, i, end), dir);
+                if (!target.empty())
+                {
+                    dir = target;
+                }
+                continue;
+            }
+
+            file_kind kind = file_kind::dta;
+            bool direct = false;    // the path may follow the command without using
+            if (command == "u" || command == "us" || command == "use")
+            {
+                direct = true;
+            }
+            else if (command == "import" && i < end && tokens[i].kind == token_kind::word)
+            {
+                std::string sub = cell->text(tokens[i]);
+                if (sub.compare(0, 5, "delim") == 0)
+                {
+                    kind = file_kind::delimited;
+                }
+                else if (sub == "excel")
+                {
+                    kind = file_kind::excel;
+                }
+                else
+                {
+                    continue;
+                }
+                direct = true;
+                ++i;
+            }
+            else if (command == "insheet")
+            {
+                kind = file_kind::delimited;
+            }
+            else if (command != "merge" && command != "append" && command != "joinby" && command != "cross")
+            {
+                continue;
+            }
+
+            // using, before any options, takes precedence: use x y using f
+            size_t using_at = end;
+            for (size_t j = i; j < end && !is_statement_end(*cell, tokens[j]); ++j)
+            {
+                if (is_word(*cell, tokens[j], "using"))
+                {
+                    using_at = j;
+                    break;
+                }
+            }
+
+            if (using_at < end)
+            {
+                // append using a b c
+                i = using_at + 1;
+                while (i < end && !is_statement_end(*cell, tokens[i]))
+                {
+                    size_t before = i;
+                    std::string path = read_path(*cell, i, end);
+                    if (!path.empty())
+                    {
+                        add(path, kind);
+                    }
+                    if (i == before)
+                    {
+                        ++i;
+                    }
+                }
+            }
+            else if (direct)
+            {
+                std::string path = read_path(*cell, i, end);
+                if (!path.empty())
+                {
+                    add(path, kind);
+                }
+            }
+        }
+        return files;
+    }
+
+    data_prefetcher::data_prefetcher(uint64_t max_bytes)
+        : m_max_bytes(max_bytes)
+    {
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    data_prefetcher::~data_prefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_queue.clear();
+        }
+        m_wakeup.notify_all();
+        m_thread.join();
+    }
+
+    void data_prefetcher::prefetch(const std::vector<std::string>& files)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.insert(m_queue.end(), files.begin(), files.end());
+        }
+        m_wakeup.notify_all();
+    }
+
+    void data_prefetcher::run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wakeup.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_stopping)
+            {
+                return;
+            }
+            std::string file = std::move(m_queue.front());
+            m_queue.pop_front();
+            lock.unlock();
+            prefetch_file(file, m_max_bytes);
+            lock.lock();
+        }
+    }
+
+} // namespace xeus_stata
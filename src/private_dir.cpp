@@ -0,0 +1,105 @@
+#include "xeus-stata/private_dir.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+
+#if !defined(XEUS_STATA_PLATFORM_WINDOWS)
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    namespace
+    {
+        bool fail(std::string& error, const fs::path& path, const std::string& reason)
+        {
+            error = path.string() + " " + reason;
+            return false;
+        }
+
+        fs::path normalized(const std::string& path)
+        {
+            std::error_code ec;
+            fs::path result = fs::absolute(path, ec).lexically_normal();
+            if (!result.has_filename() && result.has_parent_path() && result != result.root_path())
+            {
+                result = result.parent_path();
+            }
+            return result;
+        }
+    }
+
+    bool check_private_path(const std::string& path, std::string& error)
+    {
+#if defined(XEUS_STATA_PLATFORM_WINDOWS)
+        (void)path;
+        (void)error;
+        return true;
+#else
+        fs::path target = normalized(path);
+        struct stat st;
+        if (lstat(target.c_str(), &st) != 0)
+        {
+            return fail(error, target, std::string("cannot be read: ") + std::strerror(errno));
+        }
+        if (S_ISLNK(st.st_mode))
+        {
+            return fail(error, target, "is a symbolic link");
+        }
+        if (st.st_uid != geteuid())
+        {
+            return fail(error, target, "is owned by another user");
+        }
+        if (st.st_mode & (S_IWGRP | S_IWOTH))
+        {
+            return fail(error, target, "is writable by group or others");
+        }
+
+        // Whoever can write to a directory above can swap the path out
+        for (fs::path dir = target.parent_path(); !dir.empty(); dir = dir.parent_path())
+        {
+            if (stat(dir.c_str(), &st) != 0)
+            {
+                return fail(error, dir, std::string("cannot be read: ") + std::strerror(errno));
+            }
+            if (st.st_uid != geteuid() && st.st_uid != 0)
+            {
+                return fail(error, dir, "is owned by another user");
+            }
+            if ((st.st_mode & (S_IWGRP | S_IWOTH)) && !(st.st_mode & S_ISVTX))
+            {
+                return fail(error, dir, "is writable by group or others");
+            }
+            if (dir == dir.root_path())
+            {
+                break;
+            }
+        }
+        return true;
+#endif
+    }
+
+    bool ensure_private_dir(const std::string& path, std::string& error)
+    {
+#if !defined(XEUS_STATA_PLATFORM_WINDOWS)
+        fs::path target = normalized(path);
+        fs::path current;
+        struct stat st;
+        for (const auto& part : target)
+        {
+            current /= part;
+            if (stat(current.c_str(), &st) != 0 && mkdir(current.c_str(), 0700) != 0 && errno != EEXIST)
+            {
+                return fail(error, current, std::string("cannot be created: ") + std::strerror(errno));
+            }
+        }
+#endif
+        return check_private_path(path, error);
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,180 @@
+#include "xeus-stata/profile.hpp"
+#include "xeus-stata/stata_parser.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <regex>
+#include <sstream>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        struct call_site
+        {
+            size_t column;      // where the name starts; callees are indented further
+            size_t row;         // index into the aggregated rows
+            double total_s;
+            double children_s = 0;
+        };
+
+        std::string format_seconds(double seconds)
+        {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(3) << seconds;
+            return out.str();
+        }
+
+        std::string format_share(double part, double whole)
+        {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(1) << (whole > 0 ? 100.0 * part / whole : 0.0) << "%";
+            return out.str();
+        }
+    }
+
+    profile_report parse_profiler_report(const std::string& output)
+    {
+        static const std::regex site_re(R"(^(\s*)(\d+)\s+(\d*\.?\d+)(\s+)(\S+)\s*$)");
+        static const std::regex count_re(R"(Overall total count\s*=\s*(\d+))");
+        static const std::regex time_re(R"(Overall total time\s*=\s*(\d*\.?\d+))");
+
+        profile_report report;
+        std::map<std::string, size_t> index;
+        std::vector<call_site> sites;
+        std::vector<call_site> stack;
+
+        // Self time is known once a call site's callees have all been
+        // read, i.e. when it leaves the stack
+        auto close_site = [&report](const call_site& site) {
+            report.rows[site.row].self_s += std::max(0.0, site.total_s - site.children_s);
+        };
+
+        std::stringstream ss(output);
+        std::string line;
+        std::smatch m;
+        while (std::getline(ss, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (std::regex_search(line, m, count_re))
+            {
+                report.total_count = std::stoll(m[1]);
+                continue;
+            }
+            if (std::regex_search(line, m, time_re))
+            {
+                report.total_s = std::stod(m[1]);
+                continue;
+            }
+            if (!std::regex_match(line, m, site_re))
+            {
+                continue;
+            }
+
+            std::string program = m[5];
+            call_site site;
+            site.column = static_cast<size_t>(m.position(5));
+            site.total_s = std::stod(m[3]);
+
+            auto found = index.find(program);
+            if (found == index.end())
+            {
+                found = index.emplace(program, report.rows.size()).first;
+                report.rows.push_back(profile_row{program, 0, 0, 0});
+            }
+            site.row = found->second;
+            report.rows[site.row].calls += std::stoll(m[2]);
+
+            while (!stack.empty() && stack.back().column >= site.column)
+            {
+                close_site(stack.back());
+                stack.pop_back();
+            }
+            if (stack.empty())
+            {
+                // Only top-level time counts toward the total, recursion
+                // and nesting would count it twice
+                report.rows[site.row].total_s += site.total_s;
+            }
+            else
+            {
+                stack.back().children_s += site.total_s;
+                if (std::none_of(stack.begin(), stack.end(),
+                                 [&site](const call_site& s) { return s.row == site.row; }))
+                {
+                    report.rows[site.row].total_s += site.total_s;
+                }
+            }
+            stack.push_back(site);
+        }
+        while (!stack.empty())
+        {
+            close_site(stack.back());
+            stack.pop_back();
+        }
+
+        std::stable_sort(report.rows.begin(), report.rows.end(), [](const profile_row& a, const profile_row& b) {
+            return a.self_s > b.self_s;
+        });
+        return report;
+    }
+
+    std::string format_profile_text(const profile_report& report)
+    {
+        std::ostringstream out;
+        out << std::left << std::setw(32) << "program" << std::right << std::setw(10) << "calls"
+            << std::setw(12) << "total (s)" << std::setw(12) << "self (s)" << std::setw(9) << "self %" << "\n";
+        for (const auto& row : report.rows)
+        {
+            out << std::left << std::setw(32) << row.program << std::right << std::setw(10) << row.calls
+                << std::setw(12) << format_seconds(row.total_s) << std::setw(12) << format_seconds(row.self_s)
+                << std::setw(9) << format_share(row.self_s, report.total_s) << "\n";
+        }
+        out << "Overall: " << report.total_count << " calls, " << format_seconds(report.total_s) << " s";
+        return out.str();
+    }
+
+    std::string format_profile_html(const profile_report& report)
+    {
+        std::ostringstream out;
+        out << "<table class=\"stata-profile\"><thead><tr>"
+            << "<th style=\"text-align:left\">Program</th><th>Calls</th><th>Total (s)</th>"
+            << "<th>Self (s)</th><th>Self %</th></tr></thead><tbody>";
+        for (const auto& row : report.rows)
+        {
+            out << "<tr><td style=\"text-align:left\"><code>" << html_escape(row.program) << "</code></td>"
+                << "<td>" << row.calls << "</td>"
+                << "<td>" << format_seconds(row.total_s) << "</td>"
+                << "<td>" << format_seconds(row.self_s) << "</td>"
+                << "<td>" << format_share(row.self_s, report.total_s) << "</td></tr>";
+        }
+        out << "</tbody><tfoot><tr><th style=\"text-align:left\">Overall</th>"
+            << "<td>" << report.total_count << "</td><td>" << format_seconds(report.total_s) << "</td>"
+            << "<td></td><td></td></tr></tfoot></table>";
+        return out.str();
+    }
+
+    nl::json profile_to_json(const profile_report& report)
+    {
+        nl::json rows = nl::json::array();
+        for (const auto& row : report.rows)
+        {
+            rows.push_back({
+                {"program", row.program},
+                {"calls", row.calls},
+                {"total_s", row.total_s},
+                {"self_s", row.self_s}
+            });
+        }
+        return {
+            {"rows", rows},
+            {"total_count", report.total_count},
+            {"total_s", report.total_s}
+        };
+    }
+
+} // namespace xeus_stata
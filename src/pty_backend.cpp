@@ -0,0 +1,999 @@
+#include "xeus-stata/session_backend.hpp"
+#include "xeus-stata/stata_parser.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+#include "xeus-stata/trace.hpp"
+#include "xeus-stata/stata_spawn.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fstream>
+#include <random>
+#include <future>
+#include <atomic>
+#include <filesystem>
+#include <chrono>
+#include <sys/stat.h>
+
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <signal.h>
+    #include <poll.h>
+    #if !defined(__APPLE__)
+        #include <sys/syscall.h>
+    #endif
+#endif
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // Set on the thread that brings up a replacement Stata process, so
+        // that commands it issues do not wait on themselves
+        thread_local bool t_respawning = false;
+
+        bool env_flag(const char* name, bool default_value)
+        {
+            const char* value = std::getenv(name);
+            if (!value || value[0] == '\0')
+            {
+                return default_value;
+            }
+            return std::string(value) != "0" && std::string(value) != "false";
+        }
+
+        // Longest line the tty line discipline accepts in canonical mode
+        const size_t MAX_TYPED_LINE = 4000;
+
+        // XEUS_STATA_DOFILE_MODE=never types cells into the console
+        // instead of running them from the scratch do-file
+        bool typed_cells_from_env()
+        {
+            const char* value = std::getenv("XEUS_STATA_DOFILE_MODE");
+            return value && std::string(value) == "never";
+        }
+
+        // Length of the longest line of code
+        size_t longest_line(const std::string& code)
+        {
+            size_t longest = 0;
+            size_t line_start = 0;
+            while (line_start < code.size())
+            {
+                size_t line_end = code.find('\n', line_start);
+                if (line_end == std::string::npos)
+                {
+                    line_end = code.size();
+                }
+                longest = std::max(longest, line_end - line_start);
+                line_start = line_end + 1;
+            }
+            return longest;
+        }
+    }
+
+    class pty_backend final : public session_backend
+    {
+    public:
+        explicit pty_backend(const std::string& stata_path)
+            : m_stata_path(stata_path)
+            , m_master_fd(-1)
+            , m_pid(-1)
+            , m_pidfd(-1)
+            , m_use_pool(env_flag("XEUS_STATA_POOL", false))
+            , m_pool_socket(default_pool_socket())
+            , m_ready(false)
+            , m_respawn_enabled(env_flag("XEUS_STATA_RESPAWN", true))
+            , m_typed_cells(typed_cells_from_env())
+            , m_scratch_dir(make_scratch_dir())
+            , m_log_capture(std::getenv("XEUS_STATA_CAPTURE") && std::string(std::getenv("XEUS_STATA_CAPTURE")) == "log")
+            , m_log_path(m_scratch_dir + "/output.smcl")
+            , m_log_reopen(false)
+        {
+            const char* grace = std::getenv("XEUS_STATA_SHUTDOWN_GRACE_MS");
+            if (grace && grace[0] != '\0')
+            {
+                m_shutdown_grace_ms = std::atoi(grace);
+            }
+            const char* timeout = std::getenv("XEUS_STATA_EXECUTE_TIMEOUT_MS");
+            if (timeout && timeout[0] != '\0')
+            {
+                m_execute_timeout_ms = std::atoi(timeout);
+            }
+
+            if (m_stata_path.empty())
+            {
+                // Try environment variable first
+                const char* env_path = std::getenv("STATA_PATH");
+                if (env_path && env_path[0] != '\0')
+                {
+                    m_stata_path = env_path;
+                }
+                else
+                {
+                    m_stata_path = DEFAULT_STATA_PATH;
+                }
+            }
+
+            start_stata();
+        }
+
+        ~pty_backend() override
+        {
+            if (m_respawn.valid())
+            {
+                m_respawn.wait();
+            }
+            shutdown();
+
+            std::error_code ec;
+            std::filesystem::remove_all(m_scratch_dir, ec);
+        }
+
+        void start_stata()
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            // An idle Stata from the xstata-pool daemon skips the cold
+            // start; without a daemon, start one here
+            stata_process process;
+            bool pooled = m_use_pool && acquire_pooled_stata(m_pool_socket, m_stata_path, process);
+            if (!pooled)
+            {
+                process = spawn_stata(m_stata_path, false);
+            }
+            m_master_fd = process.master_fd;
+            m_pid = process.pid;
+            m_own_child = process.own_child;
+
+            // Track liveness through a pidfd where the kernel supports it,
+            // it becomes readable the moment the child exits
+#if defined(SYS_pidfd_open)
+            m_pidfd = static_cast<int>(syscall(SYS_pidfd_open, m_pid.load(), 0));
+#endif
+
+            if (pooled)
+            {
+                // Already configured by the pool, but started in its
+                // working directory (and with its environment). Read the
+                // cd through a sync marker so its echo and prompt are not
+                // taken for the first cell's output.
+                std::error_code ec;
+                std::string cwd = std::filesystem::current_path(ec).string();
+                if (!ec)
+                {
+                    std::string sync = generate_execution_marker();
+                    write_command("quietly capture cd " + compound_quote(cwd) + "\n"
+                                  "display \"__SYNC__\" \"" + sync + "__\"");
+                    read_until_marker("__SYNC__" + sync + "__", 5000, false);
+                }
+            }
+            else
+            {
+                // Wait for Stata to start and show prompt
+                std::string startup_output = read_until_prompt(5000); // 5 second timeout
+
+                // Set up initial configuration
+                // Disable pagination
+                write_command("set more off");
+                // Set line size for better output
+                write_command("set linesize 200");
+            }
+
+            // In log capture mode results are read from an SMCL log that
+            // runs for the whole session instead of from the console
+            if (m_log_capture)
+            {
+                write_command("quietly log using \"" + m_log_path + "\", smcl replace name(_xstata) nomsg");
+                m_log_reopen = false;
+            }
+
+            m_ready = true;
+#else
+            throw std::runtime_error("Windows support not yet implemented");
+#endif
+        }
+
+        std::string name() const override
+        {
+            return "pty";
+        }
+
+        execution_result execute(const std::string& code, const expression_list& expressions = {}) override
+        {
+            wait_for_respawn();
+
+            if (!m_ready)
+            {
+                throw std::runtime_error("Stata session not ready");
+            }
+
+            // Fail fast if the process died while the kernel was idle
+            check_alive();
+
+            trace_scope trace("session.execute", "session");
+            stopwatch total_timer;
+            executing_scope executing(m_executing);
+            m_interrupted = false;
+            m_interrupt_ms = 0;
+            m_read_ms = 0;
+            m_read_bytes = 0;
+            m_read_batches = 0;
+
+            // Generate unique marker for detecting command completion
+            std::string marker = generate_execution_marker();
+
+            // Generate temp file for potential graph export
+            std::string temp_graph = generate_temp_filename(".png");
+
+            // Make sure file doesn't exist before we start
+            unlink(temp_graph.c_str());
+
+            // Cells go through a do-file in the scratch directory instead
+            // of being typed into the PTY, where long lines hit the tty line
+            // limit. It runs under capture noisily so the trailer gets the
+            // cell's exact return code, whatever the cell's size; typed
+            // cells (XEUS_STATA_DOFILE_MODE=never) leave it to the output
+            // scan. include (unlike do) keeps the cell's locals in scope.
+            // Timer 100 is reserved for the kernel.
+            std::string wrapped_code = "quietly capture timer clear 100\n"
+                                       "quietly capture timer on 100\n";
+            std::string rc_expression = ".";
+            if (!m_typed_cells)
+            {
+                std::string dofile = m_scratch_dir + "/cell.do";
+                std::ofstream out(dofile, std::ios::binary | std::ios::trunc);
+                out << code << "\n";
+                out.close();
+                if (!out)
+                {
+                    throw std::runtime_error("Failed to write " + dofile);
+                }
+                wrapped_code += "capture noisily include \"" + dofile + "\"\n"
+                                "local __xstata_rc = _rc\n";
+                rc_expression = "`__xstata_rc'";
+            }
+            else if (longest_line(code) > MAX_TYPED_LINE)
+            {
+                throw std::runtime_error("A line of this cell is longer than " + std::to_string(MAX_TYPED_LINE) +
+                                         " bytes and cannot be typed into the console; unset XEUS_STATA_DOFILE_MODE=never");
+            }
+            else
+            {
+                wrapped_code += code + "\n";
+            }
+            wrapped_code += "quietly capture timer off 100\n";
+
+            // Reopen the capture log if a cell closed it (log close _all)
+            if (m_log_capture && m_log_reopen)
+            {
+                wrapped_code = "capture log close _xstata\n"
+                               "quietly log using \"" + m_log_path + "\", smcl append name(_xstata) nomsg\n" +
+                               wrapped_code;
+                m_log_reopen = false;
+            }
+            std::streamoff log_offset = m_log_capture ? log_size() : 0;
+
+            // user_expressions still see the cell's r() and e()
+            wrapped_code += expressions_command(expressions);
+
+            // The cell's r() results survive the wrapper
+            wrapped_code += "_return hold xstata_r\n";
+
+            // Wrap code with automatic graph export and marker
+            // Check if a graph exists, export it, then drop all graphs to prevent re-export
+            wrapped_code += "quietly capture graph describe Graph\n";
+            wrapped_code += "if (_rc == 0) {\n";
+            wrapped_code += "  quietly graph export \"" + temp_graph + "\", replace\n";
+            wrapped_code += "}\n";
+            wrapped_code += "quietly graph drop _all\n";
+
+            // Trailer with the return code and data state, then the marker.
+            // The marker literal is split so its echo does not match.
+            wrapped_code += "quietly capture timer list 100\n";
+            wrapped_code += trailer_command(rc_expression, "r(t100) * 1000");
+            if (rc_expression != ".")
+            {
+                wrapped_code += "local __xstata_rc\n";
+            }
+            wrapped_code += "_return restore xstata_r\n";
+            wrapped_code += "display \"__MARKER__\" \"" + marker + "__\"";
+
+            // Write command
+            stopwatch stage_timer;
+            write_command(wrapped_code);
+            double write_ms = stage_timer.elapsed_ms();
+
+            // Read output until we see the marker. There is no limit by
+            // default: a dead Stata shows up on the pidfd or as a hangup,
+            // and a stuck one can be interrupted.
+            stage_timer.restart();
+            bool finished = false;
+            std::string output = read_until_marker("__MARKER__" + marker + "__", m_execute_timeout_ms, true, &finished);
+            double wait_ms = stage_timer.elapsed_ms();
+            if (!finished)
+            {
+                unlink(temp_graph.c_str());
+                settle_after_timeout();
+            }
+
+            // Interrupt-to-idle latency, whether the break was seen or the
+            // cell finished on its own first
+            int64_t interrupt_requested = m_interrupt_requested_ns.exchange(0);
+            if (interrupt_requested != 0)
+            {
+                m_interrupt_ms = static_cast<double>(steady_now_ns() - interrupt_requested) / 1e6;
+            }
+
+            // Parse the output
+            stage_timer.restart();
+            execution_result result;
+            bool parsed = false;
+            if (m_log_capture && !m_interrupted)
+            {
+                trace_scope parse_trace("parser.parse_smcl_log", "parser");
+                parsed = read_log_output("__MARKER__" + marker + "__", log_offset, result);
+                if (!parsed)
+                {
+                    // The log is gone or stalled, fall back to the console
+                    // for this cell and reopen the log for the next one
+                    m_log_reopen = true;
+                }
+            }
+            if (!parsed)
+            {
+                trace_scope parse_trace("parser.parse_execution_output", "parser");
+                parse_trace.set_value(static_cast<int64_t>(output.size()));
+                result = parse_execution_output(output);
+            }
+            apply_trailer(result);
+            apply_expressions(result, expressions);
+
+            result.timing.parse_ms = stage_timer.elapsed_ms();
+            result.timing.write_ms = write_ms;
+            result.timing.pty_read_ms = m_read_ms;
+            result.timing.stata_ms = wait_ms - m_read_ms;
+            result.timing.bytes_written = wrapped_code.size() + 1;
+            result.timing.bytes_read = m_read_bytes;
+            result.timing.read_batches = m_read_batches;
+            result.timing.interrupt_ms = m_interrupt_ms;
+            result.timing.output_bytes = result.output.size();
+
+            // Check if temp graph file was created (it should not exist before, only after)
+            struct stat buffer;
+            if (stat(temp_graph.c_str(), &buffer) == 0 && buffer.st_size > 0)
+            {
+                // File exists and has content, add to result
+                result.graph_files.push_back(temp_graph);
+            }
+
+            result.timing.total_session_ms = total_timer.elapsed_ms();
+
+            return result;
+        }
+
+        bool is_ready() const override
+        {
+            return m_ready || m_respawn.valid();
+        }
+
+        int get_pid() const override
+        {
+            return m_pid;
+        }
+
+        void set_respawn_callback(std::function<void()> callback) override
+        {
+            m_respawn_callback = std::move(callback);
+        }
+
+        void set_wait_callback(std::function<void()> callback) override
+        {
+            m_wait_callback = std::move(callback);
+        }
+
+        void shutdown() override
+        {
+            if (m_pid > 0)
+            {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+                // Send exit command, ignoring failures since the process
+                // may already be gone
+                const char exit_cmd[] = "exit, clear\n";
+                ssize_t ignored = write(m_master_fd, exit_cmd, sizeof(exit_cmd) - 1);
+                (void)ignored;
+
+                // Give Stata a bounded grace period to exit on its own,
+                // then escalate
+                if (!wait_for_exit(m_shutdown_grace_ms))
+                {
+                    kill(m_pid, SIGTERM);
+                    if (!wait_for_exit(500))
+                    {
+                        kill(m_pid, SIGKILL);
+                        int status;
+                        waitpid(m_pid, &status, 0);
+                    }
+                }
+
+                m_pid = -1;
+#endif
+            }
+
+            if (m_pidfd >= 0)
+            {
+                close(m_pidfd);
+                m_pidfd = -1;
+            }
+
+            if (m_master_fd >= 0)
+            {
+                close(m_master_fd);
+                m_master_fd = -1;
+            }
+
+            m_ready = false;
+        }
+
+        void interrupt() override
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            // An idle Stata would answer with a stray --Break-- that ends
+            // up in the next cell's output
+            if (m_pid > 0 && m_executing)
+            {
+                m_interrupt_requested_ns = steady_now_ns();
+                kill(m_pid, SIGINT);
+            }
+#endif
+        }
+
+    private:
+        std::streamoff log_size() const
+        {
+            struct stat st;
+            return stat(m_log_path.c_str(), &st) == 0 ? static_cast<std::streamoff>(st.st_size) : 0;
+        }
+
+        // Read the cell's part of the SMCL log, starting at offset, until the
+        // marker shows up. The console marker has already been seen, so the
+        // log only needs a moment to catch up.
+        bool read_log_output(const std::string& marker, std::streamoff offset, execution_result& result)
+        {
+            const int timeout_ms = 2000;
+            stopwatch timer;
+            while (true)
+            {
+                std::ifstream log(m_log_path, std::ios::binary);
+                if (log)
+                {
+                    log.seekg(offset);
+                    std::string chunk((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+
+                    bool found_marker = false;
+                    result = parse_smcl_execution_output(chunk, marker, found_marker);
+                    if (found_marker)
+                    {
+                        m_read_bytes += chunk.size();
+                        return true;
+                    }
+                }
+
+                if (timer.elapsed_ms() > timeout_ms)
+                {
+                    return false;
+                }
+                usleep(5000);
+            }
+        }
+
+        void wait_for_respawn()
+        {
+            if (m_respawn.valid() && !t_respawning)
+            {
+                // Rethrows if the replacement process failed to start
+                m_respawn.get();
+            }
+        }
+
+        // Non-blocking liveness check, throws if the child has exited
+        void check_alive()
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            if (m_pid <= 0)
+            {
+                return;
+            }
+
+            if (m_pidfd >= 0)
+            {
+                struct pollfd pfd = {m_pidfd, POLLIN, 0};
+                if (poll(&pfd, 1, 0) > 0)
+                {
+                    handle_child_exit();
+                }
+                return;
+            }
+
+            if (!m_own_child)
+            {
+                if (kill(m_pid, 0) != 0 && errno == ESRCH)
+                {
+                    handle_child_exit();
+                }
+                return;
+            }
+
+            int status;
+            if (waitpid(m_pid, &status, WNOHANG) == m_pid)
+            {
+                handle_child_exit(&status);
+            }
+#endif
+        }
+
+        // Reap the dead child, schedule a replacement and fail the current
+        // command with the exit status or signal
+        [[noreturn]] void handle_child_exit(const int* reaped_status = nullptr)
+        {
+            // Only replace a process that made it through startup, otherwise
+            // a bad STATA_PATH would respawn forever
+            bool was_ready = m_ready;
+            int status = 0;
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            if (reaped_status)
+            {
+                status = *reaped_status;
+            }
+            else if (!m_own_child)
+            {
+                // Reaped by the pool daemon, only make sure it is gone
+                kill(m_pid, SIGKILL);
+                status = -1;
+            }
+            else
+            {
+                // Give a hung-up but still running child a moment to exit,
+                // then make sure it is gone
+                pid_t waited = 0;
+                for (int i = 0; i < 50 && waited == 0; ++i)
+                {
+                    waited = waitpid(m_pid, &status, WNOHANG);
+                    if (waited == 0)
+                    {
+                        usleep(2000);
+                    }
+                }
+                if (waited == 0)
+                {
+                    kill(m_pid, SIGKILL);
+                    waitpid(m_pid, &status, 0);
+                }
+            }
+#endif
+
+            int exit_status = -1;
+            int signal_number = 0;
+            std::string description;
+            if (status == -1)
+            {
+                description = "exited";
+            }
+            else if (WIFEXITED(status))
+            {
+                exit_status = WEXITSTATUS(status);
+                description = "exited with status " + std::to_string(exit_status);
+            }
+            else if (WIFSIGNALED(status))
+            {
+                signal_number = WTERMSIG(status);
+                description = "was killed by signal " + std::to_string(signal_number) +
+                              " (" + strsignal(signal_number) + ")";
+            }
+            else
+            {
+                description = "exited";
+            }
+
+
+            // The process is gone, release its resources without trying to
+            // talk to it
+            m_pid = -1;
+            shutdown();
+
+            std::string message = "Stata process " + description;
+            if (m_respawn_enabled && was_ready && !t_respawning)
+            {
+                schedule_respawn();
+                message += "; a new Stata process is starting";
+            }
+
+            throw stata_process_error(message, exit_status, signal_number);
+        }
+
+        void schedule_respawn()
+        {
+            m_respawn = std::async(std::launch::async, [this]() {
+                struct respawn_scope
+                {
+                    respawn_scope() { t_respawning = true; }
+                    ~respawn_scope() { t_respawning = false; }
+                } scope;
+
+                start_stata();
+
+                const char* init_do = std::getenv("XEUS_STATA_INIT_DO");
+                if (init_do && init_do[0] != '\0')
+                {
+                    auto result = execute("quietly do \"" + std::string(init_do) + "\"");
+                    if (result.is_error)
+                    {
+                        std::cerr << "Initialization do-file failed after respawn: r("
+                                  << result.error_code << ")" << std::endl;
+                    }
+                }
+
+                if (m_respawn_callback)
+                {
+                    try
+                    {
+                        m_respawn_callback();
+                    }
+                    catch (const std::exception& e)
+                    {
+                        std::cerr << "Respawn callback failed: " << e.what() << std::endl;
+                    }
+                }
+            });
+        }
+
+        std::string generate_temp_filename(const std::string& extension)
+        {
+            // Generate unique temp filename
+            std::random_device rd;
+            std::mt19937 gen(rd());
+            std::uniform_int_distribution<> dis(0, 999999);
+
+            std::string temp_dir = "/tmp";
+            std::string filename;
+
+            do {
+                std::stringstream ss;
+                ss << temp_dir << "/xeus_stata_graph_" << dis(gen) << extension;
+                filename = ss.str();
+
+                // Check if file exists
+                struct stat buffer;
+                if (stat(filename.c_str(), &buffer) != 0) {
+                    break; // File doesn't exist, we can use this name
+                }
+            } while (true);
+
+            return filename;
+        }
+
+        void write_command(const std::string& command)
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            trace_scope trace("session.write", "session");
+            std::string cmd = command + "\n";
+            trace.set_value(static_cast<int64_t>(cmd.size()));
+
+            // The PTY is non-blocking and its input queue is small, so write
+            // in pieces and wait for room in between. Stata's output is
+            // drained meanwhile so it can never block on a full output queue
+            // while we block on a full input queue.
+            size_t offset = 0;
+            int waited_ms = 0;
+            const int write_timeout_ms = 30000;
+            char buffer[4096];
+
+            while (offset < cmd.size())
+            {
+                ssize_t written = write(m_master_fd, cmd.data() + offset, cmd.size() - offset);
+                if (written > 0)
+                {
+                    offset += static_cast<size_t>(written);
+                    waited_ms = 0;
+                    continue;
+                }
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    if (waited_ms >= write_timeout_ms)
+                    {
+                        throw std::runtime_error("Timed out writing to Stata process");
+                    }
+
+                    struct pollfd pfds[2];
+                    pfds[0].fd = m_master_fd;
+                    pfds[0].events = POLLOUT | POLLIN;
+                    pfds[0].revents = 0;
+                    pfds[1].fd = m_pidfd;
+                    pfds[1].events = POLLIN;
+                    pfds[1].revents = 0;
+                    nfds_t nfds = m_pidfd >= 0 ? 2 : 1;
+
+                    int ret = poll(pfds, nfds, 100);
+                    if (ret == 0)
+                    {
+                        waited_ms += 100;
+                        check_alive();
+                        continue;
+                    }
+                    if (ret > 0 && (pfds[1].revents & POLLIN))
+                    {
+                        handle_child_exit();
+                    }
+                    if (ret > 0 && (pfds[0].revents & POLLIN))
+                    {
+                        ssize_t n = read(m_master_fd, buffer, sizeof(buffer));
+                        if (n > 0)
+                        {
+                            m_pending_output.append(buffer, static_cast<size_t>(n));
+                            m_read_bytes += static_cast<size_t>(n);
+                            ++m_read_batches;
+                        }
+                    }
+                    continue;
+                }
+
+                check_alive();
+                throw std::runtime_error("Failed to write to Stata process: " +
+                                         std::string(strerror(errno)));
+            }
+#endif
+        }
+
+        static int64_t steady_now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        struct executing_scope
+        {
+            explicit executing_scope(std::atomic<bool>& flag) : m_flag(flag) { m_flag = true; }
+            ~executing_scope() { m_flag = false; }
+            std::atomic<bool>& m_flag;
+        };
+
+        // After --Break--, the rest of the typed wrapper (graph export,
+        // marker) is still queued in the terminal and runs next. Type a
+        // sync marker behind it and read until that appears, so the next
+        // cell starts on a drained PTY. The marker literal is split so the
+        // command echo cannot match it.
+        void settle_after_break()
+        {
+            trace_scope trace("session.settle_break", "session");
+            m_interrupted = true;
+            std::string sync = generate_execution_marker();
+            write_command("display \"__SYNC__\" \"" + sync + "__\"");
+            read_until_marker("__SYNC__" + sync + "__", 5000, false);
+        }
+
+        // The cell ran past XEUS_STATA_EXECUTE_TIMEOUT_MS: break it and
+        // read up to a sync marker, so the next cell does not pick up this
+        // one's output. A Stata that ignores the break is replaced.
+        [[noreturn]] void settle_after_timeout()
+        {
+            trace_scope trace("session.settle_timeout", "session");
+            kill(m_pid, SIGINT);
+            std::string sync = generate_execution_marker();
+            write_command("display \"__SYNC__\" \"" + sync + "__\"");
+            bool synced = false;
+            read_until_marker("__SYNC__" + sync + "__", 10000, false, &synced);
+            std::string what = "Cell did not finish within " + std::to_string(m_execute_timeout_ms) +
+                               " ms (XEUS_STATA_EXECUTE_TIMEOUT_MS)";
+            if (!synced)
+            {
+                kill(m_pid, SIGKILL);
+                handle_child_exit();
+            }
+            throw stata_timeout_error(what + " and was interrupted");
+        }
+
+        // Wait up to timeout_ms for the child to exit and reap it
+        bool wait_for_exit(int timeout_ms)
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            int status;
+            if (m_pidfd >= 0)
+            {
+                // Readable the moment the child exits, no polling loop
+                struct pollfd pfd = {m_pidfd, POLLIN, 0};
+                int ret;
+                do
+                {
+                    ret = poll(&pfd, 1, timeout_ms);
+                } while (ret < 0 && errno == EINTR);
+                return ret > 0 && (!m_own_child || waitpid(m_pid, &status, WNOHANG) == m_pid);
+            }
+
+            stopwatch timer;
+            while (m_own_child ? waitpid(m_pid, &status, WNOHANG) == 0 : kill(m_pid, 0) == 0)
+            {
+                if (timer.elapsed_ms() >= timeout_ms)
+                {
+                    return false;
+                }
+                usleep(5000);
+            }
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        std::string read_until_prompt(int timeout_ms)
+        {
+            return read_until_marker(".", timeout_ms);
+        }
+
+        // timeout_ms <= 0 waits as long as Stata is alive. found tells
+        // the marker (or a break) from a timeout.
+        std::string read_until_marker(const std::string& marker, int timeout_ms, bool watch_break = true,
+                                      bool* found = nullptr)
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+            trace_scope trace("session.wait_marker", "session");
+            char buffer[4096];
+
+            // Start with anything drained while the command was being written
+            std::string output;
+            output.swap(m_pending_output);
+            bool seen = output.find(marker) != std::string::npos;
+            if (found)
+            {
+                *found = seen;
+            }
+            if (seen)
+            {
+                return output.substr(0, output.find(marker));
+            }
+
+            // Watch the PTY and, if available, the pidfd so a dying child
+            // is noticed immediately rather than at the timeout
+            struct pollfd pfds[2];
+            pfds[0].fd = m_master_fd;
+            pfds[0].events = POLLIN;
+            pfds[1].fd = m_pidfd;
+            pfds[1].events = POLLIN;
+            nfds_t nfds = m_pidfd >= 0 ? 2 : 1;
+            struct pollfd& pfd = pfds[0];
+
+            const int poll_interval = 100; // 100ms
+            stopwatch wait_timer;
+            stopwatch callback_timer;
+
+            while (timeout_ms <= 0 || wait_timer.elapsed_ms() < timeout_ms)
+            {
+                pfds[0].revents = 0;
+                pfds[1].revents = 0;
+                int ret = poll(pfds, nfds, poll_interval);
+
+                if (m_wait_callback && callback_timer.elapsed_ms() >= poll_interval)
+                {
+                    callback_timer.restart();
+                    m_wait_callback();
+                }
+
+                if (ret > 0 && !(pfd.revents & POLLIN) &&
+                    ((pfd.revents & (POLLHUP | POLLERR)) || (pfds[1].revents & POLLIN)))
+                {
+                    handle_child_exit();
+                }
+
+                if (nfds == 1 && ret == 0)
+                {
+                    check_alive();
+                }
+
+                if (ret > 0 && (pfd.revents & POLLIN))
+                {
+                    trace_scope read_trace("pty.read", "pty");
+                    stopwatch read_timer;
+                    ssize_t n = read(m_master_fd, buffer, sizeof(buffer) - 1);
+                    m_read_ms += read_timer.elapsed_ms();
+                    read_trace.set_value(n);
+                    if (n < 0 && errno == EIO)
+                    {
+                        // Slave side closed, the child is gone
+                        handle_child_exit();
+                    }
+                    if (n > 0)
+                    {
+                        m_read_bytes += static_cast<size_t>(n);
+                        ++m_read_batches;
+                        buffer[n] = '\0';
+                        output += buffer;
+
+                        // Check if we've received the marker
+                        if (output.find(marker) != std::string::npos)
+                        {
+                            // Remove the marker and everything after it
+                            size_t pos = output.find(marker);
+                            output = output.substr(0, pos);
+                            seen = true;
+                            break;
+                        }
+
+                        // Check if Stata was interrupted (--Break-- message)
+                        size_t break_pos = watch_break ? output.find("--Break--") : std::string::npos;
+                        if (break_pos != std::string::npos)
+                        {
+                            // Keep what the cell printed before the break
+                            output = output.substr(0, break_pos) + "--Break--";
+                            settle_after_break();
+                            seen = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (found)
+            {
+                *found = seen;
+            }
+            return output;
+#else
+            return "";
+#endif
+        }
+
+        std::string m_stata_path;
+        int m_master_fd;
+        std::atomic<pid_t> m_pid;
+        int m_pidfd;
+
+        // Processes handed over by the pool are not our children: they
+        // cannot be reaped and their exit status is unknown
+        bool m_own_child = true;
+        bool m_use_pool;
+        std::string m_pool_socket;
+        std::atomic<bool> m_ready;
+        bool m_respawn_enabled;
+        std::future<void> m_respawn;
+        std::function<void()> m_respawn_callback;
+        std::function<void()> m_wait_callback;
+
+        bool m_typed_cells;
+        std::string m_scratch_dir;
+
+        bool m_log_capture;
+        std::string m_log_path;
+        bool m_log_reopen;
+
+        // Output read from the PTY while a command was still being written
+        std::string m_pending_output;
+
+        // Interrupt handling: SIGINT is only sent while a cell runs, and the
+        // time from the request to a settled PTY is reported per cell
+        std::atomic<bool> m_executing{false};
+        std::atomic<int64_t> m_interrupt_requested_ns{0};
+        bool m_interrupted = false;
+        double m_interrupt_ms = 0;
+        int m_shutdown_grace_ms = 2000;
+        int m_execute_timeout_ms = 0;   // 0: no limit
+
+        // PTY read statistics for the current execution
+        double m_read_ms = 0;
+        size_t m_read_bytes = 0;
+        size_t m_read_batches = 0;
+    };
+
+    std::unique_ptr<session_backend> make_pty_backend(const std::string& stata_path)
+    {
+        return std::make_unique<pty_backend>(stata_path);
+    }
+
+} // namespace xeus_stata
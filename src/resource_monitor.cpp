@@ -0,0 +1,345 @@
+#include "xeus-stata/resource_monitor.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+#include "xeus-stata/timing.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include <unistd.h>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // State and CPU ticks from a stat line; the command name in
+        // parentheses may contain spaces, so fields are counted after it
+        bool parse_stat_line(const std::string& line, char& state, uint64_t& ticks)
+        {
+            size_t close = line.rfind(')');
+            if (close == std::string::npos)
+            {
+                return false;
+            }
+            std::stringstream ss(line.substr(close + 1));
+            std::vector<std::string> fields;
+            std::string field;
+            while (ss >> field)
+            {
+                fields.push_back(field);
+            }
+            // fields[0] is field 3 (state), utime and stime are 14 and 15
+            if (fields.size() < 13)
+            {
+                return false;
+            }
+            state = fields[0][0];
+            ticks = std::strtoull(fields[11].c_str(), nullptr, 10) + std::strtoull(fields[12].c_str(), nullptr, 10);
+            return true;
+        }
+
+        uint64_t status_kib(const std::string& line, size_t prefix)
+        {
+            return std::strtoull(line.c_str() + prefix, nullptr, 10) * 1024;
+        }
+    }
+
+    bool read_process_usage(int pid, process_usage& usage)
+    {
+        usage = process_usage();
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        if (pid <= 0)
+        {
+            return false;
+        }
+        std::string base = "/proc/" + std::to_string(pid);
+
+        std::string line;
+        {
+            std::ifstream stat(base + "/stat");
+            char state;
+            uint64_t ticks;
+            if (!std::getline(stat, line) || !parse_stat_line(line, state, ticks))
+            {
+                return false;
+            }
+            static const long ticks_per_second = sysconf(_SC_CLK_TCK);
+            usage.cpu_seconds = static_cast<double>(ticks) / static_cast<double>(ticks_per_second);
+        }
+
+        {
+            std::ifstream status(base + "/status");
+            while (std::getline(status, line))
+            {
+                if (line.compare(0, 6, "VmRSS:") == 0)
+                {
+                    usage.rss_bytes = status_kib(line, 6);
+                }
+                else if (line.compare(0, 7, "VmSwap:") == 0)
+                {
+                    usage.swap_bytes = status_kib(line, 7);
+                }
+                else if (line.compare(0, 8, "Threads:") == 0)
+                {
+                    usage.threads = std::atoi(line.c_str() + 8);
+                }
+            }
+        }
+
+        {
+            std::ifstream io(base + "/io");
+            while (std::getline(io, line))
+            {
+                if (line.compare(0, 11, "read_bytes:") == 0)
+                {
+                    usage.read_bytes = std::strtoull(line.c_str() + 11, nullptr, 10);
+                }
+                else if (line.compare(0, 12, "write_bytes:") == 0)
+                {
+                    usage.write_bytes = std::strtoull(line.c_str() + 12, nullptr, 10);
+                }
+            }
+        }
+
+        // Per-thread states tell a busy StataMP from one stuck on I/O
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(base + "/task", ec))
+        {
+            std::ifstream stat(entry.path() / "stat");
+            char state;
+            uint64_t ticks;
+            if (std::getline(stat, line) && parse_stat_line(line, state, ticks))
+            {
+                usage.running_threads += state == 'R' ? 1 : 0;
+                usage.blocked_threads += state == 'D' ? 1 : 0;
+            }
+        }
+
+        usage.valid = true;
+        return true;
+#else
+        (void)pid;
+        return false;
+#endif
+    }
+
+    nl::json cell_resources_to_json(const cell_resources& resources)
+    {
+        return {
+            {"peak_rss_bytes", resources.peak_rss_bytes},
+            {"cpu_seconds", resources.cpu_seconds},
+            {"read_bytes", resources.read_bytes},
+            {"write_bytes", resources.write_bytes},
+            {"max_threads", resources.max_threads},
+            {"samples", resources.samples},
+            {"rss_warning", resources.rss_warning}
+        };
+    }
+
+    uint64_t parse_byte_size(const std::string& text)
+    {
+        char* end = nullptr;
+        double value = std::strtod(text.c_str(), &end);
+        if (text.empty() || end == text.c_str() || value < 0)
+        {
+            return 0;
+        }
+        uint64_t scale = 1;
+        switch (std::toupper(static_cast<unsigned char>(*end)))
+        {
+            case '\0': break;
+            case 'K': scale = 1ull << 10; break;
+            case 'M': scale = 1ull << 20; break;
+            case 'G': scale = 1ull << 30; break;
+            case 'T': scale = 1ull << 40; break;
+            default: return 0;
+        }
+        return static_cast<uint64_t>(value * static_cast<double>(scale));
+    }
+
+    std::string format_byte_size(uint64_t bytes)
+    {
+        static const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+        double value = static_cast<double>(bytes);
+        size_t unit = 0;
+        while (value >= 1024 && unit < 4)
+        {
+            value /= 1024;
+            ++unit;
+        }
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << " " << units[unit];
+        return out.str();
+    }
+
+    resource_monitor::resource_monitor(std::function<int()> pid_provider, int interval_ms, uint64_t rss_limit_bytes)
+        : m_pid_provider(std::move(pid_provider))
+        , m_interval_ms(interval_ms)
+        , m_rss_limit(rss_limit_bytes)
+    {
+    }
+
+    resource_monitor::~resource_monitor()
+    {
+        stop();
+    }
+
+    void resource_monitor::start()
+    {
+        if (m_interval_ms > 0 && !m_thread.joinable())
+        {
+            m_stopping = false;
+            m_thread = std::thread([this]() { run(); });
+        }
+    }
+
+    void resource_monitor::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    void resource_monitor::run()
+    {
+        process_usage previous;
+        stopwatch since_previous;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopping)
+        {
+            lock.unlock();
+            process_usage usage;
+            bool ok = read_process_usage(m_pid_provider(), usage);
+            double elapsed_s = since_previous.elapsed_ms() / 1000.0;
+            since_previous.restart();
+            double cpu_percent = previous.valid && ok && elapsed_s > 0
+                ? std::max(0.0, (usage.cpu_seconds - previous.cpu_seconds) / elapsed_s * 100.0)
+                : 0.0;
+            previous = usage;
+            lock.lock();
+
+            if (ok)
+            {
+                record(usage, cpu_percent);
+            }
+            m_wakeup.wait_for(lock, std::chrono::milliseconds(m_interval_ms), [this]() { return m_stopping; });
+        }
+    }
+
+    // Called with m_mutex held
+    void resource_monitor::record(const process_usage& usage, double cpu_percent)
+    {
+        m_latest = usage;
+        m_latest_cpu_percent = cpu_percent;
+        ++m_samples;
+
+        if (m_in_cell)
+        {
+            ++m_cell.samples;
+            m_cell.peak_rss_bytes = std::max(m_cell.peak_rss_bytes, usage.rss_bytes);
+            m_cell.max_threads = std::max(m_cell.max_threads, usage.threads);
+            if (m_rss_limit > 0 && !m_cell.rss_warning && usage.rss_bytes >= m_rss_limit / 10 * 9)
+            {
+                m_cell.rss_warning = true;
+                m_warning_pending = true;
+            }
+        }
+    }
+
+    void resource_monitor::begin_cell()
+    {
+        process_usage usage;
+        bool ok = read_process_usage(m_pid_provider(), usage);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_in_cell = ok;
+        m_cell = cell_resources();
+        m_cell_start = usage;
+        m_warning_pending = false;
+        if (ok)
+        {
+            m_cell.peak_rss_bytes = usage.rss_bytes;
+            m_cell.max_threads = usage.threads;
+        }
+    }
+
+    cell_resources resource_monitor::end_cell()
+    {
+        process_usage usage;
+        bool ok = read_process_usage(m_pid_provider(), usage);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_in_cell)
+        {
+            return cell_resources();
+        }
+        m_in_cell = false;
+
+        // A respawned Stata has new counters; keep what was sampled
+        if (ok && usage.cpu_seconds >= m_cell_start.cpu_seconds)
+        {
+            m_cell.peak_rss_bytes = std::max(m_cell.peak_rss_bytes, usage.rss_bytes);
+            m_cell.max_threads = std::max(m_cell.max_threads, usage.threads);
+            m_cell.cpu_seconds = usage.cpu_seconds - m_cell_start.cpu_seconds;
+            m_cell.read_bytes = usage.read_bytes - std::min(usage.read_bytes, m_cell_start.read_bytes);
+            m_cell.write_bytes = usage.write_bytes - std::min(usage.write_bytes, m_cell_start.write_bytes);
+            if (m_rss_limit > 0 && !m_cell.rss_warning && usage.rss_bytes >= m_rss_limit / 10 * 9)
+            {
+                m_cell.rss_warning = true;
+                m_warning_pending = true;
+            }
+        }
+        m_cell.valid = true;
+        return m_cell;
+    }
+
+    nl::json resource_monitor::latest() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return {
+            {"valid", m_latest.valid},
+            {"cpu_percent", m_latest_cpu_percent},
+            {"cpu_seconds", m_latest.cpu_seconds},
+            {"rss_bytes", m_latest.rss_bytes},
+            {"swap_bytes", m_latest.swap_bytes},
+            {"rss_limit_bytes", m_rss_limit},
+            {"threads", m_latest.threads},
+            {"running_threads", m_latest.running_threads},
+            {"blocked_threads", m_latest.blocked_threads},
+            {"read_bytes", m_latest.read_bytes},
+            {"write_bytes", m_latest.write_bytes},
+            {"executing", m_in_cell},
+            {"interval_ms", m_interval_ms}
+        };
+    }
+
+    uint64_t resource_monitor::sample_count() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_samples;
+    }
+
+    bool resource_monitor::take_rss_warning(uint64_t& rss_bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_warning_pending)
+        {
+            return false;
+        }
+        m_warning_pending = false;
+        rss_bytes = std::max(m_latest.rss_bytes, m_cell.peak_rss_bytes);
+        return true;
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,634 @@
+#include "xeus-stata/resource_policy.hpp"
+#include "xeus-stata/resource_monitor.hpp"
+#include "xeus-stata/private_dir.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+    #include <fcntl.h>
+    #include <sched.h>
+    #include <sys/file.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace xeus_stata
+{
+    namespace
+    {
+        const char* CGROUP_ROOT = "/sys/fs/cgroup";
+
+        std::string env_string(const char* name)
+        {
+            const char* value = std::getenv(name);
+            return value ? value : "";
+        }
+
+        std::string read_line(const std::string& path)
+        {
+            std::ifstream in(path);
+            std::string line;
+            std::getline(in, line);
+            return line;
+        }
+
+        bool write_file(const std::string& path, const std::string& value, std::string& error)
+        {
+            std::ofstream out(path);
+            out << value;
+            out.flush();
+            if (!out)
+            {
+                error = "cannot write " + path + ": " + std::strerror(errno);
+                return false;
+            }
+            return true;
+        }
+
+        // CPUs of each NUMA node; one pseudo-node when sysfs has none
+        std::map<int, std::vector<int>> numa_nodes()
+        {
+            std::map<int, std::vector<int>> nodes;
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+            {
+                std::string name = entry.path().filename().string();
+                if (name.compare(0, 4, "node") == 0 && name.size() > 4 && std::isdigit(static_cast<unsigned char>(name[4])))
+                {
+                    nodes[std::atoi(name.c_str() + 4)] = parse_cpu_list(read_line((entry.path() / "cpulist").string()));
+                }
+            }
+            return nodes;
+        }
+
+        // cores ("2.5") to a cpu.max value with the default 100 ms period;
+        // anything else is passed through
+        std::string cpu_max_value(const std::string& text)
+        {
+            char* end = nullptr;
+            double cores = std::strtod(text.c_str(), &end);
+            if (end != text.c_str() && *end == '\0' && cores > 0)
+            {
+                long period = 100000;
+                return std::to_string(static_cast<long>(std::llround(cores * period))) + " " + std::to_string(period);
+            }
+            return text;
+        }
+
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        // A lock directory others cannot tamper with: a real directory owned
+        // by root or the user, and either sticky (like /tmp, so nobody can
+        // swap out another user's lock files) or writable only by its owner
+        bool trusted_lock_dir(const std::string& dir, std::string& error)
+        {
+            struct stat st;
+            if (lstat(dir.c_str(), &st) != 0)
+            {
+                error = dir + " cannot be read: " + std::strerror(errno);
+                return false;
+            }
+            if (!S_ISDIR(st.st_mode))
+            {
+                error = dir + " is not a directory";
+                return false;
+            }
+            if (st.st_uid != 0 && st.st_uid != geteuid())
+            {
+                error = dir + " is owned by another user";
+                return false;
+            }
+            if (!(st.st_mode & S_ISVTX) && (st.st_mode & (S_IWGRP | S_IWOTH)))
+            {
+                error = dir + " is writable by others and not sticky";
+                return false;
+            }
+            return true;
+        }
+#endif
+    }
+
+    resource_policy_config load_resource_policy_config()
+    {
+        resource_policy_config config;
+
+        std::string path = env_string("XEUS_STATA_RESOURCE_CONFIG");
+        if (!path.empty())
+        {
+            std::ifstream in(path);
+            if (!in)
+            {
+                throw std::runtime_error("Cannot read XEUS_STATA_RESOURCE_CONFIG file " + path);
+            }
+            nl::json j = nl::json::parse(in);
+            config.cpus = j.value("cpus", config.cpus);
+            config.numa_node = j.value("numa_node", config.numa_node);
+            config.processors = j.value("processors", config.processors);
+            config.cgroup = j.value("cgroup", config.cgroup);
+            if (j.contains("cpu_max"))
+            {
+                config.cpu_max = j["cpu_max"].is_string() ? j["cpu_max"].get<std::string>() : j["cpu_max"].dump();
+            }
+            if (j.contains("memory_max"))
+            {
+                config.memory_max = j["memory_max"].is_string() ? parse_byte_size(j["memory_max"].get<std::string>())
+                                                                : j["memory_max"].get<uint64_t>();
+            }
+        }
+
+        auto override_with = [](const char* name, auto apply) {
+            std::string value = env_string(name);
+            if (!value.empty())
+            {
+                apply(value);
+            }
+        };
+        override_with("XEUS_STATA_CPUS", [&](const std::string& v) { config.cpus = v; });
+        override_with("XEUS_STATA_NUMA_NODE", [&](const std::string& v) { config.numa_node = std::atoi(v.c_str()); });
+        override_with("XEUS_STATA_PROCESSORS", [&](const std::string& v) { config.processors = std::atoi(v.c_str()); });
+        override_with("XEUS_STATA_CGROUP", [&](const std::string& v) { config.cgroup = v; });
+        override_with("XEUS_STATA_CPU_MAX", [&](const std::string& v) { config.cpu_max = v; });
+        override_with("XEUS_STATA_MEMORY_MAX", [&](const std::string& v) { config.memory_max = parse_byte_size(v); });
+        return config;
+    }
+
+    std::vector<int> parse_cpu_list(const std::string& text)
+    {
+        std::vector<int> cpus;
+        std::stringstream ss(text);
+        std::string range;
+        while (std::getline(ss, range, ','))
+        {
+            range.erase(0, range.find_first_not_of(" \t\r\n"));
+            range.erase(range.find_last_not_of(" \t\r\n") + 1);
+            if (range.empty() || !std::isdigit(static_cast<unsigned char>(range[0])))
+            {
+                continue;
+            }
+            size_t dash = range.find('-');
+            int first = std::atoi(range.c_str());
+            int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last && cpu - first < 4096; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+        return cpus;
+    }
+
+    std::string format_cpu_list(const std::vector<int>& cpus)
+    {
+        std::ostringstream out;
+        for (size_t i = 0; i < cpus.size();)
+        {
+            size_t j = i;
+            while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            {
+                ++j;
+            }
+            out << (i > 0 ? "," : "") << cpus[i];
+            if (j > i)
+            {
+                out << "-" << cpus[j];
+            }
+            i = j + 1;
+        }
+        return out.str();
+    }
+
+    resource_policy& resource_policy::instance()
+    {
+        static resource_policy policy;
+        return policy;
+    }
+
+    resource_policy::resource_policy()
+    {
+        try
+        {
+            m_config = load_resource_policy_config();
+        }
+        catch (const std::exception& e)
+        {
+            note(e.what());
+            return;
+        }
+
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        // Only CPUs the kernel itself may use, e.g. inside a batch job
+        std::vector<int> allowed;
+        cpu_set_t own;
+        CPU_ZERO(&own);
+        if (sched_getaffinity(0, sizeof(own), &own) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &own))
+                {
+                    allowed.push_back(cpu);
+                }
+            }
+        }
+
+        if (m_config.cpus.compare(0, 5, "auto:") == 0)
+        {
+            claim_cpus(std::atoi(m_config.cpus.c_str() + 5));
+        }
+        else if (!m_config.cpus.empty())
+        {
+            for (int cpu : parse_cpu_list(m_config.cpus))
+            {
+                if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+                {
+                    m_cpus.push_back(cpu);
+                }
+            }
+            if (m_cpus.empty())
+            {
+                note("none of CPUs " + m_config.cpus + " are available to the kernel; not pinning");
+            }
+        }
+
+        for (const auto& node : numa_nodes())
+        {
+            if (std::any_of(m_cpus.begin(), m_cpus.end(), [&node](int cpu) {
+                    return std::binary_search(node.second.begin(), node.second.end(), cpu);
+                }))
+            {
+                m_nodes.push_back(node.first);
+            }
+        }
+
+        if (!m_config.cgroup.empty())
+        {
+            create_cgroup();
+        }
+#else
+        if (!m_config.cpus.empty() || !m_config.cgroup.empty())
+        {
+            note("CPU pinning and cgroups are only supported on Linux");
+        }
+#endif
+    }
+
+    resource_policy::~resource_policy()
+    {
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        for (int fd : m_lock_fds)
+        {
+            close(fd);
+        }
+        if (!m_cgroup_dir.empty())
+        {
+            // Fails while a Stata process is still in it, which is harmless
+            rmdir(m_cgroup_dir.c_str());
+        }
+#endif
+    }
+
+    void resource_policy::claim_cpus(int count)
+    {
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        if (count <= 0)
+        {
+            note("XEUS_STATA_CPUS=auto:N needs a CPU count");
+            return;
+        }
+
+        std::string lock_dir = env_string("XEUS_STATA_CPU_LOCK_DIR");
+        if (lock_dir.empty())
+        {
+            lock_dir = "/tmp/xeus-stata-cpus";
+        }
+        // Shared by every user on the host; if someone else got to create
+        // it, the kernels of this user only coordinate among themselves
+        if (mkdir(lock_dir.c_str(), 01777) == 0)
+        {
+            chmod(lock_dir.c_str(), 01777);
+        }
+        std::string error;
+        if (!trusted_lock_dir(lock_dir, error))
+        {
+            std::string own_dir = "/tmp/xeus-stata-" + std::to_string(getuid()) + "/cpus";
+            note(error + "; using " + own_dir);
+            lock_dir = own_dir;
+            if (!ensure_private_dir(lock_dir, error))
+            {
+                note(error + "; not pinning");
+                return;
+            }
+        }
+
+        cpu_set_t own;
+        CPU_ZERO(&own);
+        sched_getaffinity(0, sizeof(own), &own);
+
+        auto try_lock = [&lock_dir](int cpu) {
+            std::string path = lock_dir + "/cpu" + std::to_string(cpu) + ".lock";
+            // Symbolic links and other planted non-files are never opened
+            int fd = open(path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK, 0644);
+            struct stat st;
+            if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || flock(fd, LOCK_EX | LOCK_NB) != 0))
+            {
+                close(fd);
+                fd = -1;
+            }
+            return fd;
+        };
+
+        // Nodes with the most free CPUs first, so a kernel's cores and
+        // first-touch memory stay on one node whenever it fits
+        auto nodes = numa_nodes();
+        if (nodes.empty())
+        {
+            std::vector<int> all;
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                all.push_back(cpu);
+            }
+            nodes[0] = all;
+        }
+        std::vector<std::pair<int, std::vector<int>>> candidates;
+        for (const auto& node : nodes)
+        {
+            if (m_config.numa_node >= 0 && node.first != m_config.numa_node)
+            {
+                continue;
+            }
+            std::vector<int> usable;
+            for (int cpu : node.second)
+            {
+                if (CPU_ISSET(cpu, &own))
+                {
+                    usable.push_back(cpu);
+                }
+            }
+            candidates.emplace_back(node.first, usable);
+        }
+
+        std::map<int, int> free_cpus;
+        for (const auto& candidate : candidates)
+        {
+            int free = 0;
+            for (int cpu : candidate.second)
+            {
+                int fd = try_lock(cpu);
+                if (fd >= 0)
+                {
+                    ++free;
+                    close(fd);
+                }
+            }
+            free_cpus[candidate.first] = free;
+        }
+        std::stable_sort(candidates.begin(), candidates.end(), [&free_cpus](const auto& a, const auto& b) {
+            return free_cpus[a.first] > free_cpus[b.first];
+        });
+
+        for (const auto& candidate : candidates)
+        {
+            for (int cpu : candidate.second)
+            {
+                if (static_cast<int>(m_cpus.size()) == count)
+                {
+                    break;
+                }
+                int fd = try_lock(cpu);
+                if (fd >= 0)
+                {
+                    m_lock_fds.push_back(fd);
+                    m_cpus.push_back(cpu);
+                }
+            }
+        }
+        std::sort(m_cpus.begin(), m_cpus.end());
+
+        if (m_cpus.empty())
+        {
+            note("no free CPUs to claim in " + lock_dir + "; not pinning");
+        }
+        else if (static_cast<int>(m_cpus.size()) < count)
+        {
+            note("only " + std::to_string(m_cpus.size()) + " of " + std::to_string(count) + " CPUs were free");
+        }
+#else
+        (void)count;
+#endif
+    }
+
+    void resource_policy::create_cgroup()
+    {
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        if (!std::filesystem::exists(std::string(CGROUP_ROOT) + "/cgroup.controllers"))
+        {
+            note("no cgroup v2 hierarchy at " + std::string(CGROUP_ROOT) + "; no cgroup limits");
+            return;
+        }
+
+        // A sibling of the kernel's own cgroup: its parent must not hold
+        // processes itself for controllers to be enabled there
+        std::string parent = m_config.cgroup;
+        if (parent == "auto")
+        {
+            std::ifstream self("/proc/self/cgroup");
+            std::string line;
+            std::string own;
+            while (std::getline(self, line))
+            {
+                if (line.compare(0, 3, "0::") == 0)
+                {
+                    own = line.substr(3);
+                }
+            }
+            parent = std::string(CGROUP_ROOT) + std::filesystem::path(own).parent_path().string();
+        }
+        else if (parent.compare(0, std::strlen(CGROUP_ROOT), CGROUP_ROOT) != 0)
+        {
+            parent = std::string(CGROUP_ROOT) + (parent[0] == '/' ? "" : "/") + parent;
+        }
+
+        std::string group = parent + "/xstata-" + std::to_string(getpid());
+        if (mkdir(group.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            note("cannot create cgroup " + group + ": " + std::strerror(errno));
+            return;
+        }
+        m_cgroup_dir = group;
+
+        std::string error;
+        std::string enabled = read_line(parent + "/cgroup.subtree_control");
+        for (const char* controller : {"cpu", "memory"})
+        {
+            bool wanted = std::string(controller) == "cpu" ? !m_config.cpu_max.empty() : m_config.memory_max > 0;
+            std::stringstream ss(enabled);
+            std::string word;
+            bool on = false;
+            while (ss >> word)
+            {
+                on = on || word == controller;
+            }
+            if (wanted && !on && !write_file(parent + "/cgroup.subtree_control", std::string("+") + controller, error))
+            {
+                note(error);
+            }
+        }
+
+        if (!m_config.cpu_max.empty())
+        {
+            if (write_file(group + "/cpu.max", cpu_max_value(m_config.cpu_max), error))
+            {
+                m_cpu_max_applied = read_line(group + "/cpu.max");
+            }
+            else
+            {
+                note(error);
+            }
+        }
+        if (m_config.memory_max > 0)
+        {
+            if (write_file(group + "/memory.max", std::to_string(m_config.memory_max), error))
+            {
+                m_memory_max_applied = read_line(group + "/memory.max");
+            }
+            else
+            {
+                note(error);
+            }
+        }
+#endif
+    }
+
+    bool resource_policy::active() const
+    {
+        return !m_cpus.empty() || !m_cgroup_dir.empty() || m_config.processors > 0;
+    }
+
+    void resource_policy::apply(int pid)
+    {
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+        if (pid <= 0)
+        {
+            return;
+        }
+
+        if (!m_cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : m_cpus)
+            {
+                CPU_SET(cpu, &set);
+            }
+            // Threads inherit the mask of the thread that creates them,
+            // but a pooled Stata may already run several
+            std::error_code ec;
+            bool pinned = false;
+            for (const auto& task : std::filesystem::directory_iterator("/proc/" + std::to_string(pid) + "/task", ec))
+            {
+                pid_t tid = static_cast<pid_t>(std::atoi(task.path().filename().c_str()));
+                pinned = sched_setaffinity(tid, sizeof(set), &set) == 0 || pinned;
+            }
+            if (!pinned)
+            {
+                note("cannot pin Stata process " + std::to_string(pid) + ": " + std::strerror(errno));
+            }
+        }
+
+        if (!m_cgroup_dir.empty())
+        {
+            std::string error;
+            if (!write_file(m_cgroup_dir + "/cgroup.procs", std::to_string(pid), error))
+            {
+                note(error);
+            }
+        }
+#else
+        (void)pid;
+#endif
+    }
+
+    int resource_policy::processors() const
+    {
+        if (m_config.processors > 0)
+        {
+            return m_config.processors;
+        }
+        return static_cast<int>(m_cpus.size());
+    }
+
+    std::string resource_policy::summary() const
+    {
+        std::vector<std::string> parts;
+        if (!m_cpus.empty())
+        {
+            std::string cpus = "CPUs " + format_cpu_list(m_cpus);
+            if (!m_nodes.empty())
+            {
+                cpus += std::string(" (NUMA node") + (m_nodes.size() > 1 ? "s " : " ") + format_cpu_list(m_nodes) + ")";
+            }
+            parts.push_back(cpus);
+        }
+        if (!m_cgroup_dir.empty())
+        {
+            std::string group = "cgroup " + m_cgroup_dir;
+            if (!m_cpu_max_applied.empty())
+            {
+                group += ", cpu.max " + m_cpu_max_applied;
+            }
+            if (!m_memory_max_applied.empty())
+            {
+                group += ", memory.max " + m_memory_max_applied;
+            }
+            parts.push_back(group);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& text : m_notes)
+        {
+            parts.push_back("note: " + text);
+        }
+
+        std::string joined;
+        for (const auto& part : parts)
+        {
+            joined += (joined.empty() ? "" : "; ") + part;
+        }
+        return joined;
+    }
+
+    nl::json resource_policy::to_json() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return {
+            {"cpus", format_cpu_list(m_cpus)},
+            {"numa_nodes", m_nodes},
+            {"processors", processors()},
+            {"cgroup", m_cgroup_dir},
+            {"cpu_max", m_cpu_max_applied},
+            {"memory_max", m_memory_max_applied},
+            {"notes", m_notes}
+        };
+    }
+
+    void resource_policy::note(const std::string& text)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (std::find(m_notes.begin(), m_notes.end(), text) == m_notes.end())
+        {
+            m_notes.push_back(text);
+        }
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,155 @@
+#include "xeus-stata/session_backend.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // Lines starting with tag, with the tag removed. Echoed commands
+        // start with ". " or a line number and never match.
+        std::vector<std::string> tagged_lines(const std::string& output, const std::string& tag)
+        {
+            std::vector<std::string> values;
+            std::stringstream ss(output);
+            std::string line;
+            while (std::getline(ss, line))
+            {
+                if (line.compare(0, tag.size(), tag) == 0)
+                {
+                    std::string value = line.substr(tag.size());
+                    value.erase(value.find_last_not_of(" \t\r") + 1);
+                    values.push_back(value);
+                }
+            }
+            return values;
+        }
+
+        // Parse Stata's %21x format ("+1.8000000000000X+001"): a hex
+        // mantissa and a hex power-of-two exponent. Anything else is a
+        // missing value.
+        double parse_stata_hex(const std::string& text)
+        {
+            size_t x = text.find('X');
+            if (x == std::string::npos || text.empty())
+            {
+                return std::numeric_limits<double>::quiet_NaN();
+            }
+
+            std::string mantissa = text.substr(0, x);
+            std::string sign;
+            if (mantissa[0] == '+' || mantissa[0] == '-')
+            {
+                sign = mantissa.substr(0, 1);
+                mantissa.erase(0, 1);
+            }
+            long exponent = std::strtol(text.c_str() + x + 1, nullptr, 16);
+            std::string c_hex = sign + "0x" + mantissa + "p" + std::to_string(exponent);
+            return std::strtod(c_hex.c_str(), nullptr);
+        }
+    }
+
+    void session_backend::set_respawn_callback(std::function<void()>)
+    {
+    }
+
+    void session_backend::set_wait_callback(std::function<void()>)
+    {
+    }
+
+    std::string session_backend::get_macro(const std::string& name)
+    {
+        auto result = execute("display `" + name + "'");
+        if (!result.is_error)
+        {
+            return result.output;
+        }
+        return "";
+    }
+
+    std::vector<std::string> session_backend::variable_names()
+    {
+        auto result = execute("capture quietly ds\n"
+                              "display \"xstata_varlist:\" \"`r(varlist)'\"");
+        std::vector<std::string> names;
+        auto lines = tagged_lines(result.output, "xstata_varlist:");
+        if (!lines.empty())
+        {
+            std::stringstream ss(lines.front());
+            std::string name;
+            while (ss >> name)
+            {
+                names.push_back(name);
+            }
+        }
+        return names;
+    }
+
+    std::vector<double> session_backend::numeric_values(const std::string& variable,
+                                                        size_t first, size_t count)
+    {
+        std::vector<double> values;
+        if (count == 0)
+        {
+            return values;
+        }
+
+        // %21x round-trips doubles exactly
+        std::string code =
+            "local xstata_last = min(_N, " + std::to_string(first + count) + ")\n"
+            "forvalues xstata_i = " + std::to_string(first + 1) + "/`xstata_last' {\n"
+            "    display \"xstata_value:\" %21x " + variable + "[`xstata_i']\n"
+            "}";
+        auto result = execute(code);
+        if (result.is_error)
+        {
+            throw std::runtime_error("Cannot read variable " + variable + ": r(" +
+                                     std::to_string(result.error_code) + ")");
+        }
+
+        for (const auto& line : tagged_lines(result.output, "xstata_value:"))
+        {
+            size_t start = line.find_first_not_of(' ');
+            values.push_back(parse_stata_hex(start == std::string::npos ? "" : line.substr(start)));
+        }
+        return values;
+    }
+
+    std::string make_scratch_dir()
+    {
+        std::string base;
+        const char* env_dir = std::getenv("XEUS_STATA_SCRATCH_DIR");
+        struct stat st;
+        if (env_dir && env_dir[0] != '\0')
+        {
+            base = env_dir;
+        }
+        else if (stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) && access("/dev/shm", W_OK) == 0)
+        {
+            base = "/dev/shm";
+        }
+        else
+        {
+            base = "/tmp";
+        }
+
+        std::string tmpl = base + "/xeus-stata-XXXXXX";
+        std::vector<char> buffer(tmpl.begin(), tmpl.end());
+        buffer.push_back('\0');
+        if (mkdtemp(buffer.data()) == nullptr)
+        {
+            throw std::runtime_error("Failed to create scratch directory in " + base + ": " +
+                                     std::string(strerror(errno)));
+        }
+        return std::string(buffer.data());
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,356 @@
+#include "xeus-stata/smcl.hpp"
+
+#include <cctype>
+#include <cstdlib>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // Find the brace closing the directive opened at start, or npos
+        size_t find_closing_brace(const std::string& smcl, size_t start)
+        {
+            int depth = 0;
+            for (size_t i = start; i < smcl.size(); ++i)
+            {
+                if (smcl[i] == '{')
+                {
+                    ++depth;
+                }
+                else if (smcl[i] == '}')
+                {
+                    if (--depth == 0)
+                    {
+                        return i;
+                    }
+                }
+                else if (smcl[i] == '\n')
+                {
+                    // Directives never span lines
+                    return std::string::npos;
+                }
+            }
+            return std::string::npos;
+        }
+
+        // Position of the ':' separating arguments from text, outside braces
+        size_t find_text_colon(const std::string& directive)
+        {
+            int depth = 0;
+            for (size_t i = 0; i < directive.size(); ++i)
+            {
+                if (directive[i] == '{')
+                {
+                    ++depth;
+                }
+                else if (directive[i] == '}')
+                {
+                    --depth;
+                }
+                else if (directive[i] == ':' && depth == 0)
+                {
+                    return i;
+                }
+            }
+            return std::string::npos;
+        }
+
+        std::string canonical_style(const std::string& name)
+        {
+            if (name == "com" || name == "inp" || name == "input")
+            {
+                return name == "com" ? "com" : "inp";
+            }
+            if (name == "txt" || name == "text")
+            {
+                return "txt";
+            }
+            if (name == "res" || name == "result" || name == "hi")
+            {
+                return "res";
+            }
+            if (name == "err" || name == "error")
+            {
+                return "err";
+            }
+            return "";
+        }
+
+        // {c X} / {char X}
+        std::string render_char(const std::string& arg)
+        {
+            if (arg == "|" || arg == "-" || arg == "+")
+            {
+                return arg;
+            }
+            if (arg == "TT" || arg == "BT" || arg == "LT" || arg == "RT" ||
+                arg == "TLC" || arg == "TRC" || arg == "BLC" || arg == "BRC")
+            {
+                return "+";
+            }
+            if (arg == "-(")
+            {
+                return "{";
+            }
+            if (arg == ")-")
+            {
+                return "}";
+            }
+            if (arg == "S|")
+            {
+                return "$";
+            }
+            if (arg == "'g")
+            {
+                return "`";
+            }
+            if (!arg.empty() && std::isdigit(static_cast<unsigned char>(arg[0])))
+            {
+                long code = std::strtol(arg.c_str(), nullptr, 0);
+                if (code > 0 && code < 128)
+                {
+                    return std::string(1, static_cast<char>(code));
+                }
+            }
+            return "";
+        }
+
+        class smcl_renderer
+        {
+        public:
+            explicit smcl_renderer(int linesize)
+                : m_linesize(linesize > 0 ? static_cast<size_t>(linesize) : 80)
+                , m_style("txt")
+                , m_column(0)
+            {
+            }
+
+            void render(const std::string& smcl)
+            {
+                size_t i = 0;
+                while (i < smcl.size())
+                {
+                    char ch = smcl[i];
+                    if (ch == '{')
+                    {
+                        size_t close = find_closing_brace(smcl, i);
+                        if (close != std::string::npos)
+                        {
+                            std::string body = smcl.substr(i + 1, close - i - 1);
+                            directive(body);
+                            i = close + 1;
+
+                            // {...} continues the line on the next one, as
+                            // display ... _continue does
+                            if (body == "...")
+                            {
+                                if (i < smcl.size() && smcl[i] == '\r')
+                                {
+                                    ++i;
+                                }
+                                if (i < smcl.size() && smcl[i] == '\n')
+                                {
+                                    ++i;
+                                }
+                            }
+                            continue;
+                        }
+                    }
+
+                    // Plain text up to the next directive
+                    size_t next = smcl.find('{', i + 1);
+                    if (next == std::string::npos)
+                    {
+                        next = smcl.size();
+                    }
+                    emit(smcl.substr(i, next - i));
+                    i = next;
+                }
+            }
+
+            std::vector<smcl_segment> take()
+            {
+                return std::move(m_segments);
+            }
+
+        private:
+            size_t m_linesize;
+            std::string m_style;
+            size_t m_column;
+            std::vector<smcl_segment> m_segments;
+
+            void emit(const std::string& text)
+            {
+                std::string cleaned;
+                cleaned.reserve(text.size());
+                for (char c : text)
+                {
+                    if (c == '\r')
+                    {
+                        continue;
+                    }
+                    cleaned += c;
+                    m_column = (c == '\n') ? 0 : m_column + 1;
+                }
+                if (cleaned.empty())
+                {
+                    return;
+                }
+                if (m_segments.empty() || m_segments.back().style != m_style)
+                {
+                    m_segments.push_back({m_style, std::string()});
+                }
+                m_segments.back().text += cleaned;
+            }
+
+            void pad_to(size_t column)
+            {
+                if (m_column < column)
+                {
+                    emit(std::string(column - m_column, ' '));
+                }
+            }
+
+            // Render nested SMCL text, optionally in another style
+            void render_text(const std::string& text, const std::string& style = "")
+            {
+                std::string saved = m_style;
+                if (!style.empty())
+                {
+                    m_style = style;
+                }
+                render(text);
+                m_style = saved;
+            }
+
+            // Plain width of rendered text, for alignment directives
+            size_t rendered_width(const std::string& text)
+            {
+                smcl_renderer inner(static_cast<int>(m_linesize));
+                inner.render(text);
+                size_t width = 0;
+                for (const auto& seg : inner.m_segments)
+                {
+                    width += seg.text.size();
+                }
+                return width;
+            }
+
+            void directive(const std::string& body)
+            {
+                size_t colon = find_text_colon(body);
+                std::string head = body.substr(0, colon);
+                std::string text = colon == std::string::npos ? "" : body.substr(colon + 1);
+
+                size_t space = head.find(' ');
+                std::string name = head.substr(0, space);
+                std::string args = space == std::string::npos ? "" : head.substr(space + 1);
+                args.erase(0, args.find_first_not_of(' '));
+                args.erase(args.find_last_not_of(' ') + 1);
+
+                std::string style = canonical_style(name);
+                if (!style.empty())
+                {
+                    if (colon == std::string::npos)
+                    {
+                        m_style = style;
+                    }
+                    else
+                    {
+                        render_text(text, style);
+                    }
+                    return;
+                }
+
+                if (name == "c" || name == "char")
+                {
+                    emit(render_char(args));
+                }
+                else if (name == "hline" || name == ".-")
+                {
+                    size_t width = args.empty() ? 0 : std::strtoul(args.c_str(), nullptr, 10);
+                    if (width == 0)
+                    {
+                        width = m_column < m_linesize ? m_linesize - m_column : 0;
+                    }
+                    emit(std::string(width, '-'));
+                }
+                else if (name == "space")
+                {
+                    emit(std::string(std::strtoul(args.c_str(), nullptr, 10), ' '));
+                }
+                else if (name == "col")
+                {
+                    size_t column = std::strtoul(args.c_str(), nullptr, 10);
+                    if (column > 0)
+                    {
+                        pad_to(column - 1);
+                    }
+                }
+                else if (name == "right")
+                {
+                    size_t width = rendered_width(text);
+                    if (width < m_linesize)
+                    {
+                        pad_to(m_linesize - width);
+                    }
+                    render_text(text);
+                }
+                else if (name == "ralign" || name == "lalign" || name == "center")
+                {
+                    size_t field = args.empty() ? m_linesize : std::strtoul(args.c_str(), nullptr, 10);
+                    size_t width = rendered_width(text);
+                    size_t fill = width < field ? field - width : 0;
+                    size_t left = name == "ralign" ? fill : (name == "center" ? fill / 2 : 0);
+                    emit(std::string(left, ' '));
+                    render_text(text);
+                    emit(std::string(fill - left, ' '));
+                }
+                else if (name == "dup")
+                {
+                    size_t count = std::strtoul(args.c_str(), nullptr, 10);
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        render_text(text);
+                    }
+                }
+                else if (name == "p_end")
+                {
+                    if (m_column != 0)
+                    {
+                        emit("\n");
+                    }
+                }
+                else if (colon != std::string::npos)
+                {
+                    // Links and font changes ({help ..:text}, {bf:text},
+                    // {search r(111), local:r(111);}, ...) show their text
+                    render_text(text);
+                }
+                // Everything else ({smcl}, {sf}, {ul off}, {p ...}) only
+                // affects layout or fonts; {...} is handled in render
+            }
+        };
+    }
+
+    std::vector<smcl_segment> parse_smcl(const std::string& smcl, int linesize)
+    {
+        smcl_renderer renderer(linesize);
+        renderer.render(smcl);
+        return renderer.take();
+    }
+
+    std::string smcl_text(const std::vector<smcl_segment>& segments, const std::string& skip_style)
+    {
+        std::string text;
+        for (const auto& seg : segments)
+        {
+            if (seg.style != skip_style)
+            {
+                text += seg.text;
+            }
+        }
+        return text;
+    }
+
+} // namespace xeus_stata
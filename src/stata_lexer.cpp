@@ -0,0 +1,696 @@
+#include "xeus-stata/stata_lexer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <mutex>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        bool is_space(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        bool is_word_start(char c)
+        {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        }
+
+        bool is_word_char(char c)
+        {
+            return is_word_start(c) || (c >= '0' && c <= '9');
+        }
+
+        bool is_digit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        // Words that run the rest of the statement as another command
+        bool is_prefix_command(const std::string& word)
+        {
+            static const char* const prefixes[] = {
+                "quietly", "quietl", "quiet", "quie", "qui",
+                "noisily", "noisil", "noisi", "nois", "noi",
+                "capture", "captur", "captu", "capt", "cap"
+            };
+            for (const char* prefix : prefixes)
+            {
+                if (word == prefix)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool is_by_prefix(const std::string& word)
+        {
+            return word == "by" || word == "bysort" || word == "bys";
+        }
+    }
+
+    stata_lexer::stata_lexer(const std::string& source, size_t offset, const lexer_state& state)
+        : m_source(source)
+        , m_pos(offset)
+        , m_state(state)
+    {
+    }
+
+    token stata_lexer::make(token_kind kind, size_t start, bool unterminated)
+    {
+        token tok;
+        tok.kind = kind;
+        tok.unterminated = unterminated;
+        tok.offset = static_cast<uint32_t>(start);
+        tok.length = static_cast<uint32_t>(m_pos - start);
+
+        switch (kind)
+        {
+            case token_kind::comment:
+            case token_kind::continuation:
+                break;
+            case token_kind::end_of_statement:
+                m_state.at_statement_start = true;
+                if (m_state.mata_pending)
+                {
+                    m_state.mata_pending = false;
+                    m_state.in_mata = true;
+                }
+                break;
+            default:
+                m_state.at_statement_start = false;
+                break;
+        }
+        return tok;
+    }
+
+    bool stata_lexer::next(token& tok)
+    {
+        const std::string& src = m_source;
+        const size_t size = src.size();
+
+        while (m_pos < size)
+        {
+            if (m_state.comment_depth > 0)
+            {
+                tok = lex_block_comment(m_pos);
+                return true;
+            }
+
+            if (m_state.in_mata)
+            {
+                tok = lex_mata_line();
+                return true;
+            }
+
+            char c = src[m_pos];
+            char next = m_pos + 1 < size ? src[m_pos + 1] : '\0';
+            size_t start = m_pos;
+
+            if (is_space(c))
+            {
+                ++m_pos;
+                continue;
+            }
+
+            if (c == '\n')
+            {
+                ++m_pos;
+                if (m_state.semicolon_delimiter)
+                {
+                    continue;
+                }
+                tok = make(token_kind::end_of_statement, start);
+                return true;
+            }
+
+            if (c == ';' && m_state.semicolon_delimiter)
+            {
+                ++m_pos;
+                tok = make(token_kind::end_of_statement, start);
+                return true;
+            }
+
+            if (c == '/' && next == '*')
+            {
+                m_state.comment_depth = 1;
+                m_pos += 2;
+                tok = lex_block_comment(start);
+                return true;
+            }
+
+            // // and /// only start a comment after whitespace, so a URL
+            // like http://... stays intact
+            if (c == '/' && next == '/' && (start == 0 || is_space(src[start - 1]) || src[start - 1] == '\n'))
+            {
+                bool continuation = m_pos + 2 < size && src[m_pos + 2] == '/';
+                size_t eol = src.find('\n', m_pos);
+                if (continuation)
+                {
+                    m_pos = eol == std::string::npos ? size : eol + 1;
+                    tok = make(token_kind::continuation, start);
+                }
+                else
+                {
+                    m_pos = eol == std::string::npos ? size : eol;
+                    tok = make(token_kind::comment, start);
+                }
+                return true;
+            }
+
+            if (c == '*' && m_state.at_statement_start)
+            {
+                tok = lex_star_comment(start);
+                return true;
+            }
+
+            if (c == '#' && m_state.at_statement_start)
+            {
+                size_t word_end = m_pos + 1;
+                while (word_end < size && is_word_char(src[word_end]))
+                {
+                    ++word_end;
+                }
+                // #delimit may be abbreviated down to #d
+                size_t word_length = word_end - m_pos - 1;
+                if (word_length > 0 && word_length <= 7 &&
+                    src.compare(m_pos + 1, word_length, "delimit", word_length) == 0)
+                {
+                    size_t eol = src.find('\n', word_end);
+                    m_pos = eol == std::string::npos ? size : eol;
+                    size_t arg = word_end;
+                    while (arg < m_pos && is_space(src[arg]))
+                    {
+                        ++arg;
+                    }
+                    m_state.semicolon_delimiter = arg < m_pos && src[arg] == ';';
+                    tok = make(token_kind::delimit, start);
+                    m_state.at_statement_start = true;
+                    return true;
+                }
+            }
+
+            if (c == '"')
+            {
+                size_t close = m_pos + 1;
+                while (close < size && src[close] != '"' && src[close] != '\n')
+                {
+                    ++close;
+                }
+                bool unterminated = close >= size || src[close] != '"';
+                m_pos = unterminated ? close : close + 1;
+                tok = make(token_kind::string, start, unterminated);
+                return true;
+            }
+
+            if (c == '`')
+            {
+                bool unterminated = false;
+                token_kind kind = next == '"' ? token_kind::compound_string : token_kind::local_macro;
+                if (kind == token_kind::compound_string)
+                {
+                    skip_compound_string(m_pos, unterminated);
+                }
+                else
+                {
+                    skip_macro(m_pos, unterminated);
+                }
+                tok = make(kind, start, unterminated);
+                return true;
+            }
+
+            if (c == '$')
+            {
+                ++m_pos;
+                bool unterminated = false;
+                if (next == '{')
+                {
+                    size_t close = src.find_first_of("}\n", m_pos);
+                    unterminated = close == std::string::npos || src[close] != '}';
+                    m_pos = unterminated ? (close == std::string::npos ? size : close) : close + 1;
+                }
+                else
+                {
+                    while (m_pos < size && is_word_char(src[m_pos]))
+                    {
+                        ++m_pos;
+                    }
+                }
+                tok = make(token_kind::global_macro, start, unterminated);
+                return true;
+            }
+
+            if (is_digit(c) || (c == '.' && is_digit(next)))
+            {
+                while (m_pos < size && (is_digit(src[m_pos]) || src[m_pos] == '.' ||
+                                        src[m_pos] == 'e' || src[m_pos] == 'E'))
+                {
+                    ++m_pos;
+                }
+                tok = make(token_kind::number, start);
+                return true;
+            }
+
+            if (is_word_start(c))
+            {
+                while (m_pos < size && is_word_char(src[m_pos]))
+                {
+                    ++m_pos;
+                }
+                // mata or mata: alone on its line opens a block up to end;
+                // mata: followed by code is a single statement
+                if (m_state.at_statement_start && m_pos - start == 4 && src.compare(start, 4, "mata") == 0)
+                {
+                    size_t look = m_pos;
+                    while (look < size && is_space(src[look]))
+                    {
+                        ++look;
+                    }
+                    if (look < size && src[look] == ':')
+                    {
+                        ++look;
+                        while (look < size && is_space(src[look]))
+                        {
+                            ++look;
+                        }
+                    }
+                    if (look >= size || src[look] == '\n' ||
+                        src.compare(look, 2, "//") == 0 || src.compare(look, 2, "/*") == 0)
+                    {
+                        m_state.mata_pending = true;
+                    }
+                }
+                tok = make(token_kind::word, start);
+                return true;
+            }
+
+            ++m_pos;
+            switch (c)
+            {
+                case '{':
+                    ++m_state.brace_depth;
+                    tok = make(token_kind::open_brace, start);
+                    break;
+                case '}':
+                    --m_state.brace_depth;
+                    m_state.min_brace_depth = std::min(m_state.min_brace_depth, m_state.brace_depth);
+                    tok = make(token_kind::close_brace, start);
+                    break;
+                case '(':
+                    tok = make(token_kind::open_paren, start);
+                    break;
+                case ')':
+                    tok = make(token_kind::close_paren, start);
+                    break;
+                default:
+                    tok = make(token_kind::op, start);
+                    break;
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    token stata_lexer::lex_block_comment(size_t start)
+    {
+        // Stata lets /* */ comments nest
+        const std::string& src = m_source;
+        while (m_pos < src.size() && m_state.comment_depth > 0)
+        {
+            if (src.compare(m_pos, 2, "/*") == 0)
+            {
+                ++m_state.comment_depth;
+                m_pos += 2;
+            }
+            else if (src.compare(m_pos, 2, "*/") == 0)
+            {
+                --m_state.comment_depth;
+                m_pos += 2;
+            }
+            else
+            {
+                ++m_pos;
+            }
+        }
+        return make(token_kind::comment, start, m_state.comment_depth > 0);
+    }
+
+    token stata_lexer::lex_star_comment(size_t start)
+    {
+        // Runs to the end of the line (to the next ; under #delimit ;); a
+        // trailing /// carries it over to the next line
+        const std::string& src = m_source;
+        if (m_state.semicolon_delimiter)
+        {
+            size_t semicolon = src.find(';', m_pos);
+            m_pos = semicolon == std::string::npos ? src.size() : semicolon;
+            return make(token_kind::comment, start);
+        }
+
+        while (true)
+        {
+            size_t eol = src.find('\n', m_pos);
+            if (eol == std::string::npos)
+            {
+                m_pos = src.size();
+                break;
+            }
+            size_t last = eol;
+            while (last > m_pos && is_space(src[last - 1]))
+            {
+                --last;
+            }
+            if (last - m_pos >= 3 && src.compare(last - 3, 3, "///") == 0)
+            {
+                m_pos = eol + 1;
+                continue;
+            }
+            m_pos = eol;
+            break;
+        }
+        return make(token_kind::comment, start);
+    }
+
+    token stata_lexer::lex_mata_line()
+    {
+        const std::string& src = m_source;
+        size_t start = m_pos;
+        if (src[m_pos] == '\n')
+        {
+            ++m_pos;
+            return make(token_kind::end_of_statement, start);
+        }
+
+        size_t eol = src.find('\n', m_pos);
+        m_pos = eol == std::string::npos ? src.size() : eol;
+
+        size_t first = start;
+        while (first < m_pos && is_space(src[first]))
+        {
+            ++first;
+        }
+        size_t last = m_pos;
+        while (last > first && is_space(src[last - 1]))
+        {
+            --last;
+        }
+        if (last - first == 3 && src.compare(first, 3, "end") == 0)
+        {
+            m_state.in_mata = false;
+            return make(token_kind::word, first);
+        }
+
+        // Braces of Mata functions and loops still count, outside strings
+        // and // comments
+        bool quoted = false;
+        for (size_t i = first; i < last; ++i)
+        {
+            char c = src[i];
+            if (c == '"')
+            {
+                quoted = !quoted;
+            }
+            else if (!quoted && c == '/' && i + 1 < last && src[i + 1] == '/')
+            {
+                break;
+            }
+            else if (!quoted && c == '{')
+            {
+                ++m_state.brace_depth;
+            }
+            else if (!quoted && c == '}')
+            {
+                --m_state.brace_depth;
+                m_state.min_brace_depth = std::min(m_state.min_brace_depth, m_state.brace_depth);
+            }
+        }
+        return make(token_kind::mata_line, start);
+    }
+
+    void stata_lexer::skip_macro(size_t& pos, bool& unterminated) const
+    {
+        // `name', with nested macros such as `x`i''; ends at the line end
+        const std::string& src = m_source;
+        int depth = 0;
+        while (pos < src.size() && src[pos] != '\n')
+        {
+            char c = src[pos++];
+            if (c == '`')
+            {
+                ++depth;
+            }
+            else if (c == '\'' && --depth == 0)
+            {
+                return;
+            }
+        }
+        unterminated = true;
+    }
+
+    void stata_lexer::skip_compound_string(size_t& pos, bool& unterminated) const
+    {
+        // `"..."', where `" and "' nest
+        const std::string& src = m_source;
+        int depth = 0;
+        while (pos < src.size() && src[pos] != '\n')
+        {
+            if (src.compare(pos, 2, "`\"") == 0)
+            {
+                ++depth;
+                pos += 2;
+            }
+            else if (src.compare(pos, 2, "\"'") == 0)
+            {
+                pos += 2;
+                if (--depth == 0)
+                {
+                    return;
+                }
+            }
+            else
+            {
+                ++pos;
+            }
+        }
+        unterminated = true;
+    }
+
+    const token* lexed_cell::token_at(size_t offset) const
+    {
+        auto it = std::upper_bound(tokens.begin(), tokens.end(), offset,
+                                   [](size_t value, const token& tok) { return value < tok.offset; });
+        if (it == tokens.begin())
+        {
+            return nullptr;
+        }
+        --it;
+        return offset <= static_cast<size_t>(it->offset) + it->length ? &*it : nullptr;
+    }
+
+    std::vector<std::string> lexed_cell::commands() const
+    {
+        std::vector<std::string> result;
+        for (size_t index : command_tokens())
+        {
+            result.push_back(text(tokens[index]));
+        }
+        return result;
+    }
+
+    std::vector<size_t> lexed_cell::command_tokens() const
+    {
+        std::vector<size_t> result;
+        bool expecting = true;
+        bool skipping_by = false;
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            const token& tok = tokens[i];
+            if (tok.kind == token_kind::end_of_statement || tok.kind == token_kind::open_brace)
+            {
+                expecting = true;
+                skipping_by = false;
+                continue;
+            }
+            if (!expecting)
+            {
+                continue;
+            }
+            if (skipping_by)
+            {
+                skipping_by = !(tok.kind == token_kind::op && code[tok.offset] == ':');
+                continue;
+            }
+            if (tok.kind == token_kind::comment || tok.kind == token_kind::continuation)
+            {
+                continue;
+            }
+            if (tok.kind != token_kind::word)
+            {
+                expecting = false;
+                continue;
+            }
+
+            std::string word = text(tok);
+            if (is_prefix_command(word))
+            {
+                continue;
+            }
+            if (is_by_prefix(word))
+            {
+                skipping_by = true;
+                continue;
+            }
+            result.push_back(i);
+            expecting = false;
+        }
+        return result;
+    }
+
+    bool lexed_cell::is_command_position(size_t offset) const
+    {
+        auto it = std::lower_bound(tokens.begin(), tokens.end(), offset,
+                                   [](const token& tok, size_t value) { return tok.offset < value; });
+        while (it != tokens.begin())
+        {
+            const token& tok = *--it;
+            switch (tok.kind)
+            {
+                case token_kind::comment:
+                case token_kind::continuation:
+                    continue;
+                case token_kind::end_of_statement:
+                case token_kind::open_brace:
+                case token_kind::delimit:
+                    return true;
+                case token_kind::word:
+                    if (!is_prefix_command(text(tok)))
+                    {
+                        return false;
+                    }
+                    // quietly reg ...: the prefix must itself be a command
+                    return is_command_position(tok.offset);
+                case token_kind::op:
+                    // by group: cmd
+                    return code[tok.offset] == ':';
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    namespace
+    {
+        std::shared_ptr<lexed_cell> lex_from(const std::string& code, const lexed_cell* prefix)
+        {
+            auto cell = std::make_shared<lexed_cell>();
+            cell->code = code;
+
+            size_t offset = 0;
+            lexer_state state;
+            if (prefix)
+            {
+                cell->tokens.assign(prefix->tokens.begin(), prefix->tokens.begin() + prefix->resume_token);
+                offset = prefix->resume_offset;
+                state = prefix->resume_state;
+                cell->resume_offset = prefix->resume_offset;
+                cell->resume_token = prefix->resume_token;
+                cell->resume_state = prefix->resume_state;
+            }
+
+            stata_lexer lexer(cell->code, offset, state);
+            token tok;
+            while (lexer.next(tok))
+            {
+                cell->tokens.push_back(tok);
+                const lexer_state& now = lexer.state();
+                if (tok.kind == token_kind::end_of_statement && now.brace_depth == 0 &&
+                    now.comment_depth == 0 && !now.in_mata)
+                {
+                    cell->resume_offset = lexer.offset();
+                    cell->resume_token = cell->tokens.size();
+                    cell->resume_state = now;
+                }
+            }
+            cell->end_state = lexer.state();
+            return cell;
+        }
+    }
+
+    std::shared_ptr<const lexed_cell> lex_cell(const std::string& code)
+    {
+        static std::mutex mutex;
+        static std::list<std::shared_ptr<lexed_cell>> cache;
+        const size_t cache_size = 8;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const lexed_cell* prefix = nullptr;
+        for (auto it = cache.begin(); it != cache.end(); ++it)
+        {
+            const lexed_cell& cached = **it;
+            if (cached.code == code)
+            {
+                cache.splice(cache.begin(), cache, it);
+                return cache.front();
+            }
+            if (!prefix && cached.resume_offset > 0 && cached.resume_offset <= code.size() &&
+                code.compare(0, cached.resume_offset, cached.code, 0, cached.resume_offset) == 0)
+            {
+                prefix = &cached;
+            }
+        }
+
+        cache.push_front(lex_from(code, prefix));
+        if (cache.size() > cache_size)
+        {
+            cache.pop_back();
+        }
+        return cache.front();
+    }
+
+    completeness cell_completeness(const lexed_cell& cell, int& indent_level)
+    {
+        const lexer_state& state = cell.end_state;
+        indent_level = std::max(state.brace_depth, 0);
+
+        if (state.min_brace_depth < 0)
+        {
+            return completeness::invalid;
+        }
+        if (state.brace_depth > 0 || state.comment_depth > 0 || state.in_mata || state.mata_pending)
+        {
+            return completeness::incomplete;
+        }
+
+        // A trailing /// continues onto a line not typed yet; under
+        // #delimit ; so does anything after the last ;
+        for (auto it = cell.tokens.rbegin(); it != cell.tokens.rend(); ++it)
+        {
+            if (it->kind == token_kind::continuation)
+            {
+                return completeness::incomplete;
+            }
+            if (it->kind == token_kind::end_of_statement || it->kind == token_kind::delimit)
+            {
+                break;
+            }
+            if (it->kind == token_kind::comment)
+            {
+                continue;
+            }
+            if (state.semicolon_delimiter)
+            {
+                return completeness::incomplete;
+            }
+            break;
+        }
+        return completeness::complete;
+    }
+
+} // namespace xeus_stata
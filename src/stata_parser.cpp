@@ -1,5 +1,9 @@
 #include "xeus-stata/stata_parser.hpp"
+#include "xeus-stata/trace.hpp"
+#include "xeus-stata/smcl.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <regex>
 #include <sstream>
 #include <iomanip>
@@ -7,6 +11,329 @@
 
 namespace xeus_stata
 {
+    namespace
+    {
+        // Remove empty lines and trim trailing whitespace only
+        // IMPORTANT: Keep leading spaces for table alignment!
+        std::string compact_lines(const std::string& text)
+        {
+            std::stringstream ss(text);
+            std::stringstream output_ss;
+            std::string line;
+            bool first_line = true;
+
+            while (std::getline(ss, line))
+            {
+                // Only trim trailing whitespace (keep leading spaces for alignment)
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+
+                // Skip empty lines
+                if (!line.empty())
+                {
+                    if (!first_line)
+                    {
+                        output_ss << "\n";
+                    }
+                    output_ss << line;
+                    first_line = false;
+                }
+            }
+
+            return output_ss.str();
+        }
+
+        const char TRAILER_TAG[] = "xstata_trailer|";
+        const char EXPRESSION_TAG[] = "xstata_ux|";
+
+        // Start of the first line beginning with tag, or npos
+        size_t find_tagged_line(const std::string& text, const char* tag)
+        {
+            size_t pos = text.find(tag);
+            while (pos != std::string::npos && pos > 0 && text[pos - 1] != '\n')
+            {
+                pos = text.find(tag, pos + 1);
+            }
+            return pos;
+        }
+
+        // [start, end) of the last line starting with the trailer tag,
+        // including its newline; start is npos if there is none. A
+        // trailer wider than the line size wraps, so the non-empty lines
+        // after it, which only the kernel prints, belong to it as well.
+        std::pair<size_t, size_t> find_trailer_line(const std::string& text)
+        {
+            size_t pos = text.rfind(TRAILER_TAG);
+            while (pos != std::string::npos && pos > 0 && text[pos - 1] != '\n')
+            {
+                pos = text.rfind(TRAILER_TAG, pos - 1);
+            }
+            if (pos == std::string::npos)
+            {
+                return {std::string::npos, std::string::npos};
+            }
+            size_t end = pos;
+            while (end < text.size())
+            {
+                size_t newline = text.find('\n', end);
+                end = newline == std::string::npos ? text.size() : newline + 1;
+                size_t next = text.find_first_not_of('\r', end);
+                if (next == std::string::npos || text[next] == '\n')
+                {
+                    break;
+                }
+            }
+            return {pos, end};
+        }
+
+        // Erase [start, end) of the concatenated segment text; the trailer
+        // may be split over several segments
+        void erase_segment_range(std::vector<smcl_segment>& segments, size_t start, size_t end)
+        {
+            size_t offset = 0;
+            for (auto& segment : segments)
+            {
+                size_t seg_start = offset;
+                size_t seg_end = offset + segment.text.size();
+                offset = seg_end;
+                if (seg_end <= start || seg_start >= end)
+                {
+                    continue;
+                }
+                size_t from = std::max(start, seg_start) - seg_start;
+                size_t to = std::min(end, seg_end) - seg_start;
+                segment.text.erase(from, to - from);
+            }
+            segments.erase(std::remove_if(segments.begin(), segments.end(),
+                                          [](const smcl_segment& segment) { return segment.text.empty(); }),
+                           segments.end());
+        }
+    }
+
+    std::string compound_quote(const std::string& text)
+    {
+        return "`\"" + text + "\"'";
+    }
+
+    std::string trailer_command(const std::string& rc_expression,
+                                const std::string& elapsed_expression)
+    {
+        // The tag is split so the echoed command never matches it. The
+        // line is printed at the widest line size and the user's is put
+        // back afterwards; only a very long c(pwd) still wraps it.
+        return "local __xstata_ls = c(linesize)\n"
+               "quietly set linesize 255\n"
+               "display \"xstata_\" \"trailer|1|\" " + rc_expression +
+               " \"|\" %18.0f c(N) \"|\" %9.0f c(k) \"|\" c(changed) \"|\" c(frame)"
+               " \"|\" %12.3f " + elapsed_expression +
+               " \"|\" %15.0f clock(c(current_date) + \" \" + c(current_time), \"DMYhms\")"
+               " \"|\" c(pwd)\n"
+               "quietly set linesize `__xstata_ls'\n"
+               "local __xstata_ls\n";
+    }
+
+    bool apply_trailer(execution_result& result)
+    {
+        auto line = find_trailer_line(result.output);
+        if (line.first == std::string::npos)
+        {
+            return false;
+        }
+
+        std::string trailer;
+        for (size_t i = line.first; i < line.second; ++i)
+        {
+            if (result.output[i] != '\n' && result.output[i] != '\r')
+            {
+                trailer += result.output[i];
+            }
+        }
+        trailer.erase(trailer.find_last_not_of(" \t") + 1);
+        result.output.erase(line.first, line.second - line.first);
+        result.output.erase(result.output.find_last_not_of(" \t\r\n") + 1);
+
+        if (!result.segments.empty())
+        {
+            auto seg_line = find_trailer_line(smcl_text(result.segments));
+            if (seg_line.first != std::string::npos)
+            {
+                erase_segment_range(result.segments, seg_line.first, seg_line.second);
+            }
+        }
+
+        // version|rc|N|k|changed|frame|elapsed|clock|pwd; pwd is last
+        // since it may itself contain '|'
+        std::vector<std::string> fields;
+        size_t start = sizeof(TRAILER_TAG) - 1;
+        while (fields.size() < 8)
+        {
+            size_t bar = trailer.find('|', start);
+            if (bar == std::string::npos)
+            {
+                return false;
+            }
+            fields.push_back(trailer.substr(start, bar - start));
+            start = bar + 1;
+        }
+        fields.push_back(trailer.substr(start));
+        if (fields[0] != "1")
+        {
+            return false;
+        }
+
+        auto number = [](const std::string& text) {
+            char* end = nullptr;
+            double value = std::strtod(text.c_str(), &end);
+            return end == text.c_str() ? 0.0 : value;
+        };
+
+        cell_state& state = result.state;
+        state.valid = true;
+        state.nobs = static_cast<long long>(number(fields[2]));
+        state.nvars = static_cast<int>(number(fields[3]));
+        state.data_changed = number(fields[4]) != 0;
+        state.frame = fields[5];
+        state.stata_clock = number(fields[7]);
+        state.pwd = fields[8];
+        result.timing.stata_timer_ms = number(fields[6]);
+
+        // "." when the cell was typed into the console without capture
+        std::string rc_text = fields[1];
+        rc_text.erase(0, rc_text.find_first_not_of(' '));
+        if (rc_text.empty() || rc_text == ".")
+        {
+            return true;
+        }
+
+        int rc = std::atoi(rc_text.c_str());
+        if (rc == 0)
+        {
+            // r(N); in the output was the cell's own text
+            result.is_error = false;
+            result.error_code = 0;
+            result.error_message.clear();
+        }
+        else if (!result.is_error || result.error_code != rc)
+        {
+            // capture noisily shows the message but not r(N);
+            result.is_error = true;
+            result.error_code = rc;
+            if (rc == 1)
+            {
+                result.error_message = "Execution interrupted by user";
+            }
+            else
+            {
+                std::string error_text;
+                for (const auto& segment : result.segments)
+                {
+                    if (segment.style == "err")
+                    {
+                        error_text += segment.text;
+                    }
+                }
+                result.error_message = compact_lines(error_text.empty() ? result.output : error_text);
+            }
+        }
+        return true;
+    }
+
+    std::string expressions_command(const expression_list& expressions)
+    {
+        // An expression spanning lines would run as commands of its own,
+        // so it is refused with r(198) instead of being evaluated
+        std::string command;
+        for (size_t i = 0; i < expressions.size(); ++i)
+        {
+            const std::string& expression = expressions[i].second;
+            std::string tag = "display \"xstata_\" \"ux|" + std::to_string(i) + "|\" ";
+            if (expression.find_first_of("\r\n") != std::string::npos ||
+                expression.find_first_not_of(" \t") == std::string::npos)
+            {
+                command += tag + "198 \"|\"\n";
+                continue;
+            }
+            command += "local __xstata_ux\n"
+                       "capture local __xstata_ux = " + expression + "\n" +
+                       tag + "_rc \"|\" `\"`__xstata_ux'\"'\n";
+        }
+        if (!command.empty())
+        {
+            command += "local __xstata_ux\n";
+        }
+        return command;
+    }
+
+    void apply_expressions(execution_result& result, const expression_list& expressions)
+    {
+        size_t start = find_tagged_line(result.output, EXPRESSION_TAG);
+        if (expressions.empty() || start == std::string::npos)
+        {
+            return;
+        }
+
+        std::string block = result.output.substr(start);
+        result.output.erase(start);
+        result.output.erase(result.output.find_last_not_of(" \t\r\n") + 1);
+        if (!result.segments.empty())
+        {
+            std::string text = smcl_text(result.segments);
+            size_t seg_start = find_tagged_line(text, EXPRESSION_TAG);
+            if (seg_start != std::string::npos)
+            {
+                erase_segment_range(result.segments, seg_start, text.size());
+            }
+        }
+
+        // index|rc|value; lines without the tag continue a value that
+        // display wrapped at the line size
+        std::vector<expression_result> found(expressions.size());
+        std::vector<bool> seen(expressions.size(), false);
+        expression_result* current = nullptr;
+        std::stringstream ss(block);
+        std::string line;
+        while (std::getline(ss, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (line.compare(0, sizeof(EXPRESSION_TAG) - 1, EXPRESSION_TAG) != 0)
+            {
+                if (current)
+                {
+                    current->value += line;
+                }
+                continue;
+            }
+
+            current = nullptr;
+            size_t index_end = line.find('|', sizeof(EXPRESSION_TAG) - 1);
+            size_t rc_end = index_end == std::string::npos ? std::string::npos : line.find('|', index_end + 1);
+            if (rc_end == std::string::npos)
+            {
+                continue;
+            }
+            size_t index = std::strtoul(line.c_str() + sizeof(EXPRESSION_TAG) - 1, nullptr, 10);
+            if (index >= expressions.size())
+            {
+                continue;
+            }
+            current = &found[index];
+            current->name = expressions[index].first;
+            current->rc = std::atoi(line.c_str() + index_end + 1);
+            current->value = line.substr(rc_end + 1);
+            seen[index] = true;
+        }
+
+        for (size_t i = 0; i < found.size(); ++i)
+        {
+            if (seen[i])
+            {
+                result.expressions.push_back(std::move(found[i]));
+            }
+        }
+    }
+
     std::string generate_execution_marker()
     {
         // Generate a random hex string to use as a marker
@@ -63,6 +390,7 @@ namespace xeus_stata
 
     bool is_stata_table(const std::string& output)
     {
+        trace_scope trace("format.is_stata_table", "format");
         if (output.empty())
         {
             return false;
@@ -130,58 +458,59 @@ namespace xeus_stata
                (dash_lines >= 2 && multi_space_lines >= 3);
     }
 
-    std::string format_as_html_table(const std::string& output)
+    std::string html_escape(const std::string& text)
     {
-        // Simple approach: wrap in <pre> with CSS styling
-        std::stringstream html;
-
-        html << "<style>\n";
-        html << ".stata-output {\n";
-        html << "  font-family: ui-monospace, 'Cascadia Code', 'Source Code Pro', Menlo, 'DejaVu Sans Mono', Consolas, monospace;\n";
-        html << "  font-size: 12px;\n";
-        html << "  font-variant-ligatures: none;\n";
-        html << "  color: inherit;\n";
-        html << "  background-color: transparent;\n";
-        html << "  padding: 10px;\n";
-        html << "  border: 1px solid currentcolor;\n";
-        html << "  border-radius: 3px;\n";
-        html << "  opacity: 0.6;\n";
-        html << "  overflow-x: auto;\n";
-        html << "  margin: 0;\n";
-        html << "  line-height: 1.4;\n";
-        html << "}\n";
-        html << "</style>\n";
-        html << "<pre class=\"stata-output\">";
-
-        // Escape HTML special characters and convert spaces to nbsp for perfect alignment
-        std::string escaped = output;
-
-        // First escape & to avoid double-escaping
-        size_t pos = 0;
-        while ((pos = escaped.find("&", pos)) != std::string::npos)
+        // Size the result first so the copy below never reallocates
+        size_t extra = 0;
+        for (char c : text)
         {
-            escaped.replace(pos, 1, "&amp;");
-            pos += 5;
+            extra += (c == '&') ? 4 : (c == '<' || c == '>') ? 3 : 0;
         }
-
-        // Then escape < and >
-        pos = 0;
-        while ((pos = escaped.find("<", pos)) != std::string::npos)
+        if (extra == 0)
         {
-            escaped.replace(pos, 1, "&lt;");
-            pos += 4;
+            return text;
         }
-        pos = 0;
-        while ((pos = escaped.find(">", pos)) != std::string::npos)
+
+        std::string escaped;
+        escaped.reserve(text.size() + extra);
+        size_t start = 0;
+        size_t pos;
+        while ((pos = text.find_first_of("&<>", start)) != std::string::npos)
         {
-            escaped.replace(pos, 1, "&gt;");
-            pos += 4;
+            escaped.append(text, start, pos - start);
+            escaped += text[pos] == '&' ? "&amp;" : text[pos] == '<' ? "&lt;" : "&gt;";
+            start = pos + 1;
         }
+        escaped.append(text, start, std::string::npos);
+        return escaped;
+    }
 
-        html << escaped;
-        html << "</pre>";
+    const std::string& html_table_styles()
+    {
+        static const std::string styles =
+            "<style>"
+            ".stata-output{font-family:ui-monospace,'Cascadia Code','Source Code Pro',Menlo,'DejaVu Sans Mono',"
+            "Consolas,monospace;font-size:12px;font-variant-ligatures:none;color:inherit;"
+            "background-color:transparent;padding:10px;border:1px solid currentcolor;border-radius:3px;"
+            "opacity:0.6;overflow-x:auto;margin:0;line-height:1.4}"
+            "</style>\n";
+        return styles;
+    }
 
-        return html.str();
+    std::string format_as_html_table(const std::string& output)
+    {
+        // Simple approach: wrap in <pre> with CSS styling
+        static const std::string open_tag = "<pre class=\"stata-output\">";
+        static const std::string close_tag = "</pre>";
+
+        std::string escaped = html_escape(output);
+        std::string html;
+        html.reserve(html_table_styles().size() + open_tag.size() + escaped.size() + close_tag.size());
+        html += html_table_styles();
+        html += open_tag;
+        html += escaped;
+        html += close_tag;
+        return html;
     }
 
     bool is_raw_html_output(const std::string& output)
@@ -219,59 +548,39 @@ namespace xeus_stata
         return false;
     }
 
+    const std::string& raw_html_styles()
+    {
+        // Booktabs-style rules for tables
+        static const std::string styles =
+            "<style>"
+            ".stata-table,.stata-table table{border-collapse:collapse;border:none;font-family:inherit}"
+            ".stata-table td,.stata-table th{border:none;padding:4px 8px}"
+            ".stata-table>tr:first-child td,.stata-table>tr:first-child th,"
+            ".stata-table>tbody>tr:first-child td,.stata-table>tbody>tr:first-child th,"
+            ".stata-table thead tr:first-child th,.stata-table thead tr:first-child td"
+            "{border-top:2px solid currentcolor}"
+            ".stata-table thead tr:last-child th,.stata-table thead tr:last-child td"
+            "{border-bottom:1px solid currentcolor}"
+            ".stata-table thead td,.stata-table thead th{font-weight:bold}"
+            ".stata-table>tr:last-child td,.stata-table>tr:last-child th,"
+            ".stata-table tbody tr:last-child td,.stata-table tbody tr:last-child th"
+            "{border-bottom:2px solid currentcolor}"
+            // Tables without a proper thead: midrule under row 3, first 3 rows bold
+            ".stata-table:not(:has(thead))>tr:nth-child(3) td,"
+            ".stata-table:not(:has(thead))>tbody>tr:nth-child(3) td{border-bottom:1px solid currentcolor}"
+            ".stata-table:not(:has(thead))>tr:nth-child(-n+3) td,"
+            ".stata-table:not(:has(thead))>tbody>tr:nth-child(-n+3) td{font-weight:bold}"
+            "</style>\n";
+        return styles;
+    }
+
     std::string format_as_raw_html(const std::string& output)
     {
         // Extract just the HTML portion from the output
         // esttab output may contain non-HTML lines before the table
         std::stringstream result;
 
-        // Inject booktabs-style CSS for tables
-        result << "<style>\n";
-        result << ".stata-table, .stata-table table {\n";
-        result << "  border-collapse: collapse;\n";
-        result << "  border: none;\n";
-        result << "  font-family: inherit;\n";
-        result << "}\n";
-        result << ".stata-table td, .stata-table th {\n";
-        result << "  border: none;\n";
-        result << "  padding: 4px 8px;\n";
-        result << "}\n";
-        result << "/* Toprule: first row of table */\n";
-        result << ".stata-table > tr:first-child td,\n";
-        result << ".stata-table > tr:first-child th,\n";
-        result << ".stata-table > tbody > tr:first-child td,\n";
-        result << ".stata-table > tbody > tr:first-child th,\n";
-        result << ".stata-table thead tr:first-child th,\n";
-        result << ".stata-table thead tr:first-child td {\n";
-        result << "  border-top: 2px solid currentcolor;\n";
-        result << "}\n";
-        result << "/* Midrule: bottom of thead, or use heuristic for first 3 rows */\n";
-        result << ".stata-table thead tr:last-child th,\n";
-        result << ".stata-table thead tr:last-child td {\n";
-        result << "  border-bottom: 1px solid currentcolor;\n";
-        result << "}\n";
-        result << "/* Heuristic midrule for tables without proper thead: row 3 */\n";
-        result << ".stata-table:not(:has(thead)) > tr:nth-child(3) td,\n";
-        result << ".stata-table:not(:has(thead)) > tbody > tr:nth-child(3) td {\n";
-        result << "  border-bottom: 1px solid currentcolor;\n";
-        result << "}\n";
-        result << "/* Bold headers: thead rows or first 3 rows */\n";
-        result << ".stata-table thead td,\n";
-        result << ".stata-table thead th {\n";
-        result << "  font-weight: bold;\n";
-        result << "}\n";
-        result << ".stata-table:not(:has(thead)) > tr:nth-child(-n+3) td,\n";
-        result << ".stata-table:not(:has(thead)) > tbody > tr:nth-child(-n+3) td {\n";
-        result << "  font-weight: bold;\n";
-        result << "}\n";
-        result << "/* Bottomrule: last row */\n";
-        result << ".stata-table > tr:last-child td,\n";
-        result << ".stata-table > tr:last-child th,\n";
-        result << ".stata-table tbody tr:last-child td,\n";
-        result << ".stata-table tbody tr:last-child th {\n";
-        result << "  border-bottom: 2px solid currentcolor;\n";
-        result << "}\n";
-        result << "</style>\n";
+        result << raw_html_styles();
 
         // Find the start of HTML content
         size_t html_start = std::string::npos;
@@ -375,6 +684,7 @@ namespace xeus_stata
         execution_result result;
 
         // Strip ANSI codes first
+        trace_scope strip_trace("parser.strip_echo", "parser");
         std::string cleaned = strip_ansi_codes(output);
 
         // Check for interrupted execution (--Break--)
@@ -389,6 +699,14 @@ namespace xeus_stata
         std::regex prompt_pattern("^\\. .*$", std::regex_constants::multiline);
         cleaned = std::regex_replace(cleaned, prompt_pattern, "");
 
+        // Remove do-file echo: continuation lines of echoed commands and the
+        // trailer Stata prints after a file run through include/do
+        std::regex continuation_pattern("^> .*$", std::regex_constants::multiline);
+        cleaned = std::regex_replace(cleaned, continuation_pattern, "");
+
+        std::regex end_of_do_pattern("^end of do-file\\s*$", std::regex_constants::multiline);
+        cleaned = std::regex_replace(cleaned, end_of_do_pattern, "");
+
         // Remove incomplete display statements (from marker command)
         std::regex display_pattern("^\\. display \".*$", std::regex_constants::multiline);
         cleaned = std::regex_replace(cleaned, display_pattern, "");
@@ -407,7 +725,19 @@ namespace xeus_stata
         std::regex closing_brace_pattern("^\\}\\s*$", std::regex_constants::multiline);
         cleaned = std::regex_replace(cleaned, closing_brace_pattern, "");
 
+        // Remove the timer and return-code lines around the cell
+        std::regex trailer_wrapper_pattern("^(quietly capture timer (clear|on|off|list) 100|local __xstata_rc( = _rc)?|local __xstata_ls( = c\\(linesize\\))?|quietly set linesize (255|`__xstata_ls')|_return (hold|restore) xstata_r)\\s*$", std::regex_constants::multiline);
+        cleaned = std::regex_replace(cleaned, trailer_wrapper_pattern, "");
+
+        // Echo of the user_expressions evaluation, see expressions_command
+        std::regex expression_wrapper_pattern("^(local __xstata_ux|capture local __xstata_ux = .*|display \"xstata_\" \"ux\\|.*)$", std::regex_constants::multiline);
+        cleaned = std::regex_replace(cleaned, expression_wrapper_pattern, "");
+
+        strip_trace.set_value(static_cast<int64_t>(cleaned.size()));
+        strip_trace.finish();
+
         // Check for errors
+        trace_scope error_trace("parser.detect_errors", "parser");
         int error_code = 0;
         result.is_error = contains_error(cleaned, error_code);
         result.error_code = error_code;
@@ -437,37 +767,74 @@ namespace xeus_stata
             result.error_message = "Execution interrupted by user";
         }
 
+        error_trace.finish();
+
         // Extract graph files
         result.graph_files = extract_graph_files(cleaned);
 
         // Store cleaned output
-        result.output = cleaned;
+        trace_scope trim_trace("parser.trim_lines", "parser");
+        result.output = compact_lines(cleaned);
 
-        // Remove empty lines and trim trailing whitespace only
-        // IMPORTANT: Keep leading spaces for table alignment!
-        std::stringstream ss(result.output);
-        std::stringstream output_ss;
-        std::string line;
-        bool first_line = true;
+        return result;
+    }
 
-        while (std::getline(ss, line))
+    execution_result parse_smcl_execution_output(const std::string& smcl,
+                                                 const std::string& marker,
+                                                 bool& found_marker)
+    {
+        execution_result result;
+        result.is_error = false;
+        result.error_code = 0;
+        found_marker = false;
+
+        // Command echo is tagged {com}, so dropping it needs no pattern
+        // matching; everything up to the marker display is cell output
+        for (auto& segment : parse_smcl(smcl))
         {
-            // Only trim trailing whitespace (keep leading spaces for alignment)
-            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (segment.style == "com")
+            {
+                continue;
+            }
 
-            // Skip empty lines
-            if (!line.empty())
+            size_t pos = segment.text.find(marker);
+            if (pos != std::string::npos)
             {
-                if (!first_line)
+                segment.text.erase(pos);
+                if (!segment.text.empty())
                 {
-                    output_ss << "\n";
+                    result.segments.push_back(std::move(segment));
                 }
-                output_ss << line;
-                first_line = false;
+                found_marker = true;
+                break;
+            }
+            result.segments.push_back(std::move(segment));
+        }
+
+        std::string text = smcl_text(result.segments);
+        std::string error_text;
+        for (const auto& segment : result.segments)
+        {
+            if (segment.style == "err")
+            {
+                error_text += segment.text;
+            }
+        }
+
+        int error_code = 0;
+        if (contains_error(text, error_code))
+        {
+            result.is_error = true;
+            result.error_code = error_code;
+            result.error_message = compact_lines(error_text);
+            if (result.error_message.empty())
+            {
+                result.error_message = compact_lines(text.substr(0, text.find("r(" + std::to_string(error_code) + ");")));
             }
         }
 
-        result.output = output_ss.str();
+        result.graph_files = extract_graph_files(text);
+        result.output = compact_lines(text);
 
         return result;
     }
@@ -1,415 +1,208 @@
 #include "xeus-stata/stata_session.hpp"
-#include "xeus-stata/stata_parser.hpp"
-#include "xeus-stata/xeus_stata_config.hpp"
+#include "xeus-stata/resource_policy.hpp"
 
-#include <iostream>
-#include <sstream>
 #include <cstdlib>
-#include <cstring>
+#include <sstream>
 #include <stdexcept>
-#include <fstream>
-#include <random>
-#include <sys/stat.h>
 
-#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
-    #include <unistd.h>
-    #include <fcntl.h>
-    #include <sys/types.h>
-    #include <sys/wait.h>
-    #include <signal.h>
-    #include <poll.h>
-    #if defined(__APPLE__)
-        #include <util.h>
-    #else
-        #include <pty.h>
-        #include <sys/prctl.h>
-    #endif
-#endif
+#include <sys/stat.h>
 
 namespace xeus_stata
 {
-    class stata_session::impl
+    namespace
     {
-    public:
-        impl(const std::string& stata_path)
-            : m_stata_path(stata_path)
-            , m_master_fd(-1)
-            , m_pid(-1)
-            , m_ready(false)
+        std::string env_string(const char* name)
         {
-            if (m_stata_path.empty())
-            {
-                // Try environment variable first
-                const char* env_path = std::getenv("STATA_PATH");
-                if (env_path && env_path[0] != '\0')
-                {
-                    m_stata_path = env_path;
-                }
-                else
-                {
-                    m_stata_path = DEFAULT_STATA_PATH;
-                }
-            }
-
-            start_stata();
+            const char* value = std::getenv(name);
+            return value ? value : "";
         }
 
-        ~impl()
+        bool is_file(const std::string& path)
         {
-            shutdown();
+            struct stat st;
+            return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
         }
 
-        void start_stata()
+        // XEUS_STATA_LIBRARY, or a libstata next to the Stata executable
+        std::string find_stata_library(const std::string& stata_path)
         {
-#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
-            char slave_name[256];
-            int slave_fd;
-
-            // Open pseudo-terminal
-            if (openpty(&m_master_fd, &slave_fd, slave_name, nullptr, nullptr) == -1)
+            std::string library = env_string("XEUS_STATA_LIBRARY");
+            if (!library.empty())
             {
-                throw std::runtime_error("Failed to open pseudo-terminal: " +
-                                       std::string(strerror(errno)));
+                return library;
             }
 
-            // Fork process
-            m_pid = fork();
-            if (m_pid == -1)
+            std::string executable = stata_path.empty() ? env_string("STATA_PATH") : stata_path;
+            size_t slash = executable.rfind('/');
+            if (slash != std::string::npos)
             {
-                close(m_master_fd);
-                close(slave_fd);
-                throw std::runtime_error("Failed to fork process: " +
-                                       std::string(strerror(errno)));
-            }
-
-            if (m_pid == 0)
-            {
-                // Child process
-                close(m_master_fd);
-
-#if defined(__linux__)
-                // Ensure child is killed when parent dies
-                prctl(PR_SET_PDEATHSIG, SIGTERM);
-#endif
-
-                // Redirect stdin, stdout, stderr to slave PTY
-                dup2(slave_fd, STDIN_FILENO);
-                dup2(slave_fd, STDOUT_FILENO);
-                dup2(slave_fd, STDERR_FILENO);
-                close(slave_fd);
-
-                // Execute Stata
-                // Use -q for quiet startup (no banner)
-                execlp(m_stata_path.c_str(), m_stata_path.c_str(), "-q", nullptr);
-
-                // If exec fails
-                std::cerr << "Failed to execute Stata: " << strerror(errno) << std::endl;
-                _exit(1);
-            }
-
-            // Parent process
-            close(slave_fd);
-
-            // Set non-blocking mode
-            int flags = fcntl(m_master_fd, F_GETFL, 0);
-            fcntl(m_master_fd, F_SETFL, flags | O_NONBLOCK);
-
-            // Wait for Stata to start and show prompt
-            std::string startup_output = read_until_prompt(5000); // 5 second timeout
-
-            // Set up initial configuration
-            // Disable pagination
-            write_command("set more off");
-            // Set line size for better output
-            write_command("set linesize 200");
-
-            m_ready = true;
+#if defined(__APPLE__)
+                const char* suffix = ".dylib";
 #else
-            throw std::runtime_error("Windows support not yet implemented");
+                const char* suffix = ".so";
 #endif
-        }
-
-        execution_result execute(const std::string& code)
-        {
-            if (!m_ready)
-            {
-                throw std::runtime_error("Stata session not ready");
-            }
-
-            // Generate unique marker for detecting command completion
-            std::string marker = generate_execution_marker();
-
-            // Generate temp file for potential graph export
-            std::string temp_graph = generate_temp_filename(".png");
-
-            // Make sure file doesn't exist before we start
-            unlink(temp_graph.c_str());
-
-            // Wrap code with automatic graph export and marker
-            // Check if a graph exists, export it, then drop all graphs to prevent re-export
-            std::string wrapped_code = code + "\n";
-            wrapped_code += "quietly capture graph describe Graph\n";
-            wrapped_code += "if (_rc == 0) {\n";
-            wrapped_code += "  quietly graph export \"" + temp_graph + "\", replace\n";
-            wrapped_code += "}\n";
-            wrapped_code += "quietly graph drop _all\n";
-            wrapped_code += "display \"__MARKER__" + marker + "__\"";
-
-            // Write command
-            write_command(wrapped_code);
-
-            // Read output until we see the marker
-            std::string output = read_until_marker("__MARKER__" + marker + "__", 30000); // 30 second timeout
-
-            // Parse the output
-            execution_result result = parse_execution_output(output);
-
-            // Check if temp graph file was created (it should not exist before, only after)
-            struct stat buffer;
-            if (stat(temp_graph.c_str(), &buffer) == 0 && buffer.st_size > 0)
-            {
-                // File exists and has content, add to result
-                result.graph_files.push_back(temp_graph);
-            }
-
-            return result;
-        }
-
-        std::string get_version()
-        {
-            auto result = execute("display c(version)");
-            if (!result.is_error && !result.output.empty())
-            {
-                // Trim whitespace
-                std::string version = result.output;
-                version.erase(0, version.find_first_not_of(" \t\n\r"));
-                version.erase(version.find_last_not_of(" \t\n\r") + 1);
-                return version;
-            }
-            return "Unknown";
-        }
-
-        bool is_ready() const
-        {
-            return m_ready;
-        }
-
-        void shutdown()
-        {
-            if (m_pid > 0)
-            {
-#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
-                // Send exit command
-                write_command("exit, clear");
-
-                // Wait for process to terminate (with timeout)
-                int status;
-                int wait_result = waitpid(m_pid, &status, WNOHANG);
-
-                if (wait_result == 0)
+                std::string dir = executable.substr(0, slash + 1);
+                for (const char* edition : {"libstata-mp", "libstata-se", "libstata-be", "libstata"})
                 {
-                    // Process still running, force kill
-                    kill(m_pid, SIGTERM);
-                    usleep(100000); // Wait 100ms
-                    wait_result = waitpid(m_pid, &status, WNOHANG);
-
-                    if (wait_result == 0)
+                    std::string candidate = dir + edition + suffix;
+                    if (is_file(candidate))
                     {
-                        // Still running, force kill
-                        kill(m_pid, SIGKILL);
-                        waitpid(m_pid, &status, 0);
+                        return candidate;
                     }
                 }
-
-                m_pid = -1;
-#endif
             }
 
-            if (m_master_fd >= 0)
-            {
-                close(m_master_fd);
-                m_master_fd = -1;
-            }
-
-            m_ready = false;
+            throw std::runtime_error("XEUS_STATA_BACKEND=library needs XEUS_STATA_LIBRARY "
+                                     "(no libstata found next to the Stata executable)");
         }
 
-        void interrupt()
+        std::unique_ptr<session_backend> make_backend(const std::string& stata_path)
         {
-#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
-            if (m_pid > 0)
+            std::string backend = env_string("XEUS_STATA_BACKEND");
+            if (backend.empty() || backend == "pty")
             {
-                kill(m_pid, SIGINT);
+                return make_pty_backend(stata_path);
             }
-#endif
-        }
-
-        std::string get_macro(const std::string& name)
-        {
-            auto result = execute("display `" + name + "'");
-            if (!result.is_error)
+            if (backend == "library")
             {
-                return result.output;
+                return make_library_backend(find_stata_library(stata_path));
             }
-            return "";
-        }
-
-    private:
-        std::string generate_temp_filename(const std::string& extension)
-        {
-            // Generate unique temp filename
-            std::random_device rd;
-            std::mt19937 gen(rd());
-            std::uniform_int_distribution<> dis(0, 999999);
-
-            std::string temp_dir = "/tmp";
-            std::string filename;
-
-            do {
-                std::stringstream ss;
-                ss << temp_dir << "/xeus_stata_graph_" << dis(gen) << extension;
-                filename = ss.str();
-
-                // Check if file exists
-                struct stat buffer;
-                if (stat(filename.c_str(), &buffer) != 0) {
-                    break; // File doesn't exist, we can use this name
-                }
-            } while (true);
-
-            return filename;
+            throw std::runtime_error("Unknown XEUS_STATA_BACKEND '" + backend + "' (expected pty or library)");
         }
+    }
 
-        void write_command(const std::string& command)
-        {
-#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
-            std::string cmd = command + "\n";
-            ssize_t written = write(m_master_fd, cmd.c_str(), cmd.length());
-            if (written != static_cast<ssize_t>(cmd.length()))
+    stata_session::stata_session(const std::string& stata_path)
+        : m_backend(make_backend(stata_path))
+    {
+        apply_resource_policy();
+        m_backend->set_respawn_callback([this]() {
+            apply_resource_policy();
+            if (m_respawn_callback)
             {
-                throw std::runtime_error("Failed to write to Stata process");
+                m_respawn_callback();
             }
-#endif
-        }
-
-        std::string read_until_prompt(int timeout_ms)
-        {
-            return read_until_marker(".", timeout_ms);
-        }
-
-        std::string read_until_marker(const std::string& marker, int timeout_ms)
-        {
-#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
-            std::string output;
-            char buffer[4096];
-
-            struct pollfd pfd;
-            pfd.fd = m_master_fd;
-            pfd.events = POLLIN;
-
-            int elapsed = 0;
-            const int poll_interval = 100; // 100ms
-
-            while (elapsed < timeout_ms)
-            {
-                int ret = poll(&pfd, 1, poll_interval);
+        });
+    }
 
-                if (ret > 0 && (pfd.revents & POLLIN))
-                {
-                    ssize_t n = read(m_master_fd, buffer, sizeof(buffer) - 1);
-                    if (n > 0)
-                    {
-                        buffer[n] = '\0';
-                        output += buffer;
+    stata_session::~stata_session() = default;
 
-                        // Check if we've received the marker
-                        if (output.find(marker) != std::string::npos)
-                        {
-                            // Remove the marker and everything after it
-                            size_t pos = output.find(marker);
-                            output = output.substr(0, pos);
-                            break;
-                        }
+    execution_result stata_session::execute(const std::string& code)
+    {
+        return m_backend->execute(code);
+    }
 
-                        // Check if Stata was interrupted (--Break-- message)
-                        if (output.find("--Break--") != std::string::npos)
-                        {
-                            // Continue reading briefly to consume the prompt that comes after --Break--
-                            // This ensures the session is in a clean state for the next command
-                            usleep(100000); // Wait 100ms for prompt
+    execution_result stata_session::execute(const std::string& code, const expression_list& expressions)
+    {
+        return m_backend->execute(code, expressions);
+    }
 
-                            // Read any remaining output (the prompt)
-                            ssize_t n = read(m_master_fd, buffer, sizeof(buffer) - 1);
-                            if (n > 0)
-                            {
-                                buffer[n] = '\0';
-                                output += buffer;
-                            }
+    std::string stata_session::get_version()
+    {
+        auto result = m_backend->execute("display c(version)");
+        if (!result.is_error && !result.output.empty())
+        {
+            // Trim whitespace
+            std::string version = result.output;
+            version.erase(0, version.find_first_not_of(" \t\n\r"));
+            version.erase(version.find_last_not_of(" \t\n\r") + 1);
+            return version;
+        }
+        return "Unknown";
+    }
 
-                            // Just return the --Break-- message
-                            output = "--Break--";
-                            break;
-                        }
-                    }
-                }
+    bool stata_session::is_ready() const
+    {
+        return m_backend->is_ready();
+    }
 
-                elapsed += poll_interval;
-            }
+    int stata_session::get_pid() const
+    {
+        return m_backend->get_pid();
+    }
 
-            return output;
-#else
-            return "";
-#endif
-        }
+    void stata_session::shutdown()
+    {
+        m_backend->shutdown();
+    }
 
-        std::string m_stata_path;
-        int m_master_fd;
-        pid_t m_pid;
-        bool m_ready;
-    };
+    void stata_session::interrupt()
+    {
+        m_backend->interrupt();
+    }
 
-    // stata_session public interface implementation
-    stata_session::stata_session(const std::string& stata_path)
-        : m_impl(std::make_unique<impl>(stata_path))
+    std::string stata_session::get_macro(const std::string& name)
     {
+        return m_backend->get_macro(name);
     }
 
-    stata_session::~stata_session() = default;
+    void stata_session::set_macro(const std::string& name, const std::string& value)
+    {
+        // Execute local/global macro assignment
+        m_backend->execute("local " + name + " \"" + value + "\"");
+    }
 
-    execution_result stata_session::execute(const std::string& code)
+    void stata_session::set_respawn_callback(std::function<void()> callback)
     {
-        return m_impl->execute(code);
+        m_respawn_callback = std::move(callback);
     }
 
-    std::string stata_session::get_version()
+    void stata_session::set_wait_callback(std::function<void()> callback)
     {
-        return m_impl->get_version();
+        m_backend->set_wait_callback(std::move(callback));
     }
 
-    bool stata_session::is_ready() const
+    void stata_session::apply_resource_policy()
     {
-        return m_impl->is_ready();
+        resource_policy& policy = resource_policy::instance();
+        if (!policy.active())
+        {
+            return;
+        }
+
+        policy.apply(m_backend->get_pid());
+        int processors = policy.processors();
+        if (processors > 0)
+        {
+            // Only StataMP takes the setting; c(processors) tells what
+            // the edition and licence actually allow
+            const std::string tag = "xstata_processors:";
+            auto result = m_backend->execute("capture set processors " + std::to_string(processors) + "\n"
+                                             "display \"" + tag + "\" c(processors)");
+            std::stringstream ss(result.output);
+            std::string line;
+            while (std::getline(ss, line))
+            {
+                if (line.compare(0, tag.size(), tag) == 0)
+                {
+                    m_processors = std::atoi(line.c_str() + tag.size());
+                }
+            }
+        }
     }
 
-    void stata_session::shutdown()
+    std::string stata_session::resource_summary() const
     {
-        m_impl->shutdown();
+        std::string summary = resource_policy::instance().summary();
+        if (m_processors > 0)
+        {
+            summary = std::to_string(m_processors) + " processors" + (summary.empty() ? "" : "; " + summary);
+        }
+        return summary;
     }
 
-    void stata_session::interrupt()
+    std::string stata_session::backend_name() const
     {
-        m_impl->interrupt();
+        return m_backend->name();
     }
 
-    std::string stata_session::get_macro(const std::string& name)
+    std::vector<std::string> stata_session::variable_names()
     {
-        return m_impl->get_macro(name);
+        return m_backend->variable_names();
     }
 
-    void stata_session::set_macro(const std::string& name, const std::string& value)
+    std::vector<double> stata_session::numeric_values(const std::string& variable, size_t first, size_t count)
     {
-        // Execute local/global macro assignment
-        m_impl->execute("local " + name + " \"" + value + "\"");
+        return m_backend->numeric_values(variable, first, count);
     }
 
 } // namespace xeus_stata
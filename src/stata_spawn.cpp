@@ -0,0 +1,447 @@
+#include "xeus-stata/stata_spawn.hpp"
+#include "xeus-stata/private_dir.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+#include "xeus-stata/timing.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <sys/ioctl.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/types.h>
+    #include <sys/un.h>
+    #if defined(XEUS_STATA_PLATFORM_MACOS)
+        #include <util.h>
+    #else
+        #include <pty.h>
+        #include <sys/prctl.h>
+    #endif
+#endif
+
+namespace xeus_stata
+{
+#if defined(XEUS_STATA_PLATFORM_LINUX) || defined(XEUS_STATA_PLATFORM_MACOS)
+    namespace
+    {
+        // Linux sets close-on-exec atomically; elsewhere it is set after
+#if defined(MSG_CMSG_CLOEXEC)
+        const int RECEIVE_FLAGS = MSG_CMSG_CLOEXEC;
+#else
+        const int RECEIVE_FLAGS = 0;
+#endif
+
+        void set_cloexec(int fd)
+        {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        bool write_all(int fd, const std::string& text, int timeout_ms)
+        {
+            size_t offset = 0;
+            stopwatch timer;
+            while (offset < text.size())
+            {
+                ssize_t n = write(fd, text.data() + offset, text.size() - offset);
+                if (n > 0)
+                {
+                    offset += static_cast<size_t>(n);
+                    continue;
+                }
+                if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    return false;
+                }
+                if (timer.elapsed_ms() > timeout_ms)
+                {
+                    return false;
+                }
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                poll(&pfd, 1, 10);
+            }
+            return true;
+        }
+
+        // Discard output until the PTY has been quiet for quiet_ms
+        void drain(int fd, int quiet_ms)
+        {
+            char buffer[4096];
+            struct pollfd pfd = {fd, POLLIN, 0};
+            while (poll(&pfd, 1, quiet_ms) > 0 && read(fd, buffer, sizeof(buffer)) > 0)
+            {
+            }
+        }
+
+        // Read the PTY until marker shows up
+        bool read_until(int fd, const std::string& marker, int timeout_ms)
+        {
+            std::string output;
+            char buffer[4096];
+            stopwatch timer;
+            while (true)
+            {
+                double left = timeout_ms - timer.elapsed_ms();
+                if (left <= 0)
+                {
+                    return false;
+                }
+                struct pollfd pfd = {fd, POLLIN, 0};
+                int ret = poll(&pfd, 1, static_cast<int>(left) + 1);
+                if (ret < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (ret <= 0)
+                {
+                    continue;
+                }
+                ssize_t n = read(fd, buffer, sizeof(buffer));
+                if (n > 0)
+                {
+                    output.append(buffer, static_cast<size_t>(n));
+                    if (output.find(marker) != std::string::npos)
+                    {
+                        return true;
+                    }
+                }
+                else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+                {
+                    // EIO: the slave side is closed, Stata is gone
+                    return false;
+                }
+            }
+        }
+    }
+
+    stata_process spawn_stata(const std::string& stata_path, bool detached)
+    {
+        stata_process process;
+        int slave_fd;
+
+        // Open pseudo-terminal
+        if (openpty(&process.master_fd, &slave_fd, nullptr, nullptr, nullptr) == -1)
+        {
+            throw std::runtime_error("Failed to open pseudo-terminal: " +
+                                     std::string(strerror(errno)));
+        }
+
+        // Fork process
+        process.pid = fork();
+        if (process.pid == -1)
+        {
+            close(process.master_fd);
+            close(slave_fd);
+            throw std::runtime_error("Failed to fork process: " +
+                                     std::string(strerror(errno)));
+        }
+
+        if (process.pid == 0)
+        {
+            // Child process
+            close(process.master_fd);
+
+            if (detached)
+            {
+                // Outlive the pool that started it; closing the master
+                // hangs it up instead
+                setsid();
+                ioctl(slave_fd, TIOCSCTTY, 0);
+            }
+#if defined(__linux__)
+            else
+            {
+                // Ensure child is killed when parent dies
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+            }
+#endif
+
+            // Redirect stdin, stdout, stderr to slave PTY
+            dup2(slave_fd, STDIN_FILENO);
+            dup2(slave_fd, STDOUT_FILENO);
+            dup2(slave_fd, STDERR_FILENO);
+            close(slave_fd);
+
+            // Execute Stata
+            // Use -q for quiet startup (no banner)
+            execlp(stata_path.c_str(), stata_path.c_str(), "-q", nullptr);
+
+            // If exec fails
+            std::cerr << "Failed to execute Stata: " << strerror(errno) << std::endl;
+            _exit(1);
+        }
+
+        // Parent process
+        close(slave_fd);
+        set_cloexec(process.master_fd);
+
+        // Set non-blocking mode
+        int flags = fcntl(process.master_fd, F_GETFL, 0);
+        fcntl(process.master_fd, F_SETFL, flags | O_NONBLOCK);
+
+        return process;
+    }
+
+    bool initialize_stata(const stata_process& process, int timeout_ms)
+    {
+        stopwatch timer;
+        if (!read_until(process.master_fd, ".", timeout_ms))
+        {
+            return false;
+        }
+
+        // The ready marker is split so its echo does not match
+        std::random_device rd;
+        std::string ready = std::to_string(rd()) + std::to_string(rd());
+        std::string commands = "set more off\n"
+                               "set linesize 200\n"
+                               "display \"__READY__\" \"" + ready + "__\"\n";
+        int left = timeout_ms - static_cast<int>(timer.elapsed_ms());
+        if (!write_all(process.master_fd, commands, left) ||
+            !read_until(process.master_fd, "__READY__" + ready + "__", left))
+        {
+            return false;
+        }
+
+        // Swallow the prompt that follows
+        drain(process.master_fd, 50);
+        return true;
+    }
+
+    bool send_fd(int socket_fd, int fd, const std::string& message)
+    {
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(message.data());
+        iov.iov_len = message.size();
+
+        union
+        {
+            char buffer[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        std::memset(&control, 0, sizeof(control));
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (fd >= 0)
+        {
+            msg.msg_control = control.buffer;
+            msg.msg_controllen = sizeof(control.buffer);
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        ssize_t n;
+        do
+        {
+            n = sendmsg(socket_fd, &msg, 0);
+        } while (n < 0 && errno == EINTR);
+        return n == static_cast<ssize_t>(message.size());
+    }
+
+    bool receive_fd(int socket_fd, int& fd, std::string& message)
+    {
+        char text[512];
+        struct iovec iov;
+        iov.iov_base = text;
+        iov.iov_len = sizeof(text);
+
+        union
+        {
+            char buffer[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        ssize_t n;
+        do
+        {
+            n = recvmsg(socket_fd, &msg, RECEIVE_FLAGS);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        fd = -1;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+                set_cloexec(fd);
+            }
+        }
+        message.assign(text, static_cast<size_t>(n));
+        return true;
+    }
+
+    bool peer_is_same_user(int socket_fd)
+    {
+#if defined(SO_PEERCRED)
+        struct ucred cred;
+        socklen_t length = sizeof(cred);
+        return getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 && cred.uid == geteuid();
+#else
+        uid_t uid;
+        gid_t gid;
+        return getpeereid(socket_fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+    }
+
+    std::string default_pool_socket()
+    {
+        const char* env_socket = std::getenv("XEUS_STATA_POOL_SOCKET");
+        if (env_socket && env_socket[0] != '\0')
+        {
+            return env_socket;
+        }
+
+        const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+        if (runtime_dir && runtime_dir[0] != '\0')
+        {
+            return std::string(runtime_dir) + "/xeus-stata/pool.sock";
+        }
+
+        return "/tmp/xeus-stata-" + std::to_string(getuid()) + "/pool.sock";
+    }
+
+    bool acquire_pooled_stata(const std::string& socket_path, const std::string& stata_path,
+                              stata_process& process)
+    {
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+        // No daemon, the common case, stays quiet
+        struct stat st;
+        if (lstat(socket_path.c_str(), &st) != 0)
+        {
+            return false;
+        }
+        std::string error;
+        if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid())
+        {
+            error = socket_path + " is not a socket of this user";
+        }
+        else
+        {
+            check_private_path(std::filesystem::path(socket_path).parent_path().string(), error);
+        }
+        if (!error.empty())
+        {
+            std::cerr << "Stata pool: not used, " << error << std::endl;
+            return false;
+        }
+
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0)
+        {
+            return false;
+        }
+        set_cloexec(sock);
+
+        // A live daemon answers at once, a hung one must not stall startup
+        struct timeval timeout = {2, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        int fd = -1;
+        std::string reply;
+        bool connected = connect(sock, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0;
+        if (connected && !peer_is_same_user(sock))
+        {
+            std::cerr << "Stata pool: not used, " << socket_path << " is served by another user" << std::endl;
+            close(sock);
+            return false;
+        }
+        bool received = connected &&
+                        send_fd(sock, -1, "acquire " + stata_path + "\n") &&
+                        receive_fd(sock, fd, reply);
+        close(sock);
+
+        // "ok <pid>" with the PTY master attached
+        if (!received || reply.compare(0, 3, "ok ") != 0 || fd < 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            if (received)
+            {
+                std::cerr << "Stata pool: " << reply << std::endl;
+            }
+            return false;
+        }
+
+        process.master_fd = fd;
+        process.pid = std::atoi(reply.c_str() + 3);
+        process.own_child = false;
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        return process.pid > 0;
+    }
+#else
+    stata_process spawn_stata(const std::string&, bool)
+    {
+        throw std::runtime_error("Windows support not yet implemented");
+    }
+
+    bool initialize_stata(const stata_process&, int)
+    {
+        return false;
+    }
+
+    bool send_fd(int, int, const std::string&)
+    {
+        return false;
+    }
+
+    bool receive_fd(int, int&, std::string&)
+    {
+        return false;
+    }
+
+    bool peer_is_same_user(int)
+    {
+        return false;
+    }
+
+    std::string default_pool_socket()
+    {
+        return "";
+    }
+
+    bool acquire_pooled_stata(const std::string&, const std::string&, stata_process&)
+    {
+        return false;
+    }
+#endif
+
+} // namespace xeus_stata
@@ -0,0 +1,616 @@
+#include "xeus-stata/symbol_index.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+#include "xeus-stata/trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    // On-disk layout. Everything is addressed by offset from the start of
+    // the file, so the mapping works at any address. The file is only
+    // shared between kernels on one host, so integers are in host order;
+    // byte_order tells a foreign file apart.
+    //
+    //   header | entry[entry_count], sorted by (name, kind) | string table
+    namespace
+    {
+        const char INDEX_MAGIC[8] = {'X', 'S', 'T', 'I', 'D', 'X', '\0', '\0'};
+        const uint32_t INDEX_VERSION = 1;
+        const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+        struct index_header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint64_t source_stamp;  // adopath and kernel version the index was built from
+            uint64_t entry_count;
+            uint64_t entries_offset;
+            uint64_t strings_offset;
+            uint64_t strings_size;
+            uint64_t file_size;
+        };
+    }
+
+    struct symbol_index::entry
+    {
+        uint32_t name_offset;
+        uint32_t summary_offset;
+        uint16_t name_length;
+        uint16_t summary_length;
+        uint8_t kind;
+        uint8_t reserved[3];
+    };
+
+    namespace
+    {
+        static_assert(sizeof(index_header) == 64, "index header layout");
+
+        // Built-in commands, which have no .ado file
+        const char* const BUILTIN_COMMANDS[] = {
+            "append", "assert", "bysort", "capture", "cd", "clear", "collapse",
+            "compress", "count", "describe", "display", "drop", "duplicates",
+            "edit", "egen", "encode", "exit", "export", "file", "foreach",
+            "format", "forvalues", "generate", "graph", "help", "histogram",
+            "if", "import", "infile", "insheet", "keep", "label", "list",
+            "log", "logit", "merge", "mkdir", "preserve", "quietly", "regress",
+            "rename", "replace", "reshape", "restore", "return", "save",
+            "scatter", "sort", "summarize", "sysuse", "tabulate", "twoway",
+            "use", "while", "xi"
+        };
+
+        const char* const BUILTIN_FUNCTIONS[] = {
+            "abs", "acos", "asin", "atan", "atan2", "ceil", "clock", "comb",
+            "cond", "cos", "date", "day", "daily", "digamma", "dow", "doy",
+            "exp", "floor", "halfyear", "hh", "hours", "inlist", "inrange",
+            "int", "invlogit", "invnormal", "ln", "lnfactorial", "lngamma",
+            "log", "log10", "logit", "max", "mdy", "mi", "min", "minutes",
+            "missing", "mm", "mod", "month", "monthly", "normal", "normalden",
+            "quarter", "quarterly", "rbeta", "rbinomial", "real", "regexm",
+            "regexr", "regexs", "rnormal", "round", "rpoisson", "runiform",
+            "runiformint", "seconds", "sign", "sin", "sqrt", "ss", "strlen",
+            "strlower", "strltrim", "strofreal", "strpos", "strproper",
+            "strreverse", "strrtrim", "strtrim", "strupper", "subinstr",
+            "subinword", "substr", "sum", "tan", "tc", "td", "tm", "tq", "trunc",
+            "ustrlen", "ustrlower", "ustrregexm", "ustrregexra", "ustrregexs",
+            "ustrtrim", "ustrupper", "usubinstr", "usubstr", "week", "weekly",
+            "word", "wordcount", "year", "yearly", "yh", "ym", "yq", "yw"
+        };
+
+        std::string env_string(const char* name)
+        {
+            const char* value = std::getenv(name);
+            return value ? value : "";
+        }
+
+        // FNV-1a, enough to tell index versions apart
+        void hash_bytes(uint64_t& hash, const void* data, size_t size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+        }
+
+        void hash_string(uint64_t& hash, const std::string& text)
+        {
+            hash_bytes(hash, text.data(), text.size() + 1);
+        }
+
+        // Directories searched for .ado/.sthlp files: $XEUS_STATA_ADOPATH
+        // (colon-separated), otherwise Stata's BASE and SITE next to the
+        // executable plus PLUS and PERSONAL under ~/ado
+        std::vector<std::string> ado_dirs(const std::string& stata_path)
+        {
+            std::vector<std::string> dirs;
+            std::string adopath = env_string("XEUS_STATA_ADOPATH");
+            if (!adopath.empty())
+            {
+                size_t start = 0;
+                while (start <= adopath.size())
+                {
+                    size_t colon = adopath.find(':', start);
+                    std::string dir = adopath.substr(start, colon == std::string::npos ? std::string::npos : colon - start);
+                    if (!dir.empty())
+                    {
+                        dirs.push_back(dir);
+                    }
+                    if (colon == std::string::npos)
+                    {
+                        break;
+                    }
+                    start = colon + 1;
+                }
+                return dirs;
+            }
+
+            std::error_code ec;
+            fs::path executable = fs::weakly_canonical(stata_path, ec);
+            if (ec)
+            {
+                executable = stata_path;
+            }
+            fs::path stata_dir = executable.parent_path();
+            dirs.push_back((stata_dir / "ado" / "base").string());
+            dirs.push_back((stata_dir / "ado" / "site").string());
+
+            std::string home = env_string("HOME");
+            if (!home.empty())
+            {
+                dirs.push_back(home + "/ado/plus");
+                dirs.push_back(home + "/ado/personal");
+            }
+            return dirs;
+        }
+
+        // Ado directories keep files in one-letter subdirectories; adding
+        // or removing a file touches the mtime of its directory
+        uint64_t source_stamp(const std::vector<std::string>& dirs)
+        {
+            uint64_t hash = 1469598103934665603ULL;
+            hash_string(hash, XEUS_STATA_VERSION);
+            hash_bytes(hash, &INDEX_VERSION, sizeof(INDEX_VERSION));
+            for (const auto& dir : dirs)
+            {
+                hash_string(hash, dir);
+                std::error_code ec;
+                if (!fs::is_directory(dir, ec))
+                {
+                    continue;
+                }
+                std::vector<std::string> stamped = {dir};
+                for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+                {
+                    if (it->is_directory(ec))
+                    {
+                        stamped.push_back(it->path().string());
+                    }
+                }
+                std::sort(stamped.begin(), stamped.end());
+                for (const auto& path : stamped)
+                {
+                    struct stat st;
+                    if (stat(path.c_str(), &st) == 0)
+                    {
+                        int64_t mtime = static_cast<int64_t>(st.st_mtime);
+                        hash_string(hash, path);
+                        hash_bytes(hash, &mtime, sizeof(mtime));
+                    }
+                }
+            }
+            return hash;
+        }
+
+        // Summary from a help file's title line, e.g.
+        // {p2col:{bf:[R] regress} {hline 2}}Linear regression{p_end}
+        std::string help_summary(const fs::path& sthlp)
+        {
+            std::ifstream in(sthlp, std::ios::binary);
+            std::string line;
+            for (int i = 0; i < 60 && std::getline(in, line); ++i)
+            {
+                size_t dash = line.find("{hline 2}");
+                if (dash == std::string::npos)
+                {
+                    continue;
+                }
+                size_t start = line.find_first_not_of("} \t", dash + 9);
+                if (start == std::string::npos)
+                {
+                    continue;
+                }
+                size_t end = line.find('{', start);
+                std::string summary = line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+                summary.erase(summary.find_last_not_of(" \t\r") + 1);
+                if (!summary.empty())
+                {
+                    return summary.substr(0, 200);
+                }
+            }
+            return "";
+        }
+
+        using symbol_key = std::pair<std::string, uint8_t>;
+
+        std::map<symbol_key, std::string> collect_symbols(const std::vector<std::string>& dirs)
+        {
+            std::map<symbol_key, std::string> symbols;
+            for (const char* name : BUILTIN_COMMANDS)
+            {
+                symbols[{name, static_cast<uint8_t>(symbol_kind::command)}];
+            }
+            for (const char* name : BUILTIN_FUNCTIONS)
+            {
+                symbols[{name, static_cast<uint8_t>(symbol_kind::function)}];
+            }
+
+            std::map<std::string, fs::path> help_files;
+            for (const auto& dir : dirs)
+            {
+                std::error_code ec;
+                for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+                {
+                    // Files sit in the directory or one level below
+                    if (it->is_directory(ec))
+                    {
+                        if (it.depth() >= 1)
+                        {
+                            it.disable_recursion_pending();
+                        }
+                        continue;
+                    }
+                    if (!it->is_regular_file(ec))
+                    {
+                        continue;
+                    }
+                    const fs::path& path = it->path();
+                    std::string stem = path.stem().string();
+                    std::string extension = path.extension().string();
+                    if (extension == ".ado")
+                    {
+                        symbols[{stem, static_cast<uint8_t>(symbol_kind::command)}];
+                    }
+                    else if (extension == ".sthlp" || extension == ".hlp")
+                    {
+                        help_files.emplace(stem, path);
+                    }
+                }
+            }
+
+            for (auto& symbol : symbols)
+            {
+                if (symbol.first.second != static_cast<uint8_t>(symbol_kind::command))
+                {
+                    continue;
+                }
+                auto help = help_files.find(symbol.first.first);
+                if (help != help_files.end())
+                {
+                    symbol.second = help_summary(help->second);
+                }
+            }
+            return symbols;
+        }
+
+        std::vector<unsigned char> serialize(const std::map<symbol_key, std::string>& symbols, uint64_t stamp)
+        {
+            std::string strings;
+            std::vector<unsigned char> entries(symbols.size() * 16);
+            size_t i = 0;
+            for (const auto& symbol : symbols)
+            {
+                const std::string& name = symbol.first.first;
+                const std::string& summary = symbol.second;
+                uint32_t name_offset = static_cast<uint32_t>(strings.size());
+                strings += name;
+                uint32_t summary_offset = static_cast<uint32_t>(strings.size());
+                strings += summary;
+
+                unsigned char* out = &entries[i++ * 16];
+                uint16_t name_length = static_cast<uint16_t>(std::min<size_t>(name.size(), 0xFFFF));
+                uint16_t summary_length = static_cast<uint16_t>(std::min<size_t>(summary.size(), 0xFFFF));
+                std::memset(out, 0, 16);
+                std::memcpy(out, &name_offset, 4);
+                std::memcpy(out + 4, &summary_offset, 4);
+                std::memcpy(out + 8, &name_length, 2);
+                std::memcpy(out + 10, &summary_length, 2);
+                out[12] = symbol.first.second;
+            }
+
+            index_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+            header.version = INDEX_VERSION;
+            header.byte_order = INDEX_BYTE_ORDER;
+            header.source_stamp = stamp;
+            header.entry_count = symbols.size();
+            header.entries_offset = sizeof(header);
+            header.strings_offset = header.entries_offset + entries.size();
+            header.strings_size = strings.size();
+            header.file_size = header.strings_offset + strings.size();
+
+            std::vector<unsigned char> data(header.file_size);
+            std::memcpy(data.data(), &header, sizeof(header));
+            std::copy(entries.begin(), entries.end(), data.begin() + static_cast<std::ptrdiff_t>(header.entries_offset));
+            std::copy(strings.begin(), strings.end(), data.begin() + static_cast<std::ptrdiff_t>(header.strings_offset));
+            return data;
+        }
+
+        // Write to a temporary file in the same directory and rename it
+        // over the index, so readers only ever see a complete file
+        bool write_atomically(const std::string& path, const std::vector<unsigned char>& data)
+        {
+            std::string tmpl = path + ".XXXXXX";
+            std::vector<char> buffer(tmpl.begin(), tmpl.end());
+            buffer.push_back('\0');
+            int fd = mkstemp(buffer.data());
+            if (fd < 0)
+            {
+                return false;
+            }
+
+            size_t written = 0;
+            while (written < data.size())
+            {
+                ssize_t n = write(fd, data.data() + written, data.size() - written);
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    break;
+                }
+                written += static_cast<size_t>(n);
+            }
+            bool ok = written == data.size() && fchmod(fd, 0644) == 0 && fsync(fd) == 0;
+            ok = close(fd) == 0 && ok;
+            if (!ok || rename(buffer.data(), path.c_str()) != 0)
+            {
+                unlink(buffer.data());
+                return false;
+            }
+            return true;
+        }
+
+        // Read-only shared mapping of a valid index at path
+        bool map_index(const std::string& path, uint64_t stamp, void*& map, size_t& size)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(index_header)))
+            {
+                close(fd);
+                return false;
+            }
+            size = static_cast<size_t>(st.st_size);
+            map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (map == MAP_FAILED)
+            {
+                map = nullptr;
+                return false;
+            }
+            if (!valid_symbol_index(static_cast<const unsigned char*>(map), size, stamp))
+            {
+                munmap(map, size);
+                map = nullptr;
+                return false;
+            }
+            return true;
+        }
+    }
+
+    bool valid_symbol_index(const unsigned char* data, size_t size, uint64_t stamp)
+    {
+        if (size < sizeof(index_header))
+        {
+            return false;
+        }
+        index_header header;
+        std::memcpy(&header, data, sizeof(header));
+        bool valid = std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                     header.version == INDEX_VERSION &&
+                     header.byte_order == INDEX_BYTE_ORDER &&
+                     header.source_stamp == stamp &&
+                     header.file_size == size &&
+                     header.entries_offset == sizeof(index_header) &&
+                     header.entry_count <= (size - sizeof(index_header)) / 16 &&
+                     header.strings_offset == header.entries_offset + header.entry_count * 16 &&
+                     header.strings_size <= size - header.strings_offset &&
+                     header.strings_offset + header.strings_size == size;
+        if (!valid)
+        {
+            return false;
+        }
+
+        // Lookups trust every offset, so a truncated or corrupt file in the
+        // shared cache must not get past here
+        const unsigned char* entries = data + header.entries_offset;
+        for (uint64_t i = 0; i < header.entry_count; ++i)
+        {
+            uint32_t name_offset;
+            uint32_t summary_offset;
+            uint16_t name_length;
+            uint16_t summary_length;
+            std::memcpy(&name_offset, entries + i * 16, 4);
+            std::memcpy(&summary_offset, entries + i * 16 + 4, 4);
+            std::memcpy(&name_length, entries + i * 16 + 8, 2);
+            std::memcpy(&summary_length, entries + i * 16 + 10, 2);
+            if (static_cast<uint64_t>(name_offset) + name_length > header.strings_size ||
+                static_cast<uint64_t>(summary_offset) + summary_length > header.strings_size)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string default_index_dir()
+    {
+        std::string dir = env_string("XEUS_STATA_INDEX_DIR");
+        if (!dir.empty())
+        {
+            return dir;
+        }
+        std::string cache = env_string("XDG_CACHE_HOME");
+        if (!cache.empty())
+        {
+            return cache + "/xeus-stata";
+        }
+        std::string home = env_string("HOME");
+        if (!home.empty())
+        {
+            return home + "/.cache/xeus-stata";
+        }
+        return "/tmp/xeus-stata-" + std::to_string(getuid());
+    }
+
+    symbol_index::~symbol_index()
+    {
+        if (m_map)
+        {
+            munmap(m_map, m_size);
+        }
+    }
+
+    std::shared_ptr<const symbol_index> symbol_index::open(const std::string& stata_path)
+    {
+        trace_scope trace("index.open", "index");
+
+        std::string executable = stata_path;
+        if (executable.empty())
+        {
+            executable = env_string("STATA_PATH");
+        }
+        if (executable.empty())
+        {
+            executable = DEFAULT_STATA_PATH;
+        }
+
+        std::vector<std::string> dirs = ado_dirs(executable);
+        uint64_t stamp = source_stamp(dirs);
+
+        std::shared_ptr<symbol_index> index(new symbol_index());
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "symbols-%016llx.idx", static_cast<unsigned long long>(stamp));
+        std::string dir = default_index_dir();
+        std::string path = dir + "/" + name;
+
+        if (map_index(path, stamp, index->m_map, index->m_size))
+        {
+            index->m_data = static_cast<const unsigned char*>(index->m_map);
+            index->m_path = path;
+            return index;
+        }
+
+        // Kernels starting together build the index once: the first one
+        // takes the lock, the others map its result
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        int lock_fd = ::open((dir + "/symbols.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock_fd >= 0)
+        {
+            flock(lock_fd, LOCK_EX);
+            if (map_index(path, stamp, index->m_map, index->m_size))
+            {
+                close(lock_fd);
+                index->m_data = static_cast<const unsigned char*>(index->m_map);
+                index->m_path = path;
+                return index;
+            }
+        }
+
+        trace_scope build_trace("index.build", "index");
+        std::vector<unsigned char> data = serialize(collect_symbols(dirs), stamp);
+        build_trace.set_value(static_cast<int64_t>(data.size()));
+        build_trace.finish();
+
+        bool written = lock_fd >= 0 && write_atomically(path, data);
+        if (lock_fd >= 0)
+        {
+            close(lock_fd);
+        }
+        if (written && map_index(path, stamp, index->m_map, index->m_size))
+        {
+            index->m_data = static_cast<const unsigned char*>(index->m_map);
+            index->m_path = path;
+            return index;
+        }
+
+        std::cerr << "Symbol index not cached in " << dir << ", keeping it in memory" << std::endl;
+        index->m_owned = std::move(data);
+        index->m_data = index->m_owned.data();
+        index->m_size = index->m_owned.size();
+        return index;
+    }
+
+    const symbol_index::entry* symbol_index::entries() const
+    {
+        static_assert(sizeof(entry) == 16, "index entry layout");
+        return reinterpret_cast<const entry*>(m_data + sizeof(index_header));
+    }
+
+    const char* symbol_index::strings() const
+    {
+        return reinterpret_cast<const char*>(m_data + sizeof(index_header) + size() * sizeof(entry));
+    }
+
+    size_t symbol_index::size() const
+    {
+        index_header header;
+        std::memcpy(&header, m_data, sizeof(header));
+        return static_cast<size_t>(header.entry_count);
+    }
+
+    const symbol_index::entry* symbol_index::lower_bound(const std::string& name) const
+    {
+        const char* text = strings();
+        return std::lower_bound(entries(), entries() + size(), name,
+                                [text](const entry& e, const std::string& value) {
+                                    return value.compare(0, std::string::npos, text + e.name_offset, e.name_length) > 0;
+                                });
+    }
+
+    std::vector<std::string> symbol_index::complete(const std::string& prefix, symbol_kind kind, size_t limit) const
+    {
+        std::vector<std::string> names;
+        const char* text = strings();
+        const entry* end = entries() + size();
+        for (const entry* e = lower_bound(prefix); e != end && names.size() < limit; ++e)
+        {
+            if (e->name_length < prefix.size() || prefix.compare(0, prefix.size(), text + e->name_offset, prefix.size()) != 0)
+            {
+                break;
+            }
+            if (e->kind == static_cast<uint8_t>(kind))
+            {
+                names.emplace_back(text + e->name_offset, e->name_length);
+            }
+        }
+        return names;
+    }
+
+    std::string symbol_index::summary(const std::string& name) const
+    {
+        const char* text = strings();
+        const entry* end = entries() + size();
+        for (const entry* e = lower_bound(name); e != end; ++e)
+        {
+            if (name.compare(0, std::string::npos, text + e->name_offset, e->name_length) != 0)
+            {
+                break;
+            }
+            if (e->kind == static_cast<uint8_t>(symbol_kind::command))
+            {
+                return std::string(text + e->summary_offset, e->summary_length);
+            }
+        }
+        return "";
+    }
+
+} // namespace xeus_stata
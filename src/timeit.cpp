@@ -0,0 +1,350 @@
+#include "xeus-stata/timeit.hpp"
+#include "xeus-stata/stata_session.hpp"
+#include "xeus-stata/stata_parser.hpp"
+#include "xeus-stata/timing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        const char* USAGE = "Usage: %%timeit [-n RUNS] [-w WARMUP] [-p]\n"
+                            "  -n  timed runs (default 7)\n"
+                            "  -w  untimed warmup runs (default 1)\n"
+                            "  -p  restore the data before every run, like preserve/restore";
+
+        // Runs of an empty cell measuring what the kernel adds to each one
+        const size_t CALIBRATION_RUNS = 5;
+
+        size_t parse_count(const std::string& text, size_t min)
+        {
+            char* end = nullptr;
+            long value = std::strtol(text.c_str(), &end, 10);
+            if (text.empty() || *end != '\0' || value < static_cast<long>(min) || value > 100000)
+            {
+                throw std::runtime_error(USAGE);
+            }
+            return static_cast<size_t>(value);
+        }
+
+        // Nearest-rank percentile of sorted samples
+        double percentile(const std::vector<double>& sorted, double p)
+        {
+            if (sorted.empty())
+            {
+                return 0;
+            }
+            size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+            return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+        }
+
+        // 3 significant digits in a unit that fits
+        std::string format_duration(double ms)
+        {
+            std::ostringstream out;
+            double value = ms;
+            const char* unit = "ms";
+            if (ms < 1)
+            {
+                value = ms * 1000;
+                unit = "\xc2\xb5s";
+            }
+            else if (ms >= 1000)
+            {
+                value = ms / 1000;
+                unit = "s";
+            }
+            int decimals = value >= 100 ? 0 : value >= 10 ? 1 : 2;
+            out << std::fixed << std::setprecision(decimals) << value << " " << unit;
+            return out.str();
+        }
+
+        std::string tagged_value(const std::string& output, const std::string& tag)
+        {
+            std::stringstream ss(output);
+            std::string line;
+            while (std::getline(ss, line))
+            {
+                if (line.compare(0, tag.size(), tag) == 0)
+                {
+                    return line.substr(tag.size());
+                }
+            }
+            return "";
+        }
+
+        // Comment lines as long as the lines of code, so the calibration
+        // cell is written and run the same way as the cell itself
+        std::string calibration_cell(const std::string& code)
+        {
+            std::string cell;
+            std::stringstream ss(code);
+            std::string line;
+            while (std::getline(ss, line))
+            {
+                if (!line.empty())
+                {
+                    cell += "*" + std::string(line.size() - 1, 'x');
+                }
+                cell += "\n";
+            }
+            return cell;
+        }
+
+        std::string run_error(const std::string& what, const execution_result& result)
+        {
+            std::string message = result.error_message;
+            message.erase(0, message.find_first_not_of(" \t\r\n"));
+            return what + " failed with r(" + std::to_string(result.error_code) + ")" +
+                   (message.empty() ? "" : ":\n" + message);
+        }
+
+        // Saved copy of the data the runs start from
+        class data_snapshot
+        {
+        public:
+            explicit data_snapshot(stata_session& session)
+                : m_session(session)
+                , m_dir(make_scratch_dir())
+                , m_file(m_dir + "/timeit.dta")
+            {
+                auto result = m_session.execute(
+                    "display \"xstata_k:\" c(k)\n"
+                    "if c(k) > 0 {\n"
+                    "    preserve\n"
+                    "    quietly save " + compound_quote(m_file) + "\n"
+                    "    restore\n"
+                    "}");
+                if (result.is_error)
+                {
+                    throw std::runtime_error(run_error("Saving the data", result));
+                }
+                m_has_data = std::atoi(tagged_value(result.output, "xstata_k:").c_str()) > 0;
+            }
+
+            ~data_snapshot()
+            {
+                std::error_code ec;
+                std::filesystem::remove_all(m_dir, ec);
+            }
+
+            void restore()
+            {
+                auto result = m_session.execute(m_has_data ? "quietly use " + compound_quote(m_file) + ", clear" : "clear");
+                if (result.is_error)
+                {
+                    throw std::runtime_error(run_error("Restoring the data", result));
+                }
+            }
+
+        private:
+            stata_session& m_session;
+            std::string m_dir;
+            std::string m_file;
+            bool m_has_data = false;
+        };
+    }
+
+    timeit_options parse_timeit_args(const std::vector<std::string>& args)
+    {
+        timeit_options options;
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            if (args[i] == "-n" && i + 1 < args.size())
+            {
+                options.runs = parse_count(args[++i], 1);
+            }
+            else if (args[i] == "-w" && i + 1 < args.size())
+            {
+                options.warmup = parse_count(args[++i], 0);
+            }
+            else if (args[i] == "-p")
+            {
+                options.restore_data = true;
+            }
+            else
+            {
+                throw std::runtime_error(USAGE);
+            }
+        }
+        return options;
+    }
+
+    timing_summary summarize_samples(std::vector<double> samples)
+    {
+        timing_summary summary;
+        summary.samples = samples;
+        if (samples.empty())
+        {
+            return summary;
+        }
+        std::sort(samples.begin(), samples.end());
+        size_t n = samples.size();
+        summary.min = samples.front();
+        summary.median = n % 2 == 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+        summary.p95 = percentile(samples, 95);
+        summary.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+        return summary;
+    }
+
+    timeit_result run_timeit(stata_session& session, const std::string& code, const timeit_options& options)
+    {
+        timeit_result result;
+        result.options = options;
+        if (code.find_first_not_of(" \t\r\n") == std::string::npos)
+        {
+            throw std::runtime_error("%%timeit: the cell is empty\n" + std::string(USAGE));
+        }
+
+        std::unique_ptr<data_snapshot> snapshot;
+        if (options.restore_data)
+        {
+            snapshot = std::make_unique<data_snapshot>(session);
+        }
+
+        std::vector<double> kernel_samples;
+        std::vector<double> stata_samples;
+        bool has_stata_timer = true;
+        for (size_t run = 0; run < options.warmup + options.runs; ++run)
+        {
+            if (snapshot)
+            {
+                snapshot->restore();
+            }
+
+            stopwatch timer;
+            execution_result executed = session.execute(code);
+            double wall = timer.elapsed_ms();
+            for (const auto& graph_file : executed.graph_files)
+            {
+                std::remove(graph_file.c_str());
+            }
+            if (executed.is_error)
+            {
+                if (snapshot)
+                {
+                    snapshot->restore();
+                }
+                throw std::runtime_error(run_error(run < options.warmup ? "Warmup run " + std::to_string(run + 1)
+                                                                        : "Run " + std::to_string(run - options.warmup + 1),
+                                                   executed));
+            }
+            if (run < options.warmup)
+            {
+                continue;
+            }
+            kernel_samples.push_back(wall);
+            stata_samples.push_back(executed.timing.stata_timer_ms);
+            has_stata_timer = has_stata_timer && executed.state.valid;
+        }
+
+        // Writing the cell, the end marker, the trailer and parsing cost
+        // the same for a cell of comments of the same shape; take them off
+        // the kernel clock
+        std::string calibration_code = calibration_cell(code);
+        std::vector<double> calibration;
+        for (size_t i = 0; i < CALIBRATION_RUNS; ++i)
+        {
+            stopwatch timer;
+            session.execute(calibration_code);
+            calibration.push_back(timer.elapsed_ms());
+        }
+        result.overhead_ms = summarize_samples(calibration).median;
+        for (double& sample : kernel_samples)
+        {
+            sample = std::max(0.0, sample - result.overhead_ms);
+        }
+
+        if (snapshot)
+        {
+            snapshot->restore();
+        }
+
+        result.kernel = summarize_samples(kernel_samples);
+        result.has_stata_timer = has_stata_timer;
+        if (has_stata_timer)
+        {
+            result.stata = summarize_samples(stata_samples);
+        }
+        return result;
+    }
+
+    std::string format_timeit_text(const timeit_result& result)
+    {
+        const timing_summary& primary = result.has_stata_timer ? result.stata : result.kernel;
+        std::ostringstream out;
+        out << format_duration(primary.median) << " median, " << format_duration(primary.min) << " min, "
+            << format_duration(primary.p95) << " p95 (" << result.options.runs << " runs, "
+            << result.options.warmup << " warmup" << (result.options.restore_data ? ", data restored" : "") << ")";
+        if (result.has_stata_timer)
+        {
+            out << "\nkernel clock: " << format_duration(result.kernel.median) << " median, net of "
+                << format_duration(result.overhead_ms) << " per-cell overhead";
+        }
+        return out.str();
+    }
+
+    std::string format_timeit_html(const timeit_result& result)
+    {
+        std::ostringstream out;
+        auto row = [&out](const std::string& name, const timing_summary& summary) {
+            out << "<tr><th style=\"text-align:left\">" << name << "</th>"
+                << "<td>" << format_duration(summary.min) << "</td>"
+                << "<td>" << format_duration(summary.median) << "</td>"
+                << "<td>" << format_duration(summary.p95) << "</td>"
+                << "<td>" << format_duration(summary.mean) << "</td></tr>";
+        };
+
+        out << "<table class=\"stata-timeit\">"
+            << "<thead><tr><th></th><th>min</th><th>median</th><th>p95</th><th>mean</th></tr></thead><tbody>";
+        if (result.has_stata_timer)
+        {
+            row("Stata timer", result.stata);
+        }
+        row("Kernel clock (net)", result.kernel);
+        out << "</tbody></table>"
+            << "<p style=\"font-size:smaller\">" << result.options.runs << " runs after "
+            << result.options.warmup << " warmup"
+            << (result.options.restore_data ? ", data restored before each run" : "")
+            << "; kernel overhead of " << format_duration(result.overhead_ms)
+            << " per cell subtracted</p>";
+        return out.str();
+    }
+
+    nl::json timeit_to_json(const timeit_result& result)
+    {
+        auto summary_json = [](const timing_summary& summary) {
+            return nl::json{
+                {"min_ms", summary.min},
+                {"median_ms", summary.median},
+                {"p95_ms", summary.p95},
+                {"mean_ms", summary.mean},
+                {"samples_ms", summary.samples}
+            };
+        };
+
+        nl::json j = {
+            {"runs", result.options.runs},
+            {"warmup", result.options.warmup},
+            {"restore_data", result.options.restore_data},
+            {"overhead_ms", result.overhead_ms},
+            {"kernel", summary_json(result.kernel)}
+        };
+        if (result.has_stata_timer)
+        {
+            j["stata"] = summary_json(result.stata);
+        }
+        return j;
+    }
+
+} // namespace xeus_stata
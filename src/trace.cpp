@@ -0,0 +1,315 @@
+#include "xeus-stata/trace.hpp"
+#include "xeus-stata/xeus_stata_config.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+    #include <sys/syscall.h>
+#endif
+
+namespace xeus_stata
+{
+    namespace detail
+    {
+        std::atomic<bool> g_tracing_enabled(false);
+    }
+
+    namespace
+    {
+        struct trace_event
+        {
+            const char* name;
+            const char* category;
+            uint64_t start_us;
+            uint64_t duration_us;
+            int64_t cell;
+            int64_t value;
+        };
+
+        // Single-producer (owning thread) single-consumer (flusher) ring
+        constexpr size_t RING_CAPACITY = 8192;
+
+        struct trace_ring
+        {
+            std::array<trace_event, RING_CAPACITY> events;
+            std::atomic<size_t> head{0};
+            std::atomic<size_t> tail{0};
+            std::atomic<uint64_t> dropped{0};
+            std::atomic<bool> retired{false};   // the owning thread has exited
+            uint64_t tid = 0;
+
+            // Guarded by the state mutex
+            std::string thread_name;
+            bool name_written = false;
+            bool drained = false;               // retired and empty, to be dropped
+        };
+
+        struct trace_state
+        {
+            std::mutex mutex;
+            std::condition_variable wakeup;
+            std::vector<std::shared_ptr<trace_ring>> rings;
+            std::FILE* file = nullptr;
+            bool first_event = true;
+            bool stopping = false;
+            std::thread flusher;
+        };
+
+        trace_state& state()
+        {
+            static trace_state instance;
+            return instance;
+        }
+
+        std::atomic<int64_t> g_current_cell(0);
+
+        // Retires the thread's ring when the thread exits. Graph workers
+        // are a new thread per task, so the flusher drains retired rings
+        // once more and drops them instead of keeping one per dead thread.
+        struct ring_owner
+        {
+            std::shared_ptr<trace_ring> ring;
+
+            ~ring_owner()
+            {
+                if (ring)
+                {
+                    ring->retired.store(true, std::memory_order_release);
+                }
+            }
+        };
+
+        thread_local ring_owner t_ring;
+
+        uint64_t current_tid()
+        {
+#if defined(XEUS_STATA_PLATFORM_LINUX)
+            return static_cast<uint64_t>(syscall(SYS_gettid));
+#else
+            return std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xffffffff;
+#endif
+        }
+
+        trace_ring* thread_ring()
+        {
+            if (!t_ring.ring)
+            {
+                auto ring = std::make_shared<trace_ring>();
+                ring->tid = current_tid();
+                std::lock_guard<std::mutex> lock(state().mutex);
+                state().rings.push_back(ring);
+                t_ring.ring = std::move(ring);
+            }
+            return t_ring.ring.get();
+        }
+
+        void write_separator(trace_state& st)
+        {
+            std::fputs(st.first_event ? "\n" : ",\n", st.file);
+            st.first_event = false;
+        }
+
+        // Drain every ring into the trace file, called with the mutex held
+        void flush_locked(trace_state& st)
+        {
+            if (!st.file)
+            {
+                return;
+            }
+
+            const int pid = static_cast<int>(getpid());
+            for (auto& ring : st.rings)
+            {
+                // Read before head, so a retired ring is drained of
+                // everything its thread recorded
+                bool retired = ring->retired.load(std::memory_order_acquire);
+
+                if (!ring->thread_name.empty() && !ring->name_written)
+                {
+                    write_separator(st);
+                    std::fprintf(st.file,
+                                 "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%llu,"
+                                 "\"args\":{\"name\":\"%s\"}}",
+                                 pid, static_cast<unsigned long long>(ring->tid),
+                                 ring->thread_name.c_str());
+                    ring->name_written = true;
+                }
+
+                size_t tail = ring->tail.load(std::memory_order_relaxed);
+                size_t head = ring->head.load(std::memory_order_acquire);
+                while (tail != head)
+                {
+                    const trace_event& ev = ring->events[tail % RING_CAPACITY];
+                    write_separator(st);
+                    std::fprintf(st.file,
+                                 "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                                 "\"pid\":%d,\"tid\":%llu,\"args\":{\"cell\":%lld",
+                                 ev.name, ev.category,
+                                 static_cast<unsigned long long>(ev.start_us),
+                                 static_cast<unsigned long long>(ev.duration_us),
+                                 pid, static_cast<unsigned long long>(ring->tid),
+                                 static_cast<long long>(ev.cell));
+                    if (ev.value >= 0)
+                    {
+                        std::fprintf(st.file, ",\"value\":%lld", static_cast<long long>(ev.value));
+                    }
+                    std::fputs("}}", st.file);
+                    ++tail;
+                }
+                ring->tail.store(tail, std::memory_order_release);
+
+                uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+                if (dropped > 0)
+                {
+                    write_separator(st);
+                    std::fprintf(st.file,
+                                 "{\"name\":\"dropped_events\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,"
+                                 "\"pid\":%d,\"tid\":%llu,\"args\":{\"value\":%llu}}",
+                                 static_cast<unsigned long long>(trace_scope::now_us()), pid,
+                                 static_cast<unsigned long long>(ring->tid),
+                                 static_cast<unsigned long long>(dropped));
+                }
+                ring->drained = retired;
+            }
+            st.rings.erase(std::remove_if(st.rings.begin(), st.rings.end(),
+                                          [](const std::shared_ptr<trace_ring>& ring) { return ring->drained; }),
+                           st.rings.end());
+            std::fflush(st.file);
+        }
+
+        void flusher_loop()
+        {
+            trace_state& st = state();
+            std::unique_lock<std::mutex> lock(st.mutex);
+            while (!st.stopping)
+            {
+                st.wakeup.wait_for(lock, std::chrono::milliseconds(100));
+                flush_locked(st);
+            }
+        }
+    }
+
+    uint64_t trace_scope::now_us()
+    {
+        // Offset by one so that zero can mean "not recording"
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count()) + 1;
+    }
+
+    void trace_scope::record(const char* name, const char* category,
+                             uint64_t start_us, uint64_t duration_us, int64_t value)
+    {
+        if (!tracing_enabled())
+        {
+            return;
+        }
+
+        trace_ring* ring = thread_ring();
+        size_t head = ring->head.load(std::memory_order_relaxed);
+        size_t tail = ring->tail.load(std::memory_order_acquire);
+        if (head - tail >= RING_CAPACITY)
+        {
+            // Flusher is behind, drop rather than block
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        ring->events[head % RING_CAPACITY] = trace_event{
+            name, category, start_us, duration_us,
+            g_current_cell.load(std::memory_order_relaxed), value
+        };
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    void start_tracing_from_env()
+    {
+        const char* path = std::getenv("XEUS_STATA_TRACE");
+        if (path && path[0] != '\0')
+        {
+            start_tracing(path);
+        }
+    }
+
+    void start_tracing(const std::string& path)
+    {
+        trace_state& st = state();
+        {
+            std::lock_guard<std::mutex> lock(st.mutex);
+            if (st.file)
+            {
+                return;
+            }
+            st.file = std::fopen(path.c_str(), "w");
+            if (!st.file)
+            {
+                std::cerr << "Warning: cannot open trace file " << path << std::endl;
+                return;
+            }
+            // JSON array format; the closing bracket is optional for the
+            // trace viewers, so a killed kernel still leaves a usable trace
+            std::fputs("[", st.file);
+            st.first_event = true;
+            st.stopping = false;
+        }
+
+        st.flusher = std::thread(flusher_loop);
+        detail::g_tracing_enabled.store(true, std::memory_order_relaxed);
+        trace_set_thread_name("shell");
+    }
+
+    void stop_tracing()
+    {
+        trace_state& st = state();
+        if (!tracing_enabled())
+        {
+            return;
+        }
+        detail::g_tracing_enabled.store(false, std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> lock(st.mutex);
+            st.stopping = true;
+        }
+        st.wakeup.notify_all();
+        if (st.flusher.joinable())
+        {
+            st.flusher.join();
+        }
+
+        std::lock_guard<std::mutex> lock(st.mutex);
+        flush_locked(st);
+        std::fputs("\n]\n", st.file);
+        std::fclose(st.file);
+        st.file = nullptr;
+    }
+
+    void trace_set_cell(int64_t cell_id)
+    {
+        g_current_cell.store(cell_id, std::memory_order_relaxed);
+    }
+
+    void trace_set_thread_name(const char* name)
+    {
+        if (!tracing_enabled())
+        {
+            return;
+        }
+        trace_ring* ring = thread_ring();
+        std::lock_guard<std::mutex> lock(state().mutex);
+        ring->thread_name = name;
+        ring->name_written = false;
+    }
+
+} // namespace xeus_stata
@@ -5,24 +5,372 @@
 #include "xeus-stata/xeus_stata_config.hpp"
 #include "xeus-stata/base64.hpp"
 #include "xeus-stata/stata_parser.hpp"
+#include "xeus-stata/magics.hpp"
+#include "xeus-stata/checkpoint.hpp"
+#include "xeus-stata/trace.hpp"
+#include "xeus-stata/metrics.hpp"
+#include "xeus-stata/png.hpp"
+#include "xeus-stata/stata_lexer.hpp"
+#include "xeus-stata/symbol_index.hpp"
+#include "xeus-stata/parallel.hpp"
+#include "xeus-stata/timeit.hpp"
+#include "xeus-stata/profile.hpp"
+#include "xeus-stata/resource_monitor.hpp"
+#include "xeus-stata/resource_policy.hpp"
+#include "xeus-stata/prefetch.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <vector>
 #include <unistd.h>
 
 namespace xeus_stata
 {
+    namespace
+    {
+        nl::json timing_to_json(const execution_timing& timing)
+        {
+            return {
+                {"write_ms", timing.write_ms},
+                {"stata_ms", timing.stata_ms},
+                {"stata_timer_ms", timing.stata_timer_ms},
+                {"pty_read_ms", timing.pty_read_ms},
+                {"parse_ms", timing.parse_ms},
+                {"session_ms", timing.total_session_ms},
+                {"interrupt_ms", timing.interrupt_ms},
+                {"format_ms", timing.format_ms},
+                {"graph_read_ms", timing.graph_read_ms},
+                {"optimize_ms", timing.optimize_ms},
+                {"encode_ms", timing.encode_ms},
+                {"publish_ms", timing.publish_ms},
+                {"total_ms", timing.total_ms},
+                {"idle_ms", timing.idle_ms},
+                {"bytes_written", timing.bytes_written},
+                {"bytes_read", timing.bytes_read},
+                {"read_batches", timing.read_batches},
+                {"output_bytes", timing.output_bytes},
+                {"graph_bytes", timing.graph_bytes},
+                {"optimized_bytes", timing.optimized_bytes},
+                {"encoded_bytes", timing.encoded_bytes}
+            };
+        }
+
+        nl::json state_to_json(const cell_state& state)
+        {
+            return {
+                {"nobs", state.nobs},
+                {"nvars", state.nvars},
+                {"changed", state.data_changed},
+                {"frame", state.frame},
+                {"pwd", state.pwd},
+                {"stata_clock", state.stata_clock}
+            };
+        }
+
+        // String-valued user_expressions go to Stata, anything else is
+        // answered with an error by expressions_to_json
+        expression_list expressions_from_json(const nl::json& user_expressions)
+        {
+            expression_list expressions;
+            if (user_expressions.is_object())
+            {
+                for (const auto& item : user_expressions.items())
+                {
+                    if (item.value().is_string())
+                    {
+                        expressions.emplace_back(item.key(), item.value().get<std::string>());
+                    }
+                }
+            }
+            return expressions;
+        }
+
+        nl::json expression_error(const std::string& ename, const std::string& evalue)
+        {
+            return {
+                {"status", "error"},
+                {"ename", ename},
+                {"evalue", evalue},
+                {"traceback", nl::json::array({evalue})}
+            };
+        }
+
+        // The user_expressions reply field, one entry per requested name
+        nl::json expressions_to_json(const nl::json& user_expressions, const std::vector<expression_result>& evaluated)
+        {
+            nl::json reply = nl::json::object();
+            if (!user_expressions.is_object())
+            {
+                return reply;
+            }
+            for (const auto& item : user_expressions.items())
+            {
+                if (!item.value().is_string())
+                {
+                    reply[item.key()] = expression_error("TypeError", "A user expression must be a string");
+                    continue;
+                }
+                auto found = std::find_if(evaluated.begin(), evaluated.end(),
+                                          [&item](const expression_result& e) { return e.name == item.key(); });
+                if (found == evaluated.end())
+                {
+                    reply[item.key()] = expression_error("NotEvaluated", "Stata did not reach the expression");
+                }
+                else if (found->rc != 0)
+                {
+                    reply[item.key()] = expression_error("StataError", "r(" + std::to_string(found->rc) + ")");
+                }
+                else
+                {
+                    reply[item.key()] = {
+                        {"status", "ok"},
+                        {"data", {{"text/plain", found->value}}},
+                        {"metadata", nl::json::object()}
+                    };
+                }
+            }
+            return reply;
+        }
+
+        // One-line summary printed under the cell in %timing on mode
+        std::string format_timing(const execution_timing& timing)
+        {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(1)
+                << "\n[timing] total " << timing.total_ms << " ms"
+                << " | stata " << timing.stata_ms
+                << " | write " << timing.write_ms
+                << " | pty read " << timing.pty_read_ms
+                << " | parse " << timing.parse_ms
+                << " | format " << timing.format_ms
+                << " | graph read " << timing.graph_read_ms
+                << " | optimize " << timing.optimize_ms
+                << " | base64 " << timing.encode_ms
+                << " | publish " << timing.publish_ms
+                << " | idle before " << timing.idle_ms
+                << " | " << timing.bytes_written << " B in, "
+                << timing.bytes_read << " B out (" << timing.read_batches << " reads)";
+            if (timing.interrupt_ms > 0)
+            {
+                out << ", interrupt settled in " << timing.interrupt_ms << " ms";
+            }
+            if (timing.graph_bytes > 0)
+            {
+                out << ", " << timing.graph_bytes << " B graphs";
+                if (timing.optimized_bytes != timing.graph_bytes)
+                {
+                    out << " (" << timing.optimized_bytes << " B sent)";
+                }
+            }
+            out << "\n";
+            return out.str();
+        }
+
+        // A graph read, optimized and base64-encoded off the shell thread
+        struct prepared_graph
+        {
+            std::string mime_type;
+            std::string encoded;
+            nl::json metadata = nl::json::object();
+            size_t file_bytes = 0;
+            size_t sent_bytes = 0;
+            double read_ms = 0;
+            double optimize_ms = 0;
+            double encode_ms = 0;
+        };
+
+        // Move a graph file to dest, copying across file systems
+        bool keep_file(const std::string& source, const std::string& dest)
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(std::filesystem::path(dest).parent_path(), ec);
+            if (std::rename(source.c_str(), dest.c_str()) == 0)
+            {
+                return true;
+            }
+            if (std::filesystem::copy_file(source, dest, std::filesystem::copy_options::overwrite_existing, ec))
+            {
+                unlink(source.c_str());
+                return true;
+            }
+            return false;
+        }
+
+        using graph_bytes = std::shared_ptr<const std::vector<unsigned char>>;
+
+        // Read an exported graph; empty if it is missing
+        graph_bytes read_graph_file(const std::string& graph_file)
+        {
+            trace_scope read_trace("graph.read", "graph");
+            std::ifstream file(graph_file, std::ios::binary);
+            if (!file)
+            {
+                return std::make_shared<const std::vector<unsigned char>>();
+            }
+            auto buffer = std::make_shared<const std::vector<unsigned char>>(
+                std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            read_trace.set_value(static_cast<int64_t>(buffer->size()));
+            return buffer;
+        }
+
+        std::string graph_mime_type(const std::string& graph_file)
+        {
+            if (graph_file.find(".svg") != std::string::npos)
+            {
+                return "image/svg+xml";
+            }
+            if (graph_file.find(".pdf") != std::string::npos)
+            {
+                return "application/pdf";
+            }
+            return "image/png";
+        }
+
+        // keep_as is where the full-resolution original goes if the image
+        // is downsampled; otherwise the exported file is removed
+        prepared_graph prepare_graph(const std::string& graph_file, std::shared_future<graph_bytes> pending,
+                                     bool optimize, png_budget budget, const std::string& keep_as)
+        {
+            prepared_graph graph;
+            stopwatch read_timer;
+            graph_bytes data = pending.get();
+            graph.read_ms = read_timer.elapsed_ms();
+            graph.mime_type = graph_mime_type(graph_file);
+            graph.file_bytes = data->size();
+            std::vector<unsigned char> buffer = *data;
+            stopwatch timer;
+
+            bool kept = false;
+            if (graph.mime_type == "image/png" && !buffer.empty())
+            {
+                png_info info;
+                bool has_info = read_png_info(buffer.data(), buffer.size(), info);
+                if (has_info && optimize)
+                {
+                    timer.restart();
+                    trace_scope optimize_trace("graph.optimize", "graph");
+                    optimize_trace.set_value(static_cast<int64_t>(buffer.size()));
+                    png_optimize_result optimized = optimize_png(buffer, budget);
+                    if (optimized.resampled && keep_file(graph_file, keep_as))
+                    {
+                        kept = true;
+                        graph.metadata["xeus_stata"] = {
+                            {"original", keep_as},
+                            {"original_width", info.width},
+                            {"original_height", info.height}
+                        };
+                    }
+                    buffer.swap(optimized.data);
+                    info = optimized.info;
+                    graph.optimize_ms = timer.elapsed_ms();
+                }
+
+                if (has_info)
+                {
+                    graph.metadata["image/png"] = {
+                        {"width", info.width},
+                        {"height", info.height}
+                    };
+                }
+            }
+            graph.sent_bytes = buffer.size();
+
+            if (!buffer.empty())
+            {
+                // Base64 encode the image data
+                timer.restart();
+                trace_scope encode_trace("graph.encode", "graph");
+                encode_trace.set_value(static_cast<int64_t>(buffer.size()));
+                graph.encoded = base64_encode(buffer.data(), buffer.size());
+                graph.encode_ms = timer.elapsed_ms();
+            }
+
+            // Clean up temp file
+            if (!kept)
+            {
+                unlink(graph_file.c_str());
+            }
+            return graph;
+        }
+
+        // Where the original of a cell's index-th graph is kept if it is
+        // downsampled
+        std::string kept_graph_path(int execution_counter, size_t index)
+        {
+            return default_graph_dir() + "/xstata-" + std::to_string(getpid()) + "-" +
+                   std::to_string(execution_counter) + "-" + std::to_string(index) + ".png";
+        }
+
+        // Downscaled stand-in shown while the full image is prepared;
+        // empty if no preview could be made
+        prepared_graph prepare_preview(std::shared_future<graph_bytes> pending, uint32_t max_side)
+        {
+            prepared_graph preview;
+            graph_bytes data = pending.get();
+            trace_scope preview_trace("graph.preview", "graph");
+            png_optimize_result thumbnail = make_png_preview(*data, max_side);
+            if (!thumbnail.data.empty())
+            {
+                preview.mime_type = "image/png";
+                preview.encoded = base64_encode(thumbnail.data.data(), thumbnail.data.size());
+                preview.sent_bytes = thumbnail.data.size();
+                preview.metadata["image/png"] = {
+                    {"width", thumbnail.info.width},
+                    {"height", thumbnail.info.height}
+                };
+            }
+            return preview;
+        }
+    }
+
     interpreter::interpreter()
         : m_session(nullptr)
         , m_completer(nullptr)
         , m_inspector(nullptr)
+        , m_checkpoints(nullptr)
+        , m_parallel(std::make_unique<parallel_runner>())
+        , m_show_timing(false)
+        , m_metrics(std::make_unique<kernel_metrics>())
+        , m_resources_sent(0)
+        , m_resource_warnings(false)
+        , m_idle_cells(false)
+        , m_stata_pwd(std::filesystem::current_path().string())
+        , m_optimize_graphs(std::getenv("XEUS_STATA_GRAPH_OPTIMIZE") &&
+                            std::string(std::getenv("XEUS_STATA_GRAPH_OPTIMIZE")) == "1")
     {
+        const char* max_pixels = std::getenv("XEUS_STATA_GRAPH_MAX_PIXELS");
+        const char* max_bytes = std::getenv("XEUS_STATA_GRAPH_MAX_BYTES");
+        m_graph_budget.max_pixels = max_pixels ? std::strtoull(max_pixels, nullptr, 10) : 4000000;
+        m_graph_budget.max_bytes = max_bytes ? std::strtoull(max_bytes, nullptr, 10) : 1024 * 1024;
+
+        const char* preview_bytes = std::getenv("XEUS_STATA_GRAPH_PREVIEW_BYTES");
+        const char* preview_side = std::getenv("XEUS_STATA_GRAPH_PREVIEW_SIZE");
+        m_preview_min_bytes = preview_bytes ? std::strtoull(preview_bytes, nullptr, 10) : 256 * 1024;
+        m_preview_max_side = preview_side ? static_cast<uint32_t>(std::strtoul(preview_side, nullptr, 10)) : 480;
+
+        const char* prefetch = std::getenv("XEUS_STATA_PREFETCH");
+        if (!prefetch || std::string(prefetch) != "0")
+        {
+            const char* prefetch_bytes = std::getenv("XEUS_STATA_PREFETCH_MAX_BYTES");
+            uint64_t max_bytes = prefetch_bytes ? parse_byte_size(prefetch_bytes) : 0;
+            m_prefetcher = std::make_unique<data_prefetcher>(max_bytes > 0 ? max_bytes : 2ull << 30);
+        }
     }
 
     interpreter::~interpreter()
     {
+        if (m_resources)
+        {
+            m_resources->stop();
+        }
+        m_metrics->stop_exporter();
     }
 
     void interpreter::interrupt()
@@ -31,6 +379,7 @@ namespace xeus_stata
         {
             m_session->interrupt();
         }
+        m_parallel->interrupt();
     }
 
     void interpreter::configure_impl()
@@ -39,8 +388,92 @@ namespace xeus_stata
         try
         {
             m_session = std::make_unique<stata_session>();
-            m_completer = std::make_unique<completion_engine>(m_session.get());
-            m_inspector = std::make_unique<inspection_engine>(m_session.get());
+            // Command/function/help index shared by every kernel on the host
+            auto index = symbol_index::open();
+            m_completer = std::make_unique<completion_engine>(m_session.get(), index);
+            m_inspector = std::make_unique<inspection_engine>(m_session.get(), index);
+            m_checkpoints = std::make_unique<checkpoint_manager>(m_session.get());
+
+            // Limits from XEUS_STATA_CPUS, XEUS_STATA_CGROUP, ... as applied
+            std::string resources = m_session->resource_summary();
+            if (!resources.empty())
+            {
+                std::cerr << "Stata resources: " << resources << std::endl;
+            }
+
+            // Metrics: Stata RSS sampling, Prometheus file and comm target
+            stata_session* session = m_session.get();
+            m_metrics->set_pid_provider([session]() { return session->get_pid(); });
+
+            int interval = 15;
+            const char* interval_env = std::getenv("XEUS_STATA_METRICS_INTERVAL");
+            if (interval_env && interval_env[0] != '\0')
+            {
+                interval = std::atoi(interval_env);
+            }
+            m_metrics->start_exporter(
+                default_metrics_dir() + "/xstata-metrics-" + std::to_string(getpid()) + ".prom",
+                interval
+            );
+
+            comm_manager().register_comm_target(
+                "xeus_stata.metrics",
+                [this](xeus::xcomm&& comm, const xeus::xmessage&) {
+                    // Reply with a snapshot on open and on every message
+                    m_metrics_comms.push_back(std::move(comm));
+                    xeus::xcomm& stored = m_metrics_comms.back();
+                    stored.on_message([this, &stored](const xeus::xmessage&) {
+                        stored.send(nl::json::object(), m_metrics->snapshot(), xeus::buffer_sequence());
+                    });
+                    stored.send(nl::json::object(), m_metrics->snapshot(), xeus::buffer_sequence());
+                }
+            );
+
+            // Resources: sampled on a background thread, pushed to the
+            // comm from the shell thread while a cell waits on Stata
+            int resource_interval = 1000;
+            const char* resource_interval_env = std::getenv("XEUS_STATA_RESOURCE_INTERVAL_MS");
+            if (resource_interval_env && resource_interval_env[0] != '\0')
+            {
+                resource_interval = std::atoi(resource_interval_env);
+            }
+            // Warn ahead of the cgroup's memory.max unless told otherwise
+            const char* rss_limit_env = std::getenv("XEUS_STATA_RSS_LIMIT");
+            m_resources = std::make_unique<resource_monitor>(
+                [session]() { return session->get_pid(); },
+                resource_interval,
+                rss_limit_env ? parse_byte_size(rss_limit_env) : resource_policy::instance().memory_max()
+            );
+            m_resources->start();
+            m_session->set_wait_callback([this]() { publish_resources(); });
+
+            comm_manager().register_comm_target(
+                "xeus_stata.resources",
+                [this](xeus::xcomm&& comm, const xeus::xmessage&) {
+                    // Latest sample on open and on every message, then
+                    // each new sample while a cell runs
+                    m_resource_comms.push_back(std::move(comm));
+                    xeus::xcomm& stored = m_resource_comms.back();
+                    stored.on_message([this, &stored](const xeus::xmessage&) {
+                        stored.send(nl::json::object(), m_resources->latest(), xeus::buffer_sequence());
+                    });
+                    stored.send(nl::json::object(), m_resources->latest(), xeus::buffer_sequence());
+                }
+            );
+
+            // Optionally bring a respawned Stata process back to the last
+            // checkpoint so the notebook can carry on
+            const char* restore_env = std::getenv("XEUS_STATA_RESPAWN_CHECKPOINT");
+            if (restore_env && std::string(restore_env) == "1")
+            {
+                m_session->set_respawn_callback([this]() {
+                    std::string last = m_checkpoints->last_checkpoint();
+                    if (!last.empty())
+                    {
+                        std::cerr << m_checkpoints->restore(last) << std::endl;
+                    }
+                });
+            }
         }
         catch (const std::exception& e)
         {
@@ -56,6 +489,8 @@ namespace xeus_stata
         xeus::execute_request_config config,
         nl::json user_expressions)
     {
+        trace_set_cell(execution_counter);
+        trace_scope trace("shell.execute_request", "shell");
         nl::json result;
 
         if (!m_session || !m_session->is_ready())
@@ -68,10 +503,46 @@ namespace xeus_stata
             return;
         }
 
+        magic_command magic;
+        if (parse_magic(code, magic))
+        {
+            cb(execute_magic(magic, execution_counter, config));
+            return;
+        }
+
+        stopwatch total_timer;
+
+        // Full-resolution graphs still being prepared, by display id
+        std::vector<std::pair<std::string, std::future<prepared_graph>>> deferred_graphs;
+        bool recorded = false;
+
         try
         {
+            // Start reading the cell's data files while its first
+            // commands run
+            std::vector<std::string> prefetched;
+            if (m_prefetcher)
+            {
+                prefetched = referenced_data_files(code, m_stata_pwd);
+                m_prefetcher->prefetch(prefetched);
+            }
+
             // Execute the code
-            auto exec_result = m_session->execute(code);
+            m_resource_warnings = !config.silent;
+            m_resources->begin_cell();
+            double idle_ms = m_idle_cells ? m_idle_timer.elapsed_ms() : 0;
+            auto exec_result = m_session->execute(code, expressions_from_json(user_expressions));
+            m_idle_timer.restart();
+            m_idle_cells = true;
+            cell_resources resources = m_resources->end_cell();
+            publish_resources();
+            m_resource_warnings = false;
+            execution_timing timing = exec_result.timing;
+            timing.idle_ms = idle_ms;
+            if (exec_result.state.valid && !exec_result.state.pwd.empty())
+            {
+                m_stata_pwd = exec_result.state.pwd;
+            }
 
             if (exec_result.is_error)
             {
@@ -88,11 +559,14 @@ namespace xeus_stata
                 traceback.push_back("Stata error code: r(" +
                                   std::to_string(exec_result.error_code) + ")");
                 result["traceback"] = traceback;
+                result["user_expressions"] = expressions_to_json(user_expressions, exec_result.expressions);
 
                 // Publish error output
                 if (!config.silent)
                 {
+                    stopwatch stage_timer;
                     publish_stream("stderr", exec_result.error_message);
+                    timing.publish_ms += stage_timer.elapsed_ms();
                 }
             }
             else
@@ -101,11 +575,41 @@ namespace xeus_stata
                 result["status"] = "ok";
                 result["execution_count"] = execution_counter;
                 result["payload"] = nl::json::array();
-                result["user_expressions"] = nl::json::object();
+                result["user_expressions"] = expressions_to_json(user_expressions, exec_result.expressions);
+
+                // Read, optimize and encode graphs on worker threads while
+                // the text output is formatted and published, so nothing
+                // but publishing stands between this cell and the next.
+                // Large PNGs also get a quick preview that is shown first
+                // and replaced once the full image is ready.
+                std::vector<std::future<prepared_graph>> graphs;
+                std::vector<std::future<prepared_graph>> previews;
+                for (size_t i = 0; i < exec_result.graph_files.size(); ++i)
+                {
+                    const std::string& graph_file = exec_result.graph_files[i];
+
+                    // prepare_graph may move or remove the file, so size it
+                    // before the tasks start
+                    std::error_code ec;
+                    auto file_bytes = std::filesystem::file_size(graph_file, ec);
+                    bool wants_preview = !config.silent && m_preview_min_bytes > 0 && !ec &&
+                                         file_bytes >= m_preview_min_bytes &&
+                                         graph_mime_type(graph_file) == "image/png";
+
+                    auto data = std::async(std::launch::async, read_graph_file, graph_file).share();
+                    graphs.push_back(std::async(std::launch::async, prepare_graph, graph_file, data,
+                                                m_optimize_graphs, m_graph_budget,
+                                                kept_graph_path(execution_counter, i)));
+                    previews.push_back(wants_preview
+                        ? std::async(std::launch::async, prepare_preview, data, m_preview_max_side)
+                        : std::future<prepared_graph>());
+                }
 
                 // Publish output with rich HTML formatting
                 if (!config.silent && !exec_result.output.empty())
                 {
+                    stopwatch stage_timer;
+                    trace_scope format_trace("format.output", "format");
                     nl::json display_data;
 
                     // Priority 1: Check if output contains raw HTML (from esttab, etc.)
@@ -114,12 +618,6 @@ namespace xeus_stata
                         // Raw HTML - render without escaping
                         display_data["text/html"] = format_as_raw_html(exec_result.output);
                         display_data["text/plain"] = exec_result.output;
-
-                        publish_execution_result(
-                            execution_counter,
-                            std::move(display_data),
-                            nl::json::object()
-                        );
                     }
                     // Priority 2: Check if output looks like a Stata table
                     else if (is_stata_table(exec_result.output))
@@ -127,7 +625,13 @@ namespace xeus_stata
                         // Stata table - escape HTML and wrap in styled <pre>
                         display_data["text/plain"] = exec_result.output;
                         display_data["text/html"] = format_as_html_table(exec_result.output);
+                    }
+                    timing.format_ms = stage_timer.elapsed_ms();
 
+                    stage_timer.restart();
+                    trace_scope publish_trace("iopub.publish", "iopub");
+                    if (!display_data.empty())
+                    {
                         publish_execution_result(
                             execution_counter,
                             std::move(display_data),
@@ -139,61 +643,117 @@ namespace xeus_stata
                         // Regular text output
                         publish_stream("stdout", exec_result.output);
                     }
+                    timing.publish_ms += stage_timer.elapsed_ms();
                 }
 
-                // Handle graphs
-                for (const auto& graph_file : exec_result.graph_files)
+                // Publish graphs in export order. A graph with a preview is
+                // shown as the preview now and updated after the reply.
+                for (size_t i = 0; i < graphs.size(); ++i)
                 {
-                    // Read graph file as binary and publish as display data
-                    std::ifstream file(graph_file, std::ios::binary);
-                    if (file)
+                    if (previews[i].valid())
                     {
-                        // Read binary data
-                        std::vector<unsigned char> buffer(std::istreambuf_iterator<char>(file), {});
-                        file.close();
-
-                        if (!buffer.empty())
+                        prepared_graph preview = previews[i].get();
+                        if (!preview.encoded.empty())
                         {
-                            // Base64 encode the image data
-                            std::string encoded = base64_encode(buffer.data(), buffer.size());
-
-                            // Determine MIME type based on extension
-                            std::string mime_type = "image/png";
-                            if (graph_file.find(".svg") != std::string::npos)
-                            {
-                                mime_type = "image/svg+xml";
-                            }
-                            else if (graph_file.find(".pdf") != std::string::npos)
-                            {
-                                mime_type = "application/pdf";
-                            }
-
-                            // Create display data
-                            nl::json display_data;
-                            display_data[mime_type] = encoded;
-
-                            // Add metadata for PNG images
-                            nl::json metadata = nl::json::object();
-                            if (mime_type == "image/png")
-                            {
-                                metadata["image/png"] = {
-                                    {"width", 600},
-                                    {"height", 400}
-                                };
-                            }
-
-                            publish_execution_result(
-                                execution_counter,
-                                std::move(display_data),
-                                std::move(metadata)
+                            std::string display_id = "xstata-" + std::to_string(getpid()) + "-" +
+                                                     std::to_string(execution_counter) + "-" + std::to_string(i);
+                            nl::json preview_data;
+                            preview_data[preview.mime_type] = std::move(preview.encoded);
+
+                            stopwatch stage_timer;
+                            trace_scope publish_trace("iopub.publish", "iopub");
+                            display_data(
+                                std::move(preview_data),
+                                std::move(preview.metadata),
+                                nl::json{{"display_id", display_id}}
                             );
+                            timing.publish_ms += stage_timer.elapsed_ms();
+                            deferred_graphs.emplace_back(display_id, std::move(graphs[i]));
+                            continue;
                         }
+                    }
 
-                        // Clean up temp file
-                        unlink(graph_file.c_str());
+                    prepared_graph graph = graphs[i].get();
+                    timing.graph_read_ms += graph.read_ms;
+                    timing.optimize_ms += graph.optimize_ms;
+                    timing.encode_ms += graph.encode_ms;
+                    timing.graph_bytes += graph.file_bytes;
+                    timing.optimized_bytes += graph.sent_bytes;
+                    timing.encoded_bytes += graph.encoded.size();
+                    if (graph.encoded.empty())
+                    {
+                        continue;
                     }
+
+                    nl::json display_data;
+                    display_data[graph.mime_type] = std::move(graph.encoded);
+
+                    stopwatch stage_timer;
+                    trace_scope publish_trace("iopub.publish", "iopub");
+                    publish_execution_result(
+                        execution_counter,
+                        std::move(display_data),
+                        std::move(graph.metadata)
+                    );
+                    timing.publish_ms += stage_timer.elapsed_ms();
+                    m_metrics->record_graph(graph.sent_bytes);
                 }
             }
+
+            // Per-stage latency breakdown for this cell
+            timing.total_ms = total_timer.elapsed_ms();
+            m_metrics->record_execution(
+                timing.total_ms,
+                timing.parse_ms,
+                timing.bytes_read,
+                exec_result.is_error ? exec_result.error_code : 0
+            );
+            recorded = true;
+            result["xeus_stata"]["timing"] = timing_to_json(timing);
+            if (resources.valid)
+            {
+                result["xeus_stata"]["resources"] = cell_resources_to_json(resources);
+            }
+            if (!prefetched.empty())
+            {
+                result["xeus_stata"]["prefetch"] = prefetched;
+            }
+            if (exec_result.state.valid)
+            {
+                result["xeus_stata"]["state"] = state_to_json(exec_result.state);
+            }
+
+            if (m_show_timing && !config.silent)
+            {
+                publish_stream("stdout", format_timing(timing));
+            }
+        }
+        catch (const stata_timeout_error& e)
+        {
+            // Interrupted at XEUS_STATA_EXECUTE_TIMEOUT_MS; the session is
+            // in sync again
+            result["status"] = "error";
+            result["ename"] = "TimeoutError";
+            result["evalue"] = e.what();
+            result["traceback"] = nl::json::array({e.what()});
+
+            if (!config.silent)
+            {
+                publish_stream("stderr", std::string("Error: ") + e.what());
+            }
+        }
+        catch (const stata_process_error& e)
+        {
+            // The Stata process died under this cell
+            result["status"] = "error";
+            result["ename"] = "StataProcessExited";
+            result["evalue"] = e.what();
+            result["traceback"] = nl::json::array({e.what()});
+
+            if (!config.silent)
+            {
+                publish_stream("stderr", std::string("Error: ") + e.what());
+            }
         }
         catch (const std::exception& e)
         {
@@ -208,13 +768,342 @@ namespace xeus_stata
             }
         }
 
+        // A cell that threw never closed its resource window, nor was it
+        // counted; it failed without an r() code
+        m_resource_warnings = false;
+        m_resources->end_cell();
+        if (!recorded)
+        {
+            m_metrics->record_execution(total_timer.elapsed_ms(), 0, 0, -1);
+        }
+
         cb(std::move(result));
+
+        // The reply is out; swap the full-resolution graphs in for their
+        // previews as they become ready. Publishing stays on this thread.
+        for (auto& deferred : deferred_graphs)
+        {
+            try
+            {
+                prepared_graph graph = deferred.second.get();
+                if (graph.encoded.empty())
+                {
+                    continue;
+                }
+
+                nl::json graph_data;
+                graph_data[graph.mime_type] = std::move(graph.encoded);
+
+                trace_scope publish_trace("iopub.update_display", "iopub");
+                update_display_data(
+                    std::move(graph_data),
+                    std::move(graph.metadata),
+                    nl::json{{"display_id", deferred.first}}
+                );
+                m_metrics->record_graph(graph.sent_bytes);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Failed to publish graph " << deferred.first << ": " << e.what() << std::endl;
+            }
+        }
+    }
+
+    void interpreter::publish_resources()
+    {
+        if (!m_resources)
+        {
+            return;
+        }
+
+        uint64_t samples = m_resources->sample_count();
+        if (samples != m_resources_sent && !m_resource_comms.empty())
+        {
+            nl::json latest = m_resources->latest();
+            for (auto& comm : m_resource_comms)
+            {
+                comm.send(nl::json::object(), latest, xeus::buffer_sequence());
+            }
+        }
+        m_resources_sent = samples;
+
+        uint64_t rss = 0;
+        if (m_resources->take_rss_warning(rss) && m_resource_warnings)
+        {
+            publish_stream("stderr", "Warning: Stata is using " + format_byte_size(rss) + " of memory, close to the " +
+                                     format_byte_size(m_resources->rss_limit()) + " limit (XEUS_STATA_RSS_LIMIT)\n");
+        }
+    }
+
+    nl::json interpreter::execute_magic(
+        const magic_command& magic,
+        int execution_counter,
+        const xeus::execute_request_config& config)
+    {
+        nl::json result;
+
+        try
+        {
+            std::string output;
+
+            if (magic.name == "checkpoint")
+            {
+                const std::string usage =
+                    "Usage: %checkpoint save <name> | %checkpoint restore <name> | %checkpoint list";
+                std::string action = magic.args.empty() ? "" : magic.args[0];
+
+                if ((action == "save" || action == "restore") && magic.args.size() == 2)
+                {
+                    output = action == "save"
+                        ? m_checkpoints->save(magic.args[1])
+                        : m_checkpoints->restore(magic.args[1]);
+                }
+                else if (action == "list")
+                {
+                    auto names = m_checkpoints->list();
+                    output = names.empty() ? "No checkpoints in " + m_checkpoints->root()
+                                           : "Checkpoints in " + m_checkpoints->root() + ":";
+                    for (const auto& name : names)
+                    {
+                        output += "\n  " + name;
+                    }
+                }
+                else
+                {
+                    throw std::runtime_error(usage);
+                }
+            }
+            else if (magic.name == "timing")
+            {
+                std::string mode = magic.args.empty() ? "" : magic.args[0];
+                if (mode == "on" || mode == "off")
+                {
+                    m_show_timing = (mode == "on");
+                    output = "Per-cell timing " + mode;
+                }
+                else
+                {
+                    throw std::runtime_error("Usage: %timing on | %timing off");
+                }
+            }
+            else if (magic.name == "timeit" && magic.is_cell_magic)
+            {
+                timeit_result timed = run_timeit(*m_session, magic.body, parse_timeit_args(magic.args));
+                if (!config.silent)
+                {
+                    display_data(
+                        nl::json{{"text/plain", format_timeit_text(timed)}, {"text/html", format_timeit_html(timed)}},
+                        nl::json::object(),
+                        nl::json::object()
+                    );
+                }
+                result["xeus_stata"]["timeit"] = timeit_to_json(timed);
+            }
+            else if (magic.name == "profile" && magic.is_cell_magic)
+            {
+                return execute_profile(magic.body, execution_counter, config);
+            }
+            else if (magic.name == "parallel" && magic.is_cell_magic)
+            {
+                return execute_parallel(magic, execution_counter, config);
+            }
+            else
+            {
+                throw std::runtime_error("Unknown magic: %" + magic.name);
+            }
+
+            if (!config.silent && !output.empty())
+            {
+                publish_stream("stdout", output);
+            }
+
+            result["status"] = "ok";
+            result["execution_count"] = execution_counter;
+            result["payload"] = nl::json::array();
+            result["user_expressions"] = nl::json::object();
+        }
+        catch (const std::exception& e)
+        {
+            result["status"] = "error";
+            result["ename"] = "MagicError";
+            result["evalue"] = e.what();
+            result["traceback"] = nl::json::array({e.what()});
+
+            if (!config.silent)
+            {
+                publish_stream("stderr", std::string("Error: ") + e.what());
+            }
+        }
+
+        return result;
+    }
+
+    nl::json interpreter::execute_profile(
+        const std::string& code,
+        int execution_counter,
+        const xeus::execute_request_config& config)
+    {
+        auto checked = [this](const std::string& command) {
+            auto result = m_session->execute(command);
+            if (result.is_error)
+            {
+                throw std::runtime_error(command + " failed with r(" + std::to_string(result.error_code) + ")");
+            }
+            return result;
+        };
+
+        checked("profiler clear");
+        checked("profiler on");
+        execution_result executed;
+        try
+        {
+            executed = m_session->execute(code);
+        }
+        catch (...)
+        {
+            m_session->execute("profiler off");
+            throw;
+        }
+        checked("profiler off");
+        // Graphs are prepared as for a plain cell while the report is read
+        std::vector<std::future<prepared_graph>> graphs;
+        for (size_t i = 0; i < executed.graph_files.size(); ++i)
+        {
+            const std::string& graph_file = executed.graph_files[i];
+            auto data = std::async(std::launch::async, read_graph_file, graph_file).share();
+            graphs.push_back(std::async(std::launch::async, prepare_graph, graph_file, data,
+                                        m_optimize_graphs, m_graph_budget,
+                                        kept_graph_path(execution_counter, i)));
+        }
+        profile_report report = parse_profiler_report(checked("profiler report").output);
+
+        nl::json result;
+        if (!config.silent)
+        {
+            if (!executed.output.empty())
+            {
+                publish_stream("stdout", executed.output);
+            }
+            if (executed.is_error && !executed.error_message.empty())
+            {
+                publish_stream("stderr", executed.error_message);
+            }
+        }
+        for (auto& pending : graphs)
+        {
+            prepared_graph graph = pending.get();
+            if (config.silent || graph.encoded.empty())
+            {
+                continue;
+            }
+            nl::json graph_data;
+            graph_data[graph.mime_type] = std::move(graph.encoded);
+            publish_execution_result(execution_counter, std::move(graph_data), std::move(graph.metadata));
+            m_metrics->record_graph(graph.sent_bytes);
+        }
+        if (!config.silent)
+        {
+            display_data(
+                nl::json{
+                    {"text/plain", format_profile_text(report)},
+                    {"text/html", format_profile_html(report)},
+                    {"application/json", profile_to_json(report)}
+                },
+                nl::json::object(),
+                nl::json::object()
+            );
+        }
+
+        if (executed.is_error)
+        {
+            result["status"] = "error";
+            result["ename"] = "StataError";
+            result["evalue"] = "r(" + std::to_string(executed.error_code) + ")";
+            result["traceback"] = nl::json::array({executed.error_message,
+                                                   "Stata error code: r(" + std::to_string(executed.error_code) + ")"});
+        }
+        else
+        {
+            result["status"] = "ok";
+            result["execution_count"] = execution_counter;
+            result["payload"] = nl::json::array();
+            result["user_expressions"] = nl::json::object();
+        }
+        result["xeus_stata"]["profile"] = profile_to_json(report);
+        return result;
+    }
+
+    nl::json interpreter::execute_parallel(
+        const magic_command& magic,
+        int execution_counter,
+        const xeus::execute_request_config& config)
+    {
+        parallel_job job = parse_parallel_cell(magic.args, magic.body);
+
+        // Progress is one display, updated in place while the workers run
+        std::string display_id = "xstata-parallel-" + std::to_string(getpid()) + "-" +
+                                 std::to_string(execution_counter);
+        bool shown = false;
+        auto progress = [&](const std::string& text) {
+            if (config.silent)
+            {
+                return;
+            }
+            nl::json data = {{"text/plain", text}};
+            nl::json transient = {{"display_id", display_id}};
+            if (shown)
+            {
+                update_display_data(std::move(data), nl::json::object(), std::move(transient));
+            }
+            else
+            {
+                display_data(std::move(data), nl::json::object(), std::move(transient));
+                shown = true;
+            }
+        };
+
+        stopwatch timer;
+        parallel_result outcome = m_parallel->run(*m_session, job, progress);
+
+        if (!config.silent && !outcome.output.empty())
+        {
+            publish_stream("stdout", outcome.output);
+        }
+
+        nl::json result;
+        if (outcome.is_error)
+        {
+            result["status"] = "error";
+            result["ename"] = "StataError";
+            result["evalue"] = "r(" + std::to_string(outcome.error_code) + ")";
+            result["traceback"] = nl::json::array({outcome.error_message});
+            if (!config.silent)
+            {
+                publish_stream("stderr", outcome.error_message);
+            }
+        }
+        else
+        {
+            result["status"] = "ok";
+            result["execution_count"] = execution_counter;
+            result["payload"] = nl::json::array();
+            result["user_expressions"] = nl::json::object();
+        }
+        result["xeus_stata"]["parallel"] = {
+            {"workers", job.workers},
+            {"tasks", outcome.tasks},
+            {"merged", outcome.merged},
+            {"total_ms", timer.elapsed_ms()}
+        };
+        return result;
     }
 
     nl::json interpreter::complete_request_impl(
         const std::string& code,
         int cursor_pos)
     {
+        trace_scope trace("shell.complete_request", "shell");
+        stopwatch timer;
         nl::json result;
 
         if (!m_completer)
@@ -237,6 +1126,7 @@ namespace xeus_stata
             result["cursor_start"] = start_pos;
             result["cursor_end"] = cursor_pos;
             result["metadata"] = nl::json::object();
+            m_metrics->record_completion(timer.elapsed_ms());
         }
         catch (const std::exception& e)
         {
@@ -255,6 +1145,8 @@ namespace xeus_stata
         int cursor_pos,
         int detail_level)
     {
+        trace_scope trace("shell.inspect_request", "shell");
+        stopwatch timer;
         nl::json result;
 
         if (!m_inspector)
@@ -269,6 +1161,7 @@ namespace xeus_stata
         try
         {
             std::string help_text = m_inspector->get_inspection(code, cursor_pos, detail_level);
+            m_metrics->record_inspection(timer.elapsed_ms());
 
             if (!help_text.empty())
             {
@@ -301,41 +1194,26 @@ namespace xeus_stata
 
     nl::json interpreter::is_complete_request_impl(const std::string& code)
     {
+        trace_scope trace("shell.is_complete_request", "shell");
         nl::json result;
 
-        // Simple heuristic: check for unclosed braces or continuation markers
-        int brace_count = 0;
-        bool has_continuation = false;
-
-        for (size_t i = 0; i < code.length(); ++i)
+        // Braces, comments and continuations are only counted outside
+        // strings and comments; the tokens stay cached for the cell
+        int indent_level = 0;
+        switch (cell_completeness(*lex_cell(code), indent_level))
         {
-            if (code[i] == '{')
-                ++brace_count;
-            else if (code[i] == '}')
-                --brace_count;
-
-            // Check for line continuation marker (///)
-            if (i + 2 < code.length() &&
-                code[i] == '/' && code[i+1] == '/' && code[i+2] == '/')
-            {
-                has_continuation = true;
-            }
-        }
-
-        if (brace_count > 0 || has_continuation)
-        {
-            result["status"] = "incomplete";
-            result["indent"] = "    ";
-        }
-        else if (brace_count < 0)
-        {
-            result["status"] = "invalid";
-            result["indent"] = "";
-        }
-        else
-        {
-            result["status"] = "complete";
-            result["indent"] = "";
+            case completeness::incomplete:
+                result["status"] = "incomplete";
+                result["indent"] = std::string(4 * static_cast<size_t>(std::max(indent_level, 1)), ' ');
+                break;
+            case completeness::invalid:
+                result["status"] = "invalid";
+                result["indent"] = "";
+                break;
+            case completeness::complete:
+                result["status"] = "complete";
+                result["indent"] = "";
+                break;
         }
 
         return result;
@@ -343,6 +1221,7 @@ namespace xeus_stata
 
     nl::json interpreter::kernel_info_request_impl()
     {
+        trace_scope trace("shell.kernel_info_request", "shell");
         nl::json info;
 
         info["protocol_version"] = "5.3";
@@ -363,7 +1242,13 @@ namespace xeus_stata
         banner << "A Jupyter kernel for Stata\n";
         if (m_session)
         {
-            banner << "Stata version: " << m_session->get_version();
+            banner << "Stata version: " << m_session->get_version() << "\n";
+            banner << "Backend: " << m_session->backend_name();
+            std::string resources = m_session->resource_summary();
+            if (!resources.empty())
+            {
+                banner << "\nResources: " << resources;
+            }
         }
         info["banner"] = banner.str();
 
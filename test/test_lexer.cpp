@@ -0,0 +1,196 @@
+#include "xeus-stata/stata_lexer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        completeness verdict(const std::string& code, int& indent_level)
+        {
+            return cell_completeness(*lex_cell(code), indent_level);
+        }
+
+        completeness verdict(const std::string& code)
+        {
+            int indent_level = 0;
+            return verdict(code, indent_level);
+        }
+
+        std::vector<token_kind> kinds(const std::string& code)
+        {
+            std::vector<token_kind> result;
+            stata_lexer lexer(code);
+            token tok;
+            while (lexer.next(tok))
+            {
+                result.push_back(tok.kind);
+            }
+            return result;
+        }
+    }
+
+    TEST(stata_lexer, tells_the_token_kinds_apart)
+    {
+        std::string code = "display \"a\" `\"b\"' `x' $g ${h} 1.5 (a)+\n";
+        EXPECT_EQ(kinds(code), (std::vector<token_kind>{
+            token_kind::word, token_kind::string, token_kind::compound_string,
+            token_kind::local_macro, token_kind::global_macro, token_kind::global_macro,
+            token_kind::number, token_kind::open_paren, token_kind::word, token_kind::close_paren,
+            token_kind::op, token_kind::end_of_statement}));
+    }
+
+    TEST(stata_lexer, tokens_point_into_the_source)
+    {
+        std::string code = "regress `\"a`\"b\"'c\"' x";
+        stata_lexer lexer(code);
+        token tok;
+        ASSERT_TRUE(lexer.next(tok));
+        ASSERT_TRUE(lexer.next(tok));
+        EXPECT_EQ(tok.kind, token_kind::compound_string);
+        EXPECT_FALSE(tok.unterminated);
+        EXPECT_EQ(code.substr(tok.offset, tok.length), "`\"a`\"b\"'c\"'");
+    }
+
+    TEST(stata_lexer, marks_tokens_cut_off_by_the_line_end)
+    {
+        for (const std::string code : {"display \"abc\n", "display `\"abc\n", "display `x\n", "display ${x\n"})
+        {
+            stata_lexer lexer(code);
+            token tok;
+            ASSERT_TRUE(lexer.next(tok));
+            ASSERT_TRUE(lexer.next(tok)) << code;
+            EXPECT_TRUE(tok.unterminated) << code;
+            ASSERT_TRUE(lexer.next(tok));
+            EXPECT_EQ(tok.kind, token_kind::end_of_statement) << code;
+        }
+    }
+
+    TEST(stata_lexer, keeps_slashes_in_urls)
+    {
+        EXPECT_EQ(kinds("use http://example.org/a"), (std::vector<token_kind>{
+            token_kind::word, token_kind::word, token_kind::op, token_kind::op, token_kind::op,
+            token_kind::word, token_kind::op, token_kind::word, token_kind::op, token_kind::word}));
+        EXPECT_EQ(kinds("use a // b").back(), token_kind::comment);
+    }
+
+    TEST(cell_completeness, ignores_braces_in_strings_and_comments)
+    {
+        EXPECT_EQ(verdict("display \"{\""), completeness::complete);
+        EXPECT_EQ(verdict("display `\"a { \"b\" }\"'"), completeness::complete);
+        EXPECT_EQ(verdict("display `\"a {\"'"), completeness::complete);
+        EXPECT_EQ(verdict("/* { */ display 1"), completeness::complete);
+        EXPECT_EQ(verdict("display 1 // {"), completeness::complete);
+        EXPECT_EQ(verdict("* {\ndisplay 1"), completeness::complete);
+        EXPECT_EQ(verdict("display 2 * 3 {"), completeness::incomplete);
+    }
+
+    TEST(cell_completeness, waits_for_open_braces_and_reports_the_depth)
+    {
+        int indent_level = 0;
+        EXPECT_EQ(verdict("forvalues i = 1/3 {", indent_level), completeness::incomplete);
+        EXPECT_EQ(indent_level, 1);
+        EXPECT_EQ(verdict("forvalues i = 1/3 {\n    if `i' > 1 {\n", indent_level), completeness::incomplete);
+        EXPECT_EQ(indent_level, 2);
+        EXPECT_EQ(verdict("forvalues i = 1/3 {\n    if `i' > 1 {\n    }\n}", indent_level), completeness::complete);
+        EXPECT_EQ(indent_level, 0);
+    }
+
+    TEST(cell_completeness, rejects_a_stray_closing_brace)
+    {
+        int indent_level = 0;
+        EXPECT_EQ(verdict("}", indent_level), completeness::invalid);
+        EXPECT_EQ(indent_level, 0);
+        // Balanced in total, but closed before it was opened
+        EXPECT_EQ(verdict("display 1\n}\n{"), completeness::invalid);
+    }
+
+    TEST(cell_completeness, waits_for_block_comments_which_nest)
+    {
+        EXPECT_EQ(verdict("/* open"), completeness::incomplete);
+        EXPECT_EQ(verdict("/* a /* b */ still open"), completeness::incomplete);
+        EXPECT_EQ(verdict("/* a /* b */ c */ display 1"), completeness::complete);
+    }
+
+    TEST(cell_completeness, follows_line_continuations)
+    {
+        EXPECT_EQ(verdict("regress y x ///"), completeness::incomplete);
+        EXPECT_EQ(verdict("regress y x /// more\n"), completeness::incomplete);
+        EXPECT_EQ(verdict("regress y x ///\n    z"), completeness::complete);
+        EXPECT_EQ(verdict("regress y x /// {\n    z"), completeness::complete);
+    }
+
+    TEST(cell_completeness, star_comments_only_start_a_statement)
+    {
+        // A continued * comment swallows the brace on its next line
+        EXPECT_EQ(verdict("* note ///\n  more {\ndisplay 1"), completeness::complete);
+        EXPECT_EQ(verdict("  * {"), completeness::complete);
+        EXPECT_EQ(verdict("quietly {\n* }"), completeness::incomplete);
+    }
+
+    TEST(cell_completeness, waits_for_the_semicolon_under_delimit)
+    {
+        EXPECT_EQ(verdict("#delimit ;\ndisplay 1"), completeness::incomplete);
+        EXPECT_EQ(verdict("#delimit ;\ndisplay\n 1;"), completeness::complete);
+        EXPECT_EQ(verdict("#d ;\ndisplay 1;\n// done"), completeness::complete);
+        EXPECT_EQ(verdict("#delimit ;\ndisplay 1;\n#delimit cr\ndisplay 2"), completeness::complete);
+        EXPECT_EQ(verdict("#delimit ;\n* a comment;\ndisplay 1"), completeness::incomplete);
+    }
+
+    TEST(cell_completeness, waits_for_the_end_of_a_mata_block)
+    {
+        int indent_level = 0;
+        EXPECT_EQ(verdict("mata"), completeness::incomplete);
+        EXPECT_EQ(verdict("mata:\nx = 1"), completeness::incomplete);
+        EXPECT_EQ(verdict("mata:\nvoid f()\n{\n", indent_level), completeness::incomplete);
+        EXPECT_EQ(indent_level, 1);
+        EXPECT_EQ(verdict("mata:\nvoid f()\n{\n    s = \"}\" // }\n}\nend"), completeness::complete);
+        EXPECT_EQ(verdict("mata // block\nx = 1\n  end  \ndisplay 1"), completeness::complete);
+        // mata: followed by code is one statement
+        EXPECT_EQ(verdict("mata: x = 1"), completeness::complete);
+    }
+
+    TEST(cell_completeness, a_stray_brace_in_mata_is_invalid)
+    {
+        EXPECT_EQ(verdict("mata:\n}\nend"), completeness::invalid);
+    }
+
+    TEST(lexed_cell, finds_commands_behind_prefixes)
+    {
+        auto cell = lex_cell("quietly capture regress y x\nby foreign: summarize\n"
+                             "bysort a (b): gen x = 1\nif 1 { display 2\n}");
+        EXPECT_EQ(cell->commands(), (std::vector<std::string>{"regress", "summarize", "gen", "if", "display"}));
+        EXPECT_TRUE(cell->is_command_position(0));
+        EXPECT_TRUE(cell->is_command_position(8));
+        EXPECT_FALSE(cell->is_command_position(24));
+    }
+
+    TEST(lex_cell, resuming_from_a_prefix_gives_the_same_tokens)
+    {
+        std::string start = "display 1\nforvalues i = 1/2 {\n";
+        std::string code = start + "    display `i'\n}\n";
+        auto first = lex_cell(start);
+        EXPECT_EQ(first->resume_offset, 10u);
+        auto cell = lex_cell(code);
+
+        stata_lexer lexer(code);
+        std::vector<token> fresh;
+        token tok;
+        while (lexer.next(tok))
+        {
+            fresh.push_back(tok);
+        }
+        ASSERT_EQ(cell->tokens.size(), fresh.size());
+        for (size_t i = 0; i < fresh.size(); ++i)
+        {
+            EXPECT_EQ(cell->tokens[i].kind, fresh[i].kind) << i;
+            EXPECT_EQ(cell->tokens[i].offset, fresh[i].offset) << i;
+            EXPECT_EQ(cell->tokens[i].length, fresh[i].length) << i;
+        }
+        EXPECT_EQ(lex_cell(code), cell);
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,109 @@
+#include "xeus-stata/stata_session.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // A session on the library backend, running the mock Stata library
+        // built next to the tests
+        class library_backend_test : public ::testing::Test
+        {
+        protected:
+            void SetUp() override
+            {
+                setenv("XEUS_STATA_BACKEND", "library", 1);
+                setenv("XEUS_STATA_LIBRARY", XEUS_STATA_MOCK_LIBRARY, 1);
+                m_session = std::make_unique<stata_session>();
+                unsetenv("XEUS_STATA_BACKEND");
+                unsetenv("XEUS_STATA_LIBRARY");
+                m_session->execute("clear");
+            }
+
+            void TearDown() override
+            {
+                m_session.reset();
+            }
+
+            std::unique_ptr<stata_session> m_session;
+        };
+    }
+
+    TEST_F(library_backend_test, runs_a_cell_and_reads_the_trailer)
+    {
+        EXPECT_EQ(m_session->backend_name(), "library");
+        execution_result result = m_session->execute("set obs 5\ngenerate x = _n\ndisplay _N");
+        EXPECT_FALSE(result.is_error);
+        EXPECT_EQ(result.error_code, 0);
+        EXPECT_EQ(result.output, "Number of observations (_N) was 0, now 5.\n5");
+
+        ASSERT_TRUE(result.state.valid);
+        EXPECT_EQ(result.state.nobs, 5);
+        EXPECT_EQ(result.state.nvars, 1);
+        EXPECT_TRUE(result.state.data_changed);
+        EXPECT_EQ(result.state.frame, "default");
+        char cwd[4096];
+        ASSERT_NE(getcwd(cwd, sizeof(cwd)), nullptr);
+        EXPECT_EQ(result.state.pwd, cwd);
+    }
+
+    TEST_F(library_backend_test, reports_the_exact_return_code)
+    {
+        execution_result result = m_session->execute("display 1\nreplace nosuch = 1\ndisplay 2");
+        EXPECT_TRUE(result.is_error);
+        EXPECT_EQ(result.error_code, 111);
+        EXPECT_NE(result.error_message.find("variable nosuch not found"), std::string::npos) << result.error_message;
+        EXPECT_TRUE(result.state.valid);
+        // The cell stopped at the error
+        EXPECT_EQ(result.output.find('2'), std::string::npos) << result.output;
+
+        execution_result unknown = m_session->execute("frobnicate");
+        EXPECT_EQ(unknown.error_code, 199);
+    }
+
+    TEST_F(library_backend_test, printed_return_codes_are_not_errors)
+    {
+        execution_result result = m_session->execute("display \"r(198);\"");
+        EXPECT_FALSE(result.is_error);
+        EXPECT_EQ(result.error_code, 0);
+        EXPECT_EQ(result.output, "r(198);");
+        EXPECT_TRUE(result.state.valid);
+    }
+
+    TEST_F(library_backend_test, evaluates_user_expressions)
+    {
+        execution_result result = m_session->execute("set obs 3",
+            {{"n", "_N"}, {"bad", "nosuch"}, {"s", "\"a|b\""}, {"multi", "1\n2"}});
+        EXPECT_EQ(result.output, "Number of observations (_N) was 0, now 3.");
+        ASSERT_EQ(result.expressions.size(), 4u);
+        EXPECT_EQ(result.expressions[0].name, "n");
+        EXPECT_EQ(result.expressions[0].rc, 0);
+        EXPECT_EQ(result.expressions[0].value, "3");
+        EXPECT_EQ(result.expressions[1].rc, 111);
+        EXPECT_EQ(result.expressions[1].value, "");
+        EXPECT_EQ(result.expressions[2].value, "a|b");
+        EXPECT_EQ(result.expressions[3].rc, 198);
+        EXPECT_TRUE(result.state.valid);
+    }
+
+    TEST_F(library_backend_test, expressions_leave_the_cell_locals_alone)
+    {
+        m_session->execute("local xstata_ux kept");
+        execution_result result = m_session->execute("display `\"`xstata_ux'\"'", {{"n", "_N"}});
+        EXPECT_EQ(result.output, "kept");
+        ASSERT_EQ(result.expressions.size(), 1u);
+        EXPECT_EQ(result.expressions[0].value, "0");
+
+        // The kernel's own locals are gone after the cell
+        execution_result after = m_session->execute("display \"[`__xstata_ux'`__xstata_ls']\"");
+        EXPECT_EQ(after.output, "[]");
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,121 @@
+#include "xeus-stata/parallel.hpp"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    TEST(parse_parallel_cell, splits_setup_header_and_body)
+    {
+        parallel_job job = parse_parallel_cell({"4"},
+            "set seed 1\n"
+            "forvalues i = 1/100 {\n"
+            "    if `i' > 1 {\n"
+            "        display `i'\n"
+            "    }\n"
+            "}\n");
+        EXPECT_EQ(job.workers, 4u);
+        EXPECT_TRUE(job.by.empty());
+        EXPECT_FALSE(job.append);
+        EXPECT_EQ(job.setup, "set seed 1\n");
+        EXPECT_EQ(job.loop_header, "forvalues i = 1/100");
+        EXPECT_EQ(job.loop_var, "i");
+        EXPECT_EQ(job.body, "\n    if `i' > 1 {\n        display `i'\n    }\n");
+    }
+
+    TEST(parse_parallel_cell, accepts_foreach_and_abbreviations)
+    {
+        parallel_job each = parse_parallel_cell({"2"}, "foreach v in price mpg {\n summarize `v'\n}");
+        EXPECT_EQ(each.loop_header, "foreach v in price mpg");
+        EXPECT_EQ(each.loop_var, "v");
+        EXPECT_TRUE(each.setup.empty());
+
+        parallel_job forv = parse_parallel_cell({"2"}, "forv j=1/3 {\n display `j'\n}");
+        EXPECT_EQ(forv.loop_var, "j");
+    }
+
+    TEST(parse_parallel_cell, reads_the_options)
+    {
+        EXPECT_TRUE(parse_parallel_cell({"2", "append"}, "forv i=1/2 {\n}").append);
+
+        parallel_job by = parse_parallel_cell({"3", "by(", "foreign", ")"}, "regress price mpg");
+        EXPECT_EQ(by.by, "foreign");
+        EXPECT_EQ(by.body, "regress price mpg");
+        EXPECT_TRUE(by.loop_header.empty());
+    }
+
+    TEST(parse_parallel_cell, rejects_bad_worker_counts_and_options)
+    {
+        const std::string loop = "forv i=1/2 {\n}";
+        EXPECT_THROW(parse_parallel_cell({}, loop), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"0"}, loop), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"65"}, loop), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"4x"}, loop), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"2", "over(x)"}, loop), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"2", "by(1x)"}, loop), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"2", "append", "by(x)"}, "summarize"), std::runtime_error);
+    }
+
+    TEST(parse_parallel_cell, needs_one_closed_top_level_loop)
+    {
+        EXPECT_THROW(parse_parallel_cell({"2"}, "   \n"), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"2"}, "summarize price"), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"2"}, "if 1 {\n forv i=1/2 {\n }\n}"), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"2"}, "forv i=1/2 {\n display 1\n"), std::runtime_error);
+        EXPECT_THROW(parse_parallel_cell({"2"}, "forv i=1/2 {\n}\ndisplay 1"), std::runtime_error);
+        EXPECT_NO_THROW(parse_parallel_cell({"2"}, "forv i=1/2 {\n}\n// done\n"));
+    }
+
+    TEST(session_programs, skips_ado_programs_and_totals)
+    {
+        std::vector<std::string> names = session_programs(
+            ". program dir\n"
+            "  ado      1442  _get_diopts\n"
+            "            309  myprog\n"
+            "            120  helper_2\n"
+            "         ------\n"
+            "           1871\n");
+        EXPECT_EQ(names, (std::vector<std::string>{"myprog", "helper_2"}));
+    }
+
+    TEST(rebuild_programs, turns_listings_back_into_definitions)
+    {
+        std::string programs = rebuild_programs(
+            ". display \"xstata_program:hi\"\n"
+            "xstata_program:hi\n"
+            ". program list hi\n"
+            "\n"
+            "hi, rclass:\n"
+            "  1.   syntax [, n(integer 1)]\n"
+            "  2.   display \"a long li\n"
+            "ne\"\n"
+            "  3.\n"
+            " 10.   return scalar x = `n'\n"
+            "xstata_program:go\n"
+            "\n"
+            "go:\n"
+            "  1.   display 1\r\n"
+            ". quietly set linesize 80\n");
+        EXPECT_EQ(programs,
+                  "capture program drop hi\n"
+                  "program define hi, rclass\n"
+                  "syntax [, n(integer 1)]\n"
+                  "display \"a long line\"\n"
+                  "\n"
+                  "return scalar x = `n'\n"
+                  "end\n"
+                  "capture program drop go\n"
+                  "program define go\n"
+                  "display 1\n"
+                  "end\n");
+    }
+
+    TEST(rebuild_programs, skips_programs_without_a_listing)
+    {
+        EXPECT_EQ(rebuild_programs("xstata_program:gone\nprogram gone not found\nxstata_program:x\n"), "");
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,250 @@
+#include "xeus-stata/stata_parser.hpp"
+
+#include <gtest/gtest.h>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        execution_result make_result(const std::string& output)
+        {
+            execution_result result;
+            result.output = output;
+            result.is_error = false;
+            result.error_code = 0;
+            return result;
+        }
+    }
+
+    TEST(apply_trailer, returns_false_without_a_trailer)
+    {
+        execution_result result = make_result("hello\nworld");
+        EXPECT_FALSE(apply_trailer(result));
+        EXPECT_EQ(result.output, "hello\nworld");
+        EXPECT_FALSE(result.state.valid);
+    }
+
+    TEST(apply_trailer, reads_the_state_and_strips_the_line)
+    {
+        execution_result result = make_result(
+            "output\n"
+            "xstata_trailer|1|0|74|12|1|default|15.250|1900000000000|/home/user/project\n");
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_EQ(result.output, "output");
+        EXPECT_FALSE(result.is_error);
+        EXPECT_TRUE(result.state.valid);
+        EXPECT_EQ(result.state.nobs, 74);
+        EXPECT_EQ(result.state.nvars, 12);
+        EXPECT_TRUE(result.state.data_changed);
+        EXPECT_EQ(result.state.frame, "default");
+        EXPECT_DOUBLE_EQ(result.state.stata_clock, 1900000000000.0);
+        EXPECT_EQ(result.state.pwd, "/home/user/project");
+        EXPECT_DOUBLE_EQ(result.timing.stata_timer_ms, 15.25);
+    }
+
+    TEST(apply_trailer, keeps_a_bar_in_the_working_directory)
+    {
+        execution_result result = make_result("xstata_trailer|1|0|0|0|0|default|0|0|/tmp/a|b");
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_EQ(result.state.pwd, "/tmp/a|b");
+        EXPECT_EQ(result.output, "");
+    }
+
+    TEST(apply_trailer, joins_a_trailer_wrapped_at_the_line_size)
+    {
+        execution_result result = make_result(
+            "output\n"
+            "xstata_trailer|1|0|74|12|0|default|1.5|1900000000000|/home/user/my_pro\r\n"
+            "ject/deep/dire\n"
+            "ctory\n");
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_EQ(result.output, "output");
+        EXPECT_EQ(result.state.pwd, "/home/user/my_project/deep/directory");
+        EXPECT_EQ(result.state.nobs, 74);
+
+        // Wrapped inside the fields, and in the segments of a logged cell
+        execution_result split = make_result("xstata_trailer|1|0|74|1\n2|0|default|0|0|/tmp\n\nafter\n");
+        split.segments = {
+            {"txt", "note\n"},
+            {"res", "xstata_trailer|1|0|74|1\n"},
+            {"res", "2|0|default|0|0|/tmp\n"},
+            {"txt", "\n"}
+        };
+        ASSERT_TRUE(apply_trailer(split));
+        EXPECT_EQ(split.state.nvars, 12);
+        EXPECT_EQ(split.state.pwd, "/tmp");
+        EXPECT_EQ(split.output, "\nafter");
+        EXPECT_EQ(smcl_text(split.segments), "note\n\n");
+    }
+
+    TEST(apply_trailer, ignores_the_echoed_command)
+    {
+        execution_result result = make_result(
+            ". display \"xstata_\" \"trailer|1|\" _rc\n"
+            "xstata_trailer|1|0|1|1|0|default|0|0|/tmp\n");
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_EQ(result.output, ". display \"xstata_\" \"trailer|1|\" _rc");
+        EXPECT_EQ(result.state.nobs, 1);
+    }
+
+    TEST(apply_trailer, zero_return_code_clears_a_guessed_error)
+    {
+        // The cell printed r(111); itself but finished without error
+        execution_result result = make_result("r(111);\nxstata_trailer|1|0|0|0|0|default|0|0|/tmp\n");
+        result.is_error = true;
+        result.error_code = 111;
+        result.error_message = "r(111);";
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_FALSE(result.is_error);
+        EXPECT_EQ(result.error_code, 0);
+        EXPECT_EQ(result.error_message, "");
+    }
+
+    TEST(apply_trailer, nonzero_return_code_sets_the_error)
+    {
+        execution_result result = make_result(
+            "variable foo not found\nxstata_trailer|1|111|0|0|0|default|0|0|/tmp\n");
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_TRUE(result.is_error);
+        EXPECT_EQ(result.error_code, 111);
+        EXPECT_EQ(result.error_message, "variable foo not found");
+    }
+
+    TEST(apply_trailer, error_message_comes_from_error_segments)
+    {
+        execution_result result = make_result("note\nno observations\n");
+        result.segments = {
+            {"txt", "note\n"},
+            {"err", "no observations\n"},
+            {"res", "xstata_trai"},
+            {"res", "ler|1|2000|0|0|0|default|0|0|/tmp\n"}
+        };
+        result.output += "xstata_trailer|1|2000|0|0|0|default|0|0|/tmp\n";
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_EQ(result.error_code, 2000);
+        EXPECT_EQ(result.error_message, "no observations");
+        ASSERT_EQ(result.segments.size(), 2u);
+        EXPECT_EQ(smcl_text(result.segments), "note\nno observations\n");
+    }
+
+    TEST(apply_trailer, break_is_reported_as_an_interrupt)
+    {
+        execution_result result = make_result("xstata_trailer|1|1|0|0|0|default|0|0|/tmp\n");
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_TRUE(result.is_error);
+        EXPECT_EQ(result.error_code, 1);
+        EXPECT_EQ(result.error_message, "Execution interrupted by user");
+    }
+
+    TEST(apply_trailer, unknown_return_code_keeps_the_guessed_status)
+    {
+        execution_result result = make_result("r(198);\nxstata_trailer|1|.|5|2|0|default|0|0|/tmp\n");
+        result.is_error = true;
+        result.error_code = 198;
+        ASSERT_TRUE(apply_trailer(result));
+        EXPECT_TRUE(result.is_error);
+        EXPECT_EQ(result.error_code, 198);
+        EXPECT_TRUE(result.state.valid);
+        EXPECT_EQ(result.state.nobs, 5);
+    }
+
+    TEST(apply_trailer, rejects_other_versions_and_short_lines)
+    {
+        execution_result newer = make_result("xstata_trailer|2|0|0|0|0|default|0|0|/tmp\n");
+        EXPECT_FALSE(apply_trailer(newer));
+        EXPECT_FALSE(newer.state.valid);
+
+        execution_result truncated = make_result("xstata_trailer|1|0|0\n");
+        EXPECT_FALSE(apply_trailer(truncated));
+        EXPECT_FALSE(truncated.state.valid);
+    }
+
+    TEST(apply_expressions, moves_values_out_of_the_output)
+    {
+        expression_list expressions = {{"n", "_N"}, {"mean", "r(mean)"}};
+        execution_result result = make_result("cell output\nxstata_ux|0|0|74\nxstata_ux|1|0|6165.257\n");
+        apply_expressions(result, expressions);
+        EXPECT_EQ(result.output, "cell output");
+        ASSERT_EQ(result.expressions.size(), 2u);
+        EXPECT_EQ(result.expressions[0].name, "n");
+        EXPECT_EQ(result.expressions[0].rc, 0);
+        EXPECT_EQ(result.expressions[0].value, "74");
+        EXPECT_EQ(result.expressions[1].name, "mean");
+        EXPECT_EQ(result.expressions[1].value, "6165.257");
+    }
+
+    TEST(apply_expressions, keeps_the_return_code_of_a_failed_expression)
+    {
+        expression_list expressions = {{"bad", "nosuchvar"}};
+        execution_result result = make_result("xstata_ux|0|111|");
+        apply_expressions(result, expressions);
+        ASSERT_EQ(result.expressions.size(), 1u);
+        EXPECT_EQ(result.expressions[0].rc, 111);
+        EXPECT_EQ(result.expressions[0].value, "");
+    }
+
+    TEST(apply_expressions, joins_values_wrapped_at_the_line_size)
+    {
+        expression_list expressions = {{"text", "\"long\""}};
+        execution_result result = make_result("xstata_ux|0|0|abcdef\nghij\nkl\n");
+        apply_expressions(result, expressions);
+        ASSERT_EQ(result.expressions.size(), 1u);
+        EXPECT_EQ(result.expressions[0].value, "abcdefghijkl");
+    }
+
+    TEST(apply_expressions, a_value_may_contain_bars)
+    {
+        expression_list expressions = {{"s", "\"a|b\""}};
+        execution_result result = make_result("xstata_ux|0|0|a|b\r\n");
+        apply_expressions(result, expressions);
+        ASSERT_EQ(result.expressions.size(), 1u);
+        EXPECT_EQ(result.expressions[0].value, "a|b");
+    }
+
+    TEST(apply_expressions, reports_only_the_expressions_reached_in_order)
+    {
+        // The cell stopped the round trip after the second expression
+        expression_list expressions = {{"a", "1"}, {"b", "2"}, {"c", "3"}};
+        execution_result result = make_result("xstata_ux|1|0|2\nxstata_ux|0|0|1\nxstata_ux|7|0|x\n");
+        apply_expressions(result, expressions);
+        ASSERT_EQ(result.expressions.size(), 2u);
+        EXPECT_EQ(result.expressions[0].name, "a");
+        EXPECT_EQ(result.expressions[1].name, "b");
+    }
+
+    TEST(apply_expressions, ignores_tags_inside_a_line)
+    {
+        expression_list expressions = {{"a", "1"}};
+        execution_result result = make_result(". display \"xstata_ux|0|\"\nxstata_ux|0|0|1");
+        apply_expressions(result, expressions);
+        EXPECT_EQ(result.output, ". display \"xstata_ux|0|\"");
+        ASSERT_EQ(result.expressions.size(), 1u);
+        EXPECT_EQ(result.expressions[0].value, "1");
+    }
+
+    TEST(apply_expressions, leaves_the_output_alone_without_expressions)
+    {
+        execution_result result = make_result("xstata_ux|0|0|1");
+        apply_expressions(result, expression_list());
+        EXPECT_EQ(result.output, "xstata_ux|0|0|1");
+        EXPECT_TRUE(result.expressions.empty());
+    }
+
+    TEST(apply_expressions, strips_the_block_from_the_segments)
+    {
+        expression_list expressions = {{"a", "1"}};
+        execution_result result = make_result("out\nxstata_ux|0|0|1\n");
+        result.segments = {{"txt", "out\n"}, {"res", "xstata_ux|0|0|1\n"}};
+        apply_expressions(result, expressions);
+        ASSERT_EQ(result.segments.size(), 1u);
+        EXPECT_EQ(result.segments[0].text, "out\n");
+    }
+
+    TEST(format_as_raw_html, every_output_carries_all_table_rules)
+    {
+        std::string html = format_as_raw_html("<tr><td>a</td></tr>\n</thead>\n<tbody><tr><td>1</td></tr></tbody>");
+        EXPECT_EQ(html.compare(0, raw_html_styles().size(), raw_html_styles()), 0);
+        EXPECT_NE(raw_html_styles().find(":not(:has(thead))"), std::string::npos);
+    }
+
+} // namespace xeus_stata
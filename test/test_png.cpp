@@ -0,0 +1,341 @@
+#include "xeus-stata/png.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(XEUS_STATA_HAS_ZLIB)
+    #include <zlib.h>
+#endif
+
+namespace xeus_stata
+{
+    namespace
+    {
+        using bytes = std::vector<unsigned char>;
+
+        uint32_t crc32_of(const unsigned char* data, size_t size)
+        {
+            uint32_t crc = 0xffffffffu;
+            for (size_t i = 0; i < size; ++i)
+            {
+                crc ^= data[i];
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+                }
+            }
+            return ~crc;
+        }
+
+        void put_be32(bytes& out, uint32_t value)
+        {
+            for (int shift = 24; shift >= 0; shift -= 8)
+            {
+                out.push_back(static_cast<unsigned char>(value >> shift));
+            }
+        }
+
+        void put_chunk(bytes& out, const std::string& type, const bytes& data)
+        {
+            put_be32(out, static_cast<uint32_t>(data.size()));
+            size_t start = out.size();
+            out.insert(out.end(), type.begin(), type.end());
+            out.insert(out.end(), data.begin(), data.end());
+            put_be32(out, crc32_of(out.data() + start, out.size() - start));
+        }
+
+        // zlib stream of stored (uncompressed) deflate blocks, so building
+        // test images needs no compressor
+        bytes zlib_stored(const bytes& raw)
+        {
+            bytes out = {0x78, 0x01};
+            size_t pos = 0;
+            do
+            {
+                size_t length = std::min<size_t>(raw.size() - pos, 65535);
+                bool last = pos + length == raw.size();
+                out.push_back(last ? 1 : 0);
+                out.push_back(static_cast<unsigned char>(length));
+                out.push_back(static_cast<unsigned char>(length >> 8));
+                out.push_back(static_cast<unsigned char>(~length));
+                out.push_back(static_cast<unsigned char>(~length >> 8));
+                out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + length);
+                pos += length;
+            } while (pos < raw.size());
+
+            uint32_t a = 1;
+            uint32_t b = 0;
+            for (unsigned char c : raw)
+            {
+                a = (a + c) % 65521;
+                b = (b + a) % 65521;
+            }
+            put_be32(out, (b << 16) | a);
+            return out;
+        }
+
+        struct png_spec
+        {
+            uint32_t width = 1;
+            uint32_t height = 1;
+            uint8_t bit_depth = 8;
+            uint8_t color_type = 0;
+            uint8_t interlace = 0;
+        };
+
+        // A PNG with the given scanlines (filter byte first on each row)
+        // and extra chunks between IHDR and IDAT
+        bytes make_png(const png_spec& spec, const bytes& scanlines,
+                       const std::vector<std::pair<std::string, bytes>>& extra = {})
+        {
+            bytes out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            bytes ihdr;
+            put_be32(ihdr, spec.width);
+            put_be32(ihdr, spec.height);
+            ihdr.push_back(spec.bit_depth);
+            ihdr.push_back(spec.color_type);
+            ihdr.push_back(0);
+            ihdr.push_back(0);
+            ihdr.push_back(spec.interlace);
+            put_chunk(out, "IHDR", ihdr);
+            for (const auto& chunk : extra)
+            {
+                put_chunk(out, chunk.first, chunk.second);
+            }
+            put_chunk(out, "IDAT", zlib_stored(scanlines));
+            put_chunk(out, "IEND", {});
+            return out;
+        }
+
+        int paeth(int a, int b, int c)
+        {
+            int p = a + b - c;
+            int pa = std::abs(p - a);
+            int pb = std::abs(p - b);
+            int pc = std::abs(p - c);
+            return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        }
+
+        // Filter 8-bit pixels row by row with one filter type
+        bytes filter_rows(const bytes& pixels, uint32_t width, uint32_t height, unsigned int channels,
+                          unsigned char filter)
+        {
+            size_t stride = static_cast<size_t>(width) * channels;
+            bytes out;
+            for (uint32_t y = 0; y < height; ++y)
+            {
+                out.push_back(filter);
+                const unsigned char* row = &pixels[y * stride];
+                const unsigned char* prev = y > 0 ? &pixels[(y - 1) * stride] : nullptr;
+                for (size_t x = 0; x < stride; ++x)
+                {
+                    int a = x >= channels ? row[x - channels] : 0;
+                    int b = prev ? prev[x] : 0;
+                    int c = (prev && x >= channels) ? prev[x - channels] : 0;
+                    int predictor = filter == 0 ? 0 : filter == 1 ? a : filter == 2 ? b
+                                  : filter == 3 ? (a + b) / 2 : paeth(a, b, c);
+                    out.push_back(static_cast<unsigned char>(row[x] - predictor));
+                }
+            }
+            return out;
+        }
+
+        std::vector<std::string> chunk_types(const bytes& png)
+        {
+            std::vector<std::string> types;
+            for (size_t pos = 8; pos + 12 <= png.size();)
+            {
+                uint32_t length = (static_cast<uint32_t>(png[pos]) << 24) | (png[pos + 1] << 16) |
+                                  (png[pos + 2] << 8) | png[pos + 3];
+                types.emplace_back(reinterpret_cast<const char*>(&png[pos + 4]), 4);
+                pos += length + 12;
+            }
+            return types;
+        }
+
+        // 4x2 gray image whose pixels exercise every filter predictor
+        const bytes GRAY_4X2 = {10, 200, 30, 250, 60, 5, 90, 120};
+    }
+
+    TEST(png, reads_the_header)
+    {
+        png_spec spec;
+        spec.width = 4;
+        spec.height = 2;
+        bytes png = make_png(spec, filter_rows(GRAY_4X2, 4, 2, 1, 0));
+        png_info info;
+        ASSERT_TRUE(read_png_info(png.data(), png.size(), info));
+        EXPECT_EQ(info.width, 4u);
+        EXPECT_EQ(info.height, 2u);
+        EXPECT_EQ(info.bit_depth, 8);
+        EXPECT_EQ(info.color_type, 0);
+        EXPECT_EQ(info.interlace, 0);
+    }
+
+    TEST(png, rejects_data_that_is_not_a_png)
+    {
+        bytes text(64, 'x');
+        png_info info;
+        EXPECT_FALSE(read_png_info(text.data(), text.size(), info));
+
+        png_optimize_result result = optimize_png(text, png_budget{1, 1});
+        EXPECT_EQ(result.data, text);
+        EXPECT_FALSE(result.resampled);
+    }
+
+    TEST(png, strips_ancillary_chunks_but_keeps_rendering_ones)
+    {
+        bytes png = make_png(png_spec(), {0, 128}, {
+            {"tEXt", {'a', 0, 'b'}},
+            {"gAMA", {0, 0, 0xb1, 0x8f}},
+            {"pHYs", bytes(9, 0)},
+            {"tRNS", {0, 0}}
+        });
+        bytes stripped = strip_png_ancillary(png);
+        EXPECT_LT(stripped.size(), png.size());
+        EXPECT_EQ(chunk_types(stripped), (std::vector<std::string>{"IHDR", "gAMA", "tRNS", "IDAT", "IEND"}));
+    }
+
+    TEST(png, leaves_malformed_chunk_lists_alone)
+    {
+        bytes png = make_png(png_spec(), {0, 128}, {{"tEXt", {'a', 0, 'b'}}});
+
+        // A chunk length running past the end of the data
+        bytes overrun = png;
+        overrun[33] = 0x7f;
+        EXPECT_EQ(strip_png_ancillary(overrun), overrun);
+
+        // No IEND
+        bytes truncated(png.begin(), png.end() - 12);
+        EXPECT_EQ(strip_png_ancillary(truncated), truncated);
+    }
+
+#if defined(XEUS_STATA_HAS_ZLIB)
+    namespace
+    {
+        // Pixels of a PNG written by the encoder, which uses zlib
+        bytes inflate_image(const bytes& png, size_t expected)
+        {
+            bytes compressed;
+            for (size_t pos = 8; pos + 12 <= png.size();)
+            {
+                uint32_t length = (static_cast<uint32_t>(png[pos]) << 24) | (png[pos + 1] << 16) |
+                                  (png[pos + 2] << 8) | png[pos + 3];
+                if (std::memcmp(&png[pos + 4], "IDAT", 4) == 0)
+                {
+                    compressed.insert(compressed.end(), png.begin() + pos + 8, png.begin() + pos + 8 + length);
+                }
+                pos += length + 12;
+            }
+            bytes raw(expected);
+            uLongf size = static_cast<uLongf>(raw.size());
+            if (uncompress(raw.data(), &size, compressed.data(), static_cast<uLong>(compressed.size())) != Z_OK)
+            {
+                return {};
+            }
+            raw.resize(size);
+            return raw;
+        }
+    }
+
+    TEST(png, decodes_every_filter_type)
+    {
+        // Downsampled to one pixel, the result is the mean of all eight
+        unsigned int sum = 0;
+        for (unsigned char value : GRAY_4X2)
+        {
+            sum += value;
+        }
+        unsigned char mean = static_cast<unsigned char>((sum + 4) / 8);
+
+        png_spec spec;
+        spec.width = 4;
+        spec.height = 2;
+        for (unsigned char filter = 0; filter <= 4; ++filter)
+        {
+            png_optimize_result preview = make_png_preview(make_png(spec, filter_rows(GRAY_4X2, 4, 2, 1, filter)), 1);
+            ASSERT_FALSE(preview.data.empty()) << "filter " << int(filter);
+            EXPECT_EQ(preview.info.width, 1u);
+            EXPECT_EQ(preview.info.height, 1u);
+            bytes raw = inflate_image(preview.data, 2);
+            ASSERT_EQ(raw.size(), 2u) << "filter " << int(filter);
+            EXPECT_EQ(raw[1], mean) << "filter " << int(filter);
+        }
+    }
+
+    TEST(png, decodes_rgba_rows)
+    {
+        bytes pixels = {255, 0, 0, 255,   0, 255, 0, 255,
+                        0, 0, 255, 255,   255, 255, 255, 0};
+        png_spec spec;
+        spec.width = 2;
+        spec.height = 2;
+        spec.color_type = 6;
+        png_optimize_result preview = make_png_preview(make_png(spec, filter_rows(pixels, 2, 2, 4, 4)), 1);
+        ASSERT_FALSE(preview.data.empty());
+        EXPECT_TRUE(preview.resampled);
+        EXPECT_EQ(preview.info.color_type, 6);
+
+        // Each channel is averaged on its own
+        bytes raw = inflate_image(preview.data, 1 + 4);
+        ASSERT_EQ(raw.size(), 5u);
+        EXPECT_EQ(bytes(raw.begin() + 1, raw.end()), (bytes{128, 128, 128, 191}));
+    }
+
+    TEST(png, refuses_layouts_it_cannot_decode)
+    {
+        png_spec sixteen_bit;
+        sixteen_bit.bit_depth = 16;
+        EXPECT_TRUE(make_png_preview(make_png(sixteen_bit, {0, 1, 2}), 1).data.empty());
+
+        png_spec palette;
+        palette.color_type = 3;
+        EXPECT_TRUE(make_png_preview(make_png(palette, {0, 0}, {{"PLTE", {0, 0, 0}}}), 1).data.empty());
+
+        png_spec interlaced;
+        interlaced.interlace = 1;
+        EXPECT_TRUE(make_png_preview(make_png(interlaced, {0, 0}), 1).data.empty());
+    }
+
+    TEST(png, refuses_bad_filters_and_short_image_data)
+    {
+        png_spec spec;
+        spec.width = 4;
+        spec.height = 2;
+
+        bytes bad_filter = filter_rows(GRAY_4X2, 4, 2, 1, 0);
+        bad_filter[5] = 5;
+        EXPECT_TRUE(make_png_preview(make_png(spec, bad_filter), 1).data.empty());
+
+        bytes short_data = filter_rows(GRAY_4X2, 4, 2, 1, 0);
+        short_data.pop_back();
+        EXPECT_TRUE(make_png_preview(make_png(spec, short_data), 1).data.empty());
+    }
+
+    TEST(png, downsamples_to_the_pixel_budget)
+    {
+        png_spec spec;
+        spec.width = 400;
+        spec.height = 400;
+        bytes pixels(400 * 400);
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            pixels[i] = static_cast<unsigned char>(i * 7);
+        }
+        bytes png = make_png(spec, filter_rows(pixels, 400, 400, 1, 0));
+
+        png_optimize_result result = optimize_png(png, png_budget{40000, 0});
+        EXPECT_TRUE(result.resampled);
+        EXPECT_EQ(result.info.width, 200u);
+        EXPECT_EQ(result.info.height, 200u);
+        png_info info;
+        ASSERT_TRUE(read_png_info(result.data.data(), result.data.size(), info));
+        EXPECT_EQ(info.width, 200u);
+    }
+#endif
+
+} // namespace xeus_stata
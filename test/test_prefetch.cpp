@@ -0,0 +1,114 @@
+#include "xeus-stata/prefetch.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // A scratch directory holding the files the cells refer to
+        class referenced_data_files_test : public ::testing::Test
+        {
+        protected:
+            void SetUp() override
+            {
+                m_dir = (fs::temp_directory_path() / ("xstata-prefetch-test-" + std::to_string(getpid()))).string();
+                fs::create_directories(m_dir + "/sub");
+                for (const char* name : {"auto.dta", "a.dta", "b.dta", "my data.dta", "sub/c.dta",
+                                         "t.csv", "plain", "book.xlsx", "old.xls"})
+                {
+                    std::ofstream(m_dir + "/" + name) << "x";
+                }
+            }
+
+            void TearDown() override
+            {
+                std::error_code ec;
+                fs::remove_all(m_dir, ec);
+            }
+
+            std::vector<std::string> files(const std::string& code) const
+            {
+                return referenced_data_files(code, m_dir);
+            }
+
+            std::string path(const std::string& name) const
+            {
+                return m_dir + "/" + name;
+            }
+
+            std::string m_dir;
+        };
+    }
+
+    TEST_F(referenced_data_files_test, adds_the_default_extension)
+    {
+        EXPECT_EQ(files("use auto, clear"), std::vector<std::string>{path("auto.dta")});
+        EXPECT_EQ(files("u auto"), std::vector<std::string>{path("auto.dta")});
+        EXPECT_EQ(files("use auto.dta"), std::vector<std::string>{path("auto.dta")});
+    }
+
+    TEST_F(referenced_data_files_test, reads_quoted_paths)
+    {
+        EXPECT_EQ(files("use \"my data\""), std::vector<std::string>{path("my data.dta")});
+        EXPECT_EQ(files("use `\"my data.dta\"'"), std::vector<std::string>{path("my data.dta")});
+        EXPECT_EQ(files("use \"" + path("a.dta") + "\""), std::vector<std::string>{path("a.dta")});
+    }
+
+    TEST_F(referenced_data_files_test, reads_the_file_after_using)
+    {
+        EXPECT_EQ(files("use make price using auto"), std::vector<std::string>{path("auto.dta")});
+        EXPECT_EQ(files("merge 1:1 id using a, nogenerate"), std::vector<std::string>{path("a.dta")});
+        EXPECT_EQ(files("joinby id using b"), std::vector<std::string>{path("b.dta")});
+        EXPECT_EQ(files("append using a b \"my data\""),
+                  (std::vector<std::string>{path("a.dta"), path("b.dta"), path("my data.dta")}));
+    }
+
+    TEST_F(referenced_data_files_test, keeps_order_without_duplicates)
+    {
+        EXPECT_EQ(files("use b\nmerge 1:1 id using a\nuse b\nappend using a"),
+                  (std::vector<std::string>{path("b.dta"), path("a.dta")}));
+    }
+
+    TEST_F(referenced_data_files_test, follows_a_literal_cd)
+    {
+        EXPECT_EQ(files("cd sub\nuse c"), std::vector<std::string>{path("sub/c.dta")});
+        EXPECT_EQ(files("cd sub\ncd ..\nuse a"), std::vector<std::string>{path("a.dta")});
+    }
+
+    TEST_F(referenced_data_files_test, finds_imported_files)
+    {
+        EXPECT_EQ(files("import delimited t, clear"), std::vector<std::string>{path("t.csv")});
+        EXPECT_EQ(files("import delimited plain"), std::vector<std::string>{path("plain")});
+        EXPECT_EQ(files("import excel book, firstrow"), std::vector<std::string>{path("book.xlsx")});
+        EXPECT_EQ(files("import excel old"), std::vector<std::string>{path("old.xls")});
+        EXPECT_EQ(files("insheet using t"), std::vector<std::string>{path("t.csv")});
+    }
+
+    TEST_F(referenced_data_files_test, skips_what_it_cannot_know)
+    {
+        EXPECT_TRUE(files("use `file'").empty());
+        EXPECT_TRUE(files("use $data/a").empty());
+        EXPECT_TRUE(files("use \"`dir'/a\"").empty());
+        EXPECT_TRUE(files("use https://www.stata-press.com/data/r18/auto").empty());
+        EXPECT_TRUE(files("use missing").empty());
+        EXPECT_TRUE(files("import sas a").empty());
+        EXPECT_TRUE(files("save a, replace").empty());
+    }
+
+    TEST_F(referenced_data_files_test, ignores_comments_and_options)
+    {
+        EXPECT_EQ(files("* use b\nuse a // not b"), std::vector<std::string>{path("a.dta")});
+        EXPECT_EQ(files("merge 1:1 id using a, keepusing(b)"), std::vector<std::string>{path("a.dta")});
+    }
+
+} // namespace xeus_stata
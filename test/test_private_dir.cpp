@@ -0,0 +1,107 @@
+#include "xeus-stata/private_dir.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // A private scratch directory under the system temp directory,
+        // which is sticky like /tmp
+        class private_dir_test : public ::testing::Test
+        {
+        protected:
+            void SetUp() override
+            {
+                m_dir = (fs::temp_directory_path() / ("xstata-private-test-" + std::to_string(getpid()))).string();
+                fs::create_directories(m_dir);
+                chmod(m_dir.c_str(), 0700);
+            }
+
+            void TearDown() override
+            {
+                std::error_code ec;
+                fs::permissions(m_dir, fs::perms::owner_all, ec);
+                fs::remove_all(m_dir, ec);
+            }
+
+            std::string m_dir;
+        };
+    }
+
+    TEST_F(private_dir_test, accepts_a_directory_only_the_user_can_write)
+    {
+        std::string error;
+        EXPECT_TRUE(check_private_path(m_dir, error)) << error;
+        EXPECT_TRUE(check_private_path(m_dir + "/", error)) << error;
+    }
+
+    TEST_F(private_dir_test, creates_missing_directories_privately)
+    {
+        std::string path = m_dir + "/a/b";
+        std::string error;
+        ASSERT_TRUE(ensure_private_dir(path, error)) << error;
+        struct stat st;
+        ASSERT_EQ(stat(path.c_str(), &st), 0);
+        EXPECT_TRUE(S_ISDIR(st.st_mode));
+        EXPECT_EQ(st.st_mode & 0777, 0700u);
+
+        // Existing directories are fine the second time
+        EXPECT_TRUE(ensure_private_dir(path, error)) << error;
+    }
+
+    TEST_F(private_dir_test, refuses_group_or_world_writable_paths)
+    {
+        std::string path = m_dir + "/shared";
+        ASSERT_EQ(mkdir(path.c_str(), 0700), 0);
+        chmod(path.c_str(), 0770);
+        std::string error;
+        EXPECT_FALSE(check_private_path(path, error));
+        EXPECT_NE(error.find("writable by group or others"), std::string::npos) << error;
+
+        chmod(path.c_str(), 0707);
+        EXPECT_FALSE(ensure_private_dir(path, error));
+    }
+
+    TEST_F(private_dir_test, refuses_a_writable_parent)
+    {
+        std::string path = m_dir + "/inner";
+        ASSERT_EQ(mkdir(path.c_str(), 0700), 0);
+        chmod(m_dir.c_str(), 0777);
+        std::string error;
+        EXPECT_FALSE(check_private_path(path, error));
+        EXPECT_NE(error.find(m_dir), std::string::npos) << error;
+
+        // Sticky, like /tmp: others cannot swap out our entries
+        chmod(m_dir.c_str(), 01777);
+        EXPECT_TRUE(check_private_path(path, error)) << error;
+    }
+
+    TEST_F(private_dir_test, refuses_symbolic_links)
+    {
+        std::string target = m_dir + "/target";
+        std::string link = m_dir + "/link";
+        ASSERT_EQ(mkdir(target.c_str(), 0700), 0);
+        ASSERT_EQ(symlink(target.c_str(), link.c_str()), 0);
+        std::string error;
+        EXPECT_FALSE(check_private_path(link, error));
+        EXPECT_NE(error.find("symbolic link"), std::string::npos) << error;
+        EXPECT_FALSE(ensure_private_dir(link, error));
+    }
+
+    TEST_F(private_dir_test, reports_a_missing_path)
+    {
+        std::string error;
+        EXPECT_FALSE(check_private_path(m_dir + "/missing", error));
+        EXPECT_NE(error.find("cannot be read"), std::string::npos) << error;
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,122 @@
+#include "xeus-stata/profile.hpp"
+
+#include <gtest/gtest.h>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        const profile_row* find_row(const profile_report& report, const std::string& program)
+        {
+            for (const auto& row : report.rows)
+            {
+                if (row.program == program)
+                {
+                    return &row;
+                }
+            }
+            return nullptr;
+        }
+    }
+
+    TEST(parse_profiler_report, splits_total_and_self_time)
+    {
+        profile_report report = parse_profiler_report(
+            ". profiler report\n"
+            "   1   5.200  regress\n"
+            "   1   4.100    _regress\n"
+            "  10   0.500      _rmcoll\n"
+            "   2   0.300  summarize\n"
+            "------------------------\n"
+            "Overall total count =        14\n"
+            "Overall total time  =     5.500 (sec)\n");
+
+        EXPECT_EQ(report.total_count, 14);
+        EXPECT_DOUBLE_EQ(report.total_s, 5.5);
+        ASSERT_EQ(report.rows.size(), 4u);
+
+        // Sorted by self time
+        EXPECT_EQ(report.rows[0].program, "_regress");
+        EXPECT_EQ(report.rows[1].program, "regress");
+        EXPECT_EQ(report.rows[2].program, "_rmcoll");
+        EXPECT_EQ(report.rows[3].program, "summarize");
+
+        EXPECT_EQ(report.rows[0].calls, 1);
+        EXPECT_NEAR(report.rows[0].total_s, 4.1, 1e-9);
+        EXPECT_NEAR(report.rows[0].self_s, 3.6, 1e-9);
+        EXPECT_NEAR(report.rows[1].total_s, 5.2, 1e-9);
+        EXPECT_NEAR(report.rows[1].self_s, 1.1, 1e-9);
+        EXPECT_EQ(report.rows[2].calls, 10);
+        EXPECT_NEAR(report.rows[2].self_s, 0.5, 1e-9);
+    }
+
+    TEST(parse_profiler_report, sums_a_program_over_its_call_sites)
+    {
+        profile_report report = parse_profiler_report(
+            "   1   2.000  mymodel\n"
+            "   4   1.500    summarize\n"
+            "   3   0.250  summarize\n");
+
+        const profile_row* summarize = find_row(report, "summarize");
+        ASSERT_NE(summarize, nullptr);
+        EXPECT_EQ(summarize->calls, 7);
+        EXPECT_NEAR(summarize->total_s, 1.75, 1e-9);
+        EXPECT_NEAR(summarize->self_s, 1.75, 1e-9);
+
+        const profile_row* mymodel = find_row(report, "mymodel");
+        ASSERT_NE(mymodel, nullptr);
+        EXPECT_NEAR(mymodel->self_s, 0.5, 1e-9);
+    }
+
+    TEST(parse_profiler_report, counts_recursive_time_once)
+    {
+        profile_report report = parse_profiler_report(
+            "   1   3.000  walk\n"
+            "   1   2.000    walk\n"
+            "   1   1.000      walk\n");
+
+        ASSERT_EQ(report.rows.size(), 1u);
+        EXPECT_EQ(report.rows[0].calls, 3);
+        EXPECT_NEAR(report.rows[0].total_s, 3.0, 1e-9);
+        EXPECT_NEAR(report.rows[0].self_s, 3.0, 1e-9);
+    }
+
+    TEST(parse_profiler_report, self_time_is_never_negative)
+    {
+        // Rounded times can make callees add up to more than the caller
+        profile_report report = parse_profiler_report(
+            "   1   0.010  outer\n"
+            "   1   0.006    a\n"
+            "   1   0.006    b\n");
+
+        const profile_row* outer = find_row(report, "outer");
+        ASSERT_NE(outer, nullptr);
+        EXPECT_DOUBLE_EQ(outer->self_s, 0.0);
+    }
+
+    TEST(parse_profiler_report, ignores_other_lines)
+    {
+        profile_report report = parse_profiler_report(
+            "\r\n"
+            "note: nothing profiled\r\n"
+            "Overall total count =         0\r\n"
+            "Overall total time  =     0.000 (sec)\r\n");
+
+        EXPECT_TRUE(report.rows.empty());
+        EXPECT_EQ(report.total_count, 0);
+        EXPECT_DOUBLE_EQ(report.total_s, 0.0);
+    }
+
+    TEST(profile_to_json, lists_rows_in_report_order)
+    {
+        profile_report report = parse_profiler_report(
+            "   2   1.000  a\n"
+            "   1   3.000  b\n");
+        nl::json json = profile_to_json(report);
+        ASSERT_EQ(json["rows"].size(), 2u);
+        EXPECT_EQ(json["rows"][0]["program"], "b");
+        EXPECT_EQ(json["rows"][1]["program"], "a");
+        EXPECT_EQ(json["rows"][1]["calls"], 2);
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,96 @@
+#include "xeus-stata/smcl.hpp"
+#include "xeus-stata/stata_parser.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        std::string text_of(const std::string& smcl, int linesize = 80)
+        {
+            return smcl_text(parse_smcl(smcl, linesize), "");
+        }
+    }
+
+    TEST(parse_smcl, keeps_the_output_class_of_each_run)
+    {
+        std::vector<smcl_segment> segments = parse_smcl("{txt}mean = {res}42{txt}\n{error}bad\n");
+        ASSERT_EQ(segments.size(), 4u);
+        EXPECT_EQ(segments[0].style, "txt");
+        EXPECT_EQ(segments[0].text, "mean = ");
+        EXPECT_EQ(segments[1].style, "res");
+        EXPECT_EQ(segments[1].text, "42");
+        EXPECT_EQ(segments[2].style, "txt");
+        EXPECT_EQ(segments[2].text, "\n");
+        EXPECT_EQ(segments[3].style, "err");
+        EXPECT_EQ(segments[3].text, "bad\n");
+    }
+
+    TEST(parse_smcl, styles_with_text_apply_to_that_text_only)
+    {
+        std::vector<smcl_segment> segments = parse_smcl("{txt}a {err:b} {bf:c}{result:d}");
+        ASSERT_EQ(segments.size(), 4u);
+        EXPECT_EQ(segments[0].text, "a ");
+        EXPECT_EQ(segments[1].style, "err");
+        EXPECT_EQ(segments[1].text, "b");
+        EXPECT_EQ(segments[2].style, "txt");
+        EXPECT_EQ(segments[2].text, " c");
+        EXPECT_EQ(segments[3].style, "res");
+    }
+
+    TEST(parse_smcl, aligns_columns_and_draws_lines)
+    {
+        EXPECT_EQ(text_of("ab{col 6}c"), "ab   c");
+        EXPECT_EQ(text_of("abcdef{col 3}g"), "abcdefg");
+        EXPECT_EQ(text_of("{hline 4}"), "----");
+        EXPECT_EQ(text_of("ab{hline}", 10), "ab--------");
+        EXPECT_EQ(text_of("{c |}{c TLC}{c -}{c 65}"), "|+-A");
+        EXPECT_EQ(text_of("{space 3}x"), "   x");
+    }
+
+    TEST(parse_smcl, aligns_text_in_a_field)
+    {
+        EXPECT_EQ(text_of("{ralign 6:abc}|"), "   abc|");
+        EXPECT_EQ(text_of("{lalign 6:abc}|"), "abc   |");
+        EXPECT_EQ(text_of("{center 7:abc}|"), "  abc  |");
+        EXPECT_EQ(text_of("{ralign 6:{res:ab}c}|"), "   abc|");
+        EXPECT_EQ(text_of("{right:x}", 5), "    x");
+    }
+
+    TEST(parse_smcl, continuation_joins_lines)
+    {
+        EXPECT_EQ(text_of("{txt}one {...}\n{res}two\n"), "one two\n");
+        EXPECT_EQ(text_of("a{...}\r\nb{...}\nc\n"), "abc\n");
+        EXPECT_EQ(text_of("a{...}b\n"), "ab\n");
+    }
+
+    TEST(parse_smcl, shows_the_text_of_links_and_drops_the_rest)
+    {
+        EXPECT_EQ(text_of("{smcl}{sf}{help regress:regress}{ul off}"), "regress");
+        EXPECT_EQ(text_of("{search r(111), local:r(111);}"), "r(111);");
+        EXPECT_EQ(text_of("unclosed {brace\n"), "unclosed {brace\n");
+    }
+
+    TEST(smcl_text, skips_the_command_echo)
+    {
+        std::vector<smcl_segment> segments = parse_smcl("{com}. display 1\n{res}1\n{com}. exit\n");
+        EXPECT_EQ(smcl_text(segments), "1\n");
+        EXPECT_EQ(smcl_text(segments, ""), ". display 1\n1\n. exit\n");
+    }
+
+    TEST(parse_smcl_execution_output, stops_at_the_marker_and_drops_the_echo)
+    {
+        bool found_marker = false;
+        execution_result result = parse_smcl_execution_output(
+            "{com}. summarize x\n{txt}Obs {res}5\n{com}. display \"__MARKER__\" \"ab__\"\n{res}__MARKER__ab__\n",
+            "__MARKER__ab__", found_marker);
+        EXPECT_TRUE(found_marker);
+        EXPECT_EQ(result.output, "Obs 5");
+        EXPECT_FALSE(result.is_error);
+    }
+
+} // namespace xeus_stata
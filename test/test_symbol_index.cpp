@@ -0,0 +1,171 @@
+#include "xeus-stata/symbol_index.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace xeus_stata
+{
+    namespace
+    {
+        // Index file layout: a 64-byte header, 16-byte entries, then the
+        // string table
+        const size_t HEADER_SIZE = 64;
+        const size_t ENTRY_SIZE = 16;
+        const uint64_t STAMP = 0x1234abcd;
+
+        const size_t VERSION_AT = 8;
+        const size_t BYTE_ORDER_AT = 12;
+        const size_t STAMP_AT = 16;
+        const size_t ENTRY_COUNT_AT = 24;
+        const size_t ENTRIES_OFFSET_AT = 32;
+        const size_t STRINGS_OFFSET_AT = 40;
+        const size_t STRINGS_SIZE_AT = 48;
+        const size_t FILE_SIZE_AT = 56;
+
+        template <typename T>
+        void put(std::vector<unsigned char>& data, size_t at, T value)
+        {
+            std::memcpy(&data[at], &value, sizeof(value));
+        }
+
+        // An index of name/summary pairs, laid out as the kernel writes it
+        std::vector<unsigned char> make_index(const std::vector<std::pair<std::string, std::string>>& entries)
+        {
+            std::string strings;
+            std::vector<unsigned char> table(entries.size() * ENTRY_SIZE);
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                size_t at = i * ENTRY_SIZE;
+                put<uint32_t>(table, at, static_cast<uint32_t>(strings.size()));
+                strings += entries[i].first;
+                put<uint32_t>(table, at + 4, static_cast<uint32_t>(strings.size()));
+                strings += entries[i].second;
+                put<uint16_t>(table, at + 8, static_cast<uint16_t>(entries[i].first.size()));
+                put<uint16_t>(table, at + 10, static_cast<uint16_t>(entries[i].second.size()));
+                table[at + 12] = static_cast<unsigned char>(symbol_kind::command);
+            }
+
+            std::vector<unsigned char> data(HEADER_SIZE);
+            std::memcpy(data.data(), "XSTIDX\0\0", 8);
+            put<uint32_t>(data, VERSION_AT, 1);
+            put<uint32_t>(data, BYTE_ORDER_AT, 0x01020304);
+            put<uint64_t>(data, STAMP_AT, STAMP);
+            put<uint64_t>(data, ENTRY_COUNT_AT, entries.size());
+            put<uint64_t>(data, ENTRIES_OFFSET_AT, HEADER_SIZE);
+            put<uint64_t>(data, STRINGS_OFFSET_AT, HEADER_SIZE + table.size());
+            put<uint64_t>(data, STRINGS_SIZE_AT, strings.size());
+            put<uint64_t>(data, FILE_SIZE_AT, HEADER_SIZE + table.size() + strings.size());
+            data.insert(data.end(), table.begin(), table.end());
+            data.insert(data.end(), strings.begin(), strings.end());
+            return data;
+        }
+
+        const std::vector<std::pair<std::string, std::string>> SAMPLE = {
+            {"regress", "Linear regression"},
+            {"summarize", "Summary statistics"}
+        };
+
+        bool valid(const std::vector<unsigned char>& data, uint64_t stamp = STAMP)
+        {
+            return valid_symbol_index(data.data(), data.size(), stamp);
+        }
+    }
+
+    TEST(valid_symbol_index, accepts_a_well_formed_index)
+    {
+        EXPECT_TRUE(valid(make_index(SAMPLE)));
+        EXPECT_TRUE(valid(make_index({})));
+    }
+
+    TEST(valid_symbol_index, rejects_a_short_file)
+    {
+        std::vector<unsigned char> data = make_index(SAMPLE);
+        EXPECT_FALSE(valid_symbol_index(data.data(), HEADER_SIZE - 1, STAMP));
+        EXPECT_FALSE(valid_symbol_index(data.data(), 0, STAMP));
+    }
+
+    TEST(valid_symbol_index, rejects_a_foreign_header)
+    {
+        std::vector<unsigned char> magic = make_index(SAMPLE);
+        magic[0] = 'Y';
+        EXPECT_FALSE(valid(magic));
+
+        std::vector<unsigned char> version = make_index(SAMPLE);
+        put<uint32_t>(version, VERSION_AT, 2);
+        EXPECT_FALSE(valid(version));
+
+        std::vector<unsigned char> byte_order = make_index(SAMPLE);
+        put<uint32_t>(byte_order, BYTE_ORDER_AT, 0x04030201);
+        EXPECT_FALSE(valid(byte_order));
+    }
+
+    TEST(valid_symbol_index, rejects_an_index_of_another_installation)
+    {
+        EXPECT_FALSE(valid(make_index(SAMPLE), STAMP + 1));
+    }
+
+    TEST(valid_symbol_index, rejects_a_truncated_or_extended_file)
+    {
+        std::vector<unsigned char> data = make_index(SAMPLE);
+        EXPECT_FALSE(valid_symbol_index(data.data(), data.size() - 1, STAMP));
+
+        data.push_back(0);
+        EXPECT_FALSE(valid(data));
+    }
+
+    TEST(valid_symbol_index, rejects_inconsistent_offsets)
+    {
+        std::vector<unsigned char> entries = make_index(SAMPLE);
+        put<uint64_t>(entries, ENTRIES_OFFSET_AT, HEADER_SIZE + ENTRY_SIZE);
+        EXPECT_FALSE(valid(entries));
+
+        std::vector<unsigned char> strings = make_index(SAMPLE);
+        put<uint64_t>(strings, STRINGS_OFFSET_AT, HEADER_SIZE + ENTRY_SIZE);
+        EXPECT_FALSE(valid(strings));
+
+        std::vector<unsigned char> strings_size = make_index(SAMPLE);
+        put<uint64_t>(strings_size, STRINGS_SIZE_AT, strings_size.size());
+        EXPECT_FALSE(valid(strings_size));
+    }
+
+    TEST(valid_symbol_index, rejects_an_entry_count_past_the_file)
+    {
+        // Counts whose entries would overflow the offset arithmetic too
+        for (uint64_t count : {uint64_t(3), uint64_t(1) << 60, ~uint64_t(0)})
+        {
+            std::vector<unsigned char> data = make_index(SAMPLE);
+            put<uint64_t>(data, ENTRY_COUNT_AT, count);
+            EXPECT_FALSE(valid(data)) << count;
+        }
+    }
+
+    TEST(valid_symbol_index, rejects_entries_outside_the_string_table)
+    {
+        std::vector<unsigned char> base = make_index(SAMPLE);
+        size_t second = HEADER_SIZE + ENTRY_SIZE;
+        uint32_t strings_size = static_cast<uint32_t>(base.size() - HEADER_SIZE - 2 * ENTRY_SIZE);
+
+        std::vector<unsigned char> name = base;
+        put<uint32_t>(name, second, strings_size);
+        EXPECT_FALSE(valid(name));
+
+        std::vector<unsigned char> summary = base;
+        put<uint16_t>(summary, second + 10, static_cast<uint16_t>(1000));
+        EXPECT_FALSE(valid(summary));
+
+        // An offset that wraps around in 32 bits
+        std::vector<unsigned char> wrapped = base;
+        put<uint32_t>(wrapped, HEADER_SIZE, 0xffffffffu);
+        EXPECT_FALSE(valid(wrapped));
+
+        // Ending exactly at the end of the table is fine
+        std::vector<unsigned char> last = base;
+        put<uint32_t>(last, second + 4, strings_size);
+        put<uint16_t>(last, second + 10, 0);
+        EXPECT_TRUE(valid(last));
+    }
+
+} // namespace xeus_stata
@@ -0,0 +1,73 @@
+#include "xeus-stata/timeit.hpp"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <vector>
+
+namespace xeus_stata
+{
+    TEST(parse_timeit_args, has_defaults)
+    {
+        timeit_options options = parse_timeit_args({});
+        EXPECT_EQ(options.runs, 7u);
+        EXPECT_EQ(options.warmup, 1u);
+        EXPECT_FALSE(options.restore_data);
+    }
+
+    TEST(parse_timeit_args, reads_every_option)
+    {
+        timeit_options options = parse_timeit_args({"-n", "20", "-w", "0", "-p"});
+        EXPECT_EQ(options.runs, 20u);
+        EXPECT_EQ(options.warmup, 0u);
+        EXPECT_TRUE(options.restore_data);
+    }
+
+    TEST(parse_timeit_args, rejects_bad_counts_and_options)
+    {
+        EXPECT_THROW(parse_timeit_args({"-n", "0"}), std::runtime_error);
+        EXPECT_THROW(parse_timeit_args({"-n", "100001"}), std::runtime_error);
+        EXPECT_THROW(parse_timeit_args({"-n", "5x"}), std::runtime_error);
+        EXPECT_THROW(parse_timeit_args({"-w", "-1"}), std::runtime_error);
+        EXPECT_THROW(parse_timeit_args({"-n"}), std::runtime_error);
+        EXPECT_THROW(parse_timeit_args({"-q"}), std::runtime_error);
+    }
+
+    TEST(summarize_samples, keeps_run_order_and_sorts_for_statistics)
+    {
+        timing_summary summary = summarize_samples({5, 1, 4, 2, 3});
+        EXPECT_EQ(summary.samples, (std::vector<double>{5, 1, 4, 2, 3}));
+        EXPECT_DOUBLE_EQ(summary.min, 1);
+        EXPECT_DOUBLE_EQ(summary.median, 3);
+        EXPECT_DOUBLE_EQ(summary.p95, 5);
+        EXPECT_DOUBLE_EQ(summary.mean, 3);
+    }
+
+    TEST(summarize_samples, averages_the_middle_pair)
+    {
+        timing_summary summary = summarize_samples({4, 1, 3, 2});
+        EXPECT_DOUBLE_EQ(summary.median, 2.5);
+        EXPECT_DOUBLE_EQ(summary.mean, 2.5);
+    }
+
+    TEST(summarize_samples, uses_the_nearest_rank_for_p95)
+    {
+        std::vector<double> samples;
+        for (int i = 100; i >= 1; --i)
+        {
+            samples.push_back(i);
+        }
+        EXPECT_DOUBLE_EQ(summarize_samples(samples).p95, 95);
+        EXPECT_DOUBLE_EQ(summarize_samples({7}).p95, 7);
+    }
+
+    TEST(summarize_samples, is_empty_without_samples)
+    {
+        timing_summary summary = summarize_samples({});
+        EXPECT_TRUE(summary.samples.empty());
+        EXPECT_DOUBLE_EQ(summary.min, 0);
+        EXPECT_DOUBLE_EQ(summary.median, 0);
+        EXPECT_DOUBLE_EQ(summary.p95, 0);
+    }
+
+} // namespace xeus_stata